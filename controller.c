@@ -31,6 +31,7 @@
 #include "utils/waiter.h"
 
 #include "genio/genio.h"
+#include "genio/genio_pool.h"
 #include "ser2net.h"
 #include "controller.h"
 #include "dataxfer.h"
@@ -309,6 +310,29 @@ telnet_cmd_handler(void *cb_data, unsigned char cmd)
     /* These are ignored for now. */
 }
 
+/* Handle a showmem command, dump the memory pool stats. */
+static void
+showmem(struct controller_info *cntlr)
+{
+    struct genio_pool_stats stats[GENIO_POOL_NR_CLASSES];
+    unsigned int i;
+    char size[16];
+
+    genio_pool_get_stats(stats);
+    for (i = 0; i < GENIO_POOL_NR_CLASSES; i++) {
+	if (stats[i].size)
+	    snprintf(size, sizeof(size), "%u", stats[i].size);
+	else
+	    strcpy(size, "large");
+	controller_outputf(cntlr, "class=%s allocs=%llu frees=%llu"
+			   " bytes_in_use=%llu bytes_free=%llu\r\n", size,
+			   (unsigned long long) stats[i].allocs,
+			   (unsigned long long) stats[i].frees,
+			   (unsigned long long) stats[i].bytes_in_use,
+			   (unsigned long long) stats[i].bytes_free);
+    }
+}
+
 static char *help_str =
 "exit - leave the program.\r\n"
 "help - display this help.\r\n"
@@ -327,6 +351,13 @@ static char *help_str =
 "       given, all ports are displayed.\r\n"
 "showshortport [<tcp port>] - Show information about a port in a one-line\r\n"
 "       format. If no port is given, all ports are displayed.\r\n"
+"showstats [<tcp port>] - Show the statistics counters for a port as\r\n"
+"       key=value pairs. If no port is given, all ports are displayed.\r\n"
+"showmem - Show the memory pool counters for each size class as\r\n"
+"       key=value pairs.\r\n"
+"showreload - Show when the configuration was last read, how long that\r\n"
+"       took, and how many ports it changed or failed to start as\r\n"
+"       key=value pairs.\r\n"
 "setporttimeout <tcp port> <timeout> - Set the amount of time in seconds\r\n"
 "       before the port connection will be shut down if no activity\r\n"
 "       has been seen on the port.\r\n"
@@ -349,6 +380,22 @@ static char *help_str =
 "         telnet - The port is up and the telnet negotiation protocol\r\n"
 "                  runs on the port.\r\n";
 
+/*
+ * Start a maintenance operation for a command, waiting for any other
+ * one to finish.  A config reload holds the maint lock while it runs
+ * the selector waiting for acceptors to shut down, so this may be
+ * running from inside the reload; blocking there would deadlock it.
+ * Tell the user to try again instead.
+ */
+static int
+controller_start_maint_op(controller_info_t *cntlr)
+{
+    if (try_start_maint_op() == 0)
+	return 0;
+    controller_outs(cntlr, "Configuration reload in progress, try again\r\n");
+    return -1;
+}
+
 /* Process a line of input.  This scans for commands, reads any
    parameters, then calls the actual code to handle the command. */
 int
@@ -377,14 +424,26 @@ process_input_line(controller_info_t *cntlr)
 	controller_outs(cntlr, "\r\n");
     } else if (strcmp(tok, "showport") == 0) {
 	tok = strtok_r(NULL, " \t", &strtok_data);
-	start_maint_op();
+	if (controller_start_maint_op(cntlr))
+	    goto out;
 	showports(cntlr, tok);
 	end_maint_op();
     } else if (strcmp(tok, "showshortport") == 0) {
 	tok = strtok_r(NULL, " \t", &strtok_data);
-	start_maint_op();
+	if (controller_start_maint_op(cntlr))
+	    goto out;
 	showshortports(cntlr, tok);
 	end_maint_op();
+    } else if (strcmp(tok, "showstats") == 0) {
+	tok = strtok_r(NULL, " \t", &strtok_data);
+	showstats(cntlr, tok);
+    } else if (strcmp(tok, "showmem") == 0) {
+	showmem(cntlr);
+    } else if (strcmp(tok, "showreload") == 0) {
+	if (controller_start_maint_op(cntlr))
+	    goto out;
+	showreload(cntlr);
+	end_maint_op();
     } else if (strcmp(tok, "monitor") == 0) {
 	tok = strtok_r(NULL, " \t", &strtok_data);
 	if (tok == NULL) {
@@ -394,7 +453,8 @@ process_input_line(controller_info_t *cntlr)
 	}
 	if (strcmp(tok, "stop") == 0) {
 	    if (cntlr->monitor_port_id != NULL) {
-		start_maint_op();
+		if (controller_start_maint_op(cntlr))
+		    goto out;
 		data_monitor_stop(cntlr, cntlr->monitor_port_id);
 		end_maint_op();
 		cntlr->monitor_port_id = NULL;
@@ -412,7 +472,8 @@ process_input_line(controller_info_t *cntlr)
 		controller_outs(cntlr, err);
 		goto out;
 	    }
-	    start_maint_op();
+	    if (controller_start_maint_op(cntlr))
+		goto out;
 	    cntlr->monitor_port_id = data_monitor_start(cntlr, tok, str);
 	    end_maint_op();
 	}
@@ -423,7 +484,8 @@ process_input_line(controller_info_t *cntlr)
 	    controller_outs(cntlr, err);
 	    goto out;
 	}
-	start_maint_op();
+	if (controller_start_maint_op(cntlr))
+	    goto out;
 	disconnect_port(cntlr, tok);
 	end_maint_op();
     } else if (strcmp(tok, "setporttimeout") == 0) {
@@ -439,7 +501,8 @@ process_input_line(controller_info_t *cntlr)
 	    controller_outs(cntlr, err);
 	    goto out;
 	}
-	start_maint_op();
+	if (controller_start_maint_op(cntlr))
+	    goto out;
 	setporttimeout(cntlr, tok, str);
 	end_maint_op();
     } else if (strcmp(tok, "setportenable") == 0) {
@@ -455,7 +518,8 @@ process_input_line(controller_info_t *cntlr)
 	    controller_outs(cntlr, err);
 	    goto out;
 	}
-	start_maint_op();
+	if (controller_start_maint_op(cntlr))
+	    goto out;
 	setportenable(cntlr, tok, str);
 	end_maint_op();
     } else if (strcmp(tok, "setportconfig") == 0) {
@@ -472,7 +536,8 @@ process_input_line(controller_info_t *cntlr)
 	    controller_outs(cntlr, err);
 	    goto out;
 	}
-	start_maint_op();
+	if (controller_start_maint_op(cntlr))
+	    goto out;
 	setportdevcfg(cntlr, tok, str);
 	end_maint_op();
     } else if (strcmp(tok, "setportcontrol") == 0) {
@@ -489,7 +554,8 @@ process_input_line(controller_info_t *cntlr)
 	    controller_outs(cntlr, err);
 	    goto out;
 	}
-	start_maint_op();
+	if (controller_start_maint_op(cntlr))
+	    goto out;
 	setportcontrol(cntlr, tok, str);
 	end_maint_op();
     } else {
@@ -647,6 +713,17 @@ controller_write_ready(struct genio *net)
 	    goto out;
     }
 
+    if (cntlr->outbuf_count == 0) {
+	/*
+	 * With multiple threads another one may have already written
+	 * everything.  A zero length write would look like a closed
+	 * connection, so don't do one.
+	 */
+	genio_set_read_callback_enable(net, true);
+	genio_set_write_callback_enable(net, false);
+	goto out;
+    }
+
     err = genio_write(net, &write_count,
 		      &(cntlr->outbuf[cntlr->outbuf_pos]),
 		      cntlr->outbuf_count);
@@ -22,6 +22,7 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <errno.h>
@@ -30,6 +31,7 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <time.h>
 
 #include "utils/utils.h"
 #include "genio/genio.h"
@@ -42,6 +44,7 @@
 #include "utils/buffer.h"
 #include "utils/waiter.h"
 #include "led.h"
+#include "trace.h"
 
 #define SERIAL "term"
 #define NET    "tcp "
@@ -71,16 +74,109 @@ char *state_str[] = { "unconnected", "waiting input", "waiting output",
 #define PORT_TELNET		3 /* Port will do telnet negotiation. */
 char *enabled_str[] = { "off", "raw", "rawlp", "telnet" };
 
+#define PORT_STARTUP_DONE	0 /* Started, or not started from the config. */
+#define PORT_STARTUP_PENDING	1 /* Waiting for a startup thread. */
+#define PORT_STARTUP_FAILED	2 /* Could not start, to be removed. */
+
+struct enum_val lag_policy_enums[] = {
+    { "block",		LAG_POLICY_BLOCK },
+    { "drop",		LAG_POLICY_DROP },
+    { "disconnect",	LAG_POLICY_DISCONNECT },
+    { NULL }
+};
+
+/*
+ * Statistics counters.  They are only changed with the port lock
+ * held, but they are read without it, so the loads and stores are
+ * atomic to keep the 64-bit values from tearing.
+ */
+#define STAT_GET(s)	__atomic_load_n(&(s), __ATOMIC_RELAXED)
+#define STAT_SET(s, v)	__atomic_store_n(&(s), (v), __ATOMIC_RELAXED)
+#define STAT_ADD(s, v)	STAT_SET(s, STAT_GET(s) + (v))
+
+/*
+ * Where the dev_to_net ring counters start when the port is idle.
+ * Tests build ser2net with this set just below 2^32 to check the
+ * ring across where 32-bit counters would have wrapped.
+ */
+#ifndef DEV_TO_NET_START
+#define DEV_TO_NET_START 0
+#endif
+
 typedef struct trace_info_s
 {
     int  hexdump;     /* output each block as a hexdump */
     int  timestamp;   /* preceed each line with a timestamp */
-    char *filename;   /* open file.  NULL if not used */
-    int  fd;          /* open file.  -1 if not used */
+    int  capture;     /* write a binary capture file */
+    const char *filename; /* From the port's cfg, NULL if not used */
+    struct trace_file *tf; /* open file.  NULL if not used */
 } trace_info_t;
 
+/*
+ * The trace settings from the config.  The files are opened into the
+ * port's trace_info_t when the device is, see setup_trace().
+ */
+struct trace_cfg
+{
+    int  hexdump;
+    int  timestamp;
+    int  capture;
+    char *filename;
+};
+
+struct port_remaddr;
+
+/*
+ * The part of a port's config that doesn't change while it runs.
+ * Ports with the same settings share one, see port_cfg_intern().
+ * Once interned a config must not be changed, port_cfg_writable()
+ * gives the port its own copy to change.
+ */
+struct port_cfg
+{
+    unsigned int refcount;	/* Only changed with port_cfgs_lock. */
+    bool interned;
+    unsigned int hash;
+    struct port_cfg *next;	/* In the intern table. */
+
+    /* Banner to display at startup, or NULL if none. */
+    char *bannerstr;
+
+    /* RFC 2217 signature. */
+    char *signaturestr;
+
+    /* String to send to device at startup, or NULL if none. */
+    char *openstr;
+
+    /* String to send to device at close, or NULL if none. */
+    char *closestr;
+
+    /*
+     * Close on string to shutdown connection when received from
+     * serial side, or NULL if none.
+     */
+    char *closeon;
+    unsigned int closeon_len;
+
+    int  chardelay_scale;		/* The number of character
+					   periods to wait for the
+					   next character, in tenths of
+					   a character period. */
+    int  chardelay_min;			/* The minimum chardelay, in
+					   microseconds. */
+    int  chardelay_max;			/* Maximum amount of time to
+					   wait before sending the data. */
+
+    struct trace_cfg trace_read;
+    struct trace_cfg trace_write;
+    struct trace_cfg trace_both;
+
+    struct port_remaddr *remaddrs;	/* Remote addresses allowed. */
+};
+
 typedef struct port_info port_info_t;
 typedef struct net_info net_info_t;
+struct port_dev;
 
 struct net_info {
     port_info_t	   *port;		/* My port. */
@@ -94,29 +190,46 @@ struct net_info {
     bool remote_fixed;			/* Tells if the remote address was
 					   set in the configuration, and
 					   cannot be changed. */
+    struct port_dev *conn_dev;		/* The device this connection is
+					   counted on, see
+					   port_dev_conn_start(). */
+
     bool connect_back;			/* True if we connect to the remote
 					   address when data comes in. */
     struct addrinfo *remote_ai;
 
-    unsigned int bytes_received;	/* Number of bytes read from the
+    /* Statistics, use the STAT macros for these. */
+    uint64_t bytes_received;		/* Number of bytes read from the
 					   network port. */
-    unsigned int bytes_sent;		/* Number of bytes written to the
+    uint64_t bytes_sent;		/* Number of bytes written to the
 					   network port. */
+    uint64_t reads;			/* Reads from the network port. */
+    uint64_t writes;			/* Writes to the network port. */
+    uint64_t write_eagain;		/* Writes that could not write
+					   everything. */
+    uint64_t dropped;			/* Bytes thrown away because of
+					   lag-policy=drop. */
 
     struct sbuf *banner;		/* Outgoing banner */
 
-    unsigned int write_pos;		/* Our current position in the
-					   output buffer where we need
-					   to start writing next. */
+    uint64_t write_pos;			/* Our read cursor in the
+					   dev_to_net ring, the total
+					   count of ring bytes handled
+					   for this connection. */
 
-    /* Data for the telnet processing */
-    telnet_data_t tn_data;
+    /*
+     * Data for the telnet processing, only allocated while a telnet
+     * connection is up.
+     */
+    telnet_data_t *tn_data;
     bool sending_tn_data; /* Are we sending tn data at the moment? */
     int in_urgent;       /* Looking for TN_DATA_MARK, and position. */
 
-    int            timeout_left;	/* The amount of time left (in
-					   seconds) before the timeout
-					   goes off. */
+    sel_wheel_timer_t *timeout_timer;	/* Goes off when the
+					   connection may have been
+					   idle for the port timeout. */
+    time_t         last_io;		/* When I/O was last seen, in
+					   monotonic seconds. */
 
     sel_runner_t *runshutdown;		/* Used to run things at the
 					   base context.  This way we
@@ -151,13 +264,20 @@ struct port_info
 					   enabled and it will do
 					   telnet negotiations. */
 
+    int            shard;		/* The shard (see ser2net.h)
+					   the port runs on, -1 until
+					   it is picked in
+					   portconfig(). */
+    struct selector_s *sel;		/* The shard's selector and */
+    struct genio_os_funcs *o;		/* OS handlers. */
+
     int            timeout;		/* The number of seconds to
 					   wait without any I/O before
 					   we shut the port down. */
 
-    sel_timer_t *timer;			/* Used to timeout when the no
-					   I/O has been seen for a
-					   certain period of time. */
+    sel_wheel_timer_t *timer;		/* Runs once a second while
+					   there is housekeeping to do,
+					   see got_timeout(). */
 
     sel_timer_t *send_timer;		/* Used to delay a bit when
 					   waiting for characters to
@@ -194,14 +314,6 @@ struct port_info
 
     bool enable_chardelay;
 
-    int  chardelay_scale;		/* The number of character
-					   periods to wait for the
-					   next character, in tenths of
-					   a character period. */
-    int  chardelay_min;			/* The minimum chardelay, in
-					   microseconds. */
-    int  chardelay_max;			/* Maximum amount of time to
-					   wait before sending the data. */
     struct timeval send_time;		/* When using chardelay, the
 					   time when we will send the
 					   data, no matter what, set
@@ -211,7 +323,6 @@ struct port_info
     char               *portname;       /* The name given for the port. */
     struct genio_acceptor *acceptor;	/* Used to receive new connections. */
     bool               remaddr_set;	/* Did a remote address get set? */
-    struct port_remaddr *remaddrs;	/* Remote addresses allowed. */
     bool has_connect_back;		/* We have connect back addresses. */
     unsigned int num_waiting_connect_backs;
 
@@ -223,10 +334,18 @@ struct port_info
 					   port. */
     net_info_t *netcons;
 
-    unsigned int dev_bytes_received;    /* Number of bytes read from the
+    /* Statistics, use the STAT macros for these. */
+    uint64_t dev_bytes_received;	/* Number of bytes read from the
 					   device. */
-    unsigned int dev_bytes_sent;        /* Number of bytes written to the
+    uint64_t dev_bytes_sent;		/* Number of bytes written to the
 					   device. */
+    uint64_t dev_reads;			/* Reads from the device. */
+    uint64_t dev_writes;		/* Writes to the device. */
+    uint64_t dev_write_eagain;		/* Writes to the device that
+					   could not write everything. */
+    uint64_t dev_overruns;		/* Times reading the device was
+					   stopped because the network
+					   side was full. */
     /* Information use when transferring information from the network port
        to the terminal device. */
     int            net_to_dev_state;		/* State of transferring
@@ -234,7 +353,12 @@ struct port_info
                                                    to the device. */
 
     struct sbuf    net_to_dev;			/* Buffer for network
-						   to dev transfers. */
+						   to dev transfers.  This
+						   and the dev_to_net
+						   buffers are only
+						   allocated while the
+						   port is in use, see
+						   port_alloc_bufs(). */
     struct controller_info *net_monitor; /* If non-null, send any input
 					    received from the network port
 					    to this controller port. */
@@ -246,9 +370,45 @@ struct port_info
 						   data from the device to
                                                    the network port. */
 
-    struct sbuf    dev_to_net;			/* Buffer struct for
+    struct sbuf    dev_to_net;			/* Ring buffer for
 						   device to network
-						   transfers. */
+						   transfers, only buf
+						   and maxsize are
+						   used. */
+    unsigned int dev_to_net_chunk;		/* The most data read
+						   from the device or
+						   released to the
+						   network at once. */
+    unsigned int dev_to_net_nbufs;		/* The ring holds this
+						   many chunks, so the
+						   device can be read
+						   while earlier chunks
+						   are being sent. */
+    uint64_t dev_to_net_head;			/* Total bytes put
+						   into the ring. */
+    uint64_t dev_to_net_sent;			/* Total bytes released
+						   to the network
+						   connections, anything
+						   after this is held
+						   for chardelay. */
+    int lag_policy;				/* What to do with a
+						   connection that falls
+						   a full ring behind. */
+    bool splice;				/* Move the data with
+						   splice() when nothing
+						   needs to look at it. */
+    bool splice_failed;				/* The device could not
+						   splice, use the ring
+						   for this session. */
+    int splice_pipe[2];				/* The data goes from
+						   the device through
+						   this pipe to the
+						   network, -1 if not
+						   open. */
+    unsigned int splice_pending;		/* Bytes in splice_pipe. */
+    net_info_t *splice_netcon;			/* The connection the
+						   data in splice_pipe
+						   goes to. */
     unsigned char  *telnet_dev_to_net;		/* Used to read data
 						   to do telnet
 						   processing on
@@ -260,11 +420,40 @@ struct port_info
 
     struct port_info *next;		/* Used to keep a linked list
 					   of these. */
+    struct port_info *prev;
+
+    unsigned int name_hash;		/* The port name index, see */
+    struct port_info *name_next;	/* port_list_add(). */
+
+    struct port_dev *dev;		/* The port's entry in the
+					   device index. */
+    bool dev_inuse;			/* Is the port counted in
+					   dev->inuse? */
+
+    /*
+     * New ports from the config, and changed ones that have to be
+     * started, are started by the startup threads, see
+     * queue_port_startup().  startup_reconfig is set for the changed
+     * ones.
+     */
+    int startup_state;
+    bool startup_reconfig;
+    struct port_info *startup_next;
+    struct timeval startup_time;	/* From the start of the config
+					   read until it was started. */
 
     int config_num; /* Keep track of what configuration this was last
 		       updated under.  Setting to -1 means to delete
 		       the port when the current session is done. */
 
+    uint64_t config_hash; /* The hash of the config file line the
+			     port was made from and the settings it
+			     used, see port_config_same().  0 if it
+			     was changed from the control port, so it
+			     never matches. */
+    char *config_refs;	  /* The settings it used, see readconfig.h. */
+    unsigned int config_refs_len;
+
     struct port_info *new_config; /* If the port is reconfigged while
 				     open, this will hold the new
 				     configuration that should be
@@ -279,6 +468,12 @@ struct port_info
     unsigned char modemstate_mask;
     unsigned char last_modemstate;
 
+    /*
+     * Is the device reporting modem state changes itself?  If not,
+     * they are polled for in got_timeout().
+     */
+    bool modemstate_notify;
+
     /* Allow RFC 2217 mode */
     bool allow_2217;
 
@@ -288,25 +483,11 @@ struct port_info
     /* kickolduser mode */
     int kickolduser_mode;
 
-    /* Banner to display at startup, or NULL if none. */
-    char *bannerstr;
-
-    /* RFC 2217 signature. */
-    char *signaturestr;
-
-    /* String to send to device at startup, or NULL if none. */
-    char *openstr;
-
-    /* String to send to device at close, or NULL if none. */
-    char *closestr;
+    /* The settings from the config, may be shared with other ports. */
+    struct port_cfg *cfg;
 
-    /*
-     * Close on string to shutdown connection when received from
-     * serial side, or NULL if none.
-     */
-    char *closeon;
-    unsigned int closeon_pos;
-    unsigned int closeon_len;
+    unsigned int closeon_pos;		/* How much of cfg->closeon has
+					   been seen. */
 
     /*
      * Close the session when all the output has been written to the
@@ -315,12 +496,14 @@ struct port_info
     bool close_on_output_done;
 
     /*
-     * File to read/write trace, NULL if none.  If the same, then
-     * trace information is in the same file, only one open is done.
+     * File to read/write trace, from the cfg, NULL if none.  If the
+     * same, then trace information is in the same file, only one open
+     * is done.
      */
     trace_info_t trace_read;
     trace_info_t trace_write;
     trace_info_t trace_both;
+    unsigned int capture_size;	/* Size of capture trace files. */
 
     /*
      * Pointers to the above, that way if two are the same file we can just
@@ -354,6 +537,7 @@ static int setup_port(port_info_t *port, net_info_t *netcon, bool is_reconfig);
  */
 struct port_remaddr
 {
+    char *str;			/* As given, for comparing configs. */
     struct addrinfo *ai;
     bool is_port_set;
     bool is_connect_back;
@@ -368,6 +552,7 @@ remaddr_append(struct port_remaddr **list, const char *str)
     struct addrinfo *ai = NULL;
     bool is_port_set, is_connect_back = false;
     bool is_dgram;
+    const char *orig_str = str;
     int err;
 
     if (*str == '!') {
@@ -391,6 +576,12 @@ remaddr_append(struct port_remaddr **list, const char *str)
     }
     memset(r, 0, sizeof(*r));
 
+    r->str = strdup(orig_str);
+    if (!r->str) {
+	free(r);
+	err = ENOMEM;
+	goto out;
+    }
     r->ai = ai;
     r->is_port_set = is_port_set;
     r->is_connect_back = is_connect_back;
@@ -450,8 +641,740 @@ remaddr_check(const struct port_remaddr *list,
 	 netcon < &(port->netcons[port->max_connections]);	\
 	 netcon++)
 
+/*
+ * The ports are kept on a list in the order they were configured,
+ * and indexed by port name with a hash table.  The list and the index
+ * are protected by ports_lock.
+ */
 DEFINE_LOCK_INIT(static, ports_lock)
 port_info_t *ports = NULL; /* Linked list of ports. */
+static port_info_t *ports_tail = NULL;
+
+/* Starting size of the port hash tables, must be a power of 2. */
+#define PORT_INIT_HASH_SIZE	64
+
+static port_info_t **port_names;
+static unsigned int port_names_size;
+static unsigned int nr_port_names;
+
+/*
+ * There is one of these for every device name used by a port, so
+ * checking if a device is already in use by another port doesn't
+ * have to look at all the ports.  The index is protected by
+ * port_devs_lock, so ports can be freed without ports_lock.
+ */
+struct port_dev {
+    char *devname;
+    unsigned int hash;
+    unsigned int refcount;	/* Ports that have this device. */
+    unsigned int inuse;		/* Ports that have this device open,
+				   only changed atomically as it is
+				   changed without port_devs_lock. */
+
+    /*
+     * The load on the device, for the rotators.  These are kept with
+     * atomics, too, as they change as data flows.
+     */
+    uint64_t bytes;		/* Bytes read from and written to it. */
+    unsigned int connections;	/* Connections to the ports on it. */
+    time_t last_error;		/* Monotonic time in seconds it last
+				   failed to open, 0 if never. */
+
+    struct port_dev *next;
+};
+
+DEFINE_LOCK_INIT(static, port_devs_lock)
+static struct port_dev **port_devs;
+static unsigned int port_devs_size;
+static unsigned int nr_port_devs;
+
+/* FNV-1a over the string. */
+static unsigned int
+port_str_hash(const char *str)
+{
+    unsigned int h = 2166136261U;
+
+    while (*str)
+	h = (h ^ (unsigned char) *str++) * 16777619U;
+
+    return h;
+}
+
+/* Find a port by name.  Must be called with ports_lock held. */
+static port_info_t *
+port_lookup(const char *portname)
+{
+    unsigned int hash = port_str_hash(portname);
+    port_info_t *port;
+
+    port = port_names[hash & (port_names_size - 1)];
+    while (port) {
+	if (port->name_hash == hash && strcmp(port->portname, portname) == 0)
+	    break;
+	port = port->name_next;
+    }
+
+    return port;
+}
+
+static void
+port_names_add(port_info_t *port)
+{
+    unsigned int i;
+
+    if (nr_port_names >= port_names_size * 2) {
+	/* Double the table, if that fails just use longer chains. */
+	unsigned int new_size = port_names_size * 2;
+	port_info_t **new_names, *tport;
+
+	new_names = calloc(new_size, sizeof(*new_names));
+	if (new_names) {
+	    for (i = 0; i < port_names_size; i++) {
+		while (port_names[i]) {
+		    tport = port_names[i];
+		    port_names[i] = tport->name_next;
+		    tport->name_next = new_names[tport->name_hash &
+						 (new_size - 1)];
+		    new_names[tport->name_hash & (new_size - 1)] = tport;
+		}
+	    }
+	    free(port_names);
+	    port_names = new_names;
+	    port_names_size = new_size;
+	}
+    }
+
+    port->name_hash = port_str_hash(port->portname);
+    i = port->name_hash & (port_names_size - 1);
+    port->name_next = port_names[i];
+    port_names[i] = port;
+    nr_port_names++;
+}
+
+static void
+port_names_remove(port_info_t *port)
+{
+    port_info_t **p = &port_names[port->name_hash & (port_names_size - 1)];
+
+    while (*p != port)
+	p = &(*p)->name_next;
+    *p = port->name_next;
+    nr_port_names--;
+}
+
+/* Add a port to the end of the list.  Must be called with ports_lock held. */
+static void
+port_list_add(port_info_t *port)
+{
+    port->next = NULL;
+    port->prev = ports_tail;
+    if (ports_tail)
+	ports_tail->next = port;
+    else
+	ports = port;
+    ports_tail = port;
+    port_names_add(port);
+}
+
+/* Must be called with ports_lock held. */
+static void
+port_list_remove(port_info_t *port)
+{
+    if (port->prev)
+	port->prev->next = port->next;
+    else
+	ports = port->next;
+    if (port->next)
+	port->next->prev = port->prev;
+    else
+	ports_tail = port->prev;
+    port->next = NULL;
+    port->prev = NULL;
+    port_names_remove(port);
+}
+
+/*
+ * Put new_port in the list where curr is, they have the same name.
+ * Must be called with ports_lock held.
+ */
+static void
+port_list_replace(port_info_t *curr, port_info_t *new_port)
+{
+    port_info_t **p = &port_names[curr->name_hash & (port_names_size - 1)];
+
+    new_port->next = curr->next;
+    new_port->prev = curr->prev;
+    if (curr->prev)
+	curr->prev->next = new_port;
+    else
+	ports = new_port;
+    if (curr->next)
+	curr->next->prev = new_port;
+    else
+	ports_tail = new_port;
+    curr->next = NULL;
+    curr->prev = NULL;
+
+    while (*p != curr)
+	p = &(*p)->name_next;
+    *p = new_port;
+    new_port->name_hash = curr->name_hash;
+    new_port->name_next = curr->name_next;
+}
+
+/*
+ * Find or add the device index entry for the port's device.  Returns
+ * ENOMEM if it can't be allocated.
+ */
+static int
+port_dev_get(port_info_t *port)
+{
+    unsigned int hash = port_str_hash(port->io.devname), i;
+    struct port_dev *dev;
+
+    LOCK(port_devs_lock);
+    dev = port_devs[hash & (port_devs_size - 1)];
+    while (dev) {
+	if (dev->hash == hash && strcmp(dev->devname, port->io.devname) == 0)
+	    goto out;
+	dev = dev->next;
+    }
+
+    if (nr_port_devs >= port_devs_size * 2) {
+	/* Double the table, if that fails just use longer chains. */
+	unsigned int new_size = port_devs_size * 2;
+	struct port_dev **new_devs, *tdev;
+
+	new_devs = calloc(new_size, sizeof(*new_devs));
+	if (new_devs) {
+	    for (i = 0; i < port_devs_size; i++) {
+		while (port_devs[i]) {
+		    tdev = port_devs[i];
+		    port_devs[i] = tdev->next;
+		    tdev->next = new_devs[tdev->hash & (new_size - 1)];
+		    new_devs[tdev->hash & (new_size - 1)] = tdev;
+		}
+	    }
+	    free(port_devs);
+	    port_devs = new_devs;
+	    port_devs_size = new_size;
+	}
+    }
+
+    dev = calloc(1, sizeof(*dev));
+    if (!dev) {
+	UNLOCK(port_devs_lock);
+	return ENOMEM;
+    }
+    dev->devname = strdup(port->io.devname);
+    if (!dev->devname) {
+	free(dev);
+	UNLOCK(port_devs_lock);
+	return ENOMEM;
+    }
+    dev->hash = hash;
+    i = hash & (port_devs_size - 1);
+    dev->next = port_devs[i];
+    port_devs[i] = dev;
+    nr_port_devs++;
+
+ out:
+    dev->refcount++;
+    port->dev = dev;
+    UNLOCK(port_devs_lock);
+    return 0;
+}
+
+static void
+port_dev_ref(struct port_dev *dev)
+{
+    LOCK(port_devs_lock);
+    dev->refcount++;
+    UNLOCK(port_devs_lock);
+}
+
+static void
+port_dev_release(struct port_dev *dev)
+{
+    struct port_dev **p;
+
+    LOCK(port_devs_lock);
+    if (--dev->refcount == 0) {
+	p = &port_devs[dev->hash & (port_devs_size - 1)];
+	while (*p != dev)
+	    p = &(*p)->next;
+	*p = dev->next;
+	nr_port_devs--;
+	free(dev->devname);
+	free(dev);
+    }
+    UNLOCK(port_devs_lock);
+}
+
+static void
+port_dev_put(port_info_t *port)
+{
+    struct port_dev *dev = port->dev;
+
+    if (!dev)
+	return;
+
+    port->dev = NULL;
+    port_dev_release(dev);
+}
+
+/*
+ * Count a new connection on the port's device.  The connection holds
+ * a reference, the port may get replaced while it is open.
+ */
+static void
+port_dev_conn_start(port_info_t *port, net_info_t *netcon)
+{
+    if (!port->dev || netcon->conn_dev)
+	return;
+
+    port_dev_ref(port->dev);
+    netcon->conn_dev = port->dev;
+    __atomic_add_fetch(&port->dev->connections, 1, __ATOMIC_RELAXED);
+}
+
+static void
+port_dev_conn_end(net_info_t *netcon)
+{
+    struct port_dev *dev = netcon->conn_dev;
+
+    if (!dev)
+	return;
+
+    netcon->conn_dev = NULL;
+    __atomic_sub_fetch(&dev->connections, 1, __ATOMIC_RELAXED);
+    port_dev_release(dev);
+}
+
+static void
+port_dev_add_bytes(port_info_t *port, unsigned int count)
+{
+    if (port->dev)
+	__atomic_add_fetch(&port->dev->bytes, count, __ATOMIC_RELAXED);
+}
+
+static void
+port_dev_open_failed(port_info_t *port)
+{
+    struct timeval now;
+
+    if (!port->dev)
+	return;
+
+    sel_get_monotonic_time(&now);
+    /* 0 means it never failed. */
+    __atomic_store_n(&port->dev->last_error, now.tv_sec ? now.tv_sec : 1,
+		     __ATOMIC_RELAXED);
+}
+
+/*
+ * The interned port configs, indexed by a hash of their contents, so
+ * ports with the same settings share one.  Protected by
+ * port_cfgs_lock, which is taken after a port's lock.
+ */
+DEFINE_LOCK_INIT(static, port_cfgs_lock)
+static struct port_cfg **port_cfgs;
+static unsigned int port_cfgs_size;
+static unsigned int nr_port_cfgs;
+
+static struct port_cfg *
+port_cfg_alloc(void)
+{
+    struct port_cfg *cfg = calloc(1, sizeof(*cfg));
+
+    if (cfg)
+	cfg->refcount = 1;
+    return cfg;
+}
+
+static void
+remaddr_list_free(struct port_remaddr *list)
+{
+    struct port_remaddr *r;
+
+    while (list) {
+	r = list;
+	list = r->next;
+	freeaddrinfo(r->ai);
+	free(r->str);
+	free(r);
+    }
+}
+
+static void
+port_cfg_free(struct port_cfg *cfg)
+{
+    if (cfg->bannerstr)
+	free(cfg->bannerstr);
+    if (cfg->signaturestr)
+	free(cfg->signaturestr);
+    if (cfg->openstr)
+	free(cfg->openstr);
+    if (cfg->closestr)
+	free(cfg->closestr);
+    if (cfg->closeon)
+	free(cfg->closeon);
+    if (cfg->trace_read.filename)
+	free(cfg->trace_read.filename);
+    if (cfg->trace_write.filename)
+	free(cfg->trace_write.filename);
+    if (cfg->trace_both.filename)
+	free(cfg->trace_both.filename);
+    remaddr_list_free(cfg->remaddrs);
+    free(cfg);
+}
+
+static void
+port_cfg_put(struct port_cfg *cfg)
+{
+    struct port_cfg **p;
+
+    if (!cfg)
+	return;
+
+    if (cfg->interned) {
+	LOCK(port_cfgs_lock);
+	if (--cfg->refcount > 0) {
+	    UNLOCK(port_cfgs_lock);
+	    return;
+	}
+	p = &port_cfgs[cfg->hash & (port_cfgs_size - 1)];
+	while (*p != cfg)
+	    p = &(*p)->next;
+	*p = cfg->next;
+	nr_port_cfgs--;
+	UNLOCK(port_cfgs_lock);
+    }
+    port_cfg_free(cfg);
+}
+
+/* FNV-1a, continuing from h.  A NULL string hashes differently from "". */
+static unsigned int
+cfg_hash_mem(unsigned int h, const void *data, size_t len)
+{
+    const unsigned char *d = data;
+
+    while (len--)
+	h = (h ^ *d++) * 16777619U;
+    return h;
+}
+
+static unsigned int
+cfg_hash_str(unsigned int h, const char *str)
+{
+    if (!str)
+	return h * 16777619U;
+    return cfg_hash_mem(h, str, strlen(str) + 1);
+}
+
+static unsigned int
+cfg_hash_trace(unsigned int h, const struct trace_cfg *t)
+{
+    h = cfg_hash_mem(h, &t->hexdump, sizeof(t->hexdump));
+    h = cfg_hash_mem(h, &t->timestamp, sizeof(t->timestamp));
+    h = cfg_hash_mem(h, &t->capture, sizeof(t->capture));
+    return cfg_hash_str(h, t->filename);
+}
+
+static unsigned int
+port_cfg_hash(const struct port_cfg *cfg)
+{
+    unsigned int h = 2166136261U;
+    struct port_remaddr *r;
+
+    h = cfg_hash_str(h, cfg->bannerstr);
+    h = cfg_hash_str(h, cfg->signaturestr);
+    h = cfg_hash_str(h, cfg->openstr);
+    h = cfg_hash_str(h, cfg->closestr);
+    if (cfg->closeon)
+	h = cfg_hash_mem(h, cfg->closeon, cfg->closeon_len);
+    h = cfg_hash_mem(h, &cfg->closeon_len, sizeof(cfg->closeon_len));
+    h = cfg_hash_mem(h, &cfg->chardelay_scale, sizeof(cfg->chardelay_scale));
+    h = cfg_hash_mem(h, &cfg->chardelay_min, sizeof(cfg->chardelay_min));
+    h = cfg_hash_mem(h, &cfg->chardelay_max, sizeof(cfg->chardelay_max));
+    h = cfg_hash_trace(h, &cfg->trace_read);
+    h = cfg_hash_trace(h, &cfg->trace_write);
+    h = cfg_hash_trace(h, &cfg->trace_both);
+    for (r = cfg->remaddrs; r; r = r->next)
+	h = cfg_hash_str(h, r->str);
+
+    return h;
+}
+
+static bool
+cfg_str_equal(const char *a, const char *b)
+{
+    if (!a || !b)
+	return a == b;
+    return strcmp(a, b) == 0;
+}
+
+static bool
+cfg_trace_equal(const struct trace_cfg *a, const struct trace_cfg *b)
+{
+    return (a->hexdump == b->hexdump && a->timestamp == b->timestamp &&
+	    a->capture == b->capture &&
+	    cfg_str_equal(a->filename, b->filename));
+}
+
+static bool
+port_cfg_equal(const struct port_cfg *a, const struct port_cfg *b)
+{
+    struct port_remaddr *ra, *rb;
+
+    if (!cfg_str_equal(a->bannerstr, b->bannerstr) ||
+		!cfg_str_equal(a->signaturestr, b->signaturestr) ||
+		!cfg_str_equal(a->openstr, b->openstr) ||
+		!cfg_str_equal(a->closestr, b->closestr))
+	return false;
+    if (a->closeon_len != b->closeon_len || !a->closeon != !b->closeon)
+	return false;
+    if (a->closeon && memcmp(a->closeon, b->closeon, a->closeon_len) != 0)
+	return false;
+    if (a->chardelay_scale != b->chardelay_scale ||
+		a->chardelay_min != b->chardelay_min ||
+		a->chardelay_max != b->chardelay_max)
+	return false;
+    if (!cfg_trace_equal(&a->trace_read, &b->trace_read) ||
+		!cfg_trace_equal(&a->trace_write, &b->trace_write) ||
+		!cfg_trace_equal(&a->trace_both, &b->trace_both))
+	return false;
+    for (ra = a->remaddrs, rb = b->remaddrs; ra && rb;
+	 ra = ra->next, rb = rb->next) {
+	if (strcmp(ra->str, rb->str) != 0)
+	    return false;
+    }
+
+    return !ra && !rb;
+}
+
+/*
+ * Return an interned config with the same settings as cfg, with a
+ * reference for the caller.  This is cfg itself if there wasn't one
+ * already, otherwise the caller still has to put cfg.
+ */
+static struct port_cfg *
+port_cfg_intern(struct port_cfg *cfg)
+{
+    unsigned int hash = port_cfg_hash(cfg), i;
+    struct port_cfg *c;
+
+    LOCK(port_cfgs_lock);
+    for (c = port_cfgs[hash & (port_cfgs_size - 1)]; c; c = c->next) {
+	if (c->hash == hash && port_cfg_equal(c, cfg)) {
+	    c->refcount++;
+	    goto out;
+	}
+    }
+
+    if (nr_port_cfgs >= port_cfgs_size * 2) {
+	/* Double the table, if that fails just use longer chains. */
+	unsigned int new_size = port_cfgs_size * 2;
+	struct port_cfg **new_cfgs, *tcfg;
+
+	new_cfgs = calloc(new_size, sizeof(*new_cfgs));
+	if (new_cfgs) {
+	    for (i = 0; i < port_cfgs_size; i++) {
+		while (port_cfgs[i]) {
+		    tcfg = port_cfgs[i];
+		    port_cfgs[i] = tcfg->next;
+		    tcfg->next = new_cfgs[tcfg->hash & (new_size - 1)];
+		    new_cfgs[tcfg->hash & (new_size - 1)] = tcfg;
+		}
+	    }
+	    free(port_cfgs);
+	    port_cfgs = new_cfgs;
+	    port_cfgs_size = new_size;
+	}
+    }
+
+    c = cfg;
+    c->hash = hash;
+    c->interned = true;
+    i = hash & (port_cfgs_size - 1);
+    c->next = port_cfgs[i];
+    port_cfgs[i] = c;
+    nr_port_cfgs++;
+ out:
+    UNLOCK(port_cfgs_lock);
+    return c;
+}
+
+static int
+cfg_strdup(char **dst, const char *src, size_t len)
+{
+    if (!src)
+	return 0;
+    *dst = malloc(len + 1);
+    if (!*dst)
+	return ENOMEM;
+    memcpy(*dst, src, len + 1);
+    return 0;
+}
+
+static int
+cfg_dup_trace(struct trace_cfg *dst, const struct trace_cfg *src)
+{
+    *dst = *src;
+    dst->filename = NULL;
+    if (!src->filename)
+	return 0;
+    return cfg_strdup(&dst->filename, src->filename, strlen(src->filename));
+}
+
+/* A copy of the config that isn't interned. */
+static struct port_cfg *
+port_cfg_dup(const struct port_cfg *cfg)
+{
+    struct port_cfg *new_cfg = port_cfg_alloc();
+    struct port_remaddr *r;
+    int err = 0;
+
+    if (!new_cfg)
+	return NULL;
+
+    new_cfg->closeon_len = cfg->closeon_len;
+    new_cfg->chardelay_scale = cfg->chardelay_scale;
+    new_cfg->chardelay_min = cfg->chardelay_min;
+    new_cfg->chardelay_max = cfg->chardelay_max;
+    if (cfg->bannerstr)
+	err = cfg_strdup(&new_cfg->bannerstr, cfg->bannerstr,
+			 strlen(cfg->bannerstr));
+    if (!err && cfg->signaturestr)
+	err = cfg_strdup(&new_cfg->signaturestr, cfg->signaturestr,
+			 strlen(cfg->signaturestr));
+    if (!err && cfg->openstr)
+	err = cfg_strdup(&new_cfg->openstr, cfg->openstr,
+			 strlen(cfg->openstr));
+    if (!err && cfg->closestr)
+	err = cfg_strdup(&new_cfg->closestr, cfg->closestr,
+			 strlen(cfg->closestr));
+    if (!err)
+	err = cfg_strdup(&new_cfg->closeon, cfg->closeon, cfg->closeon_len);
+    if (!err)
+	err = cfg_dup_trace(&new_cfg->trace_read, &cfg->trace_read);
+    if (!err)
+	err = cfg_dup_trace(&new_cfg->trace_write, &cfg->trace_write);
+    if (!err)
+	err = cfg_dup_trace(&new_cfg->trace_both, &cfg->trace_both);
+    for (r = cfg->remaddrs; !err && r; r = r->next)
+	err = remaddr_append(&new_cfg->remaddrs, r->str);
+
+    if (err) {
+	port_cfg_free(new_cfg);
+	return NULL;
+    }
+    return new_cfg;
+}
+
+/*
+ * Switch the port to the given config, which must have the same
+ * settings if the port is running, and drop the old one.
+ */
+static void
+port_cfg_set(port_info_t *port, struct port_cfg *cfg)
+{
+    struct port_cfg *old = port->cfg;
+    struct port_remaddr *ro, *rn;
+    net_info_t *netcon;
+
+    if (old == cfg)
+	return;
+
+    /* Fixed remote addresses point into the list, move them. */
+    if (port->netcons && old) {
+	for_each_connection(port, netcon) {
+	    if (!netcon->remote_ai)
+		continue;
+	    for (ro = old->remaddrs, rn = cfg->remaddrs; ro && rn;
+		 ro = ro->next, rn = rn->next) {
+		if (ro->ai == netcon->remote_ai) {
+		    netcon->remote_ai = rn->ai;
+		    break;
+		}
+	    }
+	}
+    }
+
+    port->cfg = cfg;
+    port_cfg_put(old);
+}
+
+/*
+ * Return a config for the port that can be changed, copying it if it
+ * is interned.  Returns NULL if out of memory.
+ */
+static struct port_cfg *
+port_cfg_writable(port_info_t *port)
+{
+    struct port_cfg *cfg = port->cfg;
+
+    if (!cfg->interned)
+	return cfg;
+
+    cfg = port_cfg_dup(cfg);
+    if (cfg)
+	port_cfg_set(port, cfg);
+    return cfg;
+}
+
+/* Share the port's config with the other ports that have the same. */
+static void
+port_cfg_share(port_info_t *port)
+{
+    struct port_cfg *cfg;
+
+    if (port->cfg->interned)
+	return;
+
+    cfg = port_cfg_intern(port->cfg);
+    port_cfg_set(port, cfg);
+}
+
+/* The memory the config holds, not counting the remote addresses. */
+static unsigned long
+port_cfg_mem_size(const struct port_cfg *cfg)
+{
+    unsigned long size = sizeof(*cfg);
+    struct port_remaddr *r;
+
+    if (cfg->bannerstr)
+	size += strlen(cfg->bannerstr) + 1;
+    if (cfg->signaturestr)
+	size += strlen(cfg->signaturestr) + 1;
+    if (cfg->openstr)
+	size += strlen(cfg->openstr) + 1;
+    if (cfg->closestr)
+	size += strlen(cfg->closestr) + 1;
+    if (cfg->closeon)
+	size += cfg->closeon_len + 1;
+    for (r = cfg->remaddrs; r; r = r->next)
+	size += sizeof(*r) + strlen(r->str) + 1;
+
+    return size;
+}
+
+/*
+ * Mark the port as having its device open or not.  Must be called
+ * with the port lock held.
+ */
+static void
+port_dev_set_inuse(port_info_t *port, bool inuse)
+{
+    if (port->dev_inuse == inuse || !port->dev)
+	return;
+
+    port->dev_inuse = inuse;
+    if (inuse)
+	__atomic_add_fetch(&port->dev->inuse, 1, __ATOMIC_RELAXED);
+    else
+	__atomic_sub_fetch(&port->dev->inuse, 1, __ATOMIC_RELAXED);
+}
 
 static void shutdown_one_netcon(net_info_t *netcon, char *reason);
 static void shutdown_port(port_info_t *port, char *reason);
@@ -560,20 +1483,26 @@ init_port_data(port_info_t *port)
 
     port->net_to_dev_state = PORT_UNCONNECTED;
     port->dev_to_net_state = PORT_UNCONNECTED;
-    port->trace_read.fd = -1;
-    port->trace_write.fd = -1;
-    port->trace_both.fd = -1;
 
     port->allow_2217 = find_default_int("remctl");
     port->telnet_brk_on_sync = find_default_int("telnet_brk_on_sync");
     port->kickolduser_mode = find_default_int("kickolduser");
     port->enable_chardelay = find_default_int("chardelay");
-    port->chardelay_scale = find_default_int("chardelay-scale");
-    port->chardelay_min = find_default_int("chardelay-min");
-    port->chardelay_max = find_default_int("chardelay-max");
+    port->cfg->chardelay_scale = find_default_int("chardelay-scale");
+    port->cfg->chardelay_min = find_default_int("chardelay-min");
+    port->cfg->chardelay_max = find_default_int("chardelay-max");
     port->dev_to_net.maxsize = find_default_int("dev-to-net-bufsize");
+    port->dev_to_net_nbufs = find_default_int("dev-to-net-buffers");
     port->net_to_dev.maxsize = find_default_int("net-to-dev-bufsize");
     port->max_connections = find_default_int("max-connections");
+    port->lag_policy = find_default_int("lag-policy");
+    port->splice = find_default_int("splice");
+    port->capture_size = find_default_int("capture-size");
+    port->splice_pipe[0] = -1;
+    port->splice_pipe[1] = -1;
+    port->shard = -1;
+    port->dev_to_net_head = DEV_TO_NET_START;
+    port->dev_to_net_sent = DEV_TO_NET_START;
 
     port->led_tx = NULL;
     port->led_rx = NULL;
@@ -584,142 +1513,111 @@ init_port_data(port_info_t *port)
 static void
 reset_timer(net_info_t *netcon)
 {
-    netcon->timeout_left = netcon->port->timeout;
+    struct timeval now;
+
+    /* The timer checks this when it goes off, see netcon_timeout(). */
+    sel_get_monotonic_time(&now);
+    netcon->last_io = now.tv_sec;
+}
+
+/* Start the idle timeout for a new connection, or a new timeout. */
+static void
+netcon_start_timeout(net_info_t *netcon)
+{
+    port_info_t *port = netcon->port;
+
+    reset_timer(netcon);
+    sel_stop_wheel_timer(netcon->timeout_timer);
+    if (port->timeout > 0)
+	sel_start_wheel_timer(netcon->timeout_timer, port->timeout * 1000);
 }
 
+static void
+netcon_timeout(struct selector_s *sel, sel_wheel_timer_t *timer, void *data)
+{
+    net_info_t *netcon = data;
+    port_info_t *port = netcon->port;
+    struct timeval now;
+    time_t idle;
+
+    LOCK(port->lock);
+    if (!netcon->net || netcon->closing || port->timeout <= 0)
+	goto out_unlock;
+
+    /* I/O doesn't touch the timer, so see if there was any. */
+    sel_get_monotonic_time(&now);
+    idle = now.tv_sec - netcon->last_io;
+    if (idle >= port->timeout)
+	shutdown_one_netcon(netcon, "timeout");
+    else
+	sel_start_wheel_timer(timer, (port->timeout - idle) * 1000);
 
-static int
-timestamp(trace_info_t *t, char *buf, int size)
-{
-    time_t result;
-    if (!t->timestamp)
-        return 0;
-    result = time(NULL);
-    return strftime(buf, size, "%Y/%m/%d %H:%M:%S ", localtime(&result));
+ out_unlock:
+    UNLOCK(port->lock);
 }
 
-static int
-trace_write_end(char *out, int size, const unsigned char *start, int col)
+/* Does the port need got_timeout() to run? */
+static bool
+port_needs_timer(port_info_t *port)
 {
-    int pos = 0, w;
-
-    strncat(out, " |", size - pos);
-    pos += 2;
-    for(w = 0; w < col; w++) {
-        pos += snprintf(out + pos, size - pos, "%c",
-			isprint(start[w]) ? start[w] : '.');
-    }
-    strncat(out + pos, "|\n", size - pos);
-    pos += 2;
-    return pos;
-}
-
-int
-trace_write(port_info_t *port, trace_info_t *t, const unsigned char *buf,
-	    unsigned int buf_len, const char *prefix)
-{
-    int rv = 0, w, col = 0, pos, file = t->fd;
-    unsigned int q;
-    static char out[1024];
-    const unsigned char *start;
-
-    if (buf_len == 0)
-        return 0;
-
-    if (!t->hexdump)
-        return write(file, buf, buf_len);
-
-    pos = timestamp(t, out, sizeof(out));
-    pos += snprintf(out + pos, sizeof(out) - pos, "%s ", prefix);
-
-    start = buf;
-    for (q = 0; q < buf_len; q++) {
-        pos += snprintf(out + pos, sizeof(out) - pos, "%02x ", buf[q]);
-        col++;
-        if (col >= 8) {
-            trace_write_end(out + pos, sizeof(out) - pos, start, col);
-            rv = write(file, out, strlen(out));
-            if (rv < 0)
-                return rv;
-            pos = timestamp(t, out, sizeof(out));
-            pos += snprintf(out + pos, sizeof(out) - pos, "%s ", prefix);
-            col = 0;
-            start = buf + q + 1;
-        }
-    }
-    if (col > 0) {
-        for (w = 8; w > col; w--) {
-            strncat(out + pos, "   ", sizeof(out) - pos);
-            pos += 3;
-        }
-        trace_write_end(out + pos, sizeof(out) - pos, start, col);
-        rv = write(file, out, strlen(out));
-        if (rv < 0)
-            return rv;
-    }
-    return buf_len;
+    return (port->dev_to_net_state == PORT_CLOSING ||
+	    port->nocon_read_enable_time_left ||
+	    (port->is_2217 && !port->modemstate_notify));
 }
 
 static void
-do_trace(port_info_t *port, trace_info_t *t, const unsigned char *buf,
-	 unsigned int buf_len, const char *prefix)
+port_start_timer(port_info_t *port)
 {
-    int rv;
-
-    while (buf_len > 0) {
-    retry_write:
-	rv = trace_write(port, t, buf, buf_len, prefix);
-	if (rv == -1) {
-	    char errbuf[128];
-	    int err = errno;
-
-	    if (err == EINTR)
-		goto retry_write;
+    /* If it's already running this fails, which is fine. */
+    sel_start_wheel_timer(port->timer, 1000);
+}
 
-	    /* Fatal error writing to the file, log it and close the file. */
 
-	    if (strerror_r(err, errbuf, sizeof(errbuf)) == -1)
-		syslog(LOG_ERR, "Unable write to trace file on port %s: %d",
-		       port->portname, err);
-	    else
-		syslog(LOG_ERR, "Unable to write to trace file on port %s: %s",
-		       port->portname, errbuf);
+/* netcon is the connection the data came from, NULL for the device. */
+static void
+do_trace(port_info_t *port, trace_info_t *t, net_info_t *netcon,
+	 const unsigned char *buf, unsigned int buf_len, const char *prefix)
+{
+    if (!t->tf)
+	return;
 
-	    close(t->fd);
-	    t->fd = -1;
-	    return;
-	}
+    if (t->capture)
+	trace_file_capture(t->tf, netcon != NULL,
+			   netcon ? netcon - port->netcons + 1 : 0,
+			   buf, buf_len);
+    else
+	trace_file_data(t->tf, t->hexdump, t->timestamp, prefix, buf, buf_len);
+}
 
-	/* Handle a partial write */
-	buf_len -= rv;
-	buf += rv;
-    }
+/* Open and close messages go to timestamped and capture files. */
+static bool
+hf_wanted(trace_info_t *t)
+{
+    return t->tf && (t->timestamp || t->capture);
 }
 
 static void
 hf_out(port_info_t *port, char *buf, int len)
 {
-    if (port->tr && port->tr->timestamp)
-        write_ignore_fail(port->tr->fd, buf, len);
+    if (port->tr && hf_wanted(port->tr))
+	trace_file_text(port->tr->tf, buf, len);
 
     /* don't output to write file if it's the same as read file */
-    if (port->tw && port->tw != port->tr && port->tw->timestamp)
-        write_ignore_fail(port->tw->fd, buf, len);
+    if (port->tw && port->tw != port->tr && hf_wanted(port->tw))
+	trace_file_text(port->tw->tf, buf, len);
 
     /* don't output to both file if it's the same as read or write file */
     if (port->tb && port->tb != port->tr && port->tb != port->tw
-		&& port->tb->timestamp)
-        write_ignore_fail(port->tb->fd, buf, len);
+		&& hf_wanted(port->tb))
+	trace_file_text(port->tb->tf, buf, len);
 }
 
 static void
 header_trace(port_info_t *port, net_info_t *netcon)
 {
     char buf[1024];
-    trace_info_t tr = { 1, 1, NULL, -1 };
     int len = 0;
 
-    len += timestamp(&tr, buf, sizeof(buf));
     len += snprintf(buf + len, sizeof(buf) - len, "OPEN (");
     genio_raddr_to_str(netcon->net, &len, buf, sizeof(buf));
     len += snprintf(buf + len, sizeof(buf) - len, ")\n");
@@ -731,45 +1629,347 @@ static void
 footer_trace(port_info_t *port, char *type, char *reason)
 {
     char buf[1024];
-    trace_info_t tr = { 1, 1, NULL, -1 };
     int len = 0;
 
-    len += timestamp(&tr, buf, sizeof(buf));
     len += snprintf(buf + len, sizeof(buf), "CLOSE %s (%s)\n", type, reason);
 
     hf_out(port, buf, len);
 }
 
+/*
+ * The dev_to_net buffer is a ring shared by all the network
+ * connections of a port.  dev_to_net_head counts the bytes put into
+ * the ring, dev_to_net_sent the bytes released to the connections,
+ * and each connection's write_pos the bytes it has written.  All of
+ * these are free-running counters, the ring position is the counter
+ * modulo the ring size.  They are 64 bits so they never wrap, the
+ * ring size doesn't have to be a power of two and a wrap would move
+ * the position.  The space in use is set by the connection
+ * the farthest behind, so a slow connection only stops the device
+ * reads once it is a full ring behind, and then only if lag_policy
+ * says to block.
+ */
+#define netcon_is_reader(netcon) ((netcon)->net && !(netcon)->closing)
+
+static unsigned int
+dev_to_net_used(port_info_t *port)
+{
+    net_info_t *netcon;
+    unsigned int used = port->dev_to_net_head - port->dev_to_net_sent;
+
+    for_each_connection(port, netcon) {
+	if (!netcon_is_reader(netcon))
+	    continue;
+	if (port->dev_to_net_head - netcon->write_pos > used)
+	    used = port->dev_to_net_head - netcon->write_pos;
+    }
+    return used;
+}
+
+/*
+ * A telnet port needs room for a doubled IAC, anything less than this
+ * in the ring is treated as full.
+ */
+static unsigned int
+dev_to_net_min_room(port_info_t *port)
+{
+    return port->enabled == PORT_TELNET ? 2 : 1;
+}
+
+static unsigned int
+dev_to_net_room(port_info_t *port)
+{
+    return port->dev_to_net.maxsize - dev_to_net_used(port);
+}
+
+/*
+ * On a telnet port the IACs in the ring are doubled, don't let a
+ * connection skip to the second IAC of a pair.  Count the IACs right
+ * before pos, back to the oldest data in the ring at "oldest".  If
+ * there is an odd number, pos is in the middle of a pair, so move past
+ * it.  Returns the new position.
+ */
+static uint64_t
+dev_to_net_iac_align(port_info_t *port, uint64_t oldest, uint64_t pos)
+{
+    unsigned char *buf = port->dev_to_net.buf;
+    unsigned int size = port->dev_to_net.maxsize;
+    uint64_t p = pos;
+
+    if (port->enabled != PORT_TELNET)
+	return pos;
+
+    while (p > oldest && buf[(p - 1) % size] == TN_IAC)
+	p--;
+    if ((pos - p) & 1)
+	pos++;
+    return pos;
+}
+
+/*
+ * Is some connection not at the tail of the ring, so the lag policy
+ * can make room for it?  If so, next_lag is set to how far behind the
+ * slowest of those is.
+ */
+static bool
+dev_to_net_lag_can_free(port_info_t *port, unsigned int *next_lag)
+{
+    net_info_t *netcon;
+    unsigned int tail_lag = dev_to_net_used(port), lag;
+    bool others_have_room = false;
+
+    if (port->lag_policy == LAG_POLICY_BLOCK)
+	return false;
+
+    *next_lag = port->dev_to_net_head - port->dev_to_net_sent;
+    for_each_connection(port, netcon) {
+	if (!netcon_is_reader(netcon))
+	    continue;
+	lag = port->dev_to_net_head - netcon->write_pos;
+	if (lag < tail_lag) {
+	    others_have_room = true;
+	    if (lag > *next_lag)
+		*next_lag = lag;
+	}
+    }
+    return others_have_room;
+}
+
+/*
+ * The ring is full.  If some connection is not at the tail of the
+ * ring, it can still take data, so apply the lag policy to the
+ * connections at the tail.  Returns the room in the ring afterwards,
+ * if it is too small the device reads must stop.
+ */
+static unsigned int
+dev_to_net_handle_full(port_info_t *port)
+{
+    net_info_t *netcon;
+    unsigned int tail_lag = dev_to_net_used(port), next_lag;
+    uint64_t new_pos;
+
+    if (!dev_to_net_lag_can_free(port, &next_lag))
+	/* Everyone is stuck, just wait for them. */
+	return 0;
+
+    for_each_connection(port, netcon) {
+	if (!netcon_is_reader(netcon))
+	    continue;
+	if (port->dev_to_net_head - netcon->write_pos < tail_lag)
+	    continue;
+	if (port->lag_policy == LAG_POLICY_DROP) {
+	    /* Throw away the oldest data, up to the next slowest one. */
+	    new_pos = dev_to_net_iac_align(port, netcon->write_pos,
+					   port->dev_to_net_head - next_lag);
+	    STAT_ADD(netcon->dropped, new_pos - netcon->write_pos);
+	    netcon->write_pos = new_pos;
+	} else
+	    shutdown_one_netcon(netcon, "fell too far behind");
+    }
+
+    return dev_to_net_room(port);
+}
+
+/*
+ * Put telnet data into the ring, doubling the IACs.  The caller must
+ * make sure there is room for twice the length.
+ */
+static void
+dev_to_net_add_telnet(port_info_t *port, const unsigned char *data,
+		      unsigned int len)
+{
+    unsigned char *buf = port->dev_to_net.buf;
+    unsigned int size = port->dev_to_net.maxsize;
+    unsigned int start, room, count;
+
+    while (len > 0) {
+	start = port->dev_to_net_head % size;
+	room = size - start;
+	count = process_telnet_xmit(buf + start, room, &data, &len);
+	port->dev_to_net_head += count;
+	if (len > 0 && count < room) {
+	    /* An IAC that has to be split over the end of the ring. */
+	    buf[start + count] = TN_IAC;
+	    buf[0] = TN_IAC;
+	    port->dev_to_net_head += 2;
+	    data++;
+	    len--;
+	}
+    }
+}
+
 static bool
 any_net_data_to_write(port_info_t *port)
 {
     net_info_t *netcon;
 
     for_each_connection(port, netcon) {
-	if (!netcon->net)
+	if (!netcon_is_reader(netcon))
 	    continue;
-	if (netcon->write_pos < port->dev_to_net.cursize)
+	if (netcon->write_pos != port->dev_to_net_sent)
 	    return true;
     }
     return false;
 }
 
+/* Release everything in the ring to the network connections. */
 static void
 start_net_send(port_info_t *port)
 {
     net_info_t *netcon;
 
-    if (port->dev_to_net_state == PORT_WAITING_OUTPUT_CLEAR)
-	return;
+    port->dev_to_net_sent = port->dev_to_net_head;
+    for_each_connection(port, netcon) {
+	if (!netcon_is_reader(netcon))
+	    continue;
+	if (netcon->write_pos != port->dev_to_net_sent)
+	    genio_set_write_callback_enable(netcon->net, true);
+    }
+}
+
+/*
+ * Hold the data from the device for the chardelay so more can be
+ * batched up with it.  Returns false if chardelay_max has passed and
+ * the data should be sent now.
+ */
+static bool
+delay_net_send(port_info_t *port)
+{
+    struct timeval then;
+    int delay;
+
+    sel_get_monotonic_time(&then);
+    if (port->send_timer_running) {
+	sel_stop_timer(port->send_timer);
+    } else {
+	port->send_time = then;
+	add_usec_to_timeval(&port->send_time, port->cfg->chardelay_max);
+    }
+    delay = sub_timeval_us(&port->send_time, &then);
+    if (delay > port->chardelay)
+	delay = port->chardelay;
+    else if (delay < 0) {
+	port->send_timer_running = false;
+	return false;
+    }
+    add_usec_to_timeval(&then, delay);
+    sel_start_timer(port->send_timer, &then);
+    port->send_timer_running = true;
+    return true;
+}
+
+/*
+ * If the data from the device can be spliced straight to the
+ * network, return the connection it goes to.  This is only possible
+ * on a raw port with a single connection, when nothing else needs to
+ * see the data and nothing is left in the ring.
+ */
+static net_info_t *
+dev_to_net_splice_reader(port_info_t *port)
+{
+    net_info_t *netcon, *reader = NULL;
+
+    if (!port->splice || port->splice_failed || !port->io.f->splice_read)
+	return NULL;
+    if (port->enabled != PORT_RAW || port->tr || port->tb ||
+		port->dev_monitor || port->cfg->closeon || port->led_rx)
+	return NULL;
+    if (port->dev_to_net_head != port->dev_to_net_sent)
+	return NULL;
 
-    port->io.f->read_handler_enable(&port->io, 0);
     for_each_connection(port, netcon) {
-	if (!netcon->net)
+	if (!netcon_is_reader(netcon))
 	    continue;
-	netcon->write_pos = 0;
+	if (reader)
+	    return NULL;
+	reader = netcon;
+    }
+    if (!reader || reader->banner ||
+		reader->write_pos != port->dev_to_net_sent)
+	return NULL;
+
+    /* Make sure the network side can do it, too. */
+    if (genio_write_from_pipe(reader->net, NULL, -1, 0))
+	return NULL;
+
+    return reader;
+}
+
+/* Throw away anything in the splice pipe. */
+static void
+dev_to_net_splice_drop(port_info_t *port)
+{
+    if (port->splice_pipe[0] != -1) {
+	close(port->splice_pipe[0]);
+	close(port->splice_pipe[1]);
+	port->splice_pipe[0] = -1;
+	port->splice_pipe[1] = -1;
+    }
+    port->splice_pending = 0;
+    port->splice_netcon = NULL;
+}
+
+/*
+ * Write the data in the splice pipe to its connection.  Returns -1
+ * on something causing the netcon to shut down, 0 if the write was
+ * incomplete, and 1 if the write was completed.
+ */
+static int
+dev_to_net_splice_write(port_info_t *port, net_info_t *netcon)
+{
+    unsigned int count;
+    int reterr;
+
+    while (port->splice_pending) {
+	count = 0;
+	reterr = genio_write_from_pipe(netcon->net, &count,
+				       port->splice_pipe[0],
+				       port->splice_pending);
+	if (reterr) {
+	    if (reterr == EPIPE) {
+		shutdown_one_netcon(netcon, "EPIPE");
+	    } else {
+		syslog(LOG_ERR, "The network write for port %s had error: %s",
+		       port->portname, strerror(reterr));
+		shutdown_one_netcon(netcon, "network write error");
+	    }
+	    dev_to_net_splice_drop(port);
+	    return -1;
+	}
+	STAT_ADD(netcon->writes, 1);
+	STAT_ADD(netcon->bytes_sent, count);
+	if (count < port->splice_pending)
+	    STAT_ADD(netcon->write_eagain, 1);
+	if (count == 0)
+	    return 0;
+	port->splice_pending -= count;
+    }
+
+    return 1;
+}
+
+/*
+ * Send the data in the splice pipe.  If it can't all be written now,
+ * stop reading the device until the connection takes the rest.
+ */
+static void
+dev_to_net_splice_send(port_info_t *port)
+{
+    net_info_t *netcon = port->splice_netcon;
+    int rv;
+
+    if (!netcon_is_reader(netcon)) {
+	/* The connection went away, nobody to send it to. */
+	dev_to_net_splice_drop(port);
+	return;
+    }
+
+    rv = dev_to_net_splice_write(port, netcon);
+    if (rv == 0) {
+	port->io.f->read_handler_enable(&port->io, 0);
+	port->dev_to_net_state = PORT_WAITING_OUTPUT_CLEAR;
 	genio_set_write_callback_enable(netcon->net, true);
     }
-    port->dev_to_net_state = PORT_WAITING_OUTPUT_CLEAR;
 }
 
 void
@@ -787,7 +1987,9 @@ send_timeout(struct selector_s  *sel,
     }
 
     port->send_timer_running = false;
-    if (port->dev_to_net.cursize > 0)
+    if (port->splice_pending)
+	dev_to_net_splice_send(port);
+    else if (port->dev_to_net_head != port->dev_to_net_sent)
 	start_net_send(port);
     UNLOCK(port->lock);
 }
@@ -830,10 +2032,11 @@ connect_back_done(struct genio *net, int err, void *cb_data)
     assert(port->num_waiting_connect_backs > 0);
     port->num_waiting_connect_backs--;
     if (port->num_waiting_connect_backs == 0) {
-	if (num_connected_net(port) == 0)
+	if (num_connected_net(port) == 0) {
 	    /* No connections could be made. */
 	    port->nocon_read_enable_time_left = 10;
-	else
+	    port_start_timer(port);
+	} else
 	    port->io.f->read_handler_enable(&port->io, 1);
     }
     UNLOCK(port->lock);
@@ -870,6 +2073,7 @@ port_check_connect_backs(port_info_t *port)
 	 * connects, but failed.  Shut down the read enable for a while.
 	 */
 	port->nocon_read_enable_time_left = 10;
+	port_start_timer(port);
 	port->io.f->read_handler_enable(&port->io, 0);
     } else if (port->num_waiting_connect_backs) {
 	port->io.f->read_handler_enable(&port->io, 0);
@@ -878,17 +2082,81 @@ port_check_connect_backs(port_info_t *port)
     return port->num_waiting_connect_backs;
 }
 
+/*
+ * Splice data from the device into the pipe for netcon.  Returns
+ * false if the device can't splice and the data needs to go through
+ * the ring.
+ */
+static bool
+handle_dev_splice_read(port_info_t *port, net_info_t *netcon)
+{
+    int count;
+
+    if (port->splice_pipe[0] == -1) {
+	if (pipe(port->splice_pipe) == -1) {
+	    syslog(LOG_ERR, "Unable to allocate splice pipe for port %s: %m",
+		   port->portname);
+	    port->splice_failed = true;
+	    return false;
+	}
+	fcntl(port->splice_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(port->splice_pipe[1], F_SETFL, O_NONBLOCK);
+    }
+
+    count = port->io.f->splice_read(&port->io, port->splice_pipe[1],
+				    port->dev_to_net_chunk -
+				    port->splice_pending);
+    if (count < 0) {
+	if (errno == EINVAL || errno == ENOSYS) {
+	    /* The device doesn't support splice, use the ring. */
+	    port->splice_failed = true;
+	    return false;
+	}
+
+	if (errno == EAGAIN || errno == EWOULDBLOCK) {
+	    /*
+	     * Nothing to read, or the pipe is full.  Sending what we
+	     * have is harmless in the first case and required in the
+	     * second.
+	     */
+	    if (port->splice_pending)
+		dev_to_net_splice_send(port);
+	    return true;
+	}
+
+	/* Got an error on the read, shut down the port. */
+	syslog(LOG_ERR, "dev read error for device %s: %m", port->portname);
+	shutdown_port(port, "dev read error");
+	return true;
+    } else if (count == 0) {
+	/* The port got closed somehow, shut it down. */
+	shutdown_port(port, "closed port");
+	return true;
+    }
+
+    STAT_ADD(port->dev_bytes_received, count);
+    STAT_ADD(port->dev_reads, 1);
+    port_dev_add_bytes(port, count);
+    port->splice_pending += count;
+    port->splice_netcon = netcon;
+
+    if (port->splice_pending >= port->dev_to_net_chunk ||
+		port->chardelay == 0 || !delay_net_send(port))
+	dev_to_net_splice_send(port);
+
+    return true;
+}
+
 /* Data is ready to read on the serial port. */
 static void
 handle_dev_fd_read(struct devio *io)
 {
     port_info_t *port = (port_info_t *) io->user_data;
     int count;
-    int curend;
-    bool send_now = false;
-    unsigned int readcount, oreadcount;
+    unsigned int start, room, readcount;
     const unsigned char *readbuf;
     int nr_handlers;
+    net_info_t *netcon;
 
     LOCK(port->lock);
     if (port->dev_to_net_state != PORT_WAITING_INPUT)
@@ -897,34 +2165,53 @@ handle_dev_fd_read(struct devio *io)
     if (nr_handlers > 0)
 	goto out_unlock;
 
-    curend = port->dev_to_net.cursize;
-    oreadcount = port->dev_to_net.maxsize - curend;
-    readcount = oreadcount;
+    netcon = dev_to_net_splice_reader(port);
+    if (netcon && (!port->splice_pending || netcon == port->splice_netcon) &&
+		handle_dev_splice_read(port, netcon))
+	goto out_unlock;
+    if (port->splice_pending) {
+	/* Can't splice anymore, the pipe must be emptied first. */
+	dev_to_net_splice_send(port);
+	if (port->splice_pending)
+	    goto out_unlock;
+    }
+
+    room = dev_to_net_room(port);
+    if (room < dev_to_net_min_room(port))
+	room = dev_to_net_handle_full(port);
+    if (room < dev_to_net_min_room(port)) {
+	/* Wait for the network side to make some room. */
+	port->io.f->read_handler_enable(&port->io, 0);
+	port->dev_to_net_state = PORT_WAITING_OUTPUT_CLEAR;
+	STAT_ADD(port->dev_overruns, 1);
+	if (port->dev_to_net_head != port->dev_to_net_sent)
+	    start_net_send(port);
+	goto out_unlock;
+    }
+
+    if (room > port->dev_to_net_chunk)
+	room = port->dev_to_net_chunk;
+    start = port->dev_to_net_head % port->dev_to_net.maxsize;
     if (port->enabled == PORT_TELNET) {
-	readbuf = port->telnet_dev_to_net;
-	readcount /= 2; /* Leave room for IACs. */
-
-	if (readcount == 0) {
-	    /* We don't want a zero read, so just ignore this, as we have
-	       data to send. */
-	    send_now = true;
-	    count = 0;
-	    goto do_send;
-	}
+	readcount = room / 2; /* Leave room for IACs. */
 	count = port->io.f->read(&port->io, port->telnet_dev_to_net,
 				 readcount);
+	readbuf = port->telnet_dev_to_net;
     } else {
-	count = port->io.f->read(&port->io, port->dev_to_net.buf + curend,
+	/* Only read up to the end of the ring, we will get called again. */
+	readcount = port->dev_to_net.maxsize - start;
+	if (readcount > room)
+	    readcount = room;
+	count = port->io.f->read(&port->io, port->dev_to_net.buf + start,
 				 readcount);
-	readbuf = port->dev_to_net.buf + curend;
+	readbuf = port->dev_to_net.buf + start;
     }
 
     if (count <= 0) {
-	if (curend != 0) {
+	if (port->dev_to_net_head != port->dev_to_net_sent) {
 	    /* We still have data to send. */
-	    send_now = true;
-	    count = 0;
-	    goto do_send;
+	    start_net_send(port);
+	    goto out_unlock;
 	}
 
 	if (count < 0) {
@@ -945,17 +2232,16 @@ handle_dev_fd_read(struct devio *io)
     if (port->dev_monitor != NULL && count > 0)
 	controller_write(port->dev_monitor, (char *) readbuf, count);
 
- do_send:
-    if (port->closeon) {
+    if (port->cfg->closeon) {
 	int i;
 
 	for (i = 0; i < count; i++) {
-	    if (readbuf[i] == port->closeon[port->closeon_pos]) {
+	    if (readbuf[i] == port->cfg->closeon[port->closeon_pos]) {
 		port->closeon_pos++;
-		if (port->closeon_pos >= port->closeon_len) {
+		if (port->closeon_pos >= port->cfg->closeon_len) {
 		    port->close_on_output_done = true;
 		    /* Ignore everything after the closeon string */
-		    count = i - curend + 1;
+		    count = i + 1;
 		    break;
 		}
 	    } else {
@@ -966,10 +2252,10 @@ handle_dev_fd_read(struct devio *io)
 
     if (port->tr)
 	/* Do read tracing, ignore errors. */
-	do_trace(port, port->tr, readbuf, count, SERIAL);
+	do_trace(port, port->tr, NULL, readbuf, count, SERIAL);
     if (port->tb)
 	/* Do both tracing, ignore errors. */
-	do_trace(port, port->tb, readbuf, count, SERIAL);
+	do_trace(port, port->tb, NULL, readbuf, count, SERIAL);
 
     if (port->led_rx)
 	led_flash(port->led_rx);
@@ -977,44 +2263,21 @@ handle_dev_fd_read(struct devio *io)
     if (nr_handlers < 0) /* Nobody to handle the data. */
 	goto out_unlock;
 
-    port->dev_bytes_received += count;
-
-    if (port->enabled == PORT_TELNET) {
-	unsigned int curcount = count;
-
-	count = process_telnet_xmit(port->dev_to_net.buf + curend, oreadcount,
-				    &readbuf, &curcount);
-	assert(curcount == 0);
-    }
+    STAT_ADD(port->dev_bytes_received, count);
+    STAT_ADD(port->dev_reads, 1);
+    port_dev_add_bytes(port, count);
 
-    port->dev_to_net.cursize += count;
+    if (port->enabled == PORT_TELNET)
+	dev_to_net_add_telnet(port, readbuf, count);
+    else
+	port->dev_to_net_head += count;
 
-    if (send_now || port->dev_to_net.cursize == port->dev_to_net.maxsize ||
-		port->chardelay == 0) {
-    send_it:
+    if (port->dev_to_net_head - port->dev_to_net_sent >=
+		port->dev_to_net_chunk ||
+		dev_to_net_room(port) < dev_to_net_min_room(port) ||
+		port->close_on_output_done || port->chardelay == 0 ||
+		!delay_net_send(port))
 	start_net_send(port);
-    } else {
-	struct timeval then;
-	int delay;
-
-	sel_get_monotonic_time(&then);
-	if (port->send_timer_running) {
-	    sel_stop_timer(port->send_timer);
-	} else {
-	    port->send_time = then;
-	    add_usec_to_timeval(&port->send_time, port->chardelay_max);
-	}
-	delay = sub_timeval_us(&port->send_time, &then);
-	if (delay > port->chardelay)
-	    delay = port->chardelay;
-	else if (delay < 0) {
-	    port->send_timer_running = false;
-	    goto send_it;
-	}
-	add_usec_to_timeval(&then, delay);
-	sel_start_timer(port->send_timer, &then);
-	port->send_timer_running = true;
-    }
  out_unlock:
     UNLOCK(port->lock);
 }
@@ -1075,6 +2338,53 @@ handle_dev_fd_write(struct devio *io)
     UNLOCK(port->lock);
 }
 
+/*
+ * Send a modem state to all the RFC2217 users if it changed or if it
+ * has any delta bits set.  Must be called with the port lock held.
+ */
+static void
+send_modemstate(port_info_t *port, unsigned char modemstate)
+{
+    unsigned char data[3];
+    net_info_t *netcon;
+
+    modemstate &= port->modemstate_mask;
+    if (modemstate == port->last_modemstate && !(modemstate & 0x0f))
+	return;
+
+    data[0] = TN_OPT_COM_PORT;
+    data[1] = 107; /* Notify modemstate */
+    data[2] = modemstate;
+    port->last_modemstate = modemstate & 0xf0;
+    for_each_connection(port, netcon) {
+	if (!netcon->net || !netcon->tn_data)
+	    continue;
+	telnet_send_option(netcon->tn_data, data, 3);
+    }
+}
+
+/* The device reported a modem state change. */
+static void
+handle_dev_modem_state(struct devio *io, int modemstate)
+{
+    port_info_t *port = (port_info_t *) io->user_data;
+
+    LOCK(port->lock);
+    if (modemstate == -1) {
+	/*
+	 * The device gave up, turn notification off so it cleans up
+	 * and can be turned on again, and go back to polling.
+	 */
+	if (port->modemstate_notify)
+	    port->io.f->modem_state_notify(&port->io, 0);
+	port->modemstate_notify = false;
+	if (port->is_2217)
+	    port_start_timer(port);
+    } else if (port->is_2217 && port->dev_to_net_state != PORT_CLOSING)
+	send_modemstate(port, modemstate);
+    UNLOCK(port->lock);
+}
+
 /* Handle an exception from the serial port. */
 static void
 handle_dev_fd_except(struct devio *io)
@@ -1133,17 +2443,18 @@ handle_net_fd_read(struct genio *net, int readerr,
 	goto out_shutdown;
     }
 
-    netcon->bytes_received += buflen;
+    STAT_ADD(netcon->bytes_received, buflen);
+    STAT_ADD(netcon->reads, 1);
 
     if (port->net_monitor != NULL)
 	controller_write(port->net_monitor, (char *) buf, buflen);
 
     if (port->tw)
 	/* Do write tracing, ignore errors. */
-	do_trace(port, port->tw, buf, buflen, NET);
+	do_trace(port, port->tw, netcon, buf, buflen, NET);
     if (port->tb)
 	/* Do both tracing, ignore errors. */
-	do_trace(port, port->tb, buf, buflen, NET);
+	do_trace(port, port->tb, netcon, buf, buflen, NET);
 
     if (netcon->in_urgent) {
 	/* We are in urgent data, just read until we get a mark. */
@@ -1166,16 +2477,16 @@ handle_net_fd_read(struct genio *net, int readerr,
     if (buflen <= bufpos)
 	goto out_data_handled;
 
-    if (port->enabled == PORT_TELNET) {
+    if (netcon->tn_data) {
 	unsigned int bytesleft = buflen - bufpos;
 	unsigned char *cbuf = buf + bufpos;
 
 	port->net_to_dev.cursize = process_telnet_data(port->net_to_dev.buf,
 						       port->net_to_dev.maxsize,
 						       &cbuf, &bytesleft,
-						       &netcon->tn_data);
+						       netcon->tn_data);
 
-	if (netcon->tn_data.error) {
+	if (netcon->tn_data->error) {
 	    shutdown_one_netcon(netcon, "telnet output error");
 	    goto out_unlock;
 	}
@@ -1208,6 +2519,7 @@ handle_net_fd_read(struct genio *net, int readerr,
  retry_write:
     count = port->io.f->write(&port->io, buffer_curptr(&port->net_to_dev),
 			      port->net_to_dev.cursize);
+    STAT_ADD(port->dev_writes, 1);
     if (count == -1) {
 	if (errno == EINTR) {
 	    /* EINTR means we were interrupted, just retry. */
@@ -1218,6 +2530,7 @@ handle_net_fd_read(struct genio *net, int readerr,
 	    /* This was due to O_NONBLOCK, we need to shut off the reader
 	       and start the writer monitor.  Just ignore it, code later
 	       will enable the write handler. */
+	    STAT_ADD(port->dev_write_eagain, 1);
 	} else {
 	    /* Some other bad error. */
 	    syslog(LOG_ERR, "The dev write for port %s had error: %m",
@@ -1228,7 +2541,10 @@ handle_net_fd_read(struct genio *net, int readerr,
     } else {
 	if (port->led_tx)
 	    led_flash(port->led_tx);
-	port->dev_bytes_sent += count;
+	STAT_ADD(port->dev_bytes_sent, count);
+	port_dev_add_bytes(port, count);
+	if (count < port->net_to_dev.cursize)
+	    STAT_ADD(port->dev_write_eagain, 1);
 	port->net_to_dev.cursize -= count;
 	port->net_to_dev.pos += count;
     }
@@ -1263,94 +2579,165 @@ void io_enable_read_handler(port_info_t *port)
 }
 
 /*
- * Returns -1 on something causing the netcon to shut down, 0 if the
- * write was incomplete, and 1 if the write was completed.
- */
-static int
-send_telnet_data(port_info_t *port, net_info_t *netcon)
-{
-    telnet_data_t *td = &netcon->tn_data;
-    int reterr, buferr;
-
-    if (!netcon->sending_tn_data)
-	return 1;
-
-    reterr = buffer_write(genio_buffer_do_write, netcon->net,
-			  &td->out_telnet_cmd, &buferr);
-    /* Returns 0 on EAGAIN */
-    if (reterr == -1) {
-	if (buferr == EPIPE) {
-	    shutdown_one_netcon(netcon, "EPIPE");
-	    return -1;
-	} else {
-	    /* Some other bad error. */
-	    syslog(LOG_ERR, "The network write for port %s had error: %s",
-		   port->portname, strerror(buferr));
-	    shutdown_one_netcon(netcon, "network write error");
-	    return -1;
-	}
-    }
-
-    if (buffer_cursize(&td->out_telnet_cmd) > 0)
-	/* If we have more telnet command data to send, don't
-	   send any real data. */
-	return 0;
-
-    netcon->sending_tn_data = false;
-    return 1;
-}
-
-/*
- * Write some network data from a buffer.  Returns -1 on something
- * causing the netcon to shut down, 0 if the write was incomplete, and
- * 1 if the write was completed.
+ * Write some data to the network.  Returns -1 on something causing
+ * the netcon to shut down, 0 otherwise, with the amount written in
+ * count.
  */
 static int
-net_fd_write(port_info_t *port, net_info_t *netcon,
-	     struct sbuf *buf, unsigned int *pos)
+net_write_data(port_info_t *port, net_info_t *netcon,
+	       const struct genio_sg *sg, unsigned int sglen,
+	       unsigned int *count)
 {
-    int reterr, to_send;
-    unsigned int count = 0;
+    unsigned int i, len = 0;
+    int reterr;
 
-    to_send = buf->cursize - *pos;
-    if (to_send <= 0)
-	/* Don't send empty packets, that can confuse UDP clients. */
-	return 1;
-
-    /* Can't use buffer send operation here, multiple writers can send
-       from the buffers. */
-    reterr = genio_write(netcon->net, &count, buf->buf + *pos, to_send);
+    *count = 0;
+    reterr = genio_writev(netcon->net, count, sg, sglen);
+    STAT_ADD(netcon->writes, 1);
     if (reterr == EPIPE) {
 	shutdown_one_netcon(netcon, "EPIPE");
 	return -1;
     } else if (reterr) {
 	/* Some other bad error. */
-	syslog(LOG_ERR, "The network write for port %s had error: %m",
-	       port->portname);
+	syslog(LOG_ERR, "The network write for port %s had error: %s",
+	       port->portname, strerror(reterr));
 	shutdown_one_netcon(netcon, "network write error");
 	return -1;
     }
-    *pos += count;
 
-    if (*pos < buf->cursize)
+    for (i = 0; i < sglen; i++)
+	len += sg[i].buflen;
+    STAT_ADD(netcon->bytes_sent, *count);
+    if (*count < len)
+	STAT_ADD(netcon->write_eagain, 1);
+
+    return 0;
+}
+
+/*
+ * Add the used part of a wrapping sbuf to sg, returns the new sglen.
+ */
+static unsigned int
+sbuf_to_sg(struct sbuf *buf, struct genio_sg *sg, unsigned int sglen)
+{
+    unsigned int len = buffer_cursize(buf);
+
+    if (len == 0)
+	return sglen;
+    if (buf->pos + len > buf->maxsize)
+	len = buf->maxsize - buf->pos;
+    sg[sglen].buf = buffer_curptr(buf);
+    sg[sglen++].buflen = len;
+    if (len < buffer_cursize(buf)) {
+	sg[sglen].buf = buf->buf;
+	sg[sglen++].buflen = buffer_cursize(buf) - len;
+    }
+    return sglen;
+}
+
+/*
+ * Write everything the connection has pending with one write: the
+ * telnet commands if they are being sent, the banner, and if
+ * send_ring is set the connection's released data from the dev_to_net
+ * ring.  These go out in that order, so a later one is only written
+ * once the earlier ones are done.  Returns -1 on something causing
+ * the netcon to shut down, 0 if the write was incomplete, and 1 if
+ * the write was completed.
+ */
+static int
+net_write_pending(port_info_t *port, net_info_t *netcon, bool send_ring)
+{
+    struct sbuf *tn_cmd = NULL;
+    struct sbuf *banner = netcon->banner;
+    unsigned int size = port->dev_to_net.maxsize;
+    unsigned int tn_len = 0, banner_len = 0, ring_len = 0;
+    unsigned int sglen = 0, start, count, len;
+    struct genio_sg sg[5];
+
+    if (netcon->tn_data)
+	tn_cmd = &netcon->tn_data->out_telnet_cmd;
+    if (netcon->sending_tn_data) {
+	tn_len = buffer_cursize(tn_cmd);
+	sglen = sbuf_to_sg(tn_cmd, sg, sglen);
+    }
+    if (banner && banner->pos < banner->cursize) {
+	banner_len = banner->cursize - banner->pos;
+	sg[sglen].buf = banner->buf + banner->pos;
+	sg[sglen++].buflen = banner_len;
+    }
+    if (send_ring && netcon->write_pos != port->dev_to_net_sent) {
+	ring_len = port->dev_to_net_sent - netcon->write_pos;
+	start = netcon->write_pos % size;
+	len = ring_len;
+	if (len > size - start)
+	    len = size - start;
+	sg[sglen].buf = port->dev_to_net.buf + start;
+	sg[sglen++].buflen = len;
+	if (len < ring_len) {
+	    sg[sglen].buf = port->dev_to_net.buf;
+	    sg[sglen++].buflen = ring_len - len;
+	}
+    }
+
+    /* Don't send empty packets, that can confuse UDP clients. */
+    if (sglen > 0) {
+	if (net_write_data(port, netcon, sg, sglen, &count))
+	    return -1;
+
+	/* Hand the written count out to the pieces in order. */
+	if (tn_len) {
+	    len = count < tn_len ? count : tn_len;
+	    tn_cmd->pos = (tn_cmd->pos + len) % tn_cmd->maxsize;
+	    tn_cmd->cursize -= len;
+	    count -= len;
+	}
+	if (banner_len) {
+	    len = count < banner_len ? count : banner_len;
+	    banner->pos += len;
+	    count -= len;
+	}
+	netcon->write_pos += count;
+    }
+
+    if (netcon->sending_tn_data) {
+	if (buffer_cursize(tn_cmd) > 0)
+	    return 0;
+	netcon->sending_tn_data = false;
+    }
+    if (banner) {
+	if (banner->pos < banner->cursize)
+	    return 0;
+	free(banner->buf);
+	free(banner);
+	netcon->banner = NULL;
+    }
+    if (send_ring && netcon->write_pos != port->dev_to_net_sent)
 	return 0;
 
     return 1;
 }
 
+/*
+ * Called when a network connection has written data from the ring or
+ * gone away.  Turn the device reader back on if it was waiting for
+ * room, or if a connection has caught up past one at the tail so the
+ * lag policy can make room on the next read.  Returns true if all the
+ * released data has been written.
+ */
 static bool
 finish_dev_to_net_write(port_info_t *port)
 {
-    if (any_net_data_to_write(port))
-	return false;
+    unsigned int next_lag;
 
-    port->dev_to_net.cursize = 0;
-
-    /* We are done writing on this port, turn the reader back on. */
-    io_enable_read_handler(port);
-    port->dev_to_net_state = PORT_WAITING_INPUT;
+    if (port->dev_to_net_state == PORT_WAITING_OUTPUT_CLEAR &&
+		!port->splice_pending &&
+		(dev_to_net_room(port) >= dev_to_net_min_room(port) ||
+		 dev_to_net_lag_can_free(port, &next_lag))) {
+	io_enable_read_handler(port);
+	port->dev_to_net_state = PORT_WAITING_INPUT;
+    }
 
-    return true;
+    return !any_net_data_to_write(port);
 }
 
 /* The network fd has room to write some data.  This is only activated
@@ -1361,43 +2748,40 @@ handle_net_fd_write(struct genio *net)
 {
     net_info_t *netcon = genio_get_user_data(net);
     port_info_t *port = netcon->port;
+    bool send_ring, all_written;
     int rv;
 
     LOCK(port->lock);
- send_tn_data:
-    rv = send_telnet_data(port, netcon);
-    if (rv <= 0)
-	goto out_unlock;
+    send_ring = (port->dev_to_net_state == PORT_WAITING_INPUT ||
+		 port->dev_to_net_state == PORT_WAITING_OUTPUT_CLEAR);
 
-    if (netcon->banner) {
-	rv = net_fd_write(port, netcon, netcon->banner, &netcon->banner->pos);
+    if (send_ring && port->splice_pending && port->splice_netcon == netcon) {
+	rv = dev_to_net_splice_write(port, netcon);
 	if (rv <= 0)
 	    goto out_unlock;
-
-	free(netcon->banner->buf);
-	free(netcon->banner);
-	netcon->banner = NULL;
     }
 
-    if (port->dev_to_net_state == PORT_WAITING_OUTPUT_CLEAR) {
-	rv = net_fd_write(port, netcon,
-			  &port->dev_to_net, &netcon->write_pos);
+ send_tn_data:
+    rv = net_write_pending(port, netcon, send_ring);
+    if (rv < 0 || !send_ring)
+	goto out_unlock;
 
-	if (rv <= 0)
-	    goto out_unlock;
+    all_written = finish_dev_to_net_write(port);
+    if (rv == 0)
+	goto out_unlock;
 
-	/* Start telnet data write when the data write is done. */
-	if (buffer_cursize(&netcon->tn_data.out_telnet_cmd) > 0) {
-	    netcon->sending_tn_data = true;
-	    goto send_tn_data;
-	}
+    /* Start telnet data write when the data write is done. */
+    if (netcon->tn_data &&
+		buffer_cursize(&netcon->tn_data->out_telnet_cmd) > 0) {
+	netcon->sending_tn_data = true;
+	goto send_tn_data;
+    }
 
-	if (finish_dev_to_net_write(port)) {
-	    if (port->close_on_output_done) {
-		shutdown_one_netcon(netcon, "closeon sequence found");
-		rv = -1;
-		goto out_unlock;
-	    }
+    if (all_written) {
+	if (port->close_on_output_done) {
+	    shutdown_one_netcon(netcon, "closeon sequence found");
+	    rv = -1;
+	    goto out_unlock;
 	}
     }
 
@@ -1424,7 +2808,7 @@ handle_net_fd_urgent(struct genio *net)
 
     LOCK(port->lock);
 
-    if (port->enabled != PORT_TELNET)
+    if (port->enabled != PORT_TELNET || !netcon->tn_data)
 	goto out;
 
     /* Flush the data in the local and device queue. */
@@ -1434,9 +2818,9 @@ handle_net_fd_urgent(struct genio *net)
 
     /* Store it if we last got an IAC, and abort any current
        telnet processing. */
-    cmd_pos = netcon->tn_data.telnet_cmd_pos;
-    netcon->tn_data.telnet_cmd_pos = 0;
-    netcon->tn_data.suboption_iac = 0;
+    cmd_pos = netcon->tn_data->telnet_cmd_pos;
+    netcon->tn_data->telnet_cmd_pos = 0;
+    netcon->tn_data->suboption_iac = 0;
 
     if (cmd_pos != 1)
 	netcon->in_urgent = 1;
@@ -1468,7 +2852,7 @@ telnet_output_ready(void *cb_data)
 
     /* If we are currently sending some data, wait until it is done.
        It might have IACs in it, and we don't want to split those. */
-    if (buffer_cursize(&port->dev_to_net) != 0)
+    if (netcon->write_pos != port->dev_to_net_sent)
 	return;
 
     netcon->sending_tn_data = true;
@@ -1476,24 +2860,20 @@ telnet_output_ready(void *cb_data)
 }
 
 /* Checks to see if some other port has the same device in use.  Must
-   be called with ports_lock held. */
+   be called with ports_lock and the port lock held. */
 static int
 is_device_already_inuse(port_info_t *check_port)
 {
-    port_info_t *port = ports;
+    unsigned int inuse;
 
-    while (port != NULL) {
-	if (port != check_port) {
-	    if ((strcmp(port->io.devname, check_port->io.devname) == 0)
-		&& (port->net_to_dev_state != PORT_UNCONNECTED))
-	    {
-		return 1;
-	    }
-	}
-	port = port->next;
-    }
+    if (!check_port->dev)
+	return 0;
 
-    return 0;
+    inuse = __atomic_load_n(&check_port->dev->inuse, __ATOMIC_RELAXED);
+    if (check_port->dev_inuse)
+	inuse--;
+
+    return inuse > 0;
 }
 
 static int
@@ -1908,14 +3288,19 @@ open_trace_file(port_info_t *port,
     trfile = process_str_to_str(port, NULL, t->filename, tv, NULL, 1);
     if (!trfile) {
 	syslog(LOG_ERR, "Unable to translate trace file %s", t->filename);
-	t->fd = -1;
+	t->tf = NULL;
 	return;
     }
 
-    rv = open(trfile, O_WRONLY | O_CREAT | O_APPEND, 0600);
-    if (rv == -1) {
+    t->tf = NULL;
+    if (t->capture)
+	rv = trace_file_open_capture(trfile, port->portname,
+				     port->capture_size, &t->tf);
+    else
+	rv = trace_file_open(trfile, port->portname, &t->tf);
+    if (rv) {
 	char errbuf[128];
-	int err = errno;
+	int err = rv;
 
 	if (strerror_r(err, errbuf, sizeof(errbuf)) == -1)
 	    syslog(LOG_ERR, "Unable to open trace file %s: %d",
@@ -1926,15 +3311,28 @@ open_trace_file(port_info_t *port,
     }
 
     free(trfile);
-    t->fd = rv;
     *out = t;
 }
 
+/* The file name is the config's, the trace doesn't own it. */
+static void
+trace_from_cfg(trace_info_t *t, const struct trace_cfg *c)
+{
+    t->hexdump = c->hexdump;
+    t->timestamp = c->timestamp;
+    t->capture = c->capture;
+    t->filename = c->filename;
+}
+
 static void
 setup_trace(port_info_t *port)
 {
     struct timeval tv;
 
+    trace_from_cfg(&port->trace_read, &port->cfg->trace_read);
+    trace_from_cfg(&port->trace_write, &port->cfg->trace_write);
+    trace_from_cfg(&port->trace_both, &port->cfg->trace_both);
+
     /* Only get the time once so all trace files have consistent times. */
     gettimeofday(&tv, NULL);
 
@@ -1975,9 +3373,9 @@ recalc_port_chardelay(port_info_t *port)
     }
 
     /* We are working in microseconds here. */
-    port->chardelay = (port->bpc * 100000 * port->chardelay_scale) / port->bps;
-    if (port->chardelay < port->chardelay_min)
-	port->chardelay = port->chardelay_min;
+    port->chardelay = (port->bpc * 100000 * port->cfg->chardelay_scale) / port->bps;
+    if (port->chardelay < port->cfg->chardelay_min)
+	port->chardelay = port->cfg->chardelay_min;
 }
 
 static const struct genio_callbacks port_callbacks = {
@@ -1986,25 +3384,91 @@ static const struct genio_callbacks port_callbacks = {
     .urgent_callback = handle_net_fd_urgent
 };
 
+static void
+port_free_bufs(port_info_t *port)
+{
+    struct genio_os_funcs *o = port->o;
+
+    if (port->dev_to_net.buf)
+	o->free(o, port->dev_to_net.buf);
+    port->dev_to_net.buf = NULL;
+    if (port->telnet_dev_to_net)
+	o->free(o, port->telnet_dev_to_net);
+    port->telnet_dev_to_net = NULL;
+    if (port->net_to_dev.buf)
+	o->free(o, port->net_to_dev.buf);
+    port->net_to_dev.buf = NULL;
+}
+
+/*
+ * Allocate the data transfer buffers if the port doesn't have them.
+ * Most ports sit unused, so these are only allocated when the port
+ * is brought up and are returned to the pool when the port shuts
+ * down.
+ */
+static int
+port_alloc_bufs(port_info_t *port)
+{
+    struct genio_os_funcs *o = port->o;
+
+    if (port->dev_to_net.buf)
+	return 0;
+
+    port->dev_to_net.buf = o->alloc(o, port->dev_to_net.maxsize);
+    if (!port->dev_to_net.buf)
+	goto out_nomem;
+
+    port->telnet_dev_to_net = o->alloc(o, port->dev_to_net_chunk / 2);
+    if (!port->telnet_dev_to_net)
+	goto out_nomem;
+
+    port->net_to_dev.buf = o->alloc(o, port->net_to_dev.maxsize);
+    if (!port->net_to_dev.buf)
+	goto out_nomem;
+
+    return 0;
+
+ out_nomem:
+    port_free_bufs(port);
+    return ENOMEM;
+}
+
+static void
+netcon_free_telnet(port_info_t *port, net_info_t *netcon)
+{
+    if (netcon->tn_data) {
+	telnet_cleanup(netcon->tn_data);
+	port->o->free(port->o, netcon->tn_data);
+	netcon->tn_data = NULL;
+    }
+}
+
 static int
 port_dev_enable(port_info_t *port, net_info_t *netcon,
 		bool is_reconfig, const char **errstr)
 {
-    struct timeval then;
+    if (port_alloc_bufs(port)) {
+	*errstr = "Out of memory\r\n";
+	return -1;
+    }
 
     if (port->io.f->setup(&port->io, port->portname, errstr,
-			  &port->bps, &port->bpc) == -1)
-	    return -1;
+			  &port->bps, &port->bpc) == -1) {
+	port_free_bufs(port);
+	port_dev_open_failed(port);
+	return -1;
+    }
 
     recalc_port_chardelay(port);
     port->is_2217 = false;
+    port->modemstate_notify = false;
 
     if (!is_reconfig) {
 	if (port->devstr) {
 	    free(port->devstr->buf);
 	    free(port->devstr);
 	}
-	port->devstr = process_str_to_buf(port, netcon, port->openstr);
+	port->devstr = process_str_to_buf(port, netcon, port->cfg->openstr);
     }
     if (port->devstr)
 	port->dev_write_handler = handle_dev_fd_devstr_write;
@@ -2016,6 +3480,7 @@ port_dev_enable(port_info_t *port, net_info_t *netcon,
 			     : handle_dev_fd_read);
     port->io.write_handler = handle_dev_fd_write;
     port->io.except_handler = handle_dev_fd_except;
+    port->io.modem_state_handler = handle_dev_modem_state;
     port->io.f->except_handler_enable(&port->io, 1);
     if (port->devstr)
 	port->io.f->write_handler_enable(&port->io, 1);
@@ -2024,10 +3489,6 @@ port_dev_enable(port_info_t *port, net_info_t *netcon,
 
     setup_trace(port);
 
-    sel_get_monotonic_time(&then);
-    then.tv_sec += 1;
-    sel_start_timer(port->timer, &then);
-
     return 0;
 }
 
@@ -2035,6 +3496,7 @@ port_dev_enable(port_info_t *port, net_info_t *netcon,
 static int
 setup_port(port_info_t *port, net_info_t *netcon, bool is_reconfig)
 {
+    const char *errstr = NULL;
     int err;
 
     if (!is_reconfig) {
@@ -2042,159 +3504,531 @@ setup_port(port_info_t *port, net_info_t *netcon, bool is_reconfig)
 	    free(netcon->banner->buf);
 	    free(netcon->banner);
 	}
-	netcon->banner = process_str_to_buf(port, netcon, port->bannerstr);
+	netcon->banner = process_str_to_buf(port, netcon, port->cfg->bannerstr);
     }
 
     if (port->enabled == PORT_TELNET) {
-	err = telnet_init(&netcon->tn_data, netcon, telnet_output_ready,
+	netcon->tn_data = port->o->zalloc(port->o, sizeof(*netcon->tn_data));
+	if (!netcon->tn_data)
+	    goto out_nomem;
+	err = telnet_init(netcon->tn_data, netcon, telnet_output_ready,
 			  telnet_cmd_handler,
 			  port->allow_2217 ? telnet_cmds_2217 : telnet_cmds,
 			  telnet_init_seq,
 			  port->allow_2217 ? sizeof(telnet_init_seq)
 			      : sizeof(telnet_init_seq) - 3);
-	if (err) {
-	    char *errstr = "Out of memory\r\n";
-
-	    genio_write(netcon->net, NULL, errstr, strlen(errstr));
-	    genio_free(netcon->net);
-	    netcon->net = NULL;
-	    return -1;
-	}
+	if (err)
+	    goto out_nomem;
     }
 
+    /*
+     * The device enable normally allocates the buffers, but a
+     * connect back port may have been shut down since then.
+     */
+    if (port_alloc_bufs(port))
+	goto out_nomem;
+
     if (num_connected_net(port) == 1 && !port->has_connect_back) {
 	/* We are first, set things up on the device. */
-	const char *errstr = NULL;
-
 	err = port_dev_enable(port, netcon, is_reconfig, &errstr);
-	if (err) {
-	    if (errstr)
-		genio_write(netcon->net, NULL, errstr, strlen(errstr));
-	    genio_free(netcon->net);
-	    netcon->net = NULL;
-	    return -1;
-	}
+	if (err)
+	    goto out_err;
     }
 
     genio_set_callbacks(netcon->net, &port_callbacks, netcon);
 
-    genio_set_read_callback_enable(netcon->net, true);
-    port->net_to_dev_state = PORT_WAITING_INPUT;
+    /* Only send data that comes in after the connection. */
+    netcon->write_pos = port->dev_to_net_sent;
+
+    genio_set_read_callback_enable(netcon->net, true);
+    port_dev_set_inuse(port, true);
+    port_dev_conn_start(port, netcon);
+    port->net_to_dev_state = PORT_WAITING_INPUT;
+
+    if (port->enabled == PORT_TELNET || netcon->banner)
+	genio_set_write_callback_enable(netcon->net, true);
+
+    header_trace(port, netcon);
+
+    netcon_start_timeout(netcon);
+
+    return 0;
+
+ out_nomem:
+    errstr = "Out of memory\r\n";
+ out_err:
+    if (errstr)
+	genio_write(netcon->net, NULL, errstr, strlen(errstr));
+    netcon_free_telnet(port, netcon);
+    genio_free(netcon->net);
+    netcon->net = NULL;
+    return -1;
+}
+
+/*
+ * Returns with the port locked, if non-NULL.  Must be called with
+ * ports_lock held.
+ */
+static port_info_t *
+find_rotator_port(char *portname, struct genio *net, unsigned int *netconnum)
+{
+    port_info_t *port = port_lookup(portname);
+    unsigned int i;
+    struct sockaddr_storage addr;
+    socklen_t socklen;
+    int err;
+
+    if (!port)
+	return NULL;
+
+    LOCK(port->lock);
+    if (port->enabled == PORT_DISABLED)
+	goto out_unlock;
+    if (port->startup_state != PORT_STARTUP_DONE)
+	goto out_unlock;
+    if (port->dev_to_net_state == PORT_CLOSING)
+	goto out_unlock;
+    socklen = sizeof(addr);
+    err = genio_get_raddr(net, (struct sockaddr *) &addr, &socklen);
+    if (err)
+	goto out_unlock;
+    if (!remaddr_check(port->cfg->remaddrs, (struct sockaddr *) &addr, socklen))
+	goto out_unlock;
+    if (port->net_to_dev_state == PORT_UNCONNECTED &&
+	    is_device_already_inuse(port))
+	goto out_unlock;
+
+    for (i = 0; i < port->max_connections; i++) {
+	if (!port->netcons[i].net) {
+	    *netconnum = i;
+	    return port;
+	}
+    }
+ out_unlock:
+    UNLOCK(port->lock);
+
+    return NULL;
+}
+
+static void
+handle_new_net(port_info_t *port, struct genio *net, net_info_t *netcon)
+{
+    netcon->net = net;
+
+    /* XXX log netcon->remote */
+    setup_port(port, netcon, false);
+}
+
+#define ROTATOR_ROUND_ROBIN		0
+#define ROTATOR_LEAST_CONNECTIONS	1
+#define ROTATOR_LEAST_RECENT_BYTES	2
+#define ROTATOR_WEIGHTED		3
+
+struct enum_val rotator_strategy_enums[] = {
+    { "round-robin",		ROTATOR_ROUND_ROBIN },
+    { "least-connections",	ROTATOR_LEAST_CONNECTIONS },
+    { "least-recent-bytes",	ROTATOR_LEAST_RECENT_BYTES },
+    { "weighted",		ROTATOR_WEIGHTED },
+    { NULL }
+};
+
+/* Maximum weight for a port in a weighted rotator. */
+#define ROTATOR_MAX_WEIGHT	100
+
+/*
+ * Don't pick a port whose device failed to open this many seconds
+ * ago unless nothing else is free.
+ */
+#define ROTATOR_ERROR_HOLDOFF	10
+
+struct rotator_member
+{
+    char *portname;
+    unsigned int weight;
+
+    /*
+     * The device of the port, for the load.  This is set when the
+     * config is read and again when a port is replaced or removed
+     * later, see update_rotator_devs().  It holds a ref so it stays
+     * around if the port gets replaced.
+     */
+    struct port_dev *dev;
+
+    /*
+     * Bytes on the device in roughly the last few seconds, this is
+     * halved every second.
+     */
+    uint64_t last_bytes;
+    uint64_t recent_bytes;
+
+    bool tried;
+};
+
+typedef struct rotator
+{
+    /* The rotator lock is taken before ports_lock. */
+    DEFINE_LOCK(, lock)
+
+    int strategy;
+    struct rotator_member *members;
+    unsigned int nmembers;
+
+    /*
+     * For round-robin this is the next member to try.  For weighted
+     * it is the position in the schedule, which has each member
+     * listed weight times, spread out.
+     */
+    unsigned int curr;
+    unsigned int *schedule;
+    unsigned int schedule_len;
+
+    time_t last_sample; /* When recent_bytes was last updated. */
+
+    char *portname;
+
+    struct genio_acceptor *acceptor;
+
+    int config_num; /* The config it was last in, like ports. */
+
+    struct rotator *next;
+} rotator_t;
+
+static rotator_t *rotators = NULL;
+
+/*
+ * Protects the rotators list, only the config thread changes it but
+ * update_rotator_devs() can run from other threads.  This is taken
+ * before a rotator lock.
+ */
+DEFINE_LOCK_INIT(static, rotators_lock)
+
+static void
+free_rotator_members(struct rotator_member *members, unsigned int nmembers)
+{
+    unsigned int i;
+
+    for (i = 0; i < nmembers; i++) {
+	if (members[i].dev)
+	    port_dev_release(members[i].dev);
+	free(members[i].portname);
+    }
+    free(members);
+}
+
+/*
+ * Spread each member out in the schedule by its weight, smooth
+ * weighted round-robin, so a member with weight 3 doesn't get three
+ * connections in a row.
+ */
+static unsigned int *
+rotator_schedule(struct rotator_member *members, unsigned int nmembers,
+		 unsigned int *rlen)
+{
+    unsigned int *sched, i, j, len = 0, best;
+    int *curr;
+
+    for (i = 0; i < nmembers; i++)
+	len += members[i].weight;
+
+    sched = malloc(len * sizeof(*sched));
+    curr = calloc(nmembers, sizeof(*curr));
+    if (!sched || !curr) {
+	free(sched);
+	free(curr);
+	return NULL;
+    }
+
+    for (j = 0; j < len; j++) {
+	best = 0;
+	for (i = 0; i < nmembers; i++) {
+	    curr[i] += members[i].weight;
+	    if (curr[i] > curr[best])
+		best = i;
+	}
+	curr[best] -= len;
+	sched[j] = best;
+    }
+    free(curr);
+
+    *rlen = len;
+    return sched;
+}
+
+/*
+ * Parse the rotator's port list.  Each port may have "*<weight>" on
+ * the end, and "strategy=<name>" may be given anywhere in the list.
+ */
+static int
+rotator_parse_ports(const char *ports, int lineno, int *rstrategy,
+		    struct rotator_member **rmembers, unsigned int *rnmembers,
+		    unsigned int **rschedule, unsigned int *rschedule_len)
+{
+    struct rotator_member *members = NULL;
+    unsigned int *schedule = NULL, schedule_len = 0, nmembers = 0;
+    int strategy = ROTATOR_ROUND_ROBIN;
+    char **argv, *w, *end;
+    int argc, i, rv;
+    const char *val;
+    long weight;
+
+    rv = str_to_argv(ports, &argc, &argv, NULL);
+    if (rv)
+	return rv;
+
+    members = calloc(argc ? argc : 1, sizeof(*members));
+    if (!members) {
+	rv = ENOMEM;
+	goto out;
+    }
+
+    for (i = 0; i < argc; i++) {
+	if (cmpstrval(argv[i], "strategy=", &val)) {
+	    strategy = lookup_enum(rotator_strategy_enums, val, -1);
+	    if (strategy == -1) {
+		syslog(LOG_ERR, "Invalid rotator strategy on line %d: %s",
+		       lineno, val);
+		rv = EINVAL;
+		goto out;
+	    }
+	    continue;
+	}
+
+	weight = 1;
+	w = strrchr(argv[i], '*');
+	if (w) {
+	    weight = strtol(w + 1, &end, 10);
+	    if (w == argv[i] || *end || weight < 1
+			|| weight > ROTATOR_MAX_WEIGHT) {
+		syslog(LOG_ERR, "Invalid rotator port weight on line %d: %s",
+		       lineno, argv[i]);
+		rv = EINVAL;
+		goto out;
+	    }
+	    *w = '\0';
+	}
+	members[nmembers].portname = strdup(argv[i]);
+	if (!members[nmembers].portname) {
+	    rv = ENOMEM;
+	    goto out;
+	}
+	members[nmembers].weight = weight;
+	nmembers++;
+    }
+
+    if (nmembers == 0) {
+	syslog(LOG_ERR, "No ports given for rotator on line %d", lineno);
+	rv = EINVAL;
+	goto out;
+    }
 
-    if (port->enabled == PORT_TELNET) {
-	genio_set_write_callback_enable(netcon->net, true);
-    } else {
-	buffer_init(&netcon->tn_data.out_telnet_cmd,
-		    netcon->tn_data.out_telnet_cmdbuf, 0);
-	if (netcon->banner)
-	    genio_set_write_callback_enable(netcon->net, true);
+    if (strategy == ROTATOR_WEIGHTED) {
+	schedule = rotator_schedule(members, nmembers, &schedule_len);
+	if (!schedule) {
+	    rv = ENOMEM;
+	    goto out;
+	}
     }
 
-    header_trace(port, netcon);
+    *rstrategy = strategy;
+    *rmembers = members;
+    *rnmembers = nmembers;
+    *rschedule = schedule;
+    *rschedule_len = schedule_len;
+ out:
+    if (rv && members)
+	free_rotator_members(members, nmembers);
+    str_to_argv_free(argc, argv);
+    return rv;
+}
 
-    reset_timer(netcon);
+static bool
+rotator_member_held_off(struct rotator_member *m, time_t now)
+{
+    time_t last_error;
 
-    return 0;
+    if (!m->dev)
+	return false;
+    last_error = __atomic_load_n(&m->dev->last_error, __ATOMIC_RELAXED);
+    return last_error && now - last_error < ROTATOR_ERROR_HOLDOFF;
 }
 
-/* Returns with the port locked, if non-NULL. */
-static port_info_t *
-find_rotator_port(char *portname, struct genio *net, unsigned int *netconnum)
+/* Fold the bytes since the last sample into the decaying counts. */
+static void
+rotator_sample_bytes(rotator_t *rot, time_t now)
 {
-    port_info_t *port = ports;
+    struct rotator_member *m;
+    unsigned int i, shift;
+    uint64_t bytes;
+
+    shift = now - rot->last_sample;
+    if (shift > 63)
+	shift = 63;
+    rot->last_sample = now;
+
+    for (i = 0; i < rot->nmembers; i++) {
+	m = &rot->members[i];
+	m->recent_bytes >>= shift;
+	if (!m->dev)
+	    continue;
+	bytes = __atomic_load_n(&m->dev->bytes, __ATOMIC_RELAXED);
+	m->recent_bytes += bytes - m->last_bytes;
+	m->last_bytes = bytes;
+    }
+}
 
-    while (port) {
-	if (strcmp(port->portname, portname) == 0) {
-	    unsigned int i;
-	    struct sockaddr_storage addr;
-	    socklen_t socklen;
-	    int err;
+static uint64_t
+rotator_member_load(rotator_t *rot, struct rotator_member *m)
+{
+    if (rot->strategy == ROTATOR_LEAST_RECENT_BYTES)
+	return m->recent_bytes;
+    if (!m->dev)
+	return 0;
+    return __atomic_load_n(&m->dev->connections, __ATOMIC_RELAXED);
+}
 
-	    LOCK(port->lock);
-	    if (port->enabled == PORT_DISABLED)
-		goto next;
-	    if (port->dev_to_net_state == PORT_CLOSING)
-		goto next;
-	    socklen = sizeof(addr);
-	    err = genio_get_raddr(net, (struct sockaddr *) &addr, &socklen);
-	    if (err)
-		goto next;
-	    if (!remaddr_check(port->remaddrs,
-			       (struct sockaddr *) &addr, socklen))
-		goto next;
-	    if (port->net_to_dev_state == PORT_UNCONNECTED &&
-		is_device_already_inuse(port))
-		goto next;
-
-	    for (i = 0; i < port->max_connections; i++) {
-		if (!port->netcons[i].net) {
-		    *netconnum = i;
-		    return port;
-		}
+/*
+ * Return the next member to try, or -1 if none are left.  Must be
+ * called with the rotator lock held.  held_off says whether members
+ * whose device recently failed are allowed.
+ */
+static int
+rotator_next_member(rotator_t *rot, unsigned int *pos, bool held_off,
+		    time_t now)
+{
+    struct rotator_member *m;
+    unsigned int i, n;
+    uint64_t load, best_load = 0;
+    int best = -1;
+
+    switch (rot->strategy) {
+    case ROTATOR_LEAST_CONNECTIONS:
+    case ROTATOR_LEAST_RECENT_BYTES:
+	for (i = 0; i < rot->nmembers; i++) {
+	    m = &rot->members[i];
+	    if (m->tried)
+		continue;
+	    if (!held_off && rotator_member_held_off(m, now))
+		continue;
+	    load = rotator_member_load(rot, m);
+	    if (best == -1 || load < best_load) {
+		best = i;
+		best_load = load;
 	    }
-	next:
-	    UNLOCK(port->lock);
 	}
-	port = port->next;
+	return best;
+
+    case ROTATOR_WEIGHTED:
+	n = rot->schedule_len;
+	break;
+
+    default:
+	n = rot->nmembers;
+	break;
     }
 
-    return NULL;
+    for (; *pos < n; (*pos)++) {
+	i = (rot->curr + *pos) % n;
+	if (rot->strategy == ROTATOR_WEIGHTED)
+	    i = rot->schedule[i];
+	m = &rot->members[i];
+	if (m->tried)
+	    continue;
+	if (!held_off && rotator_member_held_off(m, now))
+	    continue;
+	(*pos)++;
+	return i;
+    }
+    return -1;
 }
 
+/*
+ * Point each member at the device of its port as it is now, so the
+ * load and the error holdoff see every member, not just the ones that
+ * have been picked.  The ports may have been added after the rotator
+ * or replaced since.  Must be called with the rotator lock held.
+ */
 static void
-handle_new_net(port_info_t *port, struct genio *net, net_info_t *netcon)
+rotator_update_devs(rotator_t *rot)
 {
-    netcon->net = net;
+    struct rotator_member *m;
+    struct port_dev *dev;
+    port_info_t *port;
+    unsigned int i;
 
-    /* XXX log netcon->remote */
-    setup_port(port, netcon, false);
+    LOCK(ports_lock);
+    for (i = 0; i < rot->nmembers; i++) {
+	m = &rot->members[i];
+	/* A port's device doesn't change while it is in the list. */
+	port = port_lookup(m->portname);
+	dev = port ? port->dev : NULL;
+	if (m->dev == dev)
+	    continue;
+	if (m->dev)
+	    port_dev_release(m->dev);
+	m->dev = dev;
+	if (dev) {
+	    port_dev_ref(dev);
+	    m->last_bytes = __atomic_load_n(&dev->bytes, __ATOMIC_RELAXED);
+	}
+	m->recent_bytes = 0;
+    }
+    UNLOCK(ports_lock);
 }
 
-typedef struct rotator
-{
-    /* Rotators use the ports_lock for mutex. */
-    int curr_port;
-    char **portv;
-    int portc;
-
-    char *portname;
-
-    struct genio_acceptor *acceptor;
-
-    struct rotator *next;
-} rotator_t;
-
-static rotator_t *rotators = NULL;
-
 /* A connection request has come in on a port. */
 static void
 handle_rot_accept(struct genio_acceptor *acceptor, struct genio *net)
 {
     rotator_t *rot = genio_acc_get_user_data(acceptor);
-    int i;
+    struct rotator_member *m = NULL;
+    struct timeval now;
+    unsigned int i, pos, netconnum;
+    port_info_t *port = NULL;
+    int pass, curr;
     const char *err;
 
-    LOCK(ports_lock);
-    i = rot->curr_port;
-    do {
-	unsigned int netconnum;
-	port_info_t *port = find_rotator_port(rot->portv[i], net, &netconnum);
-
-	if (++i >= rot->portc)
-	    i = 0;
-	if (port) {
-	    rot->curr_port = i;
+    sel_get_monotonic_time(&now);
+
+    LOCK(rot->lock);
+    if (rot->strategy == ROTATOR_LEAST_RECENT_BYTES)
+	rotator_sample_bytes(rot, now.tv_sec);
+    for (i = 0; i < rot->nmembers; i++)
+	rot->members[i].tried = false;
+
+    /*
+     * Try the ports that are not held off first, then the ones whose
+     * device recently failed to open in case it works now.
+     */
+    for (pass = 0; !port && pass < 2; pass++) {
+	pos = 0;
+	while ((curr = rotator_next_member(rot, &pos, pass, now.tv_sec)) >= 0) {
+	    m = &rot->members[curr];
+	    m->tried = true;
+	    LOCK(ports_lock);
+	    port = find_rotator_port(m->portname, net, &netconnum);
 	    UNLOCK(ports_lock);
-	    handle_new_net(port, net, &port->netcons[netconnum]);
-	    UNLOCK(port->lock);
-	    return;
+	    if (port)
+		break;
 	}
-    } while (i != rot->curr_port);
-    UNLOCK(ports_lock);
+    }
+    if (!port) {
+	UNLOCK(rot->lock);
+	err = "No free port found\r\n";
+	genio_write(net, NULL, err, strlen(err));
+	genio_free(net);
+	return;
+    }
+
+    /* Start after the one picked next time. */
+    if (rot->strategy == ROTATOR_WEIGHTED) {
+	rot->curr = (rot->curr + pos) % rot->schedule_len;
+    } else if (rot->strategy == ROTATOR_ROUND_ROBIN) {
+	rot->curr = (rot->curr + pos) % rot->nmembers;
+    }
+    UNLOCK(rot->lock);
 
-    err = "No free port found\r\n";
-    genio_write(net, NULL, err, strlen(err));
-    genio_free(net);
+    handle_new_net(port, net, &port->netcons[netconnum]);
+    UNLOCK(port->lock);
 }
 
 static waiter_t *rotator_shutdown_wait;
@@ -2205,33 +4039,80 @@ handle_rot_shutdown_done(struct genio_acceptor *acceptor, void *cb_data)
     wake_waiter(rotator_shutdown_wait);
 }
 
+/* The acceptor must not be running. */
 static void
 free_rotator(rotator_t *rot)
 {
-    if (rot->acceptor) {
-	genio_acc_shutdown(rot->acceptor, handle_rot_shutdown_done, NULL);
-	wait_for_waiter(rotator_shutdown_wait, 1);
+    if (rot->acceptor)
 	genio_acc_free(rot->acceptor);
-    }
     if (rot->portname)
 	free(rot->portname);
-    if (rot->portv)
-	str_to_argv_free(rot->portc, rot->portv);
+    if (rot->members)
+	free_rotator_members(rot->members, rot->nmembers);
+    if (rot->schedule)
+	free(rot->schedule);
+    FREE_LOCK(rot->lock);
     free(rot);
 }
 
+/*
+ * Free the rotators that are not in the given config, or all of them
+ * if it is -1.  They are all shut down together and then waited for.
+ */
+static void
+free_old_rotators(int curr_config)
+{
+    rotator_t *rot, **prot = &rotators, *old = NULL;
+    unsigned int shutdown_count = 0;
+
+    LOCK(rotators_lock);
+    while ((rot = *prot)) {
+	if (curr_config != -1 && rot->config_num == curr_config) {
+	    prot = &rot->next;
+	    continue;
+	}
+	*prot = rot->next;
+	if (genio_acc_shutdown(rot->acceptor, handle_rot_shutdown_done,
+			       NULL) == 0)
+	    shutdown_count++;
+	rot->next = old;
+	old = rot;
+    }
+    UNLOCK(rotators_lock);
+
+    wait_for_waiter(rotator_shutdown_wait, shutdown_count);
+
+    while (old) {
+	rot = old;
+	old = rot->next;
+	free_rotator(rot);
+    }
+}
+
 void
 free_rotators(void)
 {
-    rotator_t *rot, *next;
+    free_old_rotators(-1);
+}
 
-    rot = rotators;
-    while (rot) {
-	next = rot->next;
-	free_rotator(rot);
-	rot = next;
+/*
+ * Find the member devices again after the set of ports has changed,
+ * once all the ports in a config are in or when a port whose config
+ * changed or was removed is replaced or freed after its last
+ * connection closes.  Must be called without ports_lock held.
+ */
+static void
+update_rotator_devs(void)
+{
+    rotator_t *rot;
+
+    LOCK(rotators_lock);
+    for (rot = rotators; rot; rot = rot->next) {
+	LOCK(rot->lock);
+	rotator_update_devs(rot);
+	UNLOCK(rot->lock);
     }
-    rotators = NULL;
+    UNLOCK(rotators_lock);
 }
 
 static const struct genio_acceptor_callbacks rotator_cbs = {
@@ -2239,15 +4120,66 @@ static const struct genio_acceptor_callbacks rotator_cbs = {
 };
 
 int
-add_rotator(char *portname, char *ports, int lineno)
+add_rotator(char *portname, char *ports, int lineno, int config_num)
 {
     rotator_t *rot;
-    int rv;
+    struct rotator_member *members, *old_members;
+    unsigned int nmembers, old_nmembers, *schedule, *old_schedule;
+    unsigned int schedule_len;
+    int strategy, rv;
+
+    for (rot = rotators; rot; rot = rot->next) {
+	if (strcmp(rot->portname, portname) == 0)
+	    break;
+    }
+    if (rot && rot->config_num == config_num) {
+	syslog(LOG_ERR, "Rotator %s on line %d was already given",
+	       portname, lineno);
+	return EEXIST;
+    }
+
+    rv = rotator_parse_ports(ports ? ports : "", lineno, &strategy,
+			     &members, &nmembers, &schedule, &schedule_len);
+    if (rv)
+	return rv;
+
+    if (rot) {
+	/*
+	 * The rotator is already there from the last config, keep its
+	 * acceptor running and just switch to the new ports.
+	 */
+	LOCK(rot->lock);
+	old_members = rot->members;
+	old_nmembers = rot->nmembers;
+	old_schedule = rot->schedule;
+	rot->strategy = strategy;
+	rot->members = members;
+	rot->nmembers = nmembers;
+	rot->schedule = schedule;
+	rot->schedule_len = schedule_len;
+	rot->curr = 0;
+	UNLOCK(rot->lock);
+	free_rotator_members(old_members, old_nmembers);
+	if (old_schedule)
+	    free(old_schedule);
+	rot->config_num = config_num;
+	return 0;
+    }
 
     rot = malloc(sizeof(*rot));
-    if (!rot)
+    if (!rot) {
+	free_rotator_members(members, nmembers);
+	if (schedule)
+	    free(schedule);
 	return ENOMEM;
+    }
     memset(rot, 0, sizeof(*rot));
+    INIT_LOCK(rot->lock);
+    rot->strategy = strategy;
+    rot->members = members;
+    rot->nmembers = nmembers;
+    rot->schedule = schedule;
+    rot->schedule_len = schedule_len;
 
     rot->portname = strdup(portname);
     if (!rot->portname) {
@@ -2255,10 +4187,6 @@ add_rotator(char *portname, char *ports, int lineno)
 	return ENOMEM;
     }
 
-    rv = str_to_argv(ports, &rot->portc, &rot->portv, NULL);
-    if (rv)
-	goto out;
-
     rv = str_to_genio_acceptor(rot->portname, ser2net_o, 64,
 			       &rotator_cbs, rot, &rot->acceptor);
     if (rv) {
@@ -2266,9 +4194,6 @@ add_rotator(char *portname, char *ports, int lineno)
 	goto out;
     }
 
-    rot->next = rotators;
-    rotators = rot;
-
     rv = genio_acc_startup(rot->acceptor);
     if (rv) {
 	syslog(LOG_ERR, "Failed to start rotator on line %d: %s", lineno,
@@ -2276,6 +4201,12 @@ add_rotator(char *portname, char *ports, int lineno)
 	goto out;
     }
 
+    rot->config_num = config_num;
+    LOCK(rotators_lock);
+    rot->next = rotators;
+    rotators = rot;
+    UNLOCK(rotators_lock);
+
  out:
     if (rv)
 	free_rotator(rot);
@@ -2345,7 +4276,7 @@ handle_port_accept(struct genio_acceptor *acceptor, struct genio *net)
 
     socklen = sizeof(addr);
     if (!genio_get_raddr(net, (struct sockaddr *) &addr, &socklen)) {
-	if (!remaddr_check(port->remaddrs,
+	if (!remaddr_check(port->cfg->remaddrs,
 			   (struct sockaddr *) &addr, socklen)) {
 	    err = "Accessed denied due to your net address\r\n";
 	    goto out_err;
@@ -2434,7 +4365,7 @@ startup_port(struct absout *eout, port_info_t *port, bool is_reconfig)
 	return err;
     }
 
-    for (r = port->remaddrs; r; r = r->next)
+    for (r = port->cfg->remaddrs; r; r = r->next)
 	process_remaddr(eout, port, r, is_reconfig);
 
     if (port->has_connect_back) {
@@ -2472,8 +4403,10 @@ handle_port_shutdown_done(struct genio_acceptor *acceptor, void *cb_data)
     port_info_t *port = genio_acc_get_user_data(acceptor);
 
     LOCK(port->lock);
-    while (port->wait_acceptor_shutdown--)
+    while (port->wait_acceptor_shutdown > 0) {
+	port->wait_acceptor_shutdown--;
 	wake_waiter(acceptor_shutdown_wait);
+    }
 
     if (port->acceptor_reinit_on_shutdown) {
 	port->acceptor_reinit_on_shutdown = false;
@@ -2523,7 +4456,6 @@ static void
 free_port(port_info_t *port)
 {
     net_info_t *netcon;
-    struct port_remaddr *r;
 
     if (port->netcons) {
 	for_each_connection(port, netcon) {
@@ -2534,71 +4466,57 @@ free_port(port_info_t *port)
 	    }
 	    if (netcon->runshutdown)
 		sel_free_runner(netcon->runshutdown);
+	    if (netcon->timeout_timer)
+		sel_free_wheel_timer(netcon->timeout_timer);
+	    netcon_free_telnet(port, netcon);
+	    port_dev_conn_end(netcon);
 	}
     }
 
     FREE_LOCK(port->lock);
-    while (port->remaddrs) {
-	r = port->remaddrs;
-	port->remaddrs = r->next;
-	freeaddrinfo(r->ai);
-	free(r);
-    }
+    port_cfg_put(port->cfg);
     if (port->acceptor)
 	genio_acc_free(port->acceptor);
-    if (port->dev_to_net.buf)
-	free(port->dev_to_net.buf);
-    if (port->telnet_dev_to_net)
-	free(port->telnet_dev_to_net);
-    if (port->net_to_dev.buf)
-	free(port->net_to_dev.buf);
+    if (port->o)
+	port_free_bufs(port);
     if (port->timer)
-	sel_free_timer(port->timer);
+	sel_free_wheel_timer(port->timer);
     if (port->send_timer)
 	sel_free_timer(port->send_timer);
     if (port->runshutdown)
 	sel_free_runner(port->runshutdown);
     if (port->io.f)
 	port->io.f->free(&port->io);
-    if (port->trace_read.filename)
-	free(port->trace_read.filename);
-    if (port->trace_write.filename)
-	free(port->trace_write.filename);
-    if (port->trace_both.filename)
-	free(port->trace_both.filename);
+    port_dev_set_inuse(port, false);
+    port_dev_put(port);
     if (port->io.devname)
 	free(port->io.devname);
     if (port->portname)
 	free(port->portname);
     if (port->new_config)
 	free_port(port->new_config);
-    if (port->bannerstr)
-	free(port->bannerstr);
-    if (port->signaturestr)
-	free(port->signaturestr);
-    if (port->openstr)
-	free(port->openstr);
-    if (port->closestr)
-	free(port->closestr);
-    if (port->closeon)
-	free(port->closeon);
     if (port->netcons)
 	free(port->netcons);
     if (port->orig_devname)
 	free(port->orig_devname);
+    if (port->config_refs)
+	free(port->config_refs);
     free(port);
 }
 
 /*
- * Returns true if this requested a net shutdown, false if not.
+ * Returns true if this requested a net shutdown, false if not.  If
+ * queue_startup is not NULL and the new port has to be started, it is
+ * set up to be started and *queue_startup is set, the caller must
+ * pass it to queue_port_startup() once the port lock is released.
  */
 static bool
 switchout_port(struct absout *eout, port_info_t *new_port,
-	       port_info_t *curr, port_info_t *prev)
+	       port_info_t *curr, bool *queue_startup)
 {
     int new_state = new_port->enabled;
     struct genio_acceptor *tmp_acceptor;
-    int i;
+    int i, err;
 
     new_port->enabled = curr->enabled;
 
@@ -2609,23 +4527,42 @@ switchout_port(struct absout *eout, port_info_t *new_port,
     genio_acc_set_user_data(curr->acceptor, curr);
     genio_acc_set_user_data(new_port->acceptor, new_port);
 
+    /* A shutdown in progress is on the acceptor, so it goes with it. */
+    new_port->wait_acceptor_shutdown = curr->wait_acceptor_shutdown;
+    curr->wait_acceptor_shutdown = 0;
+    new_port->acceptor_reinit_on_shutdown = curr->acceptor_reinit_on_shutdown;
+    curr->acceptor_reinit_on_shutdown = false;
+
+    /* Pick up any changes to things like SSL certificates. */
+    err = genio_acc_reload(new_port->acceptor);
+    if (err && err != ENOTSUP && eout)
+	eout->out(eout, "Unable to reload network port %s: %s",
+		  new_port->portname, strerror(err));
+
     for (i = 0; i < new_port->max_connections; i++) {
 	if (i >= curr->max_connections)
 	    break;
 	if (!curr->netcons[i].net)
 	    continue;
 	new_port->netcons[i].net = curr->netcons[i].net;
+	new_port->netcons[i].conn_dev = curr->netcons[i].conn_dev;
+	curr->netcons[i].conn_dev = NULL;
     }
 
-    if (prev == NULL) {
-	ports = new_port;
-    } else {
-	prev->next = new_port;
-    }
-    new_port->next = curr->next;
+    port_list_replace(curr, new_port);
     UNLOCK(curr->lock);
     free_port(curr);
 
+    if (queue_startup && new_port->enabled == PORT_DISABLED &&
+		new_state != PORT_DISABLED) {
+	/* Like change_port_state(), port_startup() undoes it on failure. */
+	new_port->io.read_disabled = new_state == PORT_RAWLP;
+	new_port->enabled = new_state;
+	new_port->startup_reconfig = true;
+	*queue_startup = true;
+	return false;
+    }
+
     return change_port_state(eout, new_port, new_state, true);
 }
 
@@ -2643,6 +4580,7 @@ finish_shutdown_port(port_info_t *port)
     LOCK(port->lock);
     UNLOCK(port->lock);
 
+    port_dev_set_inuse(port, false);
     port->net_to_dev_state = PORT_UNCONNECTED;
     buffer_reset(&port->net_to_dev);
     if (port->devstr) {
@@ -2650,9 +4588,17 @@ finish_shutdown_port(port_info_t *port)
 	free(port->devstr);
 	port->devstr = NULL;
     }
-    buffer_reset(&port->dev_to_net);
-    port->dev_bytes_received = 0;
-    port->dev_bytes_sent = 0;
+    port->dev_to_net_head = DEV_TO_NET_START;
+    port->dev_to_net_sent = DEV_TO_NET_START;
+    port_free_bufs(port);
+    dev_to_net_splice_drop(port);
+    port->splice_failed = false;
+    STAT_SET(port->dev_bytes_received, 0);
+    STAT_SET(port->dev_bytes_sent, 0);
+    STAT_SET(port->dev_reads, 0);
+    STAT_SET(port->dev_writes, 0);
+    STAT_SET(port->dev_write_eagain, 0);
+    STAT_SET(port->dev_overruns, 0);
 
     if (genio_acc_exit_on_close(port->acceptor))
 	/* This was a zero port (for stdin/stdout), this is only
@@ -2664,23 +4610,11 @@ finish_shutdown_port(port_info_t *port)
        the new config so the port will be deleted properly and not
        reconfigured on a reconfig. */
     if (port->config_num == -1) {
-	port_info_t *curr, *prev;
-
-	prev = NULL;
 	LOCK(ports_lock);
-	curr = ports;
-	while ((curr != NULL) && (curr != port)) {
-	    prev = curr;
-	    curr = curr->next;
-	}
-	if (curr != NULL) {
-	    if (prev == NULL)
-		ports = curr->next;
-	    else
-		prev->next = curr->next;
-	}
+	port_list_remove(port);
 	UNLOCK(ports_lock);
 	free_port(port);
+	update_rotator_devs();
 	return; /* We have to return here because we no longer have a port. */
     }
 
@@ -2689,43 +4623,37 @@ finish_shutdown_port(port_info_t *port)
      * the user has closed the connection.
      */
     if (port->new_config != NULL) {
-	port_info_t *curr, *prev;
+	port_info_t *curr = port;
 
-	prev = NULL;
 	LOCK(ports_lock);
-	curr = ports;
-	while ((curr != NULL) && (curr != port)) {
-	    prev = curr;
-	    curr = curr->next;
-	}
-	if (curr != NULL) {
-	    port = curr->new_config;
-	    curr->new_config = NULL;
-	    LOCK(curr->lock);
-	    LOCK(port->lock);
-	    /* Releases curr->lock */
-	    if (switchout_port(NULL, port, curr, prev)) {
-		/*
-		 * This is an unusual case.  We have switched out the
-		 * port and it requested a shutdown, but we really
-		 * can't wait here in this thread for the shutdown to
-		 * complete.  So we mark that we are waiting and do
-		 * the startup later in the callback.
-		 */
-		port->acceptor_reinit_on_shutdown = true;
-		reinit_now = false;
-		UNLOCK(port->lock);
-	    } else {
-		UNLOCK(ports_lock);
-		goto reinit_port;
-	    }
+	port = curr->new_config;
+	curr->new_config = NULL;
+	LOCK(curr->lock);
+	LOCK(port->lock);
+	/* Releases curr->lock */
+	if (switchout_port(NULL, port, curr, NULL)) {
+	    /*
+	     * This is an unusual case.  We have switched out the
+	     * port and it requested a shutdown, but we really
+	     * can't wait here in this thread for the shutdown to
+	     * complete.  So we mark that we are waiting and do
+	     * the startup later in the callback.
+	     */
+	    port->acceptor_reinit_on_shutdown = true;
+	    reinit_now = false;
+	    UNLOCK(port->lock);
+	    UNLOCK(ports_lock);
+	} else {
+	    UNLOCK(ports_lock);
+	    port_reinit_now(port);
+	    UNLOCK(port->lock);
+	    reinit_now = false;
 	}
-	UNLOCK(ports_lock);
+	update_rotator_devs();
     }
 
     if (reinit_now) {
 	LOCK(port->lock);
-    reinit_port:
 	port_reinit_now(port);
 	UNLOCK(port->lock);
     }
@@ -2756,7 +4684,8 @@ shutdown_port_io(port_info_t *port)
 }
 
 static void
-timer_shutdown_done(struct selector_s *sel, sel_timer_t *timer, void *cb_data)
+timer_shutdown_done(struct selector_s *sel, sel_wheel_timer_t *timer,
+		    void *cb_data)
 {
     shutdown_port_io(cb_data);
 }
@@ -2788,7 +4717,8 @@ handle_dev_fd_close_write(port_info_t *port)
 closeit:
     if (port->shutdown_timeout_count) {
 	port->shutdown_timeout_count = 0;
-	if (sel_stop_timer_with_done(port->timer, timer_shutdown_done, port))
+	if (sel_stop_wheel_timer_with_done(port->timer, timer_shutdown_done,
+					   port))
 	    shutdown_port_io(port);
     }
 }
@@ -2800,7 +4730,7 @@ start_shutdown_port_io(port_info_t *port)
 	free(port->devstr->buf);
 	free(port->devstr);
     }
-    port->devstr = process_str_to_buf(port, NULL, port->closestr);
+    port->devstr = process_str_to_buf(port, NULL, port->cfg->closestr);
     if (port->net_to_dev_state != PORT_UNCONNECTED) {
 	port->io.f->read_handler_enable(&port->io, 0);
 	port->io.f->except_handler_enable(&port->io, 0);
@@ -2825,23 +4755,24 @@ start_shutdown_port(port_info_t *port, char *reason)
 
     footer_trace(port, "port", reason);
 
-    if (port->trace_write.fd != -1) {
-	close(port->trace_write.fd);
-	port->trace_write.fd = -1;
+    if (port->trace_write.tf) {
+	trace_file_close(port->trace_write.tf);
+	port->trace_write.tf = NULL;
     }
-    if (port->trace_read.fd != -1) {
-	close(port->trace_read.fd);
-	port->trace_read.fd = -1;
+    if (port->trace_read.tf) {
+	trace_file_close(port->trace_read.tf);
+	port->trace_read.tf = NULL;
     }
-    if (port->trace_both.fd != -1) {
-	close(port->trace_both.fd);
-	port->trace_both.fd = -1;
+    if (port->trace_both.tf) {
+	trace_file_close(port->trace_both.tf);
+	port->trace_both.tf = NULL;
     }
     port->tw = port->tr = port->tb = NULL;
 
     /* FIXME - this should be calculated somehow, not a raw number .*/
     port->shutdown_timeout_count = 4;
     port->dev_to_net_state = PORT_CLOSING;
+    port_start_timer(port);
 }
 
 static void
@@ -2851,8 +4782,12 @@ netcon_finish_shutdown(net_info_t *netcon)
 
     LOCK(port->lock);
     netcon->closing = false;
-    netcon->bytes_received = 0;
-    netcon->bytes_sent = 0;
+    STAT_SET(netcon->bytes_received, 0);
+    STAT_SET(netcon->bytes_sent, 0);
+    STAT_SET(netcon->reads, 0);
+    STAT_SET(netcon->writes, 0);
+    STAT_SET(netcon->write_eagain, 0);
+    STAT_SET(netcon->dropped, 0);
     netcon->sending_tn_data = false;
     netcon->write_pos = 0;
     if (netcon->banner) {
@@ -2860,7 +4795,7 @@ netcon_finish_shutdown(net_info_t *netcon)
 	free(netcon->banner);
 	netcon->banner = NULL;
     }
-    telnet_cleanup(&netcon->tn_data);
+    netcon_free_telnet(port, netcon);
 
     if (num_connected_net(port) == 0) {
 	if (!port->has_connect_back) {
@@ -2881,8 +4816,11 @@ handle_net_fd_closed(struct genio *net, void *cb_data)
 
     genio_free(netcon->net);
     netcon->net = NULL;
+    port_dev_conn_end(netcon);
 
     LOCK(port->lock);
+    if (port->splice_netcon == netcon)
+	dev_to_net_splice_drop(port);
     if (port->dev_to_net_state == PORT_WAITING_OUTPUT_CLEAR)
 	finish_dev_to_net_write(port);
     UNLOCK(port->lock);
@@ -2912,6 +4850,7 @@ shutdown_one_netcon(net_info_t *netcon, char *reason)
     footer_trace(netcon->port, "netcon", reason);
 
     netcon->closing = true;
+    sel_stop_wheel_timer(netcon->timeout_timer);
     /* shutdown_netcon_clear() may clain the port lock, run it elsewhere. */
     sel_run(netcon->runshutdown, shutdown_netcon_clear, netcon);
 }
@@ -2935,15 +4874,18 @@ shutdown_port(port_info_t *port, char *reason)
 	start_shutdown_port_io(port);
 }
 
+/*
+ * Port housekeeping, run once a second while port_needs_timer() says
+ * there is something to do.  Connection idle timeouts are handled
+ * separately by netcon_timeout().
+ */
 void
 got_timeout(struct selector_s *sel,
-	    sel_timer_t *timer,
+	    sel_wheel_timer_t *timer,
 	    void        *data)
 {
     port_info_t *port = (port_info_t *) data;
-    struct timeval then;
     unsigned char modemstate;
-    net_info_t *netcon;
 
     LOCK(port->lock);
 
@@ -2969,37 +4911,13 @@ got_timeout(struct selector_s *sel,
 	goto out;
     }
 
-    if (port->timeout && port->net_to_dev_state != PORT_UNCONNECTED) {
-	for_each_connection(port, netcon) {
-	    if (!netcon->net)
-		continue;
-	    netcon->timeout_left--;
-	    if (netcon->timeout_left < 0)
-		shutdown_one_netcon(netcon, "timeout");
-	}
-    }
-
-    if (port->is_2217 &&
-		(port->io.f->get_modem_state(&port->io, &modemstate) != -1)) {
-	modemstate &= port->modemstate_mask;
-	if (modemstate != port->last_modemstate) {
-	    unsigned char data[3];
-	    data[0] = TN_OPT_COM_PORT;
-	    data[1] = 107; /* Notify modemstate */
-	    data[2] = modemstate;
-	    port->last_modemstate = modemstate;
-	    for_each_connection(port, netcon) {
-		if (!netcon->net)
-		    continue;
-		telnet_send_option(&netcon->tn_data, data, 3);
-	    }
-	}
-    }
+    if (port->is_2217 && !port->modemstate_notify &&
+		(port->io.f->get_modem_state(&port->io, &modemstate) != -1))
+	send_modemstate(port, modemstate);
 
  out:
-    sel_get_monotonic_time(&then);
-    then.tv_sec += 1;
-    sel_start_timer(port->timer, &then);
+    if (port_needs_timer(port))
+	sel_start_wheel_timer(port->timer, 1000);
     UNLOCK(port->lock);
 }
 
@@ -3037,7 +4955,7 @@ port_add_remaddr(struct absout *eout, port_info_t *port, const char *istr)
     remstr = strtok_r(str, ";", &strtok_data);
     /* Note that we ignore an empty remaddr. */
     while (remstr && *remstr) {
-	err = remaddr_append(&port->remaddrs, remstr);
+	err = remaddr_append(&port->cfg->remaddrs, remstr);
 	if (err) {
 	    eout->out(eout, "Error adding remote address '%s': %s\n", remstr,
 		      strerror(err));
@@ -3053,12 +4971,20 @@ static int
 myconfig(void *data, struct absout *eout, const char *pos)
 {
     port_info_t *port = data;
+    struct port_cfg *cfg;
     enum str_type stype;
     char *s;
     const char *val;
     unsigned int len;
     int rv, ival;
 
+    /* From the control port the config may be shared, copy it. */
+    cfg = port_cfg_writable(port);
+    if (!cfg) {
+	eout->out(eout, "Out of memory");
+	return -1;
+    }
+
     if (strcmp(pos, "remctl") == 0) {
 	port->allow_2217 = true;
     } else if (strcmp(pos, "-remctl") == 0) {
@@ -3069,41 +4995,75 @@ myconfig(void *data, struct absout *eout, const char *pos)
         port->kickolduser_mode = 0;
     } else if (strcmp(pos, "hexdump") == 0 ||
 	       strcmp(pos, "-hexdump") == 0) {
-	port->trace_read.hexdump = (*pos != '-');
-	port->trace_write.hexdump = (*pos != '-');
-	port->trace_both.hexdump = (*pos != '-');
+	cfg->trace_read.hexdump = (*pos != '-');
+	cfg->trace_write.hexdump = (*pos != '-');
+	cfg->trace_both.hexdump = (*pos != '-');
     } else if (strcmp(pos, "timestamp") == 0 ||
 	       strcmp(pos, "-timestamp") == 0) {
-	port->trace_read.timestamp = (*pos != '-');
-	port->trace_write.timestamp = (*pos != '-');
-	port->trace_both.timestamp = (*pos != '-');
+	cfg->trace_read.timestamp = (*pos != '-');
+	cfg->trace_write.timestamp = (*pos != '-');
+	cfg->trace_both.timestamp = (*pos != '-');
+    } else if (strcmp(pos, "capture") == 0 ||
+	       strcmp(pos, "-capture") == 0) {
+	cfg->trace_read.capture = (*pos != '-');
+	cfg->trace_write.capture = (*pos != '-');
+	cfg->trace_both.capture = (*pos != '-');
     } else if (strcmp(pos, "tr-hexdump") == 0 ||
 	       strcmp(pos, "-tr-hexdump") == 0) {
-	port->trace_read.hexdump = (*pos != '-');
+	cfg->trace_read.hexdump = (*pos != '-');
     } else if (strcmp(pos, "tr-timestamp") == 0 ||
 	       strcmp(pos, "-tr-timestamp") == 0) {
-	port->trace_read.timestamp = (*pos != '-');
+	cfg->trace_read.timestamp = (*pos != '-');
+    } else if (strcmp(pos, "tr-capture") == 0 ||
+	       strcmp(pos, "-tr-capture") == 0) {
+	cfg->trace_read.capture = (*pos != '-');
     } else if (strcmp(pos, "tw-hexdump") == 0 ||
 	       strcmp(pos, "-tw-hexdump") == 0) {
-	port->trace_write.hexdump = (*pos != '-');
+	cfg->trace_write.hexdump = (*pos != '-');
     } else if (strcmp(pos, "tw-timestamp") == 0 ||
 	       strcmp(pos, "-tw-timestamp") == 0) {
-	port->trace_write.timestamp = (*pos != '-');
+	cfg->trace_write.timestamp = (*pos != '-');
+    } else if (strcmp(pos, "tw-capture") == 0 ||
+	       strcmp(pos, "-tw-capture") == 0) {
+	cfg->trace_write.capture = (*pos != '-');
     } else if (strcmp(pos, "tb-hexdump") == 0 ||
 	       strcmp(pos, "-tb-hexdump") == 0) {
-	port->trace_both.hexdump = (*pos != '-');
+	cfg->trace_both.hexdump = (*pos != '-');
     } else if (strcmp(pos, "tb-timestamp") == 0 ||
 	       strcmp(pos, "-tb-timestamp") == 0) {
-	port->trace_both.timestamp = (*pos != '-');
+	cfg->trace_both.timestamp = (*pos != '-');
+    } else if (strcmp(pos, "tb-capture") == 0 ||
+	       strcmp(pos, "-tb-capture") == 0) {
+	cfg->trace_both.capture = (*pos != '-');
+    } else if ((rv = cmpstrint(pos, "capture-size=", &ival, eout))) {
+	if (rv == -1)
+	    return -1;
+	port->capture_size = ival;
+    } else if ((rv = cmpstrint(pos, "shard=", &ival, eout))) {
+	if (rv == -1)
+	    return -1;
+	if (port->sel) {
+	    eout->out(eout, "The shard cannot be changed on a running port");
+	    return -1;
+	}
+	if (ival < 0 || ival >= ser2net_num_shards) {
+	    eout->out(eout, "Shard %d is out of range, there are %d shards",
+		      ival, ser2net_num_shards);
+	    return -1;
+	}
+	port->shard = ival;
     } else if (cmpstrval(pos, "tr=", &val)) {
 	/* trace read, data from the port to the socket */
-	port->trace_read.filename = find_tracefile(val);
+	free(cfg->trace_read.filename);
+	cfg->trace_read.filename = find_tracefile(val);
     } else if (cmpstrval(pos, "tw=", &val)) {
 	/* trace write, data from the socket to the port */
-	port->trace_write.filename = find_tracefile(val);
+	free(cfg->trace_write.filename);
+	cfg->trace_write.filename = find_tracefile(val);
     } else if (cmpstrval(pos, "tb=", &val)) {
 	/* trace both directions. */
-	port->trace_both.filename = find_tracefile(val);
+	free(cfg->trace_both.filename);
+	cfg->trace_both.filename = find_tracefile(val);
     } else if (cmpstrval(pos, "led-rx=", &val)) {
 	/* LED for UART RX traffic */
 	port->led_rx = find_led(val);
@@ -3121,15 +5081,15 @@ myconfig(void *data, struct absout *eout, const char *pos)
     } else if ((rv = cmpstrint(pos, "chardelay-scale=", &ival, eout))) {
 	if (rv == -1)
 	    return -1;
-	port->chardelay_scale = ival;
+	cfg->chardelay_scale = ival;
     } else if ((rv = cmpstrint(pos, "chardelay-min=", &ival, eout))) {
 	if (rv == -1)
 	    return -1;
-	port->chardelay_min = ival;
+	cfg->chardelay_min = ival;
     } else if ((rv = cmpstrint(pos, "chardelay-max=", &ival, eout))) {
 	if (rv == -1)
 	    return -1;
-	port->chardelay_max = ival;
+	cfg->chardelay_max = ival;
     } else if ((rv = cmpstrint(pos, "dev-to-net-bufsize=", &ival, eout))) {
 	if (rv == -1)
 	    return -1;
@@ -3156,12 +5116,29 @@ myconfig(void *data, struct absout *eout, const char *pos)
 	if (ival < 2)
 	    ival = 2;
 	port->net_to_dev.maxsize = ival;
+    } else if ((rv = cmpstrint(pos, "dev-to-net-buffers=", &ival, eout))) {
+	if (rv == -1)
+	    return -1;
+	if (ival < 1)
+	    ival = 1;
+	port->dev_to_net_nbufs = ival;
     } else if ((rv = cmpstrint(pos, "max-connections=", &ival, eout))) {
 	if (rv == -1)
 	    return -1;
 	if (ival < 1)
 	    ival = 1;
 	port->max_connections = ival;
+    } else if (strcmp(pos, "splice") == 0) {
+	port->splice = true;
+    } else if (strcmp(pos, "-splice") == 0) {
+	port->splice = false;
+    } else if (cmpstrval(pos, "lag-policy=", &val)) {
+	ival = lookup_enum(lag_policy_enums, val, -1);
+	if (ival == -1) {
+	    eout->out(eout, "Invalid lag policy: %s", val);
+	    return -1;
+	}
+	port->lag_policy = ival;
     } else if (cmpstrval(pos, "remaddr=", &val)) {
 	rv = port_add_remaddr(eout, port, val);
 	if (rv)
@@ -3171,25 +5148,357 @@ myconfig(void *data, struct absout *eout, const char *pos)
 	/* It's a startup banner, signature or open/close string, it's
 	   already set. */
 	switch (stype) {
-	case BANNER: port->bannerstr = s; break;
-	case SIGNATURE: port->signaturestr = s; break;
-	case OPENSTR: port->openstr = s; break;
-	case CLOSESTR: port->closestr = s; break;
-	case CLOSEON: port->closeon = s; port->closeon_len = len; break;
+	case BANNER: free(cfg->bannerstr); cfg->bannerstr = s; break;
+	case SIGNATURE: free(cfg->signaturestr); cfg->signaturestr = s; break;
+	case OPENSTR: free(cfg->openstr); cfg->openstr = s; break;
+	case CLOSESTR: free(cfg->closestr); cfg->closestr = s; break;
+	case CLOSEON:
+	    free(cfg->closeon);
+	    cfg->closeon = s;
+	    cfg->closeon_len = len;
+	    break;
 	default: free(s); goto unknown;
 	}
-    } else {
-    unknown:
-	eout->out(eout, "Unknown config item: %s", pos);
-	return -1;
+    } else {
+    unknown:
+	eout->out(eout, "Unknown config item: %s", pos);
+	return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Pick the shard the port runs on.  IPMI SOL ports stay on shard 0
+ * because the IPMI OS handler is bound to the main selector.  A port
+ * being reconfigured takes over the old port's acceptor and
+ * connections, so it stays on the old port's shard.  Otherwise use
+ * the shard from the options, or spread the ports by name.
+ */
+static void
+port_pick_shard(port_info_t *port)
+{
+    port_info_t *curr;
+    unsigned int hash = 0;
+    const char *c;
+
+    if (strncmp(port->io.devname, "sol.", 4) == 0) {
+	port->shard = 0;
+	goto out;
+    }
+
+    LOCK(ports_lock);
+    curr = port_lookup(port->portname);
+    if (curr)
+	port->shard = curr->shard;
+    UNLOCK(ports_lock);
+
+    if (port->shard == -1) {
+	for (c = port->portname; *c; c++)
+	    hash = hash * 31 + (unsigned char) *c;
+	port->shard = hash % ser2net_num_shards;
+    }
+
+ out:
+    port->sel = ser2net_shards[port->shard].sel;
+    port->o = ser2net_shards[port->shard].o;
+    port->io.sel = port->sel;
+}
+
+static const struct genio_acceptor_callbacks port_acceptor_cbs = {
+    .new_connection = handle_port_accept,
+};
+
+/*
+ * What the last read of the config file did, for showreload.  These
+ * are only changed while reading the config, and that and showreload
+ * are maintenance operations, so they don't need a lock.
+ */
+static struct timeval config_start;
+static struct timeval config_duration;
+static time_t config_time;
+static unsigned int config_ports_added;
+static unsigned int config_ports_changed;
+static unsigned int config_ports_removed;
+static unsigned int config_ports_unchanged;
+static unsigned int config_ports_failed;
+
+/*
+ * Acceptor shutdowns started while reading the config.  They are all
+ * waited for at the end, so they run at the same time.
+ */
+static unsigned int config_shutdown_count;
+
+void
+start_port_config(void)
+{
+    sel_get_monotonic_time(&config_start);
+    config_ports_added = 0;
+    config_ports_changed = 0;
+    config_ports_removed = 0;
+    config_ports_unchanged = 0;
+    config_ports_failed = 0;
+    config_shutdown_count = 0;
+}
+
+/*
+ * New ports from the config, and changed ones that were disabled and
+ * are now enabled, can be started by a pool of threads (the -W
+ * option), so a device that is slow to open doesn't hold up all the
+ * ports after it.  By default there is no pool and the ports are
+ * started one at a time by the config read, as they always have been.
+ * The threads are started as ports are queued, and they are waited
+ * for at the end of the config read.  The ports are in the port list
+ * while they start, but their acceptors aren't running, so only the
+ * rotators could find them.
+ */
+unsigned int num_startup_threads = 1;
+
+static unsigned int startup_nfailed;
+
+#ifdef USE_PTHREADS
+DEFINE_LOCK_INIT(static, startup_lock)
+static pthread_cond_t startup_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t *startup_threads;
+static unsigned int startup_nthreads;
+static bool startup_queue_done;
+static port_info_t *startup_queue, **startup_queue_tail = &startup_queue;
+#endif
+
+static int
+startup_eprint(struct absout *e, const char *str, ...)
+{
+    va_list ap;
+    char buf[1024];
+
+    va_start(ap, str);
+    vsnprintf(buf, sizeof(buf), str, ap);
+    va_end(ap);
+    syslog(LOG_ERR, "%s", buf);
+    return 0;
+}
+
+static struct absout startup_eout = { .out = startup_eprint };
+
+static void
+port_startup(struct absout *eout, port_info_t *port)
+{
+    struct timeval now;
+
+    LOCK(port->lock);
+    if (port->startup_state != PORT_STARTUP_PENDING)
+	goto out_unlock;
+
+    if (port->startup_reconfig) {
+	port->startup_reconfig = false;
+	if (startup_port(eout, port, true)) {
+	    /* Leave it in the config disabled, as change_port_state() does. */
+	    port->enabled = PORT_DISABLED;
+	    port->startup_state = PORT_STARTUP_DONE;
+	    goto out_unlock;
+	}
+    } else if (startup_port(eout, port, false) == -1) {
+	port->startup_state = PORT_STARTUP_FAILED;
+	__atomic_add_fetch(&startup_nfailed, 1, __ATOMIC_RELAXED);
+	goto out_unlock;
     }
 
-    return 0;
+    port->startup_state = PORT_STARTUP_DONE;
+    sel_get_monotonic_time(&now);
+    sub_from_timeval(&now, &config_start);
+    port->startup_time = now;
+ out_unlock:
+    UNLOCK(port->lock);
 }
 
-static const struct genio_acceptor_callbacks port_acceptor_cbs = {
-    .new_connection = handle_port_accept,
-};
+#ifdef USE_PTHREADS
+static void *
+port_startup_thread(void *data)
+{
+    port_info_t *port;
+
+    LOCK(startup_lock);
+    for (;;) {
+	while (!startup_queue && !startup_queue_done)
+	    pthread_cond_wait(&startup_cond, &startup_lock);
+	port = startup_queue;
+	if (!port)
+	    break;
+	startup_queue = port->startup_next;
+	if (!startup_queue)
+	    startup_queue_tail = &startup_queue;
+	UNLOCK(startup_lock);
+	port_startup(&startup_eout, port);
+	LOCK(startup_lock);
+    }
+    UNLOCK(startup_lock);
+
+    return NULL;
+}
+#endif
+
+/*
+ * Start a new or changed port from the config.  If there are startup
+ * threads, this is done in one of them, otherwise it is done now.
+ */
+static void
+queue_port_startup(struct absout *eout, port_info_t *port)
+{
+    LOCK(port->lock);
+    port->startup_state = PORT_STARTUP_PENDING;
+    UNLOCK(port->lock);
+
+#ifdef USE_PTHREADS
+    if (num_startup_threads > 1) {
+	LOCK(startup_lock);
+	if (!startup_threads)
+	    startup_threads = malloc(sizeof(*startup_threads)
+				     * num_startup_threads);
+	if (startup_threads && startup_nthreads < num_startup_threads) {
+	    if (pthread_create(&startup_threads[startup_nthreads], NULL,
+			       port_startup_thread, NULL) == 0)
+		startup_nthreads++;
+	}
+	if (startup_nthreads > 0) {
+	    port->startup_next = NULL;
+	    *startup_queue_tail = port;
+	    startup_queue_tail = &port->startup_next;
+	    pthread_cond_signal(&startup_cond);
+	    UNLOCK(startup_lock);
+	    return;
+	}
+	UNLOCK(startup_lock);
+    }
+#endif
+
+    port_startup(eout, port);
+}
+
+/* Wait for all the queued ports to be started. */
+static void
+drain_port_startups(void)
+{
+#ifdef USE_PTHREADS
+    unsigned int i;
+
+    LOCK(startup_lock);
+    startup_queue_done = true;
+    pthread_cond_broadcast(&startup_cond);
+    UNLOCK(startup_lock);
+
+    for (i = 0; i < startup_nthreads; i++)
+	pthread_join(startup_threads[i], NULL);
+
+    startup_nthreads = 0;
+    startup_queue_done = false;
+    free(startup_threads);
+    startup_threads = NULL;
+#endif
+}
+
+/*
+ * Wait for the ports from the config to be started, and take out the
+ * ones that couldn't be.
+ */
+void
+wait_port_startups(void)
+{
+    port_info_t *port, *next;
+
+    drain_port_startups();
+
+    if (!startup_nfailed)
+	return;
+
+    LOCK(ports_lock);
+    for (port = ports; port; port = next) {
+	next = port->next;
+	if (port->startup_state != PORT_STARTUP_FAILED)
+	    continue;
+	port_list_remove(port);
+	config_ports_added--;
+	config_ports_failed++;
+	free_port(port);
+    }
+    startup_nfailed = 0;
+    UNLOCK(ports_lock);
+}
+
+/*
+ * Is the port made from the same config line, and are the settings it
+ * looked up (defaults, strings, trace files, etc.) the same as they
+ * are now?
+ */
+static bool
+port_config_same(port_info_t *port, uint64_t config_hash)
+{
+    return port->config_hash == config_refs_hash(config_hash,
+						 port->config_refs,
+						 port->config_refs_len);
+}
+
+/*
+ * If the port was made from the same settings as the config has now,
+ * there is no need to make it again.  Returns true and marks the port
+ * as in this config if so.
+ */
+static bool
+port_config_unchanged(struct absout *eout, const char *portname,
+		      int config_num, uint64_t config_hash)
+{
+    port_info_t *port;
+    bool rv = false;
+    int err;
+
+    if (!config_hash)
+	return false;
+
+    LOCK(ports_lock);
+    port = port_lookup(portname);
+    if (!port)
+	goto out;
+
+    LOCK(port->lock);
+    /*
+     * LEDs are made again on every read of the config, so a port that
+     * uses them has to be made again to get the new ones.  A port that
+     * was deleted has been shut down, it has to be started again.
+     */
+    if (port->led_rx || port->led_tx || port->config_num == -1)
+	goto out_unlock;
+
+    if (port->new_config) {
+	if (port->new_config->led_rx || port->new_config->led_tx)
+	    goto out_unlock;
+	if (port_config_same(port->new_config, config_hash)) {
+	    rv = true;
+	} else if (port_config_same(port, config_hash)) {
+	    /* Changed back before the change went in. */
+	    free_port(port->new_config);
+	    port->new_config = NULL;
+	    rv = true;
+	}
+    } else {
+	rv = port_config_same(port, config_hash);
+    }
+    if (!rv)
+	goto out_unlock;
+
+    port->config_num = config_num;
+    config_ports_unchanged++;
+
+    /* Pick up any changes to things like SSL certificates. */
+    err = genio_acc_reload(port->acceptor);
+    if (err && err != ENOTSUP)
+	eout->out(eout, "Unable to reload network port %s: %s",
+		  port->portname, strerror(err));
+
+ out_unlock:
+    UNLOCK(port->lock);
+ out:
+    UNLOCK(ports_lock);
+    return rv;
+}
 
 /* Create a port based on a set of parameters passed in. */
 int
@@ -3199,13 +5508,17 @@ portconfig(struct absout *eout,
 	   char *timeout,
 	   char *devname,
 	   char *devcfg,
-	   int  config_num)
+	   int  config_num,
+	   uint64_t config_hash)
 {
-    port_info_t *new_port, *curr, *prev;
+    port_info_t *new_port, *curr;
     net_info_t *netcon;
     enum str_type str_type;
+    bool queue_startup = false;
     int err;
-    unsigned int shutdown_count = 0;
+
+    if (port_config_unchanged(eout, portnum, config_num, config_hash))
+	return 0;
 
     new_port = malloc(sizeof(port_info_t));
     if (new_port == NULL) {
@@ -3214,27 +5527,11 @@ portconfig(struct absout *eout,
     }
     memset(new_port, 0, sizeof(*new_port));
 
-    INIT_LOCK(new_port->lock);
-
-    if (sel_alloc_timer(ser2net_sel,
-			got_timeout, new_port,
-			&new_port->timer))
-    {
-	eout->out(eout, "Could not allocate timer data");
-	goto errout;
-    }
-
-    if (sel_alloc_timer(ser2net_sel,
-			send_timeout, new_port,
-			&new_port->send_timer))
-    {
-	eout->out(eout, "Could not allocate timer data");
-	goto errout;
-    }
+    /* Find out which settings it uses while it's made. */
+    if (config_hash)
+	config_refs_start();
 
-    if (sel_alloc_runner(ser2net_sel, &new_port->runshutdown)) {
-	goto errout;
-    }
+    INIT_LOCK(new_port->lock);
 
     new_port->io.devname = find_str(devname, &str_type, NULL);
     if (new_port->io.devname) {
@@ -3255,6 +5552,16 @@ portconfig(struct absout *eout,
 	eout->out(eout, "unable to allocate device name");
 	goto errout;
     }
+    if (port_dev_get(new_port)) {
+	eout->out(eout, "unable to allocate device index entry");
+	goto errout;
+    }
+
+    new_port->cfg = port_cfg_alloc();
+    if (!new_port->cfg) {
+	eout->out(eout, "Could not allocate a port config");
+	goto errout;
+    }
 
     /* Errors from here on out must goto errout. */
     init_port_data(new_port);
@@ -3301,33 +5608,43 @@ portconfig(struct absout *eout,
 	}
     }
 
-    err = str_to_genio_acceptor(new_port->portname, ser2net_o,
-				new_port->net_to_dev.maxsize,
-				&port_acceptor_cbs, new_port,
-				&new_port->acceptor);
-    if (err) {
-	eout->out(eout, "Invalid port name/number");
+    /* The shard can be set in the options, so pick it after those. */
+    port_pick_shard(new_port);
+
+    if (sel_alloc_wheel_timer(new_port->sel,
+			      got_timeout, new_port,
+			      &new_port->timer))
+    {
+	eout->out(eout, "Could not allocate timer data");
 	goto errout;
     }
 
-    if (buffer_init(&new_port->dev_to_net, NULL, new_port->dev_to_net.maxsize))
+    if (sel_alloc_timer(new_port->sel,
+			send_timeout, new_port,
+			&new_port->send_timer))
     {
-	eout->out(eout, "Could not allocate dev to net buffer");
+	eout->out(eout, "Could not allocate timer data");
 	goto errout;
     }
 
-    new_port->telnet_dev_to_net = malloc(new_port->dev_to_net.maxsize / 2);
-    if (!new_port->telnet_dev_to_net) {
-	eout->out(eout, "Could not allocate telnet dev_to_net buf");
+    if (sel_alloc_runner(new_port->sel, &new_port->runshutdown)) {
 	goto errout;
     }
 
-    if (buffer_init(&new_port->net_to_dev, NULL, new_port->net_to_dev.maxsize))
-    {
-	eout->out(eout, "Could not allocate net to dev buffer");
+    err = str_to_genio_acceptor(new_port->portname, new_port->o,
+				new_port->net_to_dev.maxsize,
+				&port_acceptor_cbs, new_port,
+				&new_port->acceptor);
+    if (err) {
+	eout->out(eout, "Invalid port name/number");
 	goto errout;
     }
 
+    /* The buffers themselves are allocated in port_alloc_bufs(). */
+    new_port->dev_to_net_chunk = new_port->dev_to_net.maxsize;
+    new_port->dev_to_net.maxsize = (new_port->dev_to_net_chunk *
+				    new_port->dev_to_net_nbufs);
+
     /*
      * Don't handle the remaddr default until here, we don't want to
      * mess with it if the user has set it, because the user may set
@@ -3354,80 +5671,94 @@ portconfig(struct absout *eout,
     memset(new_port->netcons, 0,
 	   sizeof(*(new_port->netcons)) * new_port->max_connections);
     for_each_connection(new_port, netcon) {
-	if (sel_alloc_runner(ser2net_sel, &netcon->runshutdown)) {
+	if (sel_alloc_runner(new_port->sel, &netcon->runshutdown)) {
 	    eout->out(eout, "Could not allocate a netcon shutdown handler");
 	    goto errout;
 	}
 
+	if (sel_alloc_wheel_timer(new_port->sel, netcon_timeout, netcon,
+				  &netcon->timeout_timer)) {
+	    eout->out(eout, "Could not allocate timer data");
+	    goto errout;
+	}
+
 	netcon->port = new_port;
     }
 
+    /* The config is done, use the same one as other ports if it can. */
+    port_cfg_share(new_port);
+
     new_port->config_num = config_num;
+    if (config_hash) {
+	if (config_refs_end(&new_port->config_refs,
+			    &new_port->config_refs_len))
+	    new_port->config_hash = config_refs_hash(config_hash,
+						     new_port->config_refs,
+						     new_port->config_refs_len);
+	else
+	    new_port->config_hash = 0;
+    }
 
     /* See if the port already exists, and reconfigure it if so. */
-    prev = NULL;
     LOCK(ports_lock);
-    curr = ports;
-    while (curr != NULL) {
-	if (strcmp(curr->portname, new_port->portname) == 0) {
-	    /* We are reconfiguring this port. */
-	    LOCK(curr->lock);
-	    if (curr->dev_to_net_state == PORT_UNCONNECTED) {
-		/* Port is disconnected, switch it now. */
-		LOCK(new_port->lock);
-		/* releases curr->lock */
-		if (switchout_port(eout, new_port, curr, prev))
-		    wait_for_port_shutdown(new_port, &shutdown_count);
-		UNLOCK(new_port->lock);
-	    } else {
-		/* Mark it to be replaced later. */
-		if (curr->new_config != NULL)
-		    free_port(curr->new_config);
-		curr->config_num = config_num;
-		curr->new_config = new_port;
-		UNLOCK(curr->lock);
-	    }
-	    goto out;
+    curr = port_lookup(new_port->portname);
+    if (curr && curr->startup_state != PORT_STARTUP_DONE) {
+	/*
+	 * The port was given twice in this config and the first one
+	 * is still starting.  The startup threads don't need
+	 * ports_lock, so wait for them here.
+	 */
+	drain_port_startups();
+	if (curr->startup_state == PORT_STARTUP_FAILED) {
+	    port_list_remove(curr);
+	    config_ports_added--;
+	    startup_nfailed--;
+	    free_port(curr);
+	    curr = NULL;
+	}
+    }
+    if (curr) {
+	/* We are reconfiguring this port. */
+	config_ports_changed++;
+	LOCK(curr->lock);
+	if (curr->dev_to_net_state == PORT_UNCONNECTED) {
+	    /* Port is disconnected, switch it now. */
+	    LOCK(new_port->lock);
+	    /* releases curr->lock */
+	    if (switchout_port(eout, new_port, curr, &queue_startup))
+		wait_for_port_shutdown(new_port, &config_shutdown_count);
+	    UNLOCK(new_port->lock);
+	    if (queue_startup)
+		queue_port_startup(eout, new_port);
 	} else {
-	    prev = curr;
-	    curr = curr->next;
+	    /* Mark it to be replaced later. */
+	    if (curr->new_config != NULL)
+		free_port(curr->new_config);
+	    curr->config_num = config_num;
+	    curr->new_config = new_port;
+	    UNLOCK(curr->lock);
 	}
+	goto out;
     }
 
     /* If we get here, the port is brand new, so don't do anything that
        would affect a port replacement here. */
 
-    if (new_port->enabled != PORT_DISABLED) {
-	int rv;
-
-	LOCK(new_port->lock);
-	rv = startup_port(eout, new_port, false);
-	UNLOCK(new_port->lock);
-	if (rv == -1)
-	    goto errout_unlock;
-    }
-
     /* Tack it on to the end of the list of ports. */
-    new_port->next = NULL;
-    if (ports == NULL) {
-	ports = new_port;
-    } else {
-	curr = ports;
-	while (curr->next != NULL) {
-	    curr = curr->next;
-	}
-	curr->next = new_port;
-    }
+    port_list_add(new_port);
+    config_ports_added++;
+
+    if (new_port->enabled != PORT_DISABLED)
+	queue_port_startup(eout, new_port);
  out:
     UNLOCK(ports_lock);
 
-    wait_for_waiter(acceptor_shutdown_wait, shutdown_count);
-
     return 0;
 
-errout_unlock:
-    UNLOCK(ports_lock);
 errout:
+    /* Stop recording, the list is freed with the port. */
+    if (config_hash)
+	config_refs_end(&new_port->config_refs, &new_port->config_refs_len);
     free_port(new_port);
     return -1;
 }
@@ -3435,45 +5766,87 @@ errout:
 void
 clear_old_port_config(int curr_config)
 {
-    port_info_t *curr, *prev;
-    unsigned int shutdown_count = 0;
+    port_info_t *curr, *next, *removed = NULL;
+    struct timeval now;
+
+    wait_port_startups();
 
-    prev = NULL;
-    curr = ports;
     LOCK(ports_lock);
-    while (curr != NULL) {
-	if (curr->config_num != curr_config) {
-	    /* The port was removed, remove it. */
-	    LOCK(curr->lock);
-	    if (curr->dev_to_net_state == PORT_UNCONNECTED) {
-		if (change_port_state(NULL, curr, PORT_DISABLED, false))
-		    wait_for_port_shutdown(curr, &shutdown_count);
-		UNLOCK(curr->lock);
-		if (prev == NULL) {
-		    ports = curr->next;
-		    free_port(curr);
-		    curr = ports;
-		} else {
-		    prev->next = curr->next;
-		    free_port(curr);
-		    curr = prev->next;
-		}
-	    } else {
-		curr->config_num = -1;
-		if (change_port_state(NULL, curr, PORT_DISABLED, false))
-		    wait_for_port_shutdown(curr, &shutdown_count);
-		UNLOCK(curr->lock);
-		prev = curr;
-		curr = curr->next;
-	    }
+    for (curr = ports; curr; curr = next) {
+	next = curr->next;
+	if (curr->config_num == curr_config)
+	    continue;
+
+	/* The port was removed, remove it. */
+	LOCK(curr->lock);
+	if (curr->config_num != -1)
+	    config_ports_removed++;
+	if (curr->dev_to_net_state == PORT_UNCONNECTED) {
+	    if (change_port_state(NULL, curr, PORT_DISABLED, false))
+		wait_for_port_shutdown(curr, &config_shutdown_count);
+	    UNLOCK(curr->lock);
+	    port_list_remove(curr);
+	    /* Free it once its acceptor is shut down. */
+	    curr->next = removed;
+	    removed = curr;
 	} else {
-	    prev = curr;
-	    curr = curr->next;
+	    curr->config_num = -1;
+	    if (change_port_state(NULL, curr, PORT_DISABLED, false))
+		wait_for_port_shutdown(curr, &config_shutdown_count);
+	    UNLOCK(curr->lock);
 	}
     }
     UNLOCK(ports_lock);
 
-    wait_for_waiter(acceptor_shutdown_wait, shutdown_count);
+    free_old_rotators(curr_config);
+    update_rotator_devs();
+
+    wait_for_waiter(acceptor_shutdown_wait, config_shutdown_count);
+    config_shutdown_count = 0;
+
+    while (removed) {
+	curr = removed;
+	removed = curr->next;
+	/* The shutdown done handler wakes us with the port locked. */
+	LOCK(curr->lock);
+	UNLOCK(curr->lock);
+	free_port(curr);
+    }
+
+    sel_get_monotonic_time(&now);
+    config_duration = now;
+    sub_from_timeval(&config_duration, &config_start);
+    config_time = time(NULL);
+    syslog(LOG_INFO, "Configuration read in %ld.%03lds: %u ports added,"
+	   " %u changed, %u removed, %u unchanged, %u failed to start",
+	   (long) config_duration.tv_sec,
+	   (long) config_duration.tv_usec / 1000,
+	   config_ports_added, config_ports_changed, config_ports_removed,
+	   config_ports_unchanged, config_ports_failed);
+}
+
+/* Show what the last read of the config file did. */
+void
+showreload(struct controller_info *cntlr)
+{
+    char timestr[32];
+    struct tm tm;
+
+    if (!config_time) {
+	controller_outs(cntlr, "The configuration has not been read\r\n");
+	return;
+    }
+
+    localtime_r(&config_time, &tm);
+    strftime(timestr, sizeof(timestr), "%Y-%m-%dT%H:%M:%S", &tm);
+    controller_outputf(cntlr, "time=%s duration=%ld.%06ld added=%u"
+		       " changed=%u removed=%u unchanged=%u failed=%u\r\n",
+		       timestr,
+		       (long) config_duration.tv_sec,
+		       (long) config_duration.tv_usec,
+		       config_ports_added, config_ports_changed,
+		       config_ports_removed, config_ports_unchanged,
+		       config_ports_failed);
 }
 
 #define REMOTEADDR_COLUMN_WIDTH \
@@ -3488,7 +5861,7 @@ showshortport(struct controller_info *cntlr, port_info_t *port)
     int  need_space = 0;
     struct absout out = { .out = cntrl_absout, .data = cntlr };
     net_info_t *netcon = NULL;
-    unsigned int bytes_recv = 0, bytes_sent = 0;
+    uint64_t bytes_recv = 0, bytes_sent = 0;
 
     controller_outputf(cntlr, "%-22s ", port->portname);
     if (port->config_num == -1)
@@ -3513,16 +5886,18 @@ showshortport(struct controller_info *cntlr, port_info_t *port)
 	count++;
     }
 
-    bytes_recv = netcon->bytes_received;
-    bytes_sent = netcon->bytes_sent;
+    bytes_recv = STAT_GET(netcon->bytes_received);
+    bytes_sent = STAT_GET(netcon->bytes_sent);
 
     controller_outputf(cntlr, "%-22s ", port->io.devname);
     controller_outputf(cntlr, "%-14s ", state_str[port->net_to_dev_state]);
     controller_outputf(cntlr, "%-14s ", state_str[port->dev_to_net_state]);
-    controller_outputf(cntlr, "%9d ", bytes_recv);
-    controller_outputf(cntlr, "%9d ", bytes_sent);
-    controller_outputf(cntlr, "%9d ", port->dev_bytes_received);
-    controller_outputf(cntlr, "%9d ", port->dev_bytes_sent);
+    controller_outputf(cntlr, "%9llu ", (unsigned long long) bytes_recv);
+    controller_outputf(cntlr, "%9llu ", (unsigned long long) bytes_sent);
+    controller_outputf(cntlr, "%9llu ",
+		       (unsigned long long) STAT_GET(port->dev_bytes_received));
+    controller_outputf(cntlr, "%9llu ",
+		       (unsigned long long) STAT_GET(port->dev_bytes_sent));
 
     if (port->enabled != PORT_RAWLP) {
 	port->io.f->show_devcfg(&port->io, &out);
@@ -3540,6 +5915,45 @@ showshortport(struct controller_info *cntlr, port_info_t *port)
 
 }
 
+static unsigned long
+str_mem_size(const char *str)
+{
+    return str ? strlen(str) + 1 : 0;
+}
+
+/*
+ * The memory the port itself holds.  Memory used by the device and
+ * network code under it is not counted.
+ */
+static unsigned long
+port_mem_size(port_info_t *port)
+{
+    unsigned long size = sizeof(*port);
+    net_info_t *netcon;
+
+    size += sizeof(*netcon) * port->max_connections;
+    for_each_connection(port, netcon) {
+	if (netcon->tn_data)
+	    size += sizeof(*netcon->tn_data);
+	if (netcon->banner)
+	    size += sizeof(*netcon->banner) + netcon->banner->maxsize;
+    }
+    if (port->dev_to_net.buf)
+	size += (port->dev_to_net.maxsize + port->dev_to_net_chunk / 2 +
+		 port->net_to_dev.maxsize);
+    if (port->devstr)
+	size += sizeof(*port->devstr) + port->devstr->maxsize;
+
+    size += str_mem_size(port->portname);
+    size += str_mem_size(port->io.devname);
+    size += str_mem_size(port->orig_devname);
+    /* A shared config is split over the ports using it. */
+    size += (port_cfg_mem_size(port->cfg) /
+	     __atomic_load_n(&port->cfg->refcount, __ATOMIC_RELAXED));
+
+    return size;
+}
+
 /* Print information about a port to the control port given in cntlr. */
 static void
 showport(struct controller_info *cntlr, port_info_t *port)
@@ -3552,15 +5966,21 @@ showport(struct controller_info *cntlr, port_info_t *port)
     controller_outputf(cntlr, "  enable state: %s\r\n",
 		       enabled_str[port->enabled]);
     controller_outputf(cntlr, "  timeout: %d\r\n", port->timeout);
+    if (port->startup_time.tv_sec || port->startup_time.tv_usec)
+	controller_outputf(cntlr, "  started after: %ld.%06lds\r\n",
+			   (long) port->startup_time.tv_sec,
+			   (long) port->startup_time.tv_usec);
 
     for_each_connection(port, netcon) {
 	if (netcon->net) {
 	    genio_raddr_to_str(netcon->net, NULL, buffer, sizeof(buffer));
 	    controller_outputf(cntlr, "  connected to: %s\r\n", buffer);
-	    controller_outputf(cntlr, "    bytes read from TCP: %d\r\n",
-			       netcon->bytes_received);
-	    controller_outputf(cntlr, "    bytes written to TCP: %d\r\n",
-			       netcon->bytes_sent);
+	    controller_outputf(cntlr, "    bytes read from TCP: %llu\r\n",
+			       (unsigned long long)
+			       STAT_GET(netcon->bytes_received));
+	    controller_outputf(cntlr, "    bytes written to TCP: %llu\r\n",
+			       (unsigned long long)
+			       STAT_GET(netcon->bytes_sent));
 	} else {
 	    controller_outputf(cntlr, "  unconnected\r\n");
 	}
@@ -3594,11 +6014,34 @@ showport(struct controller_info *cntlr, port_info_t *port)
     controller_outputf(cntlr, "  device to tcp state: %s\r\n",
 		      state_str[port->dev_to_net_state]);
 
-    controller_outputf(cntlr, "  bytes read from device: %d\r\n",
-		      port->dev_bytes_received);
+    controller_outputf(cntlr, "  lag policy: %s\r\n",
+		      lag_policy_enums[port->lag_policy].str);
 
-    controller_outputf(cntlr, "  bytes written to device: %d\r\n",
-		      port->dev_bytes_sent);
+    if (port->splice)
+	controller_outputf(cntlr, "  splice: %s\r\n",
+			   port->splice_failed ? "not supported" : "on");
+
+    controller_outputf(cntlr, "  bytes read from device: %llu\r\n",
+		      (unsigned long long) STAT_GET(port->dev_bytes_received));
+
+    controller_outputf(cntlr, "  bytes written to device: %llu\r\n",
+		      (unsigned long long) STAT_GET(port->dev_bytes_sent));
+
+    controller_outputf(cntlr, "  resident memory: %lu\r\n",
+		       port_mem_size(port));
+
+    if (port->tr || port->tw || port->tb) {
+	unsigned long dropped = 0;
+
+	if (port->tw && port->tw->tf)
+	    dropped += trace_file_dropped(port->tw->tf);
+	if (port->tr && port->tr != port->tw && port->tr->tf)
+	    dropped += trace_file_dropped(port->tr->tf);
+	if (port->tb && port->tb != port->tr && port->tb != port->tw
+		&& port->tb->tf)
+	    dropped += trace_file_dropped(port->tb->tf);
+	controller_outputf(cntlr, "  trace bytes dropped: %lu\r\n", dropped);
+    }
 
     if (port->config_num == -1) {
 	controller_outputf(cntlr, "  Port will be deleted when current"
@@ -3619,22 +6062,17 @@ find_port_by_num(char *portstr, bool allow_deleted)
     port_info_t *port;
 
     LOCK(ports_lock);
-    port = ports;
-    while (port != NULL) {
-	if (strcmp(portstr, port->portname) == 0) {
-	    LOCK(port->lock);
-	    UNLOCK(ports_lock);
-	    if (port->config_num == -1 && !allow_deleted) {
-		UNLOCK(port->lock);
-		return NULL;
-	    }
-	    return port;
+    port = port_lookup(portstr);
+    if (port) {
+	LOCK(port->lock);
+	if (port->config_num == -1 && !allow_deleted) {
+	    UNLOCK(port->lock);
+	    port = NULL;
 	}
-	port = port->next;
     }
-
     UNLOCK(ports_lock);
-    return NULL;
+
+    return port;
 }
 
 /* Handle a showport command from the control port. */
@@ -3708,6 +6146,63 @@ showshortports(struct controller_info *cntlr, char *portspec)
     }
 }
 
+static void
+showstat(struct controller_info *cntlr, port_info_t *port)
+{
+    net_info_t *netcon;
+
+    controller_outputf(cntlr, "port=%s dev_bytes_received=%llu"
+		       " dev_bytes_sent=%llu dev_reads=%llu dev_writes=%llu"
+		       " dev_write_eagain=%llu dev_overruns=%llu\r\n",
+		       port->portname,
+		       (unsigned long long) STAT_GET(port->dev_bytes_received),
+		       (unsigned long long) STAT_GET(port->dev_bytes_sent),
+		       (unsigned long long) STAT_GET(port->dev_reads),
+		       (unsigned long long) STAT_GET(port->dev_writes),
+		       (unsigned long long) STAT_GET(port->dev_write_eagain),
+		       (unsigned long long) STAT_GET(port->dev_overruns));
+
+    for_each_connection(port, netcon) {
+	controller_outputf(cntlr, "port=%s conn=%u net_bytes_received=%llu"
+			   " net_bytes_sent=%llu net_reads=%llu"
+			   " net_writes=%llu net_write_eagain=%llu"
+			   " net_dropped=%llu\r\n",
+			   port->portname,
+			   (unsigned int) (netcon - port->netcons),
+			   (unsigned long long) STAT_GET(netcon->bytes_received),
+			   (unsigned long long) STAT_GET(netcon->bytes_sent),
+			   (unsigned long long) STAT_GET(netcon->reads),
+			   (unsigned long long) STAT_GET(netcon->writes),
+			   (unsigned long long) STAT_GET(netcon->write_eagain),
+			   (unsigned long long) STAT_GET(netcon->dropped));
+    }
+}
+
+/*
+ * Handle a showstats command from the control port.  This only holds
+ * ports_lock, to keep the ports from going away, so it doesn't get in
+ * the way of data transfer.
+ */
+void
+showstats(struct controller_info *cntlr, char *portspec)
+{
+    port_info_t *port;
+
+    LOCK(ports_lock);
+    if (portspec) {
+	port = port_lookup(portspec);
+	if (port)
+	    showstat(cntlr, port);
+	else
+	    controller_outputf(cntlr, "Invalid port number: %s\r\n",
+			       portspec);
+    } else {
+	for (port = ports; port; port = port->next)
+	    showstat(cntlr, port);
+    }
+    UNLOCK(ports_lock);
+}
+
 /* Set the timeout on a port.  The port number and timeout are passed
    in as strings, this code will convert them, return any errors, and
    perform the operation. */
@@ -3727,10 +6222,11 @@ setporttimeout(struct controller_info *cntlr, char *portspec, char *timeout)
 	    controller_outputf(cntlr, "Invalid timeout: %s\r\n", timeout);
 	} else {
 	    port->timeout = timeout_num;
+	    port->config_hash = 0;
 
 	    for_each_connection(port, netcon) {
 		if (netcon->net)
-		    reset_timer(netcon);
+		    netcon_start_timeout(netcon);
 	    }
 	}
 	UNLOCK(port->lock);
@@ -3754,6 +6250,9 @@ setportdevcfg(struct controller_info *cntlr, char *portspec, char *devcfg)
 	{
 	    controller_outputf(cntlr, "Invalid device config\r\n");
 	}
+	/* myconfig() may have made the port its own copy. */
+	port_cfg_share(port);
+	port->config_hash = 0;
 	UNLOCK(port->lock);
     }
 }
@@ -3811,6 +6310,7 @@ setportenable(struct controller_info *cntlr, char *portspec, char *enable)
 	goto out_unlock;
     }
 
+    port->config_hash = 0;
     if (change_port_state(&eout, port, new_enable, false))
 	wait_for_port_shutdown(port, &shutdown_count);
 
@@ -3950,7 +6450,14 @@ com_port_will_do(void *cb_data, unsigned char cmd)
     if (port->io.f->get_modem_state(&port->io, data + 2) != -1) {
 	port->last_modemstate = data[2];
     }
-    telnet_send_option(&netcon->tn_data, data, 3);
+    telnet_send_option(netcon->tn_data, data, 3);
+
+    /* Have the device tell us about changes if it can, else poll. */
+    if (!port->modemstate_notify && port->io.f->modem_state_notify &&
+		port->io.f->modem_state_notify(&port->io, 1) == 0)
+	port->modemstate_notify = true;
+    if (!port->modemstate_notify)
+	port_start_timer(port);
     return 1;
 }
 
@@ -3974,7 +6481,7 @@ com_port_handler(void *cb_data, unsigned char *option, int len)
     case 0: /* SIGNATURE? */
     {
 	/* truncate signature, if it exceeds buffer size */
-	char *sig = port->signaturestr;
+	char *sig = port->cfg->signaturestr;
 	int sign_len;
 
 	if (!sig)
@@ -3988,7 +6495,7 @@ com_port_handler(void *cb_data, unsigned char *option, int len)
 	outopt[0] = 44;
 	outopt[1] = 100;
 	strncpy((char *) outopt + 2, sig, sign_len);
-	telnet_send_option(&netcon->tn_data, outopt, 2 + sign_len);
+	telnet_send_option(netcon->tn_data, outopt, 2 + sign_len);
 	break;
     }
 
@@ -4015,7 +6522,7 @@ com_port_handler(void *cb_data, unsigned char *option, int len)
 	outopt[1] = 101;
 	if (cisco_ios_baud_rates) {
 	    outopt[2] = baud_to_cisco_baud(val);
-	    telnet_send_option(&netcon->tn_data, outopt, 3);
+	    telnet_send_option(netcon->tn_data, outopt, 3);
 	} else {
 	    /* Basically the same as:
 	     * *((uint32_t *) (outopt + 2)) = htonl(val);
@@ -4024,7 +6531,7 @@ com_port_handler(void *cb_data, unsigned char *option, int len)
 	    outopt[3] = val >> 16;
 	    outopt[4] = val >> 8;
 	    outopt[5] = val;
-	    telnet_send_option(&netcon->tn_data, outopt, 6);
+	    telnet_send_option(netcon->tn_data, outopt, 6);
 	}
 	break;
 
@@ -4038,7 +6545,7 @@ com_port_handler(void *cb_data, unsigned char *option, int len)
 	outopt[0] = 44;
 	outopt[1] = 102;
 	outopt[2] = ucval;
-	telnet_send_option(&netcon->tn_data, outopt, 3);
+	telnet_send_option(netcon->tn_data, outopt, 3);
 	break;
 
     case 3: /* SET-PARITY */
@@ -4051,7 +6558,7 @@ com_port_handler(void *cb_data, unsigned char *option, int len)
 	outopt[0] = 44;
 	outopt[1] = 103;
 	outopt[2] = ucval;
-	telnet_send_option(&netcon->tn_data, outopt, 3);
+	telnet_send_option(netcon->tn_data, outopt, 3);
 	break;
 
     case 4: /* SET-STOPSIZE */
@@ -4064,7 +6571,7 @@ com_port_handler(void *cb_data, unsigned char *option, int len)
 	outopt[0] = 44;
 	outopt[1] = 104;
 	outopt[2] = ucval;
-	telnet_send_option(&netcon->tn_data, outopt, 3);
+	telnet_send_option(netcon->tn_data, outopt, 3);
 	break;
 
     case 5: /* SET-CONTROL */
@@ -4076,21 +6583,21 @@ com_port_handler(void *cb_data, unsigned char *option, int len)
 	outopt[0] = 44;
 	outopt[1] = 105;
 	outopt[2] = ucval;
-	telnet_send_option(&netcon->tn_data, outopt, 3);
+	telnet_send_option(netcon->tn_data, outopt, 3);
 	break;
 
     case 8: /* FLOWCONTROL-SUSPEND */
 	port->io.f->flow_control(&port->io, 1);
 	outopt[0] = 44;
 	outopt[1] = 108;
-	telnet_send_option(&netcon->tn_data, outopt, 2);
+	telnet_send_option(netcon->tn_data, outopt, 2);
 	break;
 
     case 9: /* FLOWCONTROL-RESUME */
 	port->io.f->flow_control(&port->io, 0);
 	outopt[0] = 44;
 	outopt[1] = 109;
-	telnet_send_option(&netcon->tn_data, outopt, 2);
+	telnet_send_option(netcon->tn_data, outopt, 2);
 	break;
 
     case 10: /* SET-LINESTATE-MASK */
@@ -4100,7 +6607,7 @@ com_port_handler(void *cb_data, unsigned char *option, int len)
 	outopt[0] = 44;
 	outopt[1] = 110;
 	outopt[2] = port->linestate_mask;
-	telnet_send_option(&netcon->tn_data, outopt, 3);
+	telnet_send_option(netcon->tn_data, outopt, 3);
 	break;
 
     case 11: /* SET-MODEMSTATE-MASK */
@@ -4110,7 +6617,7 @@ com_port_handler(void *cb_data, unsigned char *option, int len)
 	outopt[0] = 44;
 	outopt[1] = 111;
 	outopt[2] = port->modemstate_mask;
-	telnet_send_option(&netcon->tn_data, outopt, 3);
+	telnet_send_option(netcon->tn_data, outopt, 3);
 	break;
 
     case 12: /* PURGE_DATA */
@@ -4121,7 +6628,7 @@ com_port_handler(void *cb_data, unsigned char *option, int len)
 	outopt[0] = 44;
 	outopt[1] = 112;
 	outopt[2] = val;
-	telnet_send_option(&netcon->tn_data, outopt, 3);
+	telnet_send_option(netcon->tn_data, outopt, 3);
 	break;
 
     case 6: /* NOTIFY-LINESTATE */
@@ -4168,17 +6675,47 @@ init_dataxfer(void)
 	return ENOMEM;
 
     rotator_shutdown_wait = alloc_waiter(ser2net_sel, ser2net_wake_sig);
-    if (!rotator_shutdown_wait) {
-	free_waiter(rotator_shutdown_wait);
-	return ENOMEM;
-    }
+    if (!rotator_shutdown_wait)
+	goto out_nomem;
+
+    port_names_size = PORT_INIT_HASH_SIZE;
+    port_names = calloc(port_names_size, sizeof(*port_names));
+    if (!port_names)
+	goto out_nomem;
+
+    port_devs_size = PORT_INIT_HASH_SIZE;
+    port_devs = calloc(port_devs_size, sizeof(*port_devs));
+    if (!port_devs)
+	goto out_nomem;
+
+    port_cfgs_size = PORT_INIT_HASH_SIZE;
+    port_cfgs = calloc(port_cfgs_size, sizeof(*port_cfgs));
+    if (!port_cfgs)
+	goto out_nomem;
 
     return 0;
+
+ out_nomem:
+    shutdown_dataxfer();
+    return ENOMEM;
 }
 
 void
 shutdown_dataxfer(void)
 {
-    free_waiter(rotator_shutdown_wait);
-    free_waiter(acceptor_shutdown_wait);
+    if (port_cfgs)
+	free(port_cfgs);
+    port_cfgs = NULL;
+    if (port_devs)
+	free(port_devs);
+    port_devs = NULL;
+    if (port_names)
+	free(port_names);
+    port_names = NULL;
+    if (rotator_shutdown_wait)
+	free_waiter(rotator_shutdown_wait);
+    rotator_shutdown_wait = NULL;
+    if (acceptor_shutdown_wait)
+	free_waiter(acceptor_shutdown_wait);
+    acceptor_shutdown_wait = NULL;
 }
@@ -20,6 +20,7 @@
 #ifndef DATAXFER
 #define DATAXFER
 
+#include <stdint.h>
 #include "utils/utils.h"
 #include "controller.h"
 
@@ -37,22 +38,48 @@
 
 #endif /* linux */
 
-/* Create a port given the criteria. */
+/*
+ * What to do with a network connection that falls a full dev_to_net
+ * buffer behind the other connections on the port.
+ */
+#define LAG_POLICY_BLOCK	0 /* Stop reading the device. */
+#define LAG_POLICY_DROP		1 /* Drop the oldest data for it. */
+#define LAG_POLICY_DISCONNECT	2 /* Disconnect it. */
+extern struct enum_val lag_policy_enums[];
+
+/* Start reading a new configuration. */
+void start_port_config(void);
+
+/* Create a port given the criteria.  If a port with the same name was
+   made from the same config_hash, it is kept as it is. */
 int portconfig(struct absout *eout,
 	       char *portnum,
 	       char *state,
 	       char *timeout,
 	       char *devname,
 	       char *devcfg,
-	       int  config_num);
+	       int  config_num,
+	       uint64_t config_hash);
 
 /* Shut down all the ports, and provide a way to check when done. */
 void shutdown_ports(void);
 int check_ports_shutdown(void);
 
-/* Clear out any old ports on a reconfigure. */
+/*
+ * New ports are started by this many threads at once, 1 starts them
+ * in the thread reading the config.
+ */
+extern unsigned int num_startup_threads;
+
+/* Wait for the new ports from the config to be started. */
+void wait_port_startups(void);
+
+/* Clear out any old ports and rotators on a reconfigure. */
 void clear_old_port_config(int config_num);
 
+/* Show how long the last read of the config took and what it changed. */
+void showreload(struct controller_info *cntlr);
+
 /* Initialize the data transfer code. */
 void dataxfer_init(void);
 
@@ -64,6 +91,10 @@ void showports(struct controller_info *cntlr, char *portspec);
 /* Show information about a port (as above) but in a one-line format. */
 void showshortports(struct controller_info *cntlr, char *portspec);
 
+/* Show the statistics counters for a port (or all ports) as
+   key=value pairs, one line per port and one per connection. */
+void showstats(struct controller_info *cntlr, char *portspec);
+
 /* Set the port's timeout.  The parameters are all strings that the
    routine will convert to integers.  Error output will be generated
    on invalid data. */
@@ -122,7 +153,7 @@ int solcfg_init(struct devio *io, struct absout *eout, const char *instr,
 				   const char *item),
 		void *data);
 
-int add_rotator(char *portname, char *ports, int lineno);
+int add_rotator(char *portname, char *ports, int lineno, int config_num);
 void free_rotators(void);
 
 #endif /* DATAXFER */
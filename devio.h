@@ -24,6 +24,7 @@
 
 struct absout;
 struct devio_f;
+struct selector_s;
 
 struct devio {
     char *devname;
@@ -32,6 +33,9 @@ struct devio {
     void *my_data;
     struct devio_f *f;
 
+    /* The selector the device's fd and timers go on, set by the user. */
+    struct selector_s *sel;
+
     void *user_data;
     void (*read_handler)(struct devio *io);
     void (*write_handler)(struct devio *io);
@@ -49,11 +53,25 @@ struct devio_f {
 	    void *data);
     int (*read)(struct devio *io, void *buf, size_t size);
     int (*write)(struct devio *io, void *buf, size_t size);
+    /*
+     * Optional.  Move up to size bytes from the device into the write
+     * end of pipefd without copying.  Returns like read().
+     */
+    int (*splice_read)(struct devio *io, int pipefd, size_t size);
     void (*read_handler_enable)(struct devio *io, int enabled);
     void (*write_handler_enable)(struct devio *io, int enabled);
     void (*except_handler_enable)(struct devio *io, int enabled);
     int (*send_break)(struct devio *io);
     int (*get_modem_state)(struct devio *io, unsigned char *val);
+    /*
+     * Optional.  Start or stop reporting modem line changes through
+     * the modem_state_handler as they happen.  Returns -1 if the
+     * device can't do this, the user should poll get_modem_state
+     * instead.  If the device stops being able to do it later, the
+     * handler is called with -1, and the user should turn it off
+     * before turning it on again.
+     */
+    int (*modem_state_notify)(struct devio *io, int enabled);
     int (*set_devcontrol)(struct devio *io, const char *controls);
     void (*show_devcontrol)(struct devio *io, struct absout *out);
     void (*show_devcfg)(struct devio *io, struct absout *out);
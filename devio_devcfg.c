@@ -18,6 +18,7 @@
  */
 
 /* This code handles generating the configuration for the serial port. */
+#define _GNU_SOURCE /* For splice() */
 #include <unistd.h>
 #include <stdint.h>
 #include <termios.h>
@@ -31,6 +32,9 @@
 #include <signal.h>
 #include <errno.h>
 #include <syslog.h>
+#ifdef USE_PTHREADS
+#include <pthread.h>
+#endif
 
 #include "utils/selector.h"
 #include "utils/utils.h"
@@ -42,6 +46,10 @@
 
 #include <assert.h>
 
+#if defined(USE_PTHREADS) && defined(TIOCMIWAIT) && defined(TIOCGICOUNT)
+#define DEVCFG_MODEM_WATCH
+#endif
+
 struct devcfg_data {
     /* Information about the terminal device. */
     char           *devname;		/* The full path to the device */
@@ -64,7 +72,26 @@ struct devcfg_data {
     int disablebreak;
 
 #if HAVE_DECL_TIOCSRS485
-    struct serial_rs485 *rs485conf;
+    /*
+     * A copy, the named configs are freed on a config reload and the
+     * port may be kept if its config didn't change.
+     */
+    struct serial_rs485 rs485conf;
+#endif
+
+#ifdef DEVCFG_MODEM_WATCH
+    /*
+     * A thread that waits in TIOCMIWAIT for the modem lines to change
+     * and writes to modem_pipe to wake up the selector.  See
+     * devcfg_modem_state_notify().
+     */
+    int modem_watching;
+    pthread_t modem_thread;
+    volatile int modem_thread_stop;
+    volatile int modem_thread_done;
+    volatile int modem_thread_failed;	/* TIOCMIWAIT stopped working. */
+    int modem_pipe[2];
+    struct serial_icounter_struct icount;
 #endif
 };
 
@@ -157,7 +184,12 @@ devconfig(struct devcfg_data *d, struct absout *eout, const char *instr,
 #if HAVE_DECL_TIOCSRS485
 	} else if (cmpstrval(pos, "rs485=", &val)) {
 	    /* get RS485 configuration. */
-	    d->rs485conf = find_rs485conf(val);
+	    struct serial_rs485 *conf = find_rs485conf(val);
+
+	    if (conf)
+		d->rs485conf = *conf;
+	    else
+		memset(&d->rs485conf, 0, sizeof(d->rs485conf));
 #endif
 	} else {
 	    rv = otherconfig(data, eout, pos);
@@ -391,6 +423,195 @@ static int calc_bpc(struct devcfg_data *d)
     return size;
 }
 
+#ifdef DEVCFG_MODEM_WATCH
+static void *
+devcfg_modem_thread(void *cb_data)
+{
+    struct devcfg_data *d = cb_data;
+    sigset_t sigset;
+    char c;
+    int rv;
+
+    /* The wake signal is what gets us out of the ioctl to stop. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, ser2net_wake_sig);
+    pthread_sigmask(SIG_UNBLOCK, &sigset, NULL);
+
+    while (!d->modem_thread_stop) {
+	rv = ioctl(d->devfd, TIOCMIWAIT,
+		   TIOCM_CD | TIOCM_RI | TIOCM_DSR | TIOCM_CTS);
+	if (rv == -1 && errno == EINTR)
+	    continue;
+	/*
+	 * Set before the write, if the pipe is full the selector
+	 * already has a wakeup and sees this after it reads.
+	 */
+	if (rv == -1)
+	    d->modem_thread_failed = 1;
+	c = 0;
+	rv = write(d->modem_pipe[1], &c, 1);
+	if (d->modem_thread_failed)
+	    break;
+    }
+
+    d->modem_thread_done = 1;
+    return NULL;
+}
+
+/* Convert the modem lines to an RFC2217 modem state. */
+static unsigned char
+devcfg_modemstate(int val)
+{
+    unsigned char modemstate = 0;
+
+    if (val & TIOCM_CD)
+	modemstate |= 0x80;
+    if (val & TIOCM_RI)
+	modemstate |= 0x40;
+    if (val & TIOCM_DSR)
+	modemstate |= 0x20;
+    if (val & TIOCM_CTS)
+	modemstate |= 0x10;
+    return modemstate;
+}
+
+static void
+devcfg_modem_pipe_read(int fd, void *cb_data)
+{
+    struct devio *io = cb_data;
+    struct devcfg_data *d = io->my_data;
+    struct serial_icounter_struct icount;
+    unsigned char modemstate;
+    char buf[16];
+    int val;
+
+    while (read(fd, buf, sizeof(buf)) > 0)
+	;
+
+    if (d->modem_thread_failed) {
+	/*
+	 * The driver can't do it, tell the user to poll.  The user
+	 * turns the watch off, which cleans up the thread, so it can
+	 * be started again.
+	 */
+	io->modem_state_handler(io, -1);
+	return;
+    }
+
+    if (ioctl(d->devfd, TIOCMGET, &val) == -1)
+	return;
+    modemstate = devcfg_modemstate(val);
+
+    /*
+     * The counters catch changes that came and went before we got
+     * here, report those as deltas.
+     */
+    if (ioctl(d->devfd, TIOCGICOUNT, &icount) == 0) {
+	if (icount.cts != d->icount.cts)
+	    modemstate |= 0x01;
+	if (icount.dsr != d->icount.dsr)
+	    modemstate |= 0x02;
+	if (icount.rng != d->icount.rng)
+	    modemstate |= 0x04;
+	if (icount.dcd != d->icount.dcd)
+	    modemstate |= 0x08;
+	d->icount = icount;
+    }
+
+    io->modem_state_handler(io, modemstate);
+}
+
+static void
+devcfg_modem_pipe_cleared(int fd, void *cb_data)
+{
+    close(fd);
+}
+
+static void
+devcfg_modem_watch_stop(struct devio *io)
+{
+    struct devcfg_data *d = io->my_data;
+    struct timespec delay = { 0, 1000000 };
+
+    if (!d->modem_watching)
+	return;
+    d->modem_watching = 0;
+
+    /*
+     * Keep kicking it until it notices, the signal can come just
+     * before it goes into the ioctl.
+     */
+    d->modem_thread_stop = 1;
+    while (!d->modem_thread_done) {
+	pthread_kill(d->modem_thread, ser2net_wake_sig);
+	nanosleep(&delay, NULL);
+    }
+    pthread_join(d->modem_thread, NULL);
+
+    /* The read end is closed when the selector is done with it. */
+    close(d->modem_pipe[1]);
+    sel_clear_fd_handlers(io->sel, d->modem_pipe[0]);
+}
+
+static int
+devcfg_modem_watch_start(struct devio *io)
+{
+    struct devcfg_data *d = io->my_data;
+    int rv;
+
+    if (d->modem_watching)
+	return 0;
+
+    /* Drivers that support TIOCMIWAIT support this, too. */
+    if (ioctl(d->devfd, TIOCGICOUNT, &d->icount) == -1)
+	return -1;
+
+    if (pipe(d->modem_pipe) == -1)
+	return -1;
+    fcntl(d->modem_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(d->modem_pipe[1], F_SETFL, O_NONBLOCK);
+
+    rv = sel_set_fd_handlers(io->sel, d->modem_pipe[0], io,
+			     devcfg_modem_pipe_read, NULL, NULL,
+			     devcfg_modem_pipe_cleared);
+    if (rv)
+	goto out_err;
+
+    d->modem_thread_stop = 0;
+    d->modem_thread_done = 0;
+    d->modem_thread_failed = 0;
+    rv = pthread_create(&d->modem_thread, NULL, devcfg_modem_thread, d);
+    if (rv) {
+	close(d->modem_pipe[1]);
+	sel_clear_fd_handlers(io->sel, d->modem_pipe[0]);
+	return -1;
+    }
+    sel_set_fd_read_handler(io->sel, d->modem_pipe[0],
+			    SEL_FD_HANDLER_ENABLED);
+    d->modem_watching = 1;
+    return 0;
+
+ out_err:
+    close(d->modem_pipe[0]);
+    close(d->modem_pipe[1]);
+    return -1;
+}
+#endif
+
+static int
+devcfg_modem_state_notify(struct devio *io, int enabled)
+{
+#ifdef DEVCFG_MODEM_WATCH
+    if (!enabled) {
+	devcfg_modem_watch_stop(io);
+	return 0;
+    }
+    return devcfg_modem_watch_start(io);
+#else
+    return -1;
+#endif
+}
+
 static void
 devcfg_finish_shutdown(struct devio *io)
 {
@@ -463,6 +684,13 @@ static int devcfg_setup(struct devio *io, const char *name, const char **errstr,
     int options;
     int rv;
 
+    /* The port's selector is not known yet in devcfg_init(). */
+    if (!d->shutdown_timer &&
+	sel_alloc_timer(io->sel, shutdown_timeout, io, &d->shutdown_timer)) {
+	*errstr = "Could not allocate shutdown timer\r\n";
+	return -1;
+    }
+
     *termctl = d->default_termctl;
 
     rv = uucp_mk_lock(io->devname);
@@ -518,19 +746,17 @@ static int devcfg_setup(struct devio *io, const char *name, const char **errstr,
     }
 
 #if HAVE_DECL_TIOCSRS485
-    if (d->rs485conf) {
-        if (d->rs485conf->flags & SER_RS485_ENABLED) {
-            if (ioctl(d->devfd , TIOCSRS485, d->rs485conf ) < 0) {
-                syslog(LOG_ERR, "Could not set RS485 config for device %s port %s: %m",
-                       io->devname,
-                       name);
-                return -1;
-            }
+    if (d->rs485conf.flags & SER_RS485_ENABLED) {
+        if (ioctl(d->devfd , TIOCSRS485, &d->rs485conf ) < 0) {
+            syslog(LOG_ERR, "Could not set RS485 config for device %s port %s: %m",
+                   io->devname,
+                   name);
+            return -1;
         }
     }
 #endif
 
-    rv = sel_set_fd_handlers(ser2net_sel, d->devfd, io,
+    rv = sel_set_fd_handlers(io->sel, d->devfd, io,
 			     io->read_disabled ? NULL : do_read,
 			     do_write, do_except, devfd_fd_cleared);
     if (rv) {
@@ -546,6 +772,7 @@ static void devcfg_shutdown(struct devio *io,
 {
     struct devcfg_data *d = io->my_data;
 
+    devcfg_modem_state_notify(io, 0);
     if (d->devfd != -1) {
 	d->shutdown_done = shutdown_done;
 	/*
@@ -553,7 +780,7 @@ static void devcfg_shutdown(struct devio *io,
 	 * take to send the pending data based upon baud and count.
 	 */
 	d->shutdown_retries = 200; /* 2 seconds. */
-	sel_clear_fd_handlers(ser2net_sel, d->devfd);
+	sel_clear_fd_handlers(io->sel, d->devfd);
     } else {
 	shutdown_done(io);
     }
@@ -573,11 +800,21 @@ static int devcfg_write(struct devio *io, void *buf, size_t size)
     return write(d->devfd, buf, size);
 }
 
+#ifdef HAVE_SPLICE
+static int devcfg_splice_read(struct devio *io, int pipefd, size_t size)
+{
+    struct devcfg_data *d = io->my_data;
+
+    return splice(d->devfd, NULL, pipefd, NULL, size,
+		  SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+}
+#endif
+
 static void devcfg_read_handler_enable(struct devio *io, int enabled)
 {
     struct devcfg_data *d = io->my_data;
 
-    sel_set_fd_read_handler(ser2net_sel, d->devfd,
+    sel_set_fd_read_handler(io->sel, d->devfd,
 			    enabled ? SEL_FD_HANDLER_ENABLED :
 			    SEL_FD_HANDLER_DISABLED);
 }
@@ -586,7 +823,7 @@ static void devcfg_write_handler_enable(struct devio *io, int enabled)
 {
     struct devcfg_data *d = io->my_data;
 
-    sel_set_fd_write_handler(ser2net_sel, d->devfd,
+    sel_set_fd_write_handler(io->sel, d->devfd,
 			     enabled ? SEL_FD_HANDLER_ENABLED :
 			     SEL_FD_HANDLER_DISABLED);
 }
@@ -595,7 +832,7 @@ static void devcfg_except_handler_enable(struct devio *io, int enabled)
 {
     struct devcfg_data *d = io->my_data;
 
-    sel_set_fd_except_handler(ser2net_sel, d->devfd,
+    sel_set_fd_except_handler(io->sel, d->devfd,
 			      enabled ? SEL_FD_HANDLER_ENABLED :
 			      SEL_FD_HANDLER_DISABLED);
 }
@@ -616,15 +853,7 @@ static int devcfg_get_modem_state(struct devio *io, unsigned char *modemstate)
     if (ioctl(d->devfd, TIOCMGET, &val) != 0)
 	return -1;
 
-    *modemstate = 0;
-    if (val & TIOCM_CD)
-	*modemstate |= 0x80;
-    if (val & TIOCM_RI)
-	*modemstate |= 0x40;
-    if (val & TIOCM_DSR)
-	*modemstate |= 0x20;
-    if (val & TIOCM_CTS)
-	*modemstate |= 0x10;
+    *modemstate = devcfg_modemstate(val);
     return 0;
 }
 
@@ -936,10 +1165,12 @@ static void devcfg_free(struct devio *io)
 {
     struct devcfg_data *d = io->my_data;
 
+    devcfg_modem_state_notify(io, 0);
     if (d->devfd != -1)
 	close(d->devfd);
     io->my_data = NULL;
-    sel_free_timer(d->shutdown_timer);
+    if (d->shutdown_timer)
+	sel_free_timer(d->shutdown_timer);
     free(d);
 }
 
@@ -960,11 +1191,15 @@ static struct devio_f devcfg_io_f = {
     .reconfig = devcfg_reconfig,
     .read = devcfg_read,
     .write = devcfg_write,
+#ifdef HAVE_SPLICE
+    .splice_read = devcfg_splice_read,
+#endif
     .read_handler_enable = devcfg_read_handler_enable,
     .write_handler_enable = devcfg_write_handler_enable,
     .except_handler_enable = devcfg_except_handler_enable,
     .send_break = devcfg_send_break,
     .get_modem_state = devcfg_get_modem_state,
+    .modem_state_notify = devcfg_modem_state_notify,
     .set_devcontrol = devcfg_set_devcontrol,
     .show_devcontrol = devcfg_show_devcontrol,
     .show_devcfg = devcfg_show_devcfg,
@@ -993,14 +1228,7 @@ devcfg_init(struct devio *io, struct absout *eout, const char *instr,
     memset(d, 0, sizeof(*d));
     d->devfd = -1;
 
-    if (sel_alloc_timer(ser2net_sel, shutdown_timeout, io,
-			&d->shutdown_timer)) {
-	free(d);
-	return -1;
-    }
-
     if (devconfig(d, eout, instr, otherconfig, data) == -1) {
-	sel_free_timer(d->shutdown_timer);
 	free(d);
 	return -1;
     }
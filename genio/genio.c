@@ -23,6 +23,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/uio.h>
 #include "utils/utils.h"
 #include "genio.h"
 #include "genio_internal.h"
@@ -262,6 +263,59 @@ genio_write(struct genio *io, unsigned int *count,
     return io->funcs->write(io, count, buf, buflen);
 }
 
+int
+genio_writev(struct genio *io, unsigned int *count,
+	     const struct genio_sg *sg, unsigned int sglen)
+{
+    unsigned int i, total = 0, written;
+    int err = 0;
+
+    if (io->funcs->writev)
+	return io->funcs->writev(io, count, sg, sglen);
+
+    /* No native support, do them one at a time. */
+    for (i = 0; i < sglen; i++) {
+	if (sg[i].buflen == 0)
+	    continue;
+	err = io->funcs->write(io, &written, sg[i].buf, sg[i].buflen);
+	if (err)
+	    return err;
+	total += written;
+	if (written < sg[i].buflen)
+	    break;
+    }
+
+    if (count)
+	*count = total;
+    return 0;
+}
+
+unsigned int
+genio_sg_to_iov(const struct genio_sg *sg, unsigned int sglen,
+		struct iovec *iov, unsigned int maxiov)
+{
+    unsigned int i, n = 0;
+
+    for (i = 0; i < sglen && n < maxiov; i++) {
+	if (sg[i].buflen == 0)
+	    continue;
+	iov[n].iov_base = (void *) sg[i].buf;
+	iov[n].iov_len = sg[i].buflen;
+	n++;
+    }
+
+    return n;
+}
+
+int
+genio_write_from_pipe(struct genio *io, unsigned int *count,
+		      int pipefd, unsigned int len)
+{
+    if (!io->funcs->write_from_pipe)
+	return ENOTSUP;
+    return io->funcs->write_from_pipe(io, count, pipefd, len);
+}
+
 int
 genio_raddr_to_str(struct genio *io, int *pos,
 		   char *buf, unsigned int buflen)
@@ -418,6 +472,14 @@ genio_acc_connect(struct genio_acceptor *acceptor, void *addr,
 				    new_io);
 }
 
+int
+genio_acc_reload(struct genio_acceptor *acceptor)
+{
+    if (!acceptor->funcs->reload)
+	return ENOTSUP;
+    return acceptor->funcs->reload(acceptor);
+}
+
 bool
 genio_acc_exit_on_close(struct genio_acceptor *acceptor)
 {
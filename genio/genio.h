@@ -54,9 +54,15 @@ struct genio_os_funcs {
     /* Return allocated and zeroed data.  Return NULL on error. */
     void *(*zalloc)(struct genio_os_funcs *f, unsigned int size);
 
-    /* Free data allocated by zalloc. */
+    /* Free data allocated by zalloc or alloc. */
     void (*free)(struct genio_os_funcs *f, void *data);
 
+    /*
+     * Return allocated data that is not zeroed, for buffers that are
+     * always written before they are read.  Return NULL on error.
+     */
+    void *(*alloc)(struct genio_os_funcs *f, unsigned int size);
+
     /****** Mutexes ******/
     /* Allocate a lock.  Return NULL on error. */
     struct genio_lock *(*alloc_lock)(struct genio_os_funcs *f);
@@ -305,6 +311,39 @@ void genio_set_user_data(struct genio *io, void *user_data);
 int genio_write(struct genio *io, unsigned int *count,
 		const void *buf, unsigned int buflen);
 
+/*
+ * One piece of the data for genio_writev().
+ */
+struct genio_sg {
+    const void *buf;
+    unsigned int buflen;
+};
+
+/*
+ * Like genio_write(), but write the sglen buffers in sg one after
+ * the other, as if they were one buffer.  Where possible this is
+ * done in a single system call, so the pieces go out together.
+ * count is set to the total number of bytes consumed; the buffers
+ * are consumed in order, so a short count may end in the middle of
+ * any of them.
+ */
+int genio_writev(struct genio *io, unsigned int *count,
+		 const struct genio_sg *sg, unsigned int sglen);
+
+/*
+ * Like genio_write(), but move up to len bytes out of the read end
+ * of a pipe straight into the connection with splice(), so the data
+ * never has to be copied into user space.  This is only possible on
+ * connections that do no processing on the data (no SSL, telnet,
+ * etc.) and are backed by a file descriptor.  Returns ENOTSUP if
+ * the connection can't do this; a len of zero may be used to check
+ * that without moving any data.
+ *
+ * Errors and count work the same as genio_write().
+ */
+int genio_write_from_pipe(struct genio *io, unsigned int *count,
+			  int pipefd, unsigned int len);
+
 /*
  * Convert the remote address for this network connection to a
  * string.  The string starts at buf + *pos and goes to buf +
@@ -447,6 +486,14 @@ int genio_acc_connect(struct genio_acceptor *acceptor, void *addr,
 		      void (*connect_done)(struct genio *io, int err,
 					   void *cb_data),
 		      void *cb_data, struct genio **new_io);
+/*
+ * Reload any state the acceptor caches from outside sources (like
+ * SSL certificates and keys) so new connections will use the new
+ * data.  Existing connections are not affected.  Returns ENOTSUP if
+ * the acceptor has nothing to reload.
+ */
+int genio_acc_reload(struct genio_acceptor *acceptor);
+
 /*
  * Returns if the acceptor requests exit on close.  A hack for stdio.
  */
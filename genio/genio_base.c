@@ -214,12 +214,12 @@ filter_try_disconnect(struct basen_data *ndata, struct timeval *timeout)
 static int
 filter_ul_write(struct basen_data *ndata, genio_ul_filter_data_handler handler,
 		unsigned int *rcount,
-		const unsigned char *buf, unsigned int buflen)
+		const struct genio_sg *sg, unsigned int sglen)
 {
     if (ndata->filter)
 	return ndata->filter_ops->ul_write(ndata->filter, handler,
-					   ndata, rcount, buf, buflen);
-    return handler(ndata, rcount, buf, buflen);
+					   ndata, rcount, sg, sglen);
+    return handler(ndata, rcount, sg, sglen);
 }	     
 
 static int
@@ -260,9 +260,20 @@ filter_cleanup(struct basen_data *ndata)
 
 static int
 ll_write(struct basen_data *ndata, unsigned int *rcount,
-	 const unsigned char *buf, unsigned int buflen)
+	 const struct genio_sg *sg, unsigned int sglen)
+{
+    if (sglen == 1)
+	return ndata->ll_ops->write(ndata->ll, rcount, sg->buf, sg->buflen);
+    return ndata->ll_ops->writev(ndata->ll, rcount, sg, sglen);
+}
+
+static int
+ll_write_from_pipe(struct basen_data *ndata, unsigned int *rcount,
+		   int pipefd, unsigned int len)
 {
-    return ndata->ll_ops->write(ndata->ll, rcount, buf, buflen);
+    if (!ndata->ll_ops->write_from_pipe)
+	return ENOTSUP;
+    return ndata->ll_ops->write_from_pipe(ndata->ll, rcount, pipefd, len);
 }
 
 static int
@@ -302,7 +313,7 @@ ll_close(struct basen_data *ndata, genio_ll_close_done done, void *close_data)
 {
     int err;
 
-    err = ndata->ll_ops->close(ndata->ll, done, ndata);
+    err = ndata->ll_ops->close(ndata->ll, done, close_data);
     if (err == EINPROGRESS) {
 	basen_ref(ndata);
     } else {
@@ -339,33 +350,79 @@ basen_set_ll_enables(struct basen_data *ndata)
 static int
 basen_write_data_handler(void *cb_data,
 			 unsigned int *rcount,
-			 const unsigned char *buf,
-			 unsigned int buflen)
+			 const struct genio_sg *sg,
+			 unsigned int sglen)
 {
     struct basen_data *ndata = cb_data;
 
-    return ll_write(ndata, rcount, buf, buflen);
+    return ll_write(ndata, rcount, sg, sglen);
+}
+
+static int
+basen_writev(struct genio *net, unsigned int *rcount,
+	     const struct genio_sg *sg, unsigned int sglen)
+{
+    struct basen_data *ndata = mygenio_to_basen(net);
+    int err = 0;
+
+    basen_lock(ndata);
+    if (ndata->state != BASEN_OPEN) {
+	err = EBADF;
+	goto out_unlock;
+    }
+    if (ndata->saved_xmit_err) {
+	err = ndata->saved_xmit_err;
+	ndata->saved_xmit_err = 0;
+	goto out_unlock;
+    }
+
+    err = filter_ul_write(ndata, basen_write_data_handler, rcount, sg, sglen);
+
+ out_unlock:
+    basen_set_ll_enables(ndata);
+    basen_unlock(ndata);
+
+    return err;
 }
 
 static int
 basen_write(struct genio *net, unsigned int *rcount,
 	    const void *buf, unsigned int buflen)
+{
+    struct genio_sg sg = { buf, buflen };
+
+    return basen_writev(net, rcount, &sg, 1);
+}
+
+static int
+basen_write_from_pipe(struct genio *net, unsigned int *rcount,
+		      int pipefd, unsigned int len)
 {
     struct basen_data *ndata = mygenio_to_basen(net);
     int err = 0;
 
+    /* A filter has to see all the data, so this can't bypass it. */
+    if (ndata->filter || !ndata->ll_ops->write_from_pipe)
+	return ENOTSUP;
+
     basen_lock(ndata);
     if (ndata->state != BASEN_OPEN) {
 	err = EBADF;
 	goto out_unlock;
     }
+    if (len == 0) {
+	/* Just checking if this works, leave any saved error alone. */
+	if (rcount)
+	    *rcount = 0;
+	goto out_unlock;
+    }
     if (ndata->saved_xmit_err) {
 	err = ndata->saved_xmit_err;
 	ndata->saved_xmit_err = 0;
 	goto out_unlock;
     }
 
-    err = filter_ul_write(ndata, basen_write_data_handler, rcount, buf, buflen);
+    err = ll_write_from_pipe(ndata, rcount, pipefd, len);
 
  out_unlock:
     basen_set_ll_enables(ndata);
@@ -803,6 +860,7 @@ basen_set_write_callback_enable(struct genio *net, bool enabled)
 
 static const struct genio_functions basen_net_funcs = {
     .write = basen_write,
+    .writev = basen_writev,
     .raddr_to_str = basen_raddr_to_str,
     .get_raddr = basen_get_raddr,
     .remote_id = basen_remote_id,
@@ -811,7 +869,8 @@ static const struct genio_functions basen_net_funcs = {
     .free = basen_free,
     .ref = basen_do_ref,
     .set_read_callback_enable = basen_set_read_callback_enable,
-    .set_write_callback_enable = basen_set_write_callback_enable
+    .set_write_callback_enable = basen_set_write_callback_enable,
+    .write_from_pipe = basen_write_from_pipe
 };
 
 static unsigned int
@@ -28,8 +28,8 @@ struct genio_filter {
 
 typedef int (*genio_ul_filter_data_handler)(void *cb_data,
 					    unsigned int *rcount,
-					    const unsigned char *buf,
-					    unsigned int buflen);
+					    const struct genio_sg *sg,
+					    unsigned int sglen);
 
 typedef int (*genio_ll_filter_data_handler)(void *cb_data,
 					    unsigned int *rcount,
@@ -85,14 +85,15 @@ struct genio_filter_ops {
     int (*try_disconnect)(struct genio_filter *filter, struct timeval *timeout);
 
     /*
-     * Write data into the top of the filter.  If no data is provided
-     * (buf is NULL) then this will just attempt to write any pending
+     * Write data into the top of the filter, the buffers in sg are
+     * taken in order as one piece of data.  If no data is provided
+     * (sglen is 0) then this will just attempt to write any pending
      * data out of the bottom of the filter into the handler.
      */
     int (*ul_write)(struct genio_filter *filter,
 		    genio_ul_filter_data_handler handler, void *cb_data,
 		    unsigned int *rcount,
-		    const unsigned char *buf, unsigned int buflen);
+		    const struct genio_sg *sg, unsigned int sglen);
 
     /*
      * Write data into the bottom of the filter.  If no data is
@@ -118,10 +119,23 @@ int genio_ssl_filter_alloc(struct genio_os_funcs *o, char *args[],
 			   unsigned int max_read_size,
 			   struct genio_filter **rfilter);
 
+/*
+ * Server SSL contexts are expensive to create (they read and parse
+ * the key and certificates), so an acceptor creates one and shares
+ * it between all the filters it allocates.  Each filter holds its
+ * own reference to the context, so the acceptor may free or replace
+ * its context at any time.
+ */
+struct ssl_ctx_st;
+int genio_ssl_server_ctx_alloc(struct genio_os_funcs *o,
+			       char *keyfile,
+			       char *certfile,
+			       char *CAfilepath,
+			       struct ssl_ctx_st **rctx);
+void genio_ssl_server_ctx_free(struct ssl_ctx_st *ctx);
+
 int genio_ssl_server_filter_alloc(struct genio_os_funcs *o,
-				  char *keyfile,
-				  char *certfile,
-				  char *CAfilepath,
+				  struct ssl_ctx_st *ctx,
 				  unsigned int max_read_size,
 				  unsigned int max_write_size,
 				  struct genio_filter **rfilter);
@@ -181,6 +195,10 @@ struct genio_ll_ops {
     int (*write)(struct genio_ll *ll, unsigned int *rcount,
 		 const unsigned char *buf, unsigned int buflen);
 
+    /* Write the buffers in sg in order, all at once if possible. */
+    int (*writev)(struct genio_ll *ll, unsigned int *rcount,
+		  const struct genio_sg *sg, unsigned int sglen);
+
     int (*raddr_to_str)(struct genio_ll *ll, int *pos,
 			char *buf, unsigned int buflen);
 
@@ -207,6 +225,13 @@ struct genio_ll_ops {
     void (*set_write_callback_enable)(struct genio_ll *ll, bool enabled);
 
     void (*free)(struct genio_ll *ll);
+
+    /*
+     * Optional, move data from the given pipe to the ll without
+     * copying it.  Only used if there is no filter.
+     */
+    int (*write_from_pipe)(struct genio_ll *ll, unsigned int *rcount,
+			   int pipefd, unsigned int len);
 };
 
 enum genio_ll_close_state {
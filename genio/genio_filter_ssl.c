@@ -217,31 +217,40 @@ static int
 ssl_ul_write(struct genio_filter *filter,
 	     genio_ul_filter_data_handler handler, void *cb_data,
 	     unsigned int *rcount,
-	     const unsigned char *buf, unsigned int buflen)
+	     const struct genio_sg *sg, unsigned int sglen)
 {
     struct ssl_filter *sfilter = filter_to_ssl(filter);
+    unsigned int i, len, count = 0;
     int err = 0;
 
     ssl_lock(sfilter);
-    if (sfilter->write_data_len || buflen == 0) {
-	if (rcount)
-	    *rcount = 0;
-    } else {
-	if (buflen > sfilter->max_write_size)
-	    buflen = sfilter->max_write_size;
-	memcpy(sfilter->write_data, buf, buflen);
-	sfilter->write_data_len = buflen;
-	*rcount = buflen;
-	buflen = 0;
+    if (!sfilter->write_data_len) {
+	/*
+	 * Gather the buffers so they go out in as few SSL records as
+	 * possible.
+	 */
+	for (i = 0; i < sglen; i++) {
+	    len = sg[i].buflen;
+	    if (len > sfilter->max_write_size - sfilter->write_data_len)
+		len = sfilter->max_write_size - sfilter->write_data_len;
+	    memcpy(sfilter->write_data + sfilter->write_data_len,
+		   sg[i].buf, len);
+	    sfilter->write_data_len += len;
+	    count += len;
+	    if (len < sg[i].buflen)
+		break;
+	}
     }
+    if (rcount)
+	*rcount = count;
 
  restart:
     if (sfilter->xmit_buf_len) {
+	struct genio_sg xsg = { sfilter->xmit_buf + sfilter->xmit_buf_pos,
+				sfilter->xmit_buf_len - sfilter->xmit_buf_pos };
 	unsigned int written;
 
-	err = handler(cb_data, &written,
-		      sfilter->xmit_buf + sfilter->xmit_buf_pos,
-		      sfilter->xmit_buf_len - sfilter->xmit_buf_pos);
+	err = handler(cb_data, &written, &xsg, 1);
 	if (err) {
 	    sfilter->xmit_buf_len = 0;
 	} else {
@@ -447,7 +456,6 @@ genio_ssl_filter_raw_alloc(struct genio_os_funcs *o,
     
     sfilter->o = o;
     sfilter->is_client = is_client;
-    sfilter->ctx = ctx;
     sfilter->max_write_size = max_write_size;
     sfilter->max_read_size = max_read_size;
 
@@ -455,14 +463,16 @@ genio_ssl_filter_raw_alloc(struct genio_os_funcs *o,
     if (!sfilter->lock)
 	goto out_nomem;
 
-    sfilter->read_data = o->zalloc(o, max_read_size);
+    sfilter->read_data = o->alloc(o, max_read_size);
     if (!sfilter->read_data)
 	goto out_nomem;
 
-    sfilter->write_data = o->zalloc(o, max_write_size);
-    if (!sfilter->read_data)
+    sfilter->write_data = o->alloc(o, max_write_size);
+    if (!sfilter->write_data)
 	goto out_nomem;
 
+    /* Only take the ctx on success, the caller frees it on failure. */
+    sfilter->ctx = ctx;
     sfilter->filter.ops = &ssl_filter_ops;
     return &sfilter->filter;
 
@@ -472,16 +482,13 @@ genio_ssl_filter_raw_alloc(struct genio_os_funcs *o,
 }
 
 int
-genio_ssl_server_filter_alloc(struct genio_os_funcs *o,
-			      char *keyfile,
-			      char *certfile,
-			      char *CAfilepath,
-			      unsigned int max_read_size,
-			      unsigned int max_write_size,
-			      struct genio_filter **rfilter)
+genio_ssl_server_ctx_alloc(struct genio_os_funcs *o,
+			   char *keyfile,
+			   char *certfile,
+			   char *CAfilepath,
+			   SSL_CTX **rctx)
 {
-    SSL_CTX *ctx = NULL;
-    struct genio_filter *filter;
+    SSL_CTX *ctx;
 
     genio_ssl_initialize(o);
 
@@ -507,6 +514,36 @@ genio_ssl_server_filter_alloc(struct genio_os_funcs *o,
     if (!SSL_CTX_check_private_key(ctx))
         goto err;
 
+    *rctx = ctx;
+    return 0;
+
+ err:
+    SSL_CTX_free(ctx);
+    return EINVAL;
+}
+
+void
+genio_ssl_server_ctx_free(SSL_CTX *ctx)
+{
+    SSL_CTX_free(ctx);
+}
+
+int
+genio_ssl_server_filter_alloc(struct genio_os_funcs *o,
+			      SSL_CTX *ctx,
+			      unsigned int max_read_size,
+			      unsigned int max_write_size,
+			      struct genio_filter **rfilter)
+{
+    struct genio_filter *filter;
+
+    /* The filter frees its ctx, so it needs its own reference. */
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    CRYPTO_add(&ctx->references, 1, CRYPTO_LOCK_SSL_CTX);
+#else
+    SSL_CTX_up_ref(ctx);
+#endif
+
     filter = genio_ssl_filter_raw_alloc(o, false, ctx,
 					max_read_size, max_write_size);
 
@@ -517,10 +554,6 @@ genio_ssl_server_filter_alloc(struct genio_os_funcs *o,
 
     *rfilter = filter;
     return 0;
-
- err:
-    SSL_CTX_free(ctx);
-    return EINVAL;
 }
 
 int
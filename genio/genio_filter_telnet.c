@@ -175,10 +175,11 @@ telnet_buffer_do_write(void *cb_data, void *buf, size_t buflen,
 		       size_t *written)
 {
     struct telnet_buffer_data *data = cb_data;
+    struct genio_sg sg = { buf, buflen };
     unsigned int count;
     int err;
 
-    err = data->handler(data->cb_data, &count, buf, buflen);
+    err = data->handler(data->cb_data, &count, &sg, 1);
     if (!err)
 	*written = count;
     return err;
@@ -188,23 +189,32 @@ static int
 telnet_ul_write(struct genio_filter *filter,
 	     genio_ul_filter_data_handler handler, void *cb_data,
 	     unsigned int *rcount,
-	     const unsigned char *buf, unsigned int buflen)
+	     const struct genio_sg *sg, unsigned int sglen)
 {
     struct telnet_filter *tfilter = filter_to_telnet(filter);
+    unsigned int i, count = 0;
     int err = 0;
 
     telnet_lock(tfilter);
-    if (tfilter->write_data_len || buflen == 0) {
-	if (rcount)
-	    *rcount = 0;
-    } else {
-	unsigned int inlen = buflen;
-
-	tfilter->write_data_len =
-	    process_telnet_xmit(tfilter->write_data, tfilter->max_write_size,
-				&buf, &inlen);
-	*rcount = buflen - inlen;
+    if (!tfilter->write_data_len) {
+	/* Pack as many of the buffers as will fit into write_data. */
+	for (i = 0; i < sglen; i++) {
+	    const unsigned char *buf = sg[i].buf;
+	    unsigned int inlen = sg[i].buflen;
+
+	    tfilter->write_data_len +=
+		process_telnet_xmit(tfilter->write_data +
+				    tfilter->write_data_len,
+				    tfilter->max_write_size -
+				    tfilter->write_data_len,
+				    &buf, &inlen);
+	    count += sg[i].buflen - inlen;
+	    if (inlen)
+		break;
+	}
     }
+    if (rcount)
+	*rcount = count;
 
     if (tfilter->write_state != TELNET_IN_USER_WRITE &&
 		buffer_cursize(&tfilter->tn_data.out_telnet_cmd)) {
@@ -222,11 +232,11 @@ telnet_ul_write(struct genio_filter *filter,
 
     if (tfilter->write_state != TELNET_IN_TN_WRITE &&
 		tfilter->write_data_len) {
-	unsigned int count = 0;
+	struct genio_sg dsg = { tfilter->write_data + tfilter->write_data_pos,
+				tfilter->write_data_len };
 
-	err = handler(cb_data, &count,
-		      tfilter->write_data + tfilter->write_data_pos,
-		      tfilter->write_data_len);
+	count = 0;
+	err = handler(cb_data, &count, &dsg, 1);
 	if (!err) {
 	    if (count >= tfilter->write_data_len) {
 		tfilter->write_state = TELNET_NOT_WRITING;
@@ -503,12 +513,12 @@ genio_telnet_filter_raw_alloc(struct genio_os_funcs *o,
     if (!tfilter->lock)
 	goto out_nomem;
 
-    tfilter->read_data = o->zalloc(o, max_read_size);
+    tfilter->read_data = o->alloc(o, max_read_size);
     if (!tfilter->read_data)
 	goto out_nomem;
 
-    tfilter->write_data = o->zalloc(o, max_write_size);
-    if (!tfilter->read_data)
+    tfilter->write_data = o->alloc(o, max_write_size);
+    if (!tfilter->write_data)
 	goto out_nomem;
 
     *rops = &telnet_filter_rops;
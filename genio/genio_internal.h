@@ -37,6 +37,13 @@ struct genio_functions {
     int (*write)(struct genio *io, unsigned int *count,
 		 const void *buf, unsigned int buflen);
 
+    /*
+     * Optional, if NULL genio_writev() will call write for each
+     * buffer.
+     */
+    int (*writev)(struct genio *io, unsigned int *count,
+		  const struct genio_sg *sg, unsigned int sglen);
+
     int (*raddr_to_str)(struct genio *io, int *pos,
 			char *buf, unsigned int buflen);
 
@@ -68,6 +75,10 @@ struct genio_functions {
     void (*set_read_callback_enable)(struct genio *io, bool enabled);
 
     void (*set_write_callback_enable)(struct genio *io, bool enabled);
+
+    /* Optional, may be NULL if the genio can't splice from a pipe. */
+    int (*write_from_pipe)(struct genio *io, unsigned int *count,
+			   int pipefd, unsigned int len);
 };
 
 /*
@@ -107,6 +118,9 @@ struct genio_acceptor_functions {
 		   void (*connect_done)(struct genio *io, int err,
 					void *cb_data),
 		   void *cb_data, struct genio **new_io);
+
+    /* Optional, may be NULL if the acceptor has nothing to reload. */
+    int (*reload)(struct genio_acceptor *acceptor);
 };
 
 /*
@@ -163,6 +177,15 @@ void genio_free_addrinfo(struct genio_os_funcs *o, struct addrinfo *ai);
 
 char *genio_strdup(struct genio_os_funcs *o, const char *str);
 
+/*
+ * Fill in iov from the non-empty buffers in sg, up to maxiov
+ * entries.  Returns the number of iov entries used.
+ */
+#define GENIO_MAX_IOV 16
+struct iovec;
+unsigned int genio_sg_to_iov(const struct genio_sg *sg, unsigned int sglen,
+			     struct iovec *iov, unsigned int maxiov);
+
 int genio_check_keyvalue(const char *str, const char *key, const char **value);
 int genio_check_keyuint(const char *str, const char *key, unsigned int *value);
 #endif /* SER2NET_GENIO_INTERNAL_H */
@@ -17,12 +17,15 @@
  *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#define _GNU_SOURCE /* For splice() */
 #include <errno.h>
+#include <fcntl.h>
 #include "genio_internal.h"
 #include "genio_base.h"
 
 #include <assert.h>
 #include <unistd.h>
+#include <sys/uio.h>
 
 enum fd_state {
     FD_CLOSED,
@@ -171,6 +174,71 @@ fd_write(struct genio_ll *ll, unsigned int *rcount,
     return err;
 }
 
+static int
+fd_writev(struct genio_ll *ll, unsigned int *rcount,
+	  const struct genio_sg *sg, unsigned int sglen)
+{
+    struct fd_ll *fdll = ll_to_fd(ll);
+    struct iovec iov[GENIO_MAX_IOV];
+    unsigned int iovcnt;
+    int rv, err = 0;
+
+    iovcnt = genio_sg_to_iov(sg, sglen, iov, GENIO_MAX_IOV);
+    if (iovcnt == 0) {
+	if (rcount)
+	    *rcount = 0;
+	return 0;
+    }
+
+ retry:
+    rv = writev(fdll->fd, iov, iovcnt);
+    if (rv < 0) {
+	if (errno == EINTR)
+	    goto retry;
+	if (errno == EWOULDBLOCK || errno == EAGAIN)
+	    rv = 0; /* Handle like a zero-byte write. */
+	else
+	    err = errno;
+    } else if (rv == 0) {
+	err = EPIPE;
+    }
+
+    if (!err && rcount)
+	*rcount = rv;
+
+    return err;
+}
+
+#ifdef HAVE_SPLICE
+static int
+fd_write_from_pipe(struct genio_ll *ll, unsigned int *rcount,
+		   int pipefd, unsigned int len)
+{
+    struct fd_ll *fdll = ll_to_fd(ll);
+    ssize_t rv;
+    int err = 0;
+
+ retry:
+    rv = splice(pipefd, NULL, fdll->fd, NULL, len,
+		SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+    if (rv < 0) {
+	if (errno == EINTR)
+	    goto retry;
+	if (errno == EWOULDBLOCK || errno == EAGAIN)
+	    rv = 0; /* Handle like a zero-byte write. */
+	else
+	    err = errno;
+    } else if (rv == 0) {
+	err = EPIPE;
+    }
+
+    if (!err && rcount)
+	*rcount = rv;
+
+    return err;
+}
+#endif
+
 static int
 fd_raddr_to_str(struct genio_ll *ll, int *pos,
 		char *buf, unsigned int buflen)
@@ -262,11 +330,13 @@ fd_finish_open(struct fd_ll *fdll, int err)
 
 static void fd_finish_close(struct fd_ll *fdll)
 {
+    genio_ll_close_done close_done = fdll->close_done;
+
     fdll->state = FD_CLOSED;
     fdll->close_done = NULL;
-    if (fdll->close_done) {
+    if (close_done) {
 	fd_unlock(fdll);
-	fdll->close_done(fdll->cb_data, fdll->close_data);
+	close_done(fdll->cb_data, fdll->close_data);
 	fd_lock(fdll);
     }
 }
@@ -543,7 +613,7 @@ static int fd_close(struct genio_ll *ll, genio_ll_close_done done,
 	fdll->close_done = done;
 	fdll->close_data = close_data;
 	fd_start_close(fdll);
-	err = 0;
+	err = EINPROGRESS; /* Finished when the fd is cleared. */
     }
     fd_unlock(fdll);
 
@@ -595,6 +665,7 @@ static void fd_free(struct genio_ll *ll)
 const static struct genio_ll_ops fd_ll_ops = {
     .set_callbacks = fd_set_callbacks,
     .write = fd_write,
+    .writev = fd_writev,
     .raddr_to_str = fd_raddr_to_str,
     .get_raddr = fd_get_raddr,
     .remote_id = fd_remote_id,
@@ -602,7 +673,10 @@ const static struct genio_ll_ops fd_ll_ops = {
     .close = fd_close,
     .set_read_callback_enable = fd_set_read_callback_enable,
     .set_write_callback_enable = fd_set_write_callback_enable,
-    .free = fd_free
+    .free = fd_free,
+#ifdef HAVE_SPLICE
+    .write_from_pipe = fd_write_from_pipe
+#endif
 };
 
 struct genio_ll *
@@ -641,7 +715,7 @@ fd_genio_ll_alloc(struct genio_os_funcs *o,
 	goto out_nomem;
 
     fdll->read_data_size = max_read_size;
-    fdll->read_data = o->zalloc(o, max_read_size);
+    fdll->read_data = o->alloc(o, max_read_size);
     if (!fdll->read_data)
 	goto out_nomem;
 
@@ -60,6 +60,15 @@ child_write(struct genio_ll *ll, unsigned int *rcount,
     return genio_write(cdata->child, rcount, buf, buflen);
 }
 
+static int
+child_writev(struct genio_ll *ll, unsigned int *rcount,
+	     const struct genio_sg *sg, unsigned int sglen)
+{
+    struct genio_ll_child *cdata = ll_to_child(ll);
+
+    return genio_writev(cdata->child, rcount, sg, sglen);
+}
+
 static int
 child_raddr_to_str(struct genio_ll *ll, int *pos,
 		   char *buf, unsigned int buflen)
@@ -155,6 +164,7 @@ static void child_free(struct genio_ll *ll)
 const static struct genio_ll_ops child_ll_ops = {
     .set_callbacks = child_set_callbacks,
     .write = child_write,
+    .writev = child_writev,
     .raddr_to_str = child_raddr_to_str,
     .get_raddr = child_get_raddr,
     .remote_id = child_remote_id,
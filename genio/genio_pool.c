@@ -0,0 +1,425 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * The genio memory pool, see genio_pool.h.
+ *
+ * Each class holds blocks of a power of two size, from POOL_MIN_SIZE
+ * up.  A freed block goes into the freeing thread's cache for its
+ * class.  When a cache gets too big, half of it is moved into the
+ * shared depot, and an empty cache is refilled from the depot, so the
+ * pool lock is only taken once for a batch of blocks.  The depot is
+ * limited too, anything past that goes back to malloc.
+ *
+ * Blocks are not zeroed when they are freed or reused, so I/O
+ * buffers that are allocated with genio_pool_alloc() cost nothing
+ * more than taking them off a list.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "utils/locking.h"
+#include "genio/genio_pool.h"
+
+#define POOL_MIN_SHIFT		6
+#define POOL_MIN_SIZE		(1 << POOL_MIN_SHIFT)
+#define POOL_NR_POOLED		(GENIO_POOL_NR_CLASSES - 1)
+#define POOL_LARGE		POOL_NR_POOLED
+#define POOL_MAX_SIZE		(POOL_MIN_SIZE << (POOL_NR_POOLED - 1))
+
+/* How much free memory to keep per class in each thread and shared. */
+#define POOL_CACHE_BYTES	(64 * 1024)
+#define POOL_DEPOT_BYTES	(1024 * 1024)
+
+/*
+ * In front of every block.  It's 16 bytes so the data keeps the
+ * alignment malloc gives.
+ */
+struct pool_hdr {
+    uint32_t cls;
+    uint32_t size;	/* The size asked for, only used for POOL_LARGE. */
+    uint64_t pad;
+};
+
+/* A free block, the link goes where the data was. */
+struct pool_block {
+    struct pool_hdr hdr;
+    struct pool_block *next;
+};
+
+/*
+ * A thread's cache.  Only the owning thread changes it, but the
+ * stats code reads the counts from other threads, so they are
+ * changed with atomic stores to keep them from tearing.
+ */
+struct pool_cache {
+    struct pool_block *free[POOL_NR_POOLED];
+    unsigned int nr_free[POOL_NR_POOLED];
+
+    uint64_t allocs[GENIO_POOL_NR_CLASSES];
+    uint64_t frees[GENIO_POOL_NR_CLASSES];
+    uint64_t large_bytes_alloced;
+    uint64_t large_bytes_freed;
+
+    /* The list of all caches, protected by pool_lock. */
+    struct pool_cache *next;
+    struct pool_cache *prev;
+};
+
+#define POOL_GET(s)	__atomic_load_n(&(s), __ATOMIC_RELAXED)
+#define POOL_SET(s, v)	__atomic_store_n(&(s), (v), __ATOMIC_RELAXED)
+#define POOL_ADD(s, v)	POOL_SET(s, POOL_GET(s) + (v))
+
+/*
+ * Everything below is protected by pool_lock.  Threads that have
+ * exited, or couldn't get a cache, keep their counts in
+ * retired_cache.
+ */
+DEFINE_LOCK_INIT(static, pool_lock)
+static struct pool_block *depot[POOL_NR_POOLED];
+static unsigned int depot_nr_free[POOL_NR_POOLED];
+static struct pool_cache retired_cache;
+static struct pool_cache *caches;
+
+#ifdef USE_PTHREADS
+static __thread struct pool_cache *my_cache;
+static pthread_key_t pool_key;
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+#else
+static struct pool_cache *my_cache;
+#endif
+
+static unsigned int
+pool_class(unsigned int size)
+{
+    if (size <= POOL_MIN_SIZE)
+	return 0;
+    if (size > POOL_MAX_SIZE)
+	return POOL_LARGE;
+    return 32 - __builtin_clz(size - 1) - POOL_MIN_SHIFT;
+}
+
+static unsigned int
+pool_class_size(unsigned int cls)
+{
+    return POOL_MIN_SIZE << cls;
+}
+
+static unsigned int
+pool_cache_max(unsigned int cls)
+{
+    unsigned int max = POOL_CACHE_BYTES / pool_class_size(cls);
+
+    return max < 4 ? 4 : max;
+}
+
+static unsigned int
+pool_depot_max(unsigned int cls)
+{
+    unsigned int max = POOL_DEPOT_BYTES / pool_class_size(cls);
+
+    return max < 16 ? 16 : max;
+}
+
+/* Put a block in the depot, or free it if the depot is full. */
+static void
+pool_depot_put(struct pool_block *b)
+{
+    unsigned int cls = b->hdr.cls;
+
+    if (depot_nr_free[cls] >= pool_depot_max(cls)) {
+	free(b);
+	return;
+    }
+    b->next = depot[cls];
+    depot[cls] = b;
+    depot_nr_free[cls]++;
+}
+
+/*
+ * Move count blocks of the class from the cache to the depot.  Must
+ * be called with pool_lock held.
+ */
+static void
+pool_cache_drain(struct pool_cache *c, unsigned int cls, unsigned int count)
+{
+    while (count-- && c->free[cls]) {
+	struct pool_block *b = c->free[cls];
+
+	c->free[cls] = b->next;
+	POOL_ADD(c->nr_free[cls], -1);
+	pool_depot_put(b);
+    }
+}
+
+/* Add the counts from c into dest.  Must be called with pool_lock held. */
+static void
+pool_cache_add_stats(struct pool_cache *dest, struct pool_cache *c)
+{
+    unsigned int i;
+
+    for (i = 0; i < GENIO_POOL_NR_CLASSES; i++) {
+	POOL_ADD(dest->allocs[i], POOL_GET(c->allocs[i]));
+	POOL_ADD(dest->frees[i], POOL_GET(c->frees[i]));
+    }
+    POOL_ADD(dest->large_bytes_alloced, POOL_GET(c->large_bytes_alloced));
+    POOL_ADD(dest->large_bytes_freed, POOL_GET(c->large_bytes_freed));
+}
+
+#ifdef USE_PTHREADS
+/* A thread with a cache is exiting, give everything back. */
+static void
+pool_cache_exit(void *data)
+{
+    struct pool_cache *c = data;
+    unsigned int i;
+
+    my_cache = NULL;
+    LOCK(pool_lock);
+    for (i = 0; i < POOL_NR_POOLED; i++)
+	pool_cache_drain(c, i, c->nr_free[i]);
+    pool_cache_add_stats(&retired_cache, c);
+    if (c->prev)
+	c->prev->next = c->next;
+    else
+	caches = c->next;
+    if (c->next)
+	c->next->prev = c->prev;
+    UNLOCK(pool_lock);
+    free(c);
+}
+
+static void
+pool_key_init(void)
+{
+    pthread_key_create(&pool_key, pool_cache_exit);
+}
+#endif
+
+/* Get the calling thread's cache, or NULL if it can't have one. */
+static struct pool_cache *
+pool_get_cache(void)
+{
+    struct pool_cache *c = my_cache;
+
+    if (c)
+	return c;
+
+    c = calloc(1, sizeof(*c));
+    if (!c)
+	return NULL;
+#ifdef USE_PTHREADS
+    pthread_once(&pool_key_once, pool_key_init);
+    if (pthread_setspecific(pool_key, c)) {
+	free(c);
+	return NULL;
+    }
+#endif
+    LOCK(pool_lock);
+    c->next = caches;
+    if (caches)
+	caches->prev = c;
+    caches = c;
+    UNLOCK(pool_lock);
+    my_cache = c;
+    return c;
+}
+
+static void *
+pool_alloc_large(unsigned int size)
+{
+    struct pool_cache *c = pool_get_cache();
+    struct pool_hdr *h = malloc(sizeof(*h) + size);
+
+    if (!h)
+	return NULL;
+    h->cls = POOL_LARGE;
+    h->size = size;
+    if (c) {
+	POOL_ADD(c->allocs[POOL_LARGE], 1);
+	POOL_ADD(c->large_bytes_alloced, size);
+    } else {
+	LOCK(pool_lock);
+	POOL_ADD(retired_cache.allocs[POOL_LARGE], 1);
+	POOL_ADD(retired_cache.large_bytes_alloced, size);
+	UNLOCK(pool_lock);
+    }
+    return h + 1;
+}
+
+void *
+genio_pool_alloc(unsigned int size)
+{
+    unsigned int cls = pool_class(size);
+    struct pool_cache *c;
+    struct pool_block *b;
+
+    if (cls == POOL_LARGE)
+	return pool_alloc_large(size);
+
+    c = pool_get_cache();
+    if (c && !c->free[cls]) {
+	unsigned int count = pool_cache_max(cls) / 2;
+
+	/* Refill the cache from the depot. */
+	LOCK(pool_lock);
+	while (count-- && depot[cls]) {
+	    b = depot[cls];
+	    depot[cls] = b->next;
+	    depot_nr_free[cls]--;
+	    b->next = c->free[cls];
+	    c->free[cls] = b;
+	    POOL_ADD(c->nr_free[cls], 1);
+	}
+	UNLOCK(pool_lock);
+    }
+
+    if (c && c->free[cls]) {
+	b = c->free[cls];
+	c->free[cls] = b->next;
+	POOL_ADD(c->nr_free[cls], -1);
+    } else {
+	b = NULL;
+	if (!c) {
+	    LOCK(pool_lock);
+	    b = depot[cls];
+	    if (b) {
+		depot[cls] = b->next;
+		depot_nr_free[cls]--;
+	    }
+	    UNLOCK(pool_lock);
+	}
+	if (!b) {
+	    b = malloc(sizeof(struct pool_hdr) + pool_class_size(cls));
+	    if (!b)
+		return NULL;
+	    b->hdr.cls = cls;
+	}
+    }
+
+    if (c) {
+	POOL_ADD(c->allocs[cls], 1);
+    } else {
+	LOCK(pool_lock);
+	POOL_ADD(retired_cache.allocs[cls], 1);
+	UNLOCK(pool_lock);
+    }
+    return &b->hdr + 1;
+}
+
+void *
+genio_pool_zalloc(unsigned int size)
+{
+    void *data = genio_pool_alloc(size);
+
+    if (data)
+	memset(data, 0, size);
+    return data;
+}
+
+void
+genio_pool_free(void *data)
+{
+    struct pool_hdr *h;
+    struct pool_block *b;
+    struct pool_cache *c;
+    unsigned int cls;
+
+    if (!data)
+	return;
+
+    h = ((struct pool_hdr *) data) - 1;
+    b = (struct pool_block *) h;
+    cls = h->cls;
+    c = pool_get_cache();
+
+    if (!c) {
+	LOCK(pool_lock);
+	POOL_ADD(retired_cache.frees[cls], 1);
+	if (cls == POOL_LARGE) {
+	    POOL_ADD(retired_cache.large_bytes_freed, h->size);
+	    free(h);
+	} else {
+	    pool_depot_put(b);
+	}
+	UNLOCK(pool_lock);
+	return;
+    }
+
+    POOL_ADD(c->frees[cls], 1);
+    if (cls == POOL_LARGE) {
+	POOL_ADD(c->large_bytes_freed, h->size);
+	free(h);
+	return;
+    }
+
+    b->next = c->free[cls];
+    c->free[cls] = b;
+    POOL_ADD(c->nr_free[cls], 1);
+    if (c->nr_free[cls] > pool_cache_max(cls)) {
+	LOCK(pool_lock);
+	pool_cache_drain(c, cls, c->nr_free[cls] / 2);
+	UNLOCK(pool_lock);
+    }
+}
+
+void
+genio_pool_get_stats(struct genio_pool_stats stats[GENIO_POOL_NR_CLASSES])
+{
+    struct pool_cache total, *c;
+    uint64_t nr_free[POOL_NR_POOLED];
+    unsigned int i;
+
+    memset(&total, 0, sizeof(total));
+    memset(nr_free, 0, sizeof(nr_free));
+
+    LOCK(pool_lock);
+    pool_cache_add_stats(&total, &retired_cache);
+    for (c = caches; c; c = c->next) {
+	pool_cache_add_stats(&total, c);
+	for (i = 0; i < POOL_NR_POOLED; i++)
+	    nr_free[i] += POOL_GET(c->nr_free[i]);
+    }
+    for (i = 0; i < POOL_NR_POOLED; i++)
+	nr_free[i] += depot_nr_free[i];
+    UNLOCK(pool_lock);
+
+    for (i = 0; i < GENIO_POOL_NR_CLASSES; i++) {
+	struct genio_pool_stats *s = &stats[i];
+	uint64_t in_use = 0;
+
+	s->allocs = total.allocs[i];
+	s->frees = total.frees[i];
+	/* The counts are racy, so don't let them go negative. */
+	if (s->allocs > s->frees)
+	    in_use = s->allocs - s->frees;
+	if (i == POOL_LARGE) {
+	    s->size = 0;
+	    s->bytes_in_use = 0;
+	    if (total.large_bytes_alloced > total.large_bytes_freed)
+		s->bytes_in_use = (total.large_bytes_alloced -
+				   total.large_bytes_freed);
+	    s->bytes_free = 0;
+	} else {
+	    s->size = pool_class_size(i);
+	    s->bytes_in_use = in_use * s->size;
+	    s->bytes_free = nr_free[i] * s->size;
+	}
+    }
+}
@@ -0,0 +1,65 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef GENIO_POOL_H
+#define GENIO_POOL_H
+
+#include <stdint.h>
+
+/*
+ * A size class memory pool for the genio allocations.  Sizes are
+ * rounded up to a power of two and freed memory is kept for reuse,
+ * first in a small cache for each thread, then in a shared depot.
+ * Allocations larger than the biggest class come directly from
+ * malloc.
+ *
+ * Memory from here must be freed with genio_pool_free() and nothing
+ * else.
+ */
+
+/* Allocate size bytes, not zeroed.  Returns NULL on error. */
+void *genio_pool_alloc(unsigned int size);
+
+/* Allocate size bytes, zeroed.  Returns NULL on error. */
+void *genio_pool_zalloc(unsigned int size);
+
+void genio_pool_free(void *data);
+
+/* The pooled classes plus one for the allocations too big to pool. */
+#define GENIO_POOL_NR_CLASSES	12
+
+struct genio_pool_stats {
+    /* The class size, 0 for the class of unpooled allocations. */
+    unsigned int size;
+    uint64_t allocs;
+    uint64_t frees;
+    /* Allocated memory that is in use, and free memory kept for reuse. */
+    uint64_t bytes_in_use;
+    uint64_t bytes_free;
+};
+
+/*
+ * Fill in the stats for each class.  These are collected without
+ * stopping other threads, so they may be slightly inconsistent with
+ * each other.
+ */
+void genio_pool_get_stats(struct genio_pool_stats
+			  stats[GENIO_POOL_NR_CLASSES]);
+
+#endif /* GENIO_POOL_H */
@@ -24,6 +24,7 @@
 #include "utils/utils.h"
 #include "utils/waiter.h"
 #include "genio/genio_selector.h"
+#include "genio/genio_pool.h"
 
 struct genio_data {
     struct selector_s *sel;
@@ -33,17 +34,19 @@ struct genio_data {
 static void *
 genio_sel_zalloc(struct genio_os_funcs *f, unsigned int size)
 {
-    void *d = malloc(size);
+    return genio_pool_zalloc(size);
+}
 
-    if (d)
-	memset(d, 0, size);
-    return d;
+static void *
+genio_sel_alloc(struct genio_os_funcs *f, unsigned int size)
+{
+    return genio_pool_alloc(size);
 }
 
 static void
 genio_sel_free(struct genio_os_funcs *f, void *data)
 {
-    free(data);
+    genio_pool_free(data);
 }
 
 struct genio_lock {
@@ -475,6 +478,7 @@ genio_selector_alloc(struct selector_s *sel, int wake_sig)
 
     o->zalloc = genio_sel_zalloc;
     o->free = genio_sel_free;
+    o->alloc = genio_sel_alloc;
     o->alloc_lock = genio_sel_alloc_lock;
     o->free_lock = genio_sel_free_lock;
     o->lock = genio_sel_lock;
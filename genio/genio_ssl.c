@@ -86,6 +86,12 @@ struct sslna_data {
     char *certfile;
     char *CAfilepath;
 
+    /*
+     * Built from the above files at startup and reload and shared by
+     * all the connections from this acceptor.
+     */
+    SSL_CTX *ctx;
+
     unsigned int refcount;
     unsigned int in_cb_count;
 
@@ -126,6 +132,8 @@ sslna_finish_free(struct sslna_data *nadata)
 	nadata->o->free(nadata->o, nadata->name);
     if (nadata->CAfilepath)
 	nadata->o->free(nadata->o, nadata->CAfilepath);
+    if (nadata->ctx)
+	genio_ssl_server_ctx_free(nadata->ctx);
     nadata->o->free(nadata->o, nadata);
 }
 
@@ -184,14 +192,66 @@ sslna_leave_cb_unlock(struct sslna_data *nadata)
 	sslna_deref_and_unlock(nadata);
 }
 
+/*
+ * (Re)build the SSL context from the key and certificate files.  The
+ * old context, if any, is released, connections still using it hold
+ * their own reference.
+ */
+static int
+sslna_load_ctx(struct sslna_data *nadata)
+{
+    SSL_CTX *ctx, *old_ctx;
+    int err;
+
+    err = genio_ssl_server_ctx_alloc(nadata->o, nadata->keyfile,
+				     nadata->certfile, nadata->CAfilepath,
+				     &ctx);
+    if (err) {
+	syslog(LOG_ERR, "Error setting up ssl for %s: %s", nadata->name,
+	       strerror(err));
+	return err;
+    }
+
+    sslna_lock(nadata);
+    old_ctx = nadata->ctx;
+    nadata->ctx = ctx;
+    sslna_unlock(nadata);
+
+    if (old_ctx)
+	genio_ssl_server_ctx_free(old_ctx);
+    return 0;
+}
+
 static int
 sslna_startup(struct genio_acceptor *acceptor)
 {
     struct sslna_data *nadata = acc_to_nadata(acceptor);
+    int err;
+
+    err = sslna_load_ctx(nadata);
+    if (err)
+	return err;
 
     return genio_acc_startup(nadata->child);
 }
 
+static int
+sslna_reload(struct genio_acceptor *acceptor)
+{
+    struct sslna_data *nadata = acc_to_nadata(acceptor);
+    bool started;
+
+    sslna_lock(nadata);
+    started = nadata->ctx != NULL;
+    sslna_unlock(nadata);
+
+    /* If not started, the context will be loaded at startup. */
+    if (!started)
+	return 0;
+
+    return sslna_load_ctx(nadata);
+}
+
 static void
 sslna_child_shutdown(struct genio_acceptor *acceptor,
 		     void *shutdown_data)
@@ -358,7 +418,8 @@ static const struct genio_acceptor_functions genio_acc_ssl_funcs = {
     .shutdown = sslna_shutdown,
     .set_accept_callback_enable = sslna_set_accept_callback_enable,
     .free = sslna_free,
-    .connect = sslna_connect
+    .connect = sslna_connect,
+    .reload = sslna_reload
 };
 
 static void
@@ -384,11 +445,12 @@ sslna_new_child_connection(struct genio_acceptor *acceptor, struct genio *io)
     struct genio_ll *ll;
     int err;
 
-    err = genio_ssl_server_filter_alloc(o, nadata->keyfile, nadata->certfile,
-					nadata->CAfilepath,
+    sslna_lock(nadata);
+    err = genio_ssl_server_filter_alloc(o, nadata->ctx,
 					nadata->max_read_size,
 					nadata->max_write_size,
 					&filter);
+    sslna_unlock(nadata);
     if (err)
 	goto out_err;
 
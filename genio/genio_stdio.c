@@ -172,6 +172,16 @@ stdion_remote_id(struct genio *net, int *id)
     return 0;
 }
 
+static void
+stdion_start_deferred_op(struct stdiona_data *nadata)
+{
+    if (!nadata->deferred_op_pending) {
+	/* Call the read from the selector to avoid lock nesting issues. */
+	nadata->deferred_op_pending = true;
+	nadata->o->run(nadata->deferred_op_runner);
+    }
+}
+
 /* Must be called with nadata->lock held */
 static void
 stdion_finish_read(struct stdiona_data *nadata, int err)
@@ -205,6 +215,10 @@ stdion_finish_read(struct stdiona_data *nadata, int err)
 
     nadata->in_read = false;
 
+    /* A close done from the read callback waits for the read to finish. */
+    if (nadata->in_close)
+	stdion_start_deferred_op(nadata);
+
     if (nadata->read_enabled) {
 	nadata->o->set_read_handler(nadata->o, nadata->ostdout, true);
 	if (nadata->ostderr != -1)
@@ -250,6 +264,11 @@ stdion_deferred_op(struct genio_runner *runner, void *cbdata)
     nadata->deferred_op_pending = false;
 
     if (nadata->in_close) {
+	if (nadata->in_read) {
+	    /* stdion_finish_read() will restart this when done. */
+	    stdiona_unlock(nadata);
+	    return;
+	}
 	nadata->in_close = false;
 	nadata->in_open = false;
 	stdiona_unlock(nadata);
@@ -260,16 +279,6 @@ stdion_deferred_op(struct genio_runner *runner, void *cbdata)
     stdiona_unlock(nadata);
 }
 
-static void
-stdion_start_deferred_op(struct stdiona_data *nadata)
-{
-    if (!nadata->deferred_op_pending) {
-	/* Call the read from the selector to avoid lock nesting issues. */
-	nadata->deferred_op_pending = true;
-	nadata->o->run(nadata->deferred_op_runner);
-    }
-}
-
 static void
 stdiona_finish_free(struct stdiona_data *nadata)
 {
@@ -804,7 +813,7 @@ stdio_nadata_setup(struct genio_os_funcs *o, unsigned int max_read_size,
     nadata->refcount = 1;
 
     nadata->max_read_size = max_read_size;
-    nadata->read_data = o->zalloc(o, max_read_size);
+    nadata->read_data = o->alloc(o, max_read_size);
     if (!nadata->read_data)
 	goto out_nomem;
 
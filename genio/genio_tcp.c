@@ -621,12 +621,12 @@ tcp_genio_acceptor_alloc(const char *name,
  out_nomem:
     if (ai)
 	genio_free_addrinfo(o, ai);
-    if (nadata->lock)
-	o->free_lock(nadata->lock);
     if (nadata) {
+	if (nadata->lock)
+	    o->free_lock(nadata->lock);
 	if (nadata->name)
-	    free(nadata->name);
-	free(nadata);
+	    o->free(o, nadata->name);
+	o->free(o, nadata);
     }
     return ENOMEM;
 }
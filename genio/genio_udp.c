@@ -19,6 +19,7 @@
 
 /* This code handles UDP network I/O. */
 
+#define _GNU_SOURCE /* For recvmmsg() and sendmmsg() */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -29,12 +30,44 @@
 #include <string.h>
 #include <syslog.h>
 #include <assert.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
 
 #include "genio.h"
 #include "genio_internal.h"
 
+/*
+ * Number of datagram buffers each acceptor has for receiving, and the
+ * same number again for sending.  Reads from the socket continue as
+ * long as receive buffers are free, so a connection that isn't
+ * reading doesn't stop the others until all the buffers are used.
+ */
+#define UDPNA_NR_SLOTS		32
+
+/* Maximum datagrams to receive or send with one system call. */
+#define UDPNA_BATCH		16
+
+/* Starting size of the peer hash table, must be a power of 2. */
+#define UDPNA_INIT_HASH_SIZE	16
+
 struct udpna_data;
 
+/*
+ * A datagram buffer.  Received datagrams sit on the owner's read
+ * queue until they are consumed, datagrams to send sit on the
+ * acceptor's send queue until they can be sent.
+ */
+struct udpn_slot {
+    struct udpn_slot *next;
+    struct udpn_data *owner;	/* Only for sends, NULL if freed. */
+    unsigned char *data;
+    unsigned int len;
+    unsigned int pos;
+    int fd;			/* The fd to send this on. */
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+};
+
 struct udpn_data {
     struct genio net;
     struct udpna_data *nadata;
@@ -68,6 +101,19 @@ struct udpn_data {
     struct sockaddr *raddr;		/* Points to remote, for convenience. */
     socklen_t raddrlen;
 
+    /* Received datagrams not yet consumed by the user. */
+    struct udpn_slot *rd_head;
+    struct udpn_slot *rd_tail;
+
+    int write_err;		/* Error from a queued send, reported on
+				   the next write. */
+
+    struct udpn_data *deliver_next;	/* Deliver list in nadata. */
+
+    unsigned int hash;
+    struct udpn_data *hash_next;
+
+    struct udpn_data **list;	/* The nadata list this is on. */
     struct udpn_data *next;
 };
 
@@ -86,11 +132,27 @@ struct udpna_data {
 
     unsigned int max_read_size;
 
-    unsigned char *read_data;
+    /* All the datagram buffers, see UDPNA_NR_SLOTS. */
+    struct udpn_slot *slots;
+    unsigned char *slot_data;
+    struct udpn_slot *free_rd_slots;
+    unsigned int nr_free_rd_slots;
+    struct udpn_slot *free_wr_slots;
+    struct udpn_slot *wr_head;	/* Datagrams waiting to be sent. */
+    struct udpn_slot *wr_tail;
+    bool send_blocked;		/* Waiting for the socket to be writable. */
+
+    bool read_armed;		/* The fd read handlers are enabled. */
+    bool in_readhandler;
 
-    unsigned int data_pending_len;
-    unsigned int data_pos;
-    struct udpn_data *pending_data_owner;
+    /* Connections with received data to deliver from the deferred op. */
+    struct udpn_data *deliver_head;
+    struct udpn_data *deliver_tail;
+
+    /* Hash of every udpn_data by remote address, on any of the lists. */
+    struct udpn_data **peers;
+    unsigned int peers_size;
+    unsigned int nr_peers;
 
     struct udpn_data *pending_close_ndata; /* Linked list. */
     struct udpn_data *closed_udpns;
@@ -119,7 +181,6 @@ struct udpna_data {
     unsigned int   nr_accept_close_waiting;
 
     bool in_write;
-    unsigned int read_disable_count;
     unsigned int write_enable_count;
 };
 
@@ -150,6 +211,7 @@ static void udpna_start_deferred_op(struct udpna_data *nadata)
 static void
 udpn_remove_from_list(struct udpn_data **list, struct udpn_data *ndata)
 {
+    ndata->list = NULL;
     if (*list == ndata) {
 	*list = ndata->next;
     } else {
@@ -161,26 +223,107 @@ udpn_remove_from_list(struct udpn_data **list, struct udpn_data *ndata)
     }
 }
 
+/* FNV-1a over the address and port. */
+static unsigned int
+udpn_addr_hash(const struct sockaddr *addr)
+{
+    const unsigned char *p;
+    unsigned int len, port, h = 2166136261U;
+
+    switch (addr->sa_family) {
+    case AF_INET:
+	p = (const unsigned char *)
+	    &((const struct sockaddr_in *) addr)->sin_addr;
+	len = sizeof(struct in_addr);
+	port = ((const struct sockaddr_in *) addr)->sin_port;
+	break;
+
+    case AF_INET6:
+	p = (const unsigned char *)
+	    &((const struct sockaddr_in6 *) addr)->sin6_addr;
+	len = sizeof(struct in6_addr);
+	port = ((const struct sockaddr_in6 *) addr)->sin6_port;
+	break;
+
+    default:
+	return 0;
+    }
+
+    while (len--)
+	h = (h ^ *p++) * 16777619U;
+    h = (h ^ (port & 0xff)) * 16777619U;
+    h = (h ^ (port >> 8)) * 16777619U;
+
+    return h;
+}
+
+static void
+udpn_hash_add(struct udpna_data *nadata, struct udpn_data *ndata)
+{
+    unsigned int i;
+
+    if (nadata->nr_peers >= nadata->peers_size * 2) {
+	/* Double the table, if that fails just use longer chains. */
+	unsigned int new_size = nadata->peers_size * 2;
+	struct udpn_data **new_peers, *tndata;
+
+	new_peers = nadata->o->zalloc(nadata->o,
+				      new_size * sizeof(*new_peers));
+	if (new_peers) {
+	    for (i = 0; i < nadata->peers_size; i++) {
+		while (nadata->peers[i]) {
+		    tndata = nadata->peers[i];
+		    nadata->peers[i] = tndata->hash_next;
+		    tndata->hash_next = new_peers[tndata->hash & (new_size - 1)];
+		    new_peers[tndata->hash & (new_size - 1)] = tndata;
+		}
+	    }
+	    nadata->o->free(nadata->o, nadata->peers);
+	    nadata->peers = new_peers;
+	    nadata->peers_size = new_size;
+	}
+    }
+
+    ndata->hash = udpn_addr_hash(ndata->raddr);
+    i = ndata->hash & (nadata->peers_size - 1);
+    ndata->hash_next = nadata->peers[i];
+    nadata->peers[i] = ndata;
+    nadata->nr_peers++;
+}
+
+static void
+udpn_hash_remove(struct udpna_data *nadata, struct udpn_data *ndata)
+{
+    struct udpn_data **p = &nadata->peers[ndata->hash &
+					  (nadata->peers_size - 1)];
+
+    while (*p != ndata)
+	p = &(*p)->hash_next;
+    *p = ndata->hash_next;
+    nadata->nr_peers--;
+}
+
+/*
+ * Find the connection for the given address that is on the given
+ * list, and optionally remove it from the list.
+ */
 static struct udpn_data *
-udpn_find(struct udpn_data **list,
+udpn_find(struct udpna_data *nadata, struct udpn_data **list,
 	  struct sockaddr *addr, socklen_t addrlen,
 	  bool remove)
 {
-    struct udpn_data *ndata = *list, *prev = NULL;
+    struct udpn_data *ndata;
 
+    ndata = nadata->peers[udpn_addr_hash(addr) & (nadata->peers_size - 1)];
     while (ndata) {
-	if (sockaddr_equal(ndata->raddr, ndata->raddrlen,
-			   (struct sockaddr *) addr, addrlen, true)) {
-	    if (remove) {
-		if (!prev)
-		    *list = ndata->next;
-		else
-		    prev->next = ndata->next;
-	    }
+	if (ndata->list == list &&
+		sockaddr_equal(ndata->raddr, ndata->raddrlen,
+			       addr, addrlen, true)) {
+	    if (remove)
+		udpn_remove_from_list(list, ndata);
 	    break;
 	}
-	prev = ndata;
-	ndata = ndata->next;
+	ndata = ndata->hash_next;
     }
 
     return ndata;
@@ -190,6 +333,7 @@ static void udpn_add_to_list(struct udpn_data **list, struct udpn_data *ndata)
 {
     struct udpn_data *tndata;
 
+    ndata->list = list;
     ndata->next = NULL;
     tndata = *list;
     if (!tndata)
@@ -210,15 +354,6 @@ udpna_enable_read(struct udpna_data *nadata)
 	nadata->o->set_read_handler(nadata->o, nadata->fds[i].fd, true);
 }
 
-static void
-udpna_fd_read_enable(struct udpna_data *nadata)
-{
-    assert(nadata->read_disable_count > 0);
-    nadata->read_disable_count--;
-    if (nadata->read_disable_count == 0)
-	udpna_enable_read(nadata);
-}
-
 static void
 udpna_disable_read(struct udpna_data *nadata)
 {
@@ -228,12 +363,62 @@ udpna_disable_read(struct udpna_data *nadata)
 	nadata->o->set_read_handler(nadata->o, nadata->fds[i].fd, false);
 }
 
+/*
+ * Read from the sockets if there is a free buffer to read into and
+ * anything to read for, either new connections or open ones.
+ */
 static void
-udpna_fd_read_disable(struct udpna_data *nadata)
+udpna_check_read(struct udpna_data *nadata)
 {
-    if (nadata->read_disable_count == 0)
-	udpna_disable_read(nadata);
-    nadata->read_disable_count++;
+    bool want_read = (nadata->nr_free_rd_slots > 0 &&
+		      (nadata->setup || nadata->udpns));
+
+    if (want_read != nadata->read_armed) {
+	nadata->read_armed = want_read;
+	if (want_read)
+	    udpna_enable_read(nadata);
+	else
+	    udpna_disable_read(nadata);
+    }
+}
+
+static void
+udpna_put_rd_slot(struct udpna_data *nadata, struct udpn_slot *slot)
+{
+    slot->next = nadata->free_rd_slots;
+    nadata->free_rd_slots = slot;
+    nadata->nr_free_rd_slots++;
+    if (!nadata->in_readhandler)
+	udpna_check_read(nadata);
+}
+
+static void
+udpn_queue_rd(struct udpn_data *ndata, struct udpn_slot *slot)
+{
+    slot->next = NULL;
+    if (ndata->rd_tail)
+	ndata->rd_tail->next = slot;
+    else
+	ndata->rd_head = slot;
+    ndata->rd_tail = slot;
+}
+
+static void
+udpn_dequeue_rd(struct udpna_data *nadata, struct udpn_data *ndata)
+{
+    struct udpn_slot *slot = ndata->rd_head;
+
+    ndata->rd_head = slot->next;
+    if (!ndata->rd_head)
+	ndata->rd_tail = NULL;
+    udpna_put_rd_slot(nadata, slot);
+}
+
+static void
+udpn_drop_rd(struct udpna_data *nadata, struct udpn_data *ndata)
+{
+    while (ndata->rd_head)
+	udpn_dequeue_rd(nadata, ndata);
 }
 
 static void
@@ -250,7 +435,8 @@ udpna_fd_write_disable(struct udpna_data *nadata)
 {
     assert(nadata->write_enable_count > 0);
     nadata->write_enable_count--;
-    if (nadata->write_enable_count == 0 && !nadata->in_write)
+    if (nadata->write_enable_count == 0 && !nadata->in_write &&
+		!nadata->send_blocked)
 	udpna_disable_write(nadata);
 }
 
@@ -266,11 +452,127 @@ udpna_enable_write(struct udpna_data *nadata)
 static void
 udpna_fd_write_enable(struct udpna_data *nadata)
 {
-    if (nadata->write_enable_count == 0 && !nadata->in_write)
+    if (nadata->write_enable_count == 0 && !nadata->in_write &&
+		!nadata->send_blocked)
 	udpna_enable_write(nadata);
     nadata->write_enable_count++;
 }
 
+#if !defined(HAVE_RECVMMSG) || !defined(HAVE_SENDMMSG)
+/* Do the batch calls one datagram at a time. */
+struct udpn_mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+#define mmsghdr udpn_mmsghdr
+#define sendmmsg udpn_sendmmsg
+#define recvmmsg udpn_recvmmsg
+
+static int
+udpn_sendmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags)
+{
+    unsigned int i;
+    int rv;
+
+    for (i = 0; i < vlen; i++) {
+	rv = sendmsg(fd, &msgs[i].msg_hdr, flags);
+	if (rv == -1)
+	    return i > 0 ? (int) i : -1;
+	msgs[i].msg_len = rv;
+    }
+    return i;
+}
+
+/* Only get one at a time, the read handler will be called again. */
+static int
+udpn_recvmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags,
+	      void *timeout)
+{
+    int rv;
+
+    rv = recvmsg(fd, &msgs[0].msg_hdr, flags);
+    if (rv == -1)
+	return -1;
+    msgs[0].msg_len = rv;
+    return 1;
+}
+#endif
+
+/*
+ * Send as many of the queued datagrams as the sockets will take.  If
+ * a socket is full, turn on the write handler to finish the job.
+ */
+static void
+udpna_flush_sends(struct udpna_data *nadata)
+{
+    struct mmsghdr msgs[UDPNA_BATCH];
+    struct iovec iov[UDPNA_BATCH];
+    struct udpn_slot *slot;
+    unsigned int i;
+    int fd, rv;
+
+    while (nadata->wr_head) {
+	/* Batch up datagrams going out the same socket. */
+	fd = nadata->wr_head->fd;
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0, slot = nadata->wr_head;
+	     slot && slot->fd == fd && i < UDPNA_BATCH;
+	     i++, slot = slot->next) {
+	    iov[i].iov_base = slot->data;
+	    iov[i].iov_len = slot->len;
+	    msgs[i].msg_hdr.msg_name = &slot->addr;
+	    msgs[i].msg_hdr.msg_namelen = slot->addrlen;
+	    msgs[i].msg_hdr.msg_iov = &iov[i];
+	    msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	rv = sendmmsg(fd, msgs, i, 0);
+	if (rv == -1) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == EWOULDBLOCK || errno == EAGAIN) {
+		if (!nadata->send_blocked) {
+		    if (nadata->write_enable_count == 0 && !nadata->in_write)
+			udpna_enable_write(nadata);
+		    nadata->send_blocked = true;
+		}
+		return;
+	    }
+	    /* Report the error on the owner's next write and drop it. */
+	    if (nadata->wr_head->owner)
+		nadata->wr_head->owner->write_err = errno;
+	    rv = 1;
+	}
+
+	while (rv-- > 0) {
+	    slot = nadata->wr_head;
+	    nadata->wr_head = slot->next;
+	    slot->next = nadata->free_wr_slots;
+	    nadata->free_wr_slots = slot;
+	}
+	if (!nadata->wr_head)
+	    nadata->wr_tail = NULL;
+    }
+
+    if (nadata->send_blocked) {
+	nadata->send_blocked = false;
+	if (nadata->write_enable_count == 0 && !nadata->in_write)
+	    udpna_disable_write(nadata);
+    }
+}
+
+/* The owner is going away, the datagrams still get sent. */
+static void
+udpna_forget_sends(struct udpna_data *nadata, struct udpn_data *ndata)
+{
+    struct udpn_slot *slot;
+
+    for (slot = nadata->wr_head; slot; slot = slot->next) {
+	if (slot->owner == ndata)
+	    slot->owner = NULL;
+    }
+}
+
 static void udpna_do_free(struct udpna_data *nadata)
 {
     unsigned int i;
@@ -286,8 +588,12 @@ static void udpna_do_free(struct udpna_data *nadata)
 	genio_free_addrinfo(nadata->o, nadata->ai);
     if (nadata->fds)
 	nadata->o->free(nadata->o, nadata->fds);
-    if (nadata->read_data)
-	nadata->o->free(nadata->o, nadata->read_data);
+    if (nadata->slots)
+	nadata->o->free(nadata->o, nadata->slots);
+    if (nadata->slot_data)
+	nadata->o->free(nadata->o, nadata->slot_data);
+    if (nadata->peers)
+	nadata->o->free(nadata->o, nadata->peers);
     if (nadata->lock)
 	nadata->o->free_lock(nadata->lock);
     nadata->o->free(nadata->o, nadata);
@@ -325,6 +631,8 @@ static void udpn_finish_free(struct udpn_data *ndata)
     struct udpna_data *nadata = ndata->nadata;
 
     udpn_remove_from_list(&nadata->closed_udpns, ndata);
+    udpn_hash_remove(nadata, ndata);
+    udpna_forget_sends(nadata, ndata);
     nadata->udpn_count--;
     if (ndata->deferred_op_runner)
 	ndata->o->free_runner(ndata->deferred_op_runner);
@@ -332,15 +640,83 @@ static void udpn_finish_free(struct udpn_data *ndata)
     udpna_check_finish_free(nadata);
 }
 
+/*
+ * Send a datagram.  Small datagrams are copied to the send queue and
+ * sent in a batch from the deferred op, so everything written in one
+ * pass through the selector goes out with one system call.
+ */
 static int
-udpn_write(struct genio *net, unsigned int *count,
-	   const void *buf, unsigned int buflen)
+udpn_send(struct genio *net, unsigned int *count,
+	  const struct genio_sg *sg, unsigned int sglen)
 {
     struct udpn_data *ndata = net_to_ndata(net);
+    struct udpna_data *nadata = ndata->nadata;
+    struct iovec iov[GENIO_MAX_IOV];
+    struct msghdr msg;
+    struct udpn_slot *slot;
+    unsigned int i, len = 0;
     int rv, err = 0;
 
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = ndata->raddr;
+    msg.msg_namelen = ndata->raddrlen;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = genio_sg_to_iov(sg, sglen, iov, GENIO_MAX_IOV);
+    for (i = 0; i < msg.msg_iovlen; i++)
+	len += iov[i].iov_len;
+    if (len == 0) {
+	/* Don't send empty packets, that can confuse UDP clients. */
+	if (count)
+	    *count = 0;
+	return 0;
+    }
+
+    udpna_lock(nadata);
+    if (ndata->write_err) {
+	err = ndata->write_err;
+	ndata->write_err = 0;
+	goto out_unlock;
+    }
+
+    if (len <= nadata->max_read_size) {
+	if (!nadata->free_wr_slots)
+	    udpna_flush_sends(nadata);
+	slot = nadata->free_wr_slots;
+	if (!slot) {
+	    rv = 0; /* Handle like a zero-byte write. */
+	    goto out_count;
+	}
+	nadata->free_wr_slots = slot->next;
+
+	slot->len = 0;
+	for (i = 0; i < msg.msg_iovlen; i++) {
+	    memcpy(slot->data + slot->len, iov[i].iov_base, iov[i].iov_len);
+	    slot->len += iov[i].iov_len;
+	}
+	slot->owner = ndata;
+	slot->fd = ndata->myfd;
+	memcpy(&slot->addr, ndata->raddr, ndata->raddrlen);
+	slot->addrlen = ndata->raddrlen;
+	slot->next = NULL;
+	if (nadata->wr_tail)
+	    nadata->wr_tail->next = slot;
+	else
+	    nadata->wr_head = slot;
+	nadata->wr_tail = slot;
+	udpna_start_deferred_op(nadata);
+	rv = len;
+	goto out_count;
+    }
+
+    /* Too big to queue, send it now, but keep the datagrams in order. */
+    udpna_flush_sends(nadata);
+    if (nadata->wr_head) {
+	rv = 0;
+	goto out_count;
+    }
+
  retry:
-    rv = sendto(ndata->myfd, buf, buflen, 0, ndata->raddr, ndata->raddrlen);
+    rv = sendmsg(ndata->myfd, &msg, 0);
     if (rv < 0) {
 	if (errno == EINTR)
 	    goto retry;
@@ -352,12 +728,34 @@ udpn_write(struct genio *net, unsigned int *count,
 	err = EPIPE;
     }
 
+ out_count:
     if (!err && count)
 	*count = rv;
+ out_unlock:
+    udpna_unlock(nadata);
 
     return err;
 }
 
+static int
+udpn_write(struct genio *net, unsigned int *count,
+	   const void *buf, unsigned int buflen)
+{
+    struct genio_sg sg;
+
+    sg.buf = buf;
+    sg.buflen = buflen;
+    return udpn_send(net, count, &sg, 1);
+}
+
+/* All the buffers go out together as one datagram. */
+static int
+udpn_writev(struct genio *net, unsigned int *count,
+	    const struct genio_sg *sg, unsigned int sglen)
+{
+    return udpn_send(net, count, sg, sglen);
+}
+
 static int
 udpn_raddr_to_str(struct genio *net, int *epos,
 		  char *buf, unsigned int buflen)
@@ -422,11 +820,6 @@ udpn_finish_close(struct udpna_data *nadata, struct udpn_data *ndata)
 
     ndata->in_close = false;
 
-    if (nadata->pending_data_owner == ndata) {
-	nadata->pending_data_owner = NULL;
-	nadata->data_pending_len = 0;
-    }
-
     if (ndata->in_free)
 	udpn_finish_free(ndata);
 }
@@ -435,50 +828,70 @@ static void
 udpn_add_to_closed(struct udpna_data *nadata, struct udpn_data *ndata)
 {
     ndata->in_close = false;
-    if (!ndata->read_enabled) {
-	udpna_fd_read_enable(nadata);
-    }
     if (ndata->write_enabled) {
 	ndata->write_enabled = false;
 	udpna_fd_write_disable(nadata);
     }
+    udpn_drop_rd(nadata, ndata);
+    /* Try to get anything written before the close out now. */
+    if (nadata->wr_head && !nadata->send_blocked)
+	udpna_flush_sends(nadata);
 
     udpn_remove_from_list(&nadata->udpns, ndata);
     udpn_add_to_list(&nadata->pending_close_ndata, ndata);
+    udpna_check_read(nadata);
 
     udpna_start_deferred_op(nadata);
 }
 
+/* Deliver the queued datagrams, in_read must be set by the caller. */
 static void
 udpn_finish_read(struct udpn_data *ndata)
 {
     struct udpna_data *nadata = ndata->nadata;
     struct genio *net = &ndata->net;
+    struct udpn_slot *slot;
     unsigned int count;
 
  retry:
+    slot = ndata->rd_head;
     udpna_unlock(nadata);
-    count = net->cbs->read_callback(net, 0, nadata->read_data,
-				    nadata->data_pending_len, 0);
+    count = net->cbs->read_callback(net, 0, slot->data + slot->pos,
+				    slot->len - slot->pos, 0);
     udpna_lock(nadata);
 
-    if (ndata->closed)
+    if (ndata->closed) {
+	/* This throws away the rest of the data. */
 	udpn_add_to_closed(nadata, ndata);
+	goto out;
+    }
 
-    nadata->pending_data_owner = NULL;
-
-    if (count < nadata->data_pending_len) {
+    if (count < slot->len - slot->pos)
 	/* The user didn't comsume all the data */
-	nadata->data_pending_len -= count;
-	nadata->data_pos += count;
-	if (!ndata->closed && ndata->read_enabled)
-	    goto retry;
-    } else {
-	nadata->data_pending_len = 0;
-    }
+	slot->pos += count;
+    else
+	udpn_dequeue_rd(nadata, ndata);
+
+    if (ndata->rd_head && ndata->read_enabled)
+	goto retry;
+ out:
     ndata->in_read = false;
 }
 
+/* Deliver the queued datagrams from the deferred op. */
+static void
+udpn_schedule_read(struct udpna_data *nadata, struct udpn_data *ndata)
+{
+    ndata->in_read = true;
+    ndata->deliver_next = NULL;
+    if (nadata->deliver_tail)
+	nadata->deliver_tail->deliver_next = ndata;
+    else
+	nadata->deliver_head = ndata;
+    nadata->deliver_tail = ndata;
+    udpna_start_deferred_op(nadata);
+}
+
 static void
 udpna_deferred_op(struct genio_runner *runner, void *cbdata)
 {
@@ -487,9 +900,26 @@ udpna_deferred_op(struct genio_runner *runner, void *cbdata)
 
     udpna_lock(nadata);
 
-    while (nadata->pending_data_owner &&
-			nadata->pending_data_owner->read_enabled)
-	udpn_finish_read(nadata->pending_data_owner);
+    if (nadata->wr_head && !nadata->send_blocked)
+	udpna_flush_sends(nadata);
+
+    while (nadata->deliver_head) {
+	ndata = nadata->deliver_head;
+	nadata->deliver_head = ndata->deliver_next;
+	if (!nadata->deliver_head)
+	    nadata->deliver_tail = NULL;
+
+	if (ndata->closed) {
+	    /* The close was waiting for this read to finish. */
+	    ndata->in_read = false;
+	    if (!ndata->in_write && !ndata->in_open)
+		udpn_add_to_closed(nadata, ndata);
+	} else if (ndata->read_enabled && ndata->rd_head) {
+	    udpn_finish_read(ndata);
+	} else {
+	    ndata->in_read = false;
+	}
+    }
 
     while (nadata->pending_close_ndata) {
 	ndata = nadata->pending_close_ndata;
@@ -518,6 +948,9 @@ udpna_deferred_op(struct genio_runner *runner, void *cbdata)
     }
 }
 
+static void udpn_handle_read_incoming(struct udpna_data *nadata,
+				      struct udpn_data *ndata);
+
 static void
 udpn_deferred_op(struct genio_runner *runner, void *cbdata)
 {
@@ -535,10 +968,9 @@ udpn_deferred_op(struct genio_runner *runner, void *cbdata)
 	if (ndata->closed) {
 	    udpn_add_to_closed(nadata, ndata);
 	} else {
-	    if (ndata->read_enabled && nadata->read_disable_count == 0)
-		udpna_enable_read(nadata);
 	    if (ndata->write_enabled)
 		udpna_fd_write_enable(nadata);
+	    udpn_handle_read_incoming(nadata, ndata);
 	}
     }
     udpna_unlock(nadata);
@@ -573,6 +1005,7 @@ udpn_open(struct genio *net, void (*open_done)(struct genio *net,
 	ndata->in_open = true;
 	ndata->open_done = open_done;
 	ndata->open_data = open_data;
+	udpna_check_read(nadata);
 	udpn_start_deferred_op(ndata);
 	err = 0;
     }
@@ -588,10 +1021,6 @@ udpn_start_close(struct udpn_data *ndata,
 {
     struct udpna_data *nadata = ndata->nadata;
 
-    if (nadata->pending_data_owner == ndata) {
-	nadata->pending_data_owner = NULL;
-	nadata->data_pending_len = 0;
-    }
     ndata->in_close = true;
     ndata->closed = true;
     ndata->close_done = close_done;
@@ -659,33 +1088,19 @@ udpn_set_read_callback_enable(struct genio *net, bool enabled)
 {
     struct udpn_data *ndata = net_to_ndata(net);
     struct udpna_data *nadata = ndata->nadata;
-    bool my_data_pending;
 
     udpna_lock(nadata);
     if (ndata->closed || ndata->read_enabled == enabled)
 	goto out_unlock;
 
-    my_data_pending = (nadata->data_pending_len &&
-		       nadata->pending_data_owner == ndata);
-    if (enabled) {
-	assert(nadata->read_disable_count > 0);
-	nadata->read_disable_count--;
-    } else {
-	nadata->read_disable_count++;
-    }
+    /*
+     * Disabling just leaves new data on the read queue.  The socket
+     * is still read until the buffers run out.
+     */
     ndata->read_enabled = enabled;
-    if (ndata->in_read || ndata->in_open || (my_data_pending && !enabled)) {
-	/* Nothing to do. */
-    } else if (enabled && my_data_pending) {
-	ndata->in_read = true;
+    if (enabled && ndata->rd_head && !ndata->in_read && !ndata->in_open)
 	/* Call the read from the selector to avoid lock nesting issues. */
-	udpna_start_deferred_op(nadata);
-    } else {
-	if (enabled && nadata->read_disable_count == 0)
-	    udpna_enable_read(ndata->nadata);
-	else if (!enabled && nadata->read_disable_count == 1)
-	    udpna_disable_read(ndata->nadata);
-    }
+	udpn_schedule_read(nadata, ndata);
  out_unlock:
     udpna_unlock(nadata);
 }
@@ -715,7 +1130,8 @@ udpn_set_write_callback_enable(struct genio *net, bool enabled)
 static void
 udpn_handle_read_incoming(struct udpna_data *nadata, struct udpn_data *ndata)
 {
-    if (!ndata->read_enabled || ndata->in_read)
+    if (!ndata->read_enabled || ndata->in_read || ndata->in_open ||
+		!ndata->rd_head)
 	return;
 
     ndata->in_read = true;
@@ -747,6 +1163,12 @@ udpna_writehandler(int fd, void *cbdata)
     if (nadata->in_write)
 	goto out_unlock;
 
+    if (nadata->send_blocked) {
+	udpna_flush_sends(nadata);
+	if (nadata->send_blocked)
+	    goto out_unlock;
+    }
+
     udpna_disable_write(nadata);
     ndata = nadata->udpns;
     while (ndata) {
@@ -768,6 +1190,7 @@ udpna_writehandler(int fd, void *cbdata)
 
 static const struct genio_functions genio_udp_funcs = {
     .write = udpn_write,
+    .writev = udpn_writev,
     .raddr_to_str = udpn_raddr_to_str,
     .get_raddr = udpn_get_raddr,
     .open = udpn_open,
@@ -778,41 +1201,15 @@ static const struct genio_functions genio_udp_funcs = {
     .set_write_callback_enable = udpn_set_write_callback_enable
 };
 
+/* Hand a received datagram to its connection, or start a new one. */
 static void
-udpna_readhandler(int fd, void *cbdata)
+udpna_dispatch(struct udpna_data *nadata, int fd, struct udpn_slot *slot)
 {
-    struct udpna_data *nadata = cbdata;
+    struct sockaddr *addr = (struct sockaddr *) &slot->addr;
+    socklen_t addrlen = slot->addrlen;
     struct udpn_data *ndata;
-    struct sockaddr_storage addr;
-    socklen_t addrlen = sizeof(addr);
-
-    int datalen;
-
-    udpna_lock(nadata);
-    if (nadata->data_pending_len)
-	goto out_unlock;
-
-    datalen = recvfrom(fd, nadata->read_data, nadata->max_read_size, 0,
-		       (struct sockaddr *) &addr, &addrlen);
-    if (datalen == -1) {
-	/* FIXME - There is no really good way to report this error. */
-	if (errno != EAGAIN && errno != EWOULDBLOCK)
-	    syslog(LOG_ERR, "Could not accept on %s: %m", nadata->name);
-	goto out_unlock;
-    }
-    if (addrlen > sizeof(struct sockaddr_storage)) {
-	/* Shouldn't happen. */
-	syslog(LOG_ERR, "Address too long on %s: %d", nadata->name, addrlen);
-	goto out_unlock;
-    }
-
-    udpna_fd_read_disable(nadata);
-
-    nadata->data_pending_len = datalen;
-    nadata->data_pos = 0;
 
-    ndata = udpn_find(&nadata->udpns,
-		      (struct sockaddr *) &addr, addrlen, false);
+    ndata = udpn_find(nadata, &nadata->udpns, addr, addrlen, false);
     if (ndata) {
 	/*
 	 * Data belongs to an existing connection.
@@ -823,20 +1220,20 @@ udpna_readhandler(int fd, void *cbdata)
 	 */
 	if (!ndata->closed) {
 	    ndata->myfd = fd; /* Reset this on every read. */
-	    nadata->pending_data_owner = ndata;
+	    udpn_queue_rd(ndata, slot);
 	    udpn_handle_read_incoming(nadata, ndata);
-	    goto out_unlock_enable;
+	    return;
 	}
     }
 
     if (nadata->closed || !nadata->enabled) {
-	nadata->data_pending_len = 0;
-	goto out_unlock_enable;
+	udpna_put_rd_slot(nadata, slot);
+	return;
     }
 
     if (!ndata) {
-	ndata = udpn_find(&nadata->pending_close_ndata,
-			  (struct sockaddr *) &addr, addrlen, true);
+	ndata = udpn_find(nadata, &nadata->pending_close_ndata,
+			  addr, addrlen, true);
 	if (ndata) {
 	    if (ndata->close_done) {
 		void (*close_done)(struct genio *net, void *close_data) =
@@ -849,8 +1246,8 @@ udpna_readhandler(int fd, void *cbdata)
 		udpna_lock(nadata);
 	    }
 	} else {
-	    ndata = udpn_find(&nadata->closed_udpns,
-			      (struct sockaddr *) &addr, addrlen, true);
+	    ndata = udpn_find(nadata, &nadata->closed_udpns,
+			      addr, addrlen, true);
 	}
 	if (ndata)
 	    udpn_add_to_list(&nadata->udpns, ndata);
@@ -881,18 +1278,21 @@ udpna_readhandler(int fd, void *cbdata)
     ndata->net.funcs = &genio_udp_funcs;
     ndata->net.type = GENIO_TYPE_UDP;
 
+    ndata->raddrlen = addrlen;
+    memcpy(ndata->raddr, addr, addrlen);
+    udpn_hash_add(nadata, ndata);
+
     /* Stick it on the end of the list. */
     udpn_add_to_list(&nadata->udpns, ndata);
     nadata->udpn_count++;
 
  restart_net:
+    udpn_drop_rd(nadata, ndata);
     ndata->read_enabled = false;
-    nadata->read_disable_count++;
+    ndata->write_err = 0;
     ndata->myfd = fd;
-    ndata->raddrlen = addrlen;
-    memcpy(ndata->raddr, &addr, addrlen);
 
-    nadata->pending_data_owner = ndata;
+    udpn_queue_rd(ndata, slot);
     nadata->in_new_connection = true;
     ndata->in_read = true;
     udpna_unlock(nadata);
@@ -916,16 +1316,78 @@ udpna_readhandler(int fd, void *cbdata)
 	nadata->in_shutdown = false;
     }
     udpna_check_finish_free(nadata);
-    goto out_unlock_enable;
+    return;
 
  out_nomem:
-    nadata->data_pending_len = 0;
+    udpna_put_rd_slot(nadata, slot);
     syslog(LOG_ERR, "Out of memory allocating for udp port %s", nadata->name);
- out_unlock_enable:
-    udpna_fd_read_enable(nadata);
+}
+
+static void
+udpna_readhandler(int fd, void *cbdata)
+{
+    struct udpna_data *nadata = cbdata;
+    struct udpn_slot *slot, *slots[UDPNA_BATCH];
+    struct mmsghdr msgs[UDPNA_BATCH];
+    struct iovec iov[UDPNA_BATCH];
+    unsigned int i, n;
+    int rv;
+
+    udpna_lock(nadata);
+    /*
+     * Don't read more while the dispatch below has the lock released
+     * for a callback, so the datagrams get delivered in order.
+     */
+    if (nadata->in_readhandler)
+	goto out_unlock;
+
+    n = nadata->nr_free_rd_slots;
+    if (n > UDPNA_BATCH)
+	n = UDPNA_BATCH;
+    if (n == 0)
+	goto out_check;
+
+    /* Read into the free buffers, in the order they are on the list. */
+    memset(msgs, 0, n * sizeof(msgs[0]));
+    for (i = 0, slot = nadata->free_rd_slots; i < n; i++, slot = slot->next) {
+	iov[i].iov_base = slot->data;
+	iov[i].iov_len = nadata->max_read_size;
+	msgs[i].msg_hdr.msg_name = &slot->addr;
+	msgs[i].msg_hdr.msg_namelen = sizeof(slot->addr);
+	msgs[i].msg_hdr.msg_iov = &iov[i];
+	msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+ retry:
+    rv = recvmmsg(fd, msgs, n, 0, NULL);
+    if (rv == -1) {
+	if (errno == EINTR)
+	    goto retry;
+	/* FIXME - There is no really good way to report this error. */
+	if (errno != EAGAIN && errno != EWOULDBLOCK)
+	    syslog(LOG_ERR, "Could not accept on %s: %m", nadata->name);
+	goto out_check;
+    }
+
+    for (i = 0; i < (unsigned int) rv; i++) {
+	slot = nadata->free_rd_slots;
+	nadata->free_rd_slots = slot->next;
+	nadata->nr_free_rd_slots--;
+	slot->len = msgs[i].msg_len;
+	slot->pos = 0;
+	slot->addrlen = msgs[i].msg_hdr.msg_namelen;
+	slots[i] = slot;
+    }
+
+    nadata->in_readhandler = true;
+    for (i = 0; i < (unsigned int) rv; i++)
+	udpna_dispatch(nadata, fd, slots[i]);
+    nadata->in_readhandler = false;
+
+ out_check:
+    udpna_check_read(nadata);
  out_unlock:
     udpna_unlock(nadata);
-    return;
 }
 
 static int
@@ -948,7 +1410,7 @@ udpna_startup(struct genio_acceptor *acceptor)
 
     nadata->setup = true;
     nadata->enabled = true;
-    udpna_enable_read(nadata);
+    udpna_check_read(nadata);
  out_unlock:
     udpna_unlock(nadata);
 
@@ -1065,10 +1527,10 @@ udpna_connect(struct genio_acceptor *acceptor, void *addr,
     ndata->open_data = cb_data;
 
     udpna_lock(nadata);
+    udpn_hash_add(nadata, ndata);
     udpn_add_to_list(&nadata->udpns, ndata);
     nadata->udpn_count++;
     udpn_start_deferred_op(ndata);
-    nadata->read_disable_count++;
     udpna_unlock(nadata);
 
     *new_net = &ndata->net;
@@ -1097,6 +1559,7 @@ udp_genio_acceptor_alloc(const char *name,
     struct genio_acceptor *acc;
     struct udpna_data *nadata;
     struct addrinfo *ai = genio_dup_addrinfo(o, iai);
+    unsigned int i;
 
     if (!ai && iai) /* Allow a null ai if it was passed in. */
 	return ENOMEM;
@@ -1110,8 +1573,29 @@ udp_genio_acceptor_alloc(const char *name,
     if (!nadata->name)
 	goto out_err;
 
-    nadata->read_data = o->zalloc(o, max_read_size);
-    if (!nadata->read_data)
+    nadata->slots = o->zalloc(o, UDPNA_NR_SLOTS * 2 * sizeof(*nadata->slots));
+    if (!nadata->slots)
+	goto out_err;
+    nadata->slot_data = o->alloc(o, UDPNA_NR_SLOTS * 2 * max_read_size);
+    if (!nadata->slot_data)
+	goto out_err;
+    for (i = 0; i < UDPNA_NR_SLOTS * 2; i++) {
+	struct udpn_slot *slot = &nadata->slots[i];
+
+	slot->data = nadata->slot_data + i * max_read_size;
+	if (i < UDPNA_NR_SLOTS) {
+	    slot->next = nadata->free_rd_slots;
+	    nadata->free_rd_slots = slot;
+	} else {
+	    slot->next = nadata->free_wr_slots;
+	    nadata->free_wr_slots = slot;
+	}
+    }
+    nadata->nr_free_rd_slots = UDPNA_NR_SLOTS;
+
+    nadata->peers_size = UDPNA_INIT_HASH_SIZE;
+    nadata->peers = o->zalloc(o, nadata->peers_size * sizeof(*nadata->peers));
+    if (!nadata->peers)
 	goto out_err;
 
     nadata->deferred_op_runner = o->alloc_runner(o, udpna_deferred_op, nadata);
@@ -1140,8 +1624,12 @@ udp_genio_acceptor_alloc(const char *name,
     if (nadata) {
 	if (nadata->name)
 	    o->free(o, nadata->name);
-	if (nadata->read_data)
-	    o->free(o, nadata->read_data);
+	if (nadata->slots)
+	    o->free(o, nadata->slots);
+	if (nadata->slot_data)
+	    o->free(o, nadata->slot_data);
+	if (nadata->peers)
+	    o->free(o, nadata->peers);
 	if (nadata->deferred_op_runner)
 	    nadata->o->free_runner(nadata->deferred_op_runner);
 	if (nadata->lock)
@@ -1206,19 +1694,20 @@ udp_genio_alloc(struct addrinfo *ai,
     nadata->fds->family = ai->ai_family;
     nadata->fds->fd = new_fd;
     nadata->nr_fds = 1;
-    nadata->read_disable_count = 1;
 
     nadata->closed = true; /* Free nadata when ndata is freed. */
 
     ndata->nadata = nadata;
     ndata->closed = true; /* Start closed. */
-    nadata->closed_udpns = ndata;
-    nadata->udpn_count = 1;
 
     ndata->raddr = (struct sockaddr *) &ndata->remote;
     memcpy(ndata->raddr, ai->ai_addr, ai->ai_addrlen);
     ndata->raddrlen = ai->ai_addrlen;
 
+    udpn_hash_add(nadata, ndata);
+    udpn_add_to_list(&nadata->closed_udpns, ndata);
+    nadata->udpn_count = 1;
+
     ndata->net.funcs = &genio_udp_funcs;
     ndata->net.type = GENIO_TYPE_UDP;
     ndata->net.is_client = true;
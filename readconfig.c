@@ -23,6 +23,7 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdio.h>
@@ -48,6 +49,94 @@ static int config_num = 0;
 
 static int lineno = 0;
 
+#define CONFIG_HASH_START	14695981039346656037ULL
+
+/* FNV-1a, continuing from hash. */
+static uint64_t
+config_str_hash(uint64_t hash, const char *str, int len)
+{
+    while (len--)
+	hash = (hash ^ (unsigned char) *str++) * 1099511628211ULL;
+    return hash;
+}
+
+/*
+ * The settings (strings, trace files, defaults, etc.) looked up while
+ * a port is made from the config are recorded, so on the next read
+ * the port can be checked against just those instead of against every
+ * setting line before it.  Each one is a type character and the name,
+ * ending in a '\0'.
+ */
+#define CONFIG_REF_STR		's'
+#define CONFIG_REF_TRACEFILE	't'
+#define CONFIG_REF_RS485	'r'
+#define CONFIG_REF_DEFAULT	'd'
+
+static bool config_refs_recording;
+static bool config_refs_failed;
+static char *config_refs;
+static unsigned int config_refs_len;
+static unsigned int config_refs_size;
+
+static void
+config_ref(char type, const char *name)
+{
+    unsigned int len = strlen(name) + 2;
+    char *new_refs;
+
+    if (!config_refs_recording || config_refs_failed)
+	return;
+
+    if (config_refs_len + len > config_refs_size) {
+	unsigned int new_size = config_refs_size ? config_refs_size : 256;
+
+	while (new_size < config_refs_len + len)
+	    new_size *= 2;
+	new_refs = realloc(config_refs, new_size);
+	if (!new_refs) {
+	    config_refs_failed = true;
+	    return;
+	}
+	config_refs = new_refs;
+	config_refs_size = new_size;
+    }
+    config_refs[config_refs_len] = type;
+    memcpy(config_refs + config_refs_len + 1, name, len - 1);
+    config_refs_len += len;
+}
+
+void
+config_refs_start(void)
+{
+    config_refs_recording = true;
+    config_refs_failed = false;
+    config_refs = NULL;
+    config_refs_len = 0;
+    config_refs_size = 0;
+}
+
+bool
+config_refs_end(char **refs, unsigned int *len)
+{
+    bool rv = !config_refs_failed;
+
+    if (!config_refs_recording) {
+	*refs = NULL;
+	*len = 0;
+	return false;
+    }
+    config_refs_recording = false;
+    if (!rv) {
+	free(config_refs);
+	config_refs = NULL;
+	config_refs_len = 0;
+    }
+    *refs = config_refs;
+    *len = config_refs_len;
+    config_refs = NULL;
+    return rv;
+}
+
 struct longstr_s
 {
     char *name;
@@ -204,31 +293,42 @@ handle_longstr(const char *name, const char *line, enum str_type type)
     return;
 }
 
-char *
-find_str(const char *name, enum str_type *type, unsigned int *len)
+static struct longstr_s *
+find_longstr(const char *name)
 {
     struct longstr_s *longstr = longstrs;
 
     while (longstr) {
-	if (strcmp(name, longstr->name) == 0) {
-	    char *rv;
-
-	    /* Note that longstrs can contain \0, so be careful in handling */
-	    if (type)
-		*type = longstr->type;
-	    if (len)
-		*len = longstr->length;
-	    rv = malloc(longstr->length + 1);
-	    if (!rv)
-		return NULL;
-	    memcpy(rv, longstr->str, longstr->length + 1);
-	    return rv;
-	}
+	if (strcmp(name, longstr->name) == 0)
+	    return longstr;
 	longstr = longstr->next;
     }
     return NULL;
 }
 
+char *
+find_str(const char *name, enum str_type *type, unsigned int *len)
+{
+    struct longstr_s *longstr;
+    char *rv;
+
+    config_ref(CONFIG_REF_STR, name);
+    longstr = find_longstr(name);
+    if (!longstr)
+	return NULL;
+
+    /* Note that longstrs can contain \0, so be careful in handling */
+    if (type)
+	*type = longstr->type;
+    if (len)
+	*len = longstr->length;
+    rv = malloc(longstr->length + 1);
+    if (!rv)
+	return NULL;
+    memcpy(rv, longstr->str, longstr->length + 1);
+    return rv;
+}
+
 void
 free_longstrs(void)
 {
@@ -292,16 +392,28 @@ handle_tracefile(char *name, char *fname)
     tracefiles = new_tracefile;
 }
 
-char *
-find_tracefile(const char *name)
+static struct tracefile_s *
+find_tracefile_s(const char *name)
 {
     struct tracefile_s *tracefile = tracefiles;
 
     while (tracefile) {
 	if (strcmp(name, tracefile->name) == 0)
-	    return strdup(tracefile->str);
+	    return tracefile;
 	tracefile = tracefile->next;
     }
+    return NULL;
+}
+
+char *
+find_tracefile(const char *name)
+{
+    struct tracefile_s *tracefile;
+
+    config_ref(CONFIG_REF_TRACEFILE, name);
+    tracefile = find_tracefile_s(name);
+    if (tracefile)
+	return strdup(tracefile->str);
     syslog(LOG_ERR, "Tracefile %s not found, it will be ignored", name);
     return NULL;
 }
@@ -384,16 +496,28 @@ handle_rs485conf(char *name, char *str)
     free(new_rs485conf);
 }
 
-struct serial_rs485 *
-find_rs485conf(const char *name)
+static struct rs485conf_s *
+find_rs485conf_s(const char *name)
 {
     struct rs485conf_s *new_rs485conf = rs485confs;
 
     while (new_rs485conf) {
         if (strcmp(name, new_rs485conf->name) == 0)
-            return &new_rs485conf->conf;
+            return new_rs485conf;
         new_rs485conf = new_rs485conf->next;
     }
+    return NULL;
+}
+
+struct serial_rs485 *
+find_rs485conf(const char *name)
+{
+    struct rs485conf_s *new_rs485conf;
+
+    config_ref(CONFIG_REF_RS485, name);
+    new_rs485conf = find_rs485conf_s(name);
+    if (new_rs485conf)
+        return &new_rs485conf->conf;
     syslog(LOG_ERR, "RS485 configuration %s not found, it will be ignored", name);
     return NULL;
 }
@@ -503,8 +627,15 @@ struct default_data defaults[] = {
     { "net-to-dev-bufsize", DEFAULT_INT,.min = 1, .max = 65536,
 					.def.intval = PORT_BUFSIZE,
 					.altname = "tcp-to-dev-bufsize" },
+    { "dev-to-net-buffers", DEFAULT_INT,.min = 1, .max = 64,
+					.def.intval = 2 },
     { "max-connections", DEFAULT_INT,	.min=1, .max=65536,
 					.def.intval = 1 },
+    { "lag-policy",	DEFAULT_ENUM,	.enums = lag_policy_enums,
+					.def.intval = LAG_POLICY_BLOCK },
+    { "splice",		DEFAULT_BOOL,	.def.intval = 0 },
+    { "capture-size",	DEFAULT_INT,	.min = 65536, .max = INT_MAX,
+					.def.intval = 1048576 },
 #ifdef HAVE_OPENIPMI
     /* SOL only */
     { "authenticated",	DEFAULT_BOOL,	.def.intval = 1 },
@@ -545,34 +676,116 @@ static int cmp_default_name(struct default_data *def, const char *name)
 	    (def->altname && strcmp(def->altname, name) == 0));
 }
 
-int
-find_default_int(const char *name)
+static struct default_data *
+find_default(const char *name)
 {
     int i;
 
     for (i = 0; defaults[i].name; i++) {
-	if (cmp_default_name(&defaults[i], name) &&
-			defaults[i].type != DEFAULT_STR)
-	    return defaults[i].val.intval;
+	if (cmp_default_name(&defaults[i], name))
+	    return &defaults[i];
     }
-    abort();
+    return NULL;
+}
+
+static const char *
+default_strval(struct default_data *def)
+{
+    if (def->val.strval)
+	return def->val.strval;
+    return def->def.strval;
+}
+
+int
+find_default_int(const char *name)
+{
+    struct default_data *def = find_default(name);
+
+    if (!def || def->type == DEFAULT_STR)
+	abort();
+    config_ref(CONFIG_REF_DEFAULT, name);
+    return def->val.intval;
 }
 
 char *
 find_default_str(const char *name)
 {
-    int i;
+    struct default_data *def = find_default(name);
 
-    for (i = 0; defaults[i].name; i++) {
-	if (cmp_default_name(&defaults[i], name) &&
-			defaults[i].type == DEFAULT_STR) {
-	    const char *s = defaults[i].val.strval;
-	    if (!s)
-		s = defaults[i].def.strval;
-	    return strdup(s);
+    if (!def || def->type != DEFAULT_STR)
+	abort();
+    config_ref(CONFIG_REF_DEFAULT, name);
+    return strdup(default_strval(def));
+}
+
+uint64_t
+config_refs_hash(uint64_t hash, const char *refs, unsigned int len)
+{
+    const char *end = refs + len, *name;
+    struct longstr_s *longstr;
+    struct tracefile_s *tracefile;
+#if HAVE_DECL_TIOCSRS485
+    struct rs485conf_s *rs485conf;
+#endif
+    struct default_data *def;
+    const char *s;
+    char found;
+
+    while (refs < end) {
+	name = refs + 1;
+	hash = config_str_hash(hash, refs, strlen(refs) + 1);
+
+	/* Hash whether it is there, then its value. */
+	switch (refs[0]) {
+	case CONFIG_REF_STR:
+	    longstr = find_longstr(name);
+	    found = longstr != NULL;
+	    hash = config_str_hash(hash, &found, 1);
+	    if (longstr) {
+		hash = config_str_hash(hash, (char *) &longstr->type,
+				       sizeof(longstr->type));
+		hash = config_str_hash(hash, longstr->str, longstr->length);
+	    }
+	    break;
+
+	case CONFIG_REF_TRACEFILE:
+	    tracefile = find_tracefile_s(name);
+	    found = tracefile != NULL;
+	    hash = config_str_hash(hash, &found, 1);
+	    if (tracefile)
+		hash = config_str_hash(hash, tracefile->str,
+				       strlen(tracefile->str) + 1);
+	    break;
+
+#if HAVE_DECL_TIOCSRS485
+	case CONFIG_REF_RS485:
+	    rs485conf = find_rs485conf_s(name);
+	    found = rs485conf != NULL;
+	    hash = config_str_hash(hash, &found, 1);
+	    if (rs485conf)
+		hash = config_str_hash(hash, (char *) &rs485conf->conf,
+				       sizeof(rs485conf->conf));
+	    break;
+#endif
+
+	case CONFIG_REF_DEFAULT:
+	    def = find_default(name);
+	    if (!def)
+		break;
+	    if (def->type == DEFAULT_STR) {
+		s = default_strval(def);
+		hash = config_str_hash(hash, s, strlen(s) + 1);
+	    } else {
+		hash = config_str_hash(hash, (char *) &def->val.intval,
+				       sizeof(def->val.intval));
+	    }
+	    break;
 	}
+
+	refs += strlen(refs) + 1;
     }
-    abort();
+
+    return hash;
 }
 
 static void
@@ -720,6 +933,7 @@ handle_config_line(char *inbuf, int len)
 {
     char *portnum, *state, *timeout, *devname, *devcfg;
     char *strtok_data = NULL;
+    uint64_t line_hash;
 
     if (len == 0)
 	/* Ignore empty lines */
@@ -732,6 +946,9 @@ handle_config_line(char *inbuf, int len)
     if (inbuf[len - 1] == '\\')
 	return len - 1; /* Continued line. */
 
+    /* Hash the line now, the parsing below modifies it. */
+    line_hash = config_str_hash(CONFIG_HASH_START, inbuf, len);
+
     if (startswith(inbuf, "BANNER", &strtok_data)) {
 	char *name = strtok_r(NULL, ":", &strtok_data);
 	char *str = strtok_r(NULL, "\n", &strtok_data);
@@ -863,7 +1080,7 @@ handle_config_line(char *inbuf, int len)
 	    syslog(LOG_ERR, "No rotator name given on line %d", lineno);
 	    goto out;
 	}
-	add_rotator(name, str, lineno);
+	add_rotator(name, str, lineno, config_num);
 	goto out;
     }
 
@@ -882,6 +1099,7 @@ handle_config_line(char *inbuf, int len)
 	goto out;
     }
 
+    /* Anything else is a port. */
     /* Scan for the state. */
     state = scan_for_state(inbuf);
     if (!state) {
@@ -918,7 +1136,7 @@ handle_config_line(char *inbuf, int len)
     }
 
     portconfig(&syslog_eout, portnum, state, timeout, devname, devcfg,
-	       config_num);
+	       config_num, line_hash);
 
  out:
     return 0;
@@ -936,7 +1154,7 @@ readconfig_init(void)
     free_leds();
 
     config_num++;
-    free_rotators();
+    start_port_config();
 }
 
 /* Read the specified configuration file and call the routine to
@@ -20,6 +20,9 @@
 #ifndef READCONFIG
 #define READCONFIG
 
+#include <stdbool.h>
+#include <stdint.h>
+
 /* Handle one line of configuration. */
 int handle_config_line(char *inbuf, int len);
 
@@ -60,4 +63,16 @@ int find_default_int(const char *name);
    out of memory.  The returned value must be freed. */
 char *find_default_str(const char *name);
 
+/*
+ * Record the names of the settings looked up with the find functions
+ * above between these two calls, while a port is made from the
+ * config.  config_refs_end() returns the malloc-ed list and its
+ * length, and false if it couldn't all be recorded.
+ */
+void config_refs_start(void);
+bool config_refs_end(char **refs, unsigned int *len);
+
+/* Hash the current values of the recorded settings into hash. */
+uint64_t config_refs_hash(uint64_t hash, const char *refs, unsigned int len);
+
 #endif /* READCONFIG */
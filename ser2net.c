@@ -25,6 +25,7 @@
  * Add some type of security
  */
 
+#define _GNU_SOURCE /* For pthread_setaffinity_np() */
 #include <stdio.h>
 #include <signal.h>
 #include <stdlib.h>
@@ -44,6 +45,7 @@
 #include "controller.h"
 #include "dataxfer.h"
 #include "led.h"
+#include "trace.h"
 
 static char *config_file = "/etc/ser2net.conf";
 int config_port_from_cmdline = 0;
@@ -59,7 +61,12 @@ struct thread_info {
     pthread_t id;
 };
 struct thread_info *threads;
+static int pin_shards = 0;
+static volatile int shards_stop = 0;
+static struct thread_info *shard_threads;
 #endif
+int ser2net_num_shards = 1;
+struct ser2net_shard *ser2net_shards;
 
 
 struct selector_s *ser2net_sel;
@@ -80,8 +87,14 @@ static char *help_string =
 "  -d - Don't detach and send debug I/O to standard output\n"
 "  -l - Increate the debugging level\n"
 "  -u - Disable UUCP locking\n"
+"  -U - Use io_uring to wait for I/O if the kernel supports it\n"
 #ifdef USE_PTHREADS
 "  -t <num threads> - Use the given number of threads, default 1\n"
+"  -S <num shards> - Spread the ports over the given number of selectors,\n"
+"     each with its own thread, default 1\n"
+"  -a - Pin each shard's threads to a CPU\n"
+"  -W <num threads> - Start the ports from the config with the given\n"
+"     number of threads, default 1\n"
 #endif
 "  -b - unused (was Do CISCO IOS baud-rate negotiation, instead of RFC2217)\n"
 "  -v - print the program's version and exit\n"
@@ -197,6 +210,14 @@ static int in_config_read = 0;
 
 DEFINE_LOCK_INIT(static, maint_lock)
 
+/*
+ * The thread reading the config, while it holds the maint lock.  It
+ * runs the selector while it waits for ports to shut down, so control
+ * port commands can come in on it.
+ */
+static pthread_t reload_thread;
+static volatile bool reload_running;
+
 int ser2net_wake_sig = SIGUSR1;
 void (*finish_shutdown)(void);
 
@@ -206,6 +227,16 @@ start_maint_op(void)
     LOCK(maint_lock);
 }
 
+int
+try_start_maint_op(void)
+{
+    /* The reload already has the lock, waiting for it would hang. */
+    if (reload_running && pthread_equal(reload_thread, pthread_self()))
+	return EBUSY;
+    start_maint_op();
+    return 0;
+}
+
 void
 end_maint_op(void)
 {
@@ -217,7 +248,10 @@ config_reread_thread(void *dummy)
 {
     pthread_detach(pthread_self());
     start_maint_op();
+    reload_thread = pthread_self();
+    reload_running = true;
     reread_config_file();
+    reload_running = false;
     end_maint_op();
     LOCK(config_lock);
     in_config_read = 0;
@@ -289,6 +323,87 @@ op_loop(void *dummy)
     return NULL;
 }
 
+/* Bind a thread to a CPU, spreading the shards over the CPUs we have. */
+static void
+pin_thread(pthread_t id, int shard)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    cpu_set_t cpus;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int rv;
+
+    if (!pin_shards || ncpus <= 0)
+	return;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(shard % ncpus, &cpus);
+    rv = pthread_setaffinity_np(id, sizeof(cpus), &cpus);
+    if (rv)
+	syslog(LOG_ERR, "Unable to set CPU affinity for shard %d: %s",
+	       shard, strerror(rv));
+#endif
+}
+
+/*
+ * Threads for shards other than shard 0.  These only run the shard's
+ * selector, all the program-wide work (signals, config, shutdown) is
+ * done by the shard 0 threads in op_loop().
+ */
+static void *
+shard_loop(void *data)
+{
+    struct ser2net_shard *shard = data;
+    pthread_t self = pthread_self();
+
+    while (!shards_stop)
+	sel_select(shard->sel, wake_thread_send_sig, (long) &self, NULL, NULL);
+    shard->done = 1;
+    return NULL;
+}
+
+static void
+start_shards(void)
+{
+    int i, rv;
+
+    shard_threads = malloc(sizeof(*shard_threads) * ser2net_num_shards);
+    if (!shard_threads) {
+	syslog(LOG_ERR, "Unable to allocate shard thread info");
+	exit(1);
+    }
+
+    for (i = 1; i < ser2net_num_shards; i++) {
+	rv = pthread_create(&shard_threads[i].id, NULL, shard_loop,
+			    &ser2net_shards[i]);
+	if (rv) {
+	    syslog(LOG_ERR, "Unable to start shard thread: %s", strerror(rv));
+	    exit(1);
+	}
+	pin_thread(shard_threads[i].id, i);
+    }
+}
+
+/*
+ * Called after all the ports are shut down.  The shard threads may
+ * be about to wait when the flag is set, so keep waking them until
+ * they are gone.
+ */
+static void
+stop_shards(void)
+{
+    int i;
+
+    shards_stop = 1;
+    for (i = 1; i < ser2net_num_shards; i++) {
+	while (!ser2net_shards[i].done) {
+	    sel_wake_all(ser2net_shards[i].sel);
+	    usleep(1000);
+	}
+	pthread_join(shard_threads[i].id, NULL);
+    }
+    free(shard_threads);
+}
+
 static void
 start_threads(void)
 {
@@ -311,6 +426,7 @@ start_threads(void)
     }
 
     threads[0].id = pthread_self();
+    pin_thread(threads[0].id, 0);
 
     for (i = 1; i < num_threads; i++) {
 	rv = pthread_create(&threads[i].id, NULL, op_loop, NULL);
@@ -318,7 +434,10 @@ start_threads(void)
 	    syslog(LOG_ERR, "Unable to start thread: %s", strerror(rv));
 	    exit(1);
 	}
+	pin_thread(threads[i].id, 0);
     }
+
+    start_shards();
 }
 
 static void
@@ -379,8 +498,10 @@ slock_unlock(sel_lock_t *l)
 #else
 int ser2net_wake_sig = 0;
 void start_maint_op(void) { }
+int try_start_maint_op(void) { return 0; }
 void end_maint_op(void) { }
 static void start_threads(void) { }
+static void stop_shards(void) { }
 static void stop_threads(void (*finish)(void)) { finish(); }
 #define slock_alloc NULL
 #define slock_free NULL
@@ -394,6 +515,56 @@ op_loop(void *dummy)
 }
 #endif /* USE_PTHREADS */
 
+/*
+ * Shard 0 is the main selector, the others get their own locked
+ * selector.  The threads for them are started in start_threads().
+ */
+static void
+alloc_shards(void)
+{
+    int i, err;
+
+    ser2net_shards = calloc(ser2net_num_shards, sizeof(*ser2net_shards));
+    if (!ser2net_shards) {
+	fprintf(stderr, "Could not allocate ser2net shards\n");
+	exit(1);
+    }
+
+    ser2net_shards[0].sel = ser2net_sel;
+    ser2net_shards[0].o = ser2net_o;
+    for (i = 1; i < ser2net_num_shards; i++) {
+	err = sel_alloc_selector_thread(&ser2net_shards[i].sel,
+					ser2net_wake_sig,
+					slock_alloc, slock_free,
+					slock_lock, slock_unlock, NULL);
+	if (err) {
+	    fprintf(stderr,
+		    "Could not initialize shard %d selector: '%s'\n", i,
+		    strerror(err));
+	    exit(1);
+	}
+
+	ser2net_shards[i].o = genio_selector_alloc(ser2net_shards[i].sel,
+						   ser2net_wake_sig);
+	if (!ser2net_shards[i].o) {
+	    fprintf(stderr, "Could not alloc shard %d genio selector\n", i);
+	    exit(1);
+	}
+    }
+}
+
+static void
+free_shards(void)
+{
+    int i;
+
+    for (i = 1; i < ser2net_num_shards; i++) {
+	ser2net_shards[i].o->free_funcs(ser2net_shards[i].o);
+	sel_free_selector(ser2net_shards[i].sel);
+    }
+    free(ser2net_shards);
+}
+
 static void
 finish_shutdown_cleanly(void)
 {
@@ -411,10 +582,14 @@ finish_shutdown_cleanly(void)
 	sel_select(ser2net_sel, NULL, 0, NULL, &tv);
     } while(1);
 
+    stop_shards();
+    free_shards();
+
     ser2net_o->free_funcs(ser2net_o);
     sol_shutdown(); /* Free's the selector. */
 
     shutdown_dataxfer();
+    trace_shutdown();
 
     free_longstrs();
     free_tracefiles();
@@ -546,6 +721,10 @@ main(int argc, char *argv[])
 	    ser2net_debug = 1;
 	    break;
 
+	case 'U':
+	    sel_set_default_backend(SEL_BACKEND_URING);
+	    break;
+
 	case 'l':
 	    ser2net_debug_level++;
 	    break;
@@ -636,6 +815,38 @@ main(int argc, char *argv[])
 		exit(1);
 	    }
             break;
+
+	case 'S':
+            i++;
+            if (i == argc) {
+	        fprintf(stderr, "No shard count specified\n");
+		exit(1);
+            }
+	    ser2net_num_shards = strtoul(argv[i], &end, 10);
+	    if (end == argv[i] || *end != '\0' || ser2net_num_shards < 1) {
+	        fprintf(stderr, "Invalid shard count specified: %s\n",
+			argv[i]);
+		exit(1);
+	    }
+            break;
+
+	case 'a':
+	    pin_shards = 1;
+	    break;
+
+	case 'W':
+            i++;
+            if (i == argc) {
+	        fprintf(stderr, "No startup thread count specified\n");
+		exit(1);
+            }
+	    num_startup_threads = strtoul(argv[i], &end, 10);
+	    if (end == argv[i] || *end != '\0' || num_startup_threads < 1) {
+	        fprintf(stderr, "Invalid startup thread count specified: %s\n",
+			argv[i]);
+		exit(1);
+	    }
+            break;
 #endif
 
 	default:
@@ -645,7 +856,8 @@ main(int argc, char *argv[])
     }
 
 #ifdef USE_PTHREADS
-    if (num_threads > 1)
+    /* The startup threads set up ports on the selector, too. */
+    if (num_threads > 1 || ser2net_num_shards > 1 || num_startup_threads > 1)
 	err = sel_alloc_selector_thread(&ser2net_sel, ser2net_wake_sig,
 					slock_alloc, slock_free,
 					slock_lock, slock_unlock, NULL);
@@ -666,6 +878,8 @@ main(int argc, char *argv[])
 	exit(1);
     }
 
+    alloc_shards();
+
     setup_signals();
 
     err = init_dataxfer();
@@ -695,6 +909,8 @@ main(int argc, char *argv[])
 	if (readconfig(config_file) == -1)
 	    exit(1);
     }
+    /* Only needed for -C, reading the file does this. */
+    wait_port_startups();
 
     if (config_port != NULL) {
 	int rv;
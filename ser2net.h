@@ -29,12 +29,33 @@ extern char *rfc2217_signature;
 extern struct selector_s *ser2net_sel;
 extern struct genio_os_funcs *ser2net_o;
 
+/*
+ * Ports are spread over a number of shards, each an independent
+ * selector with its own thread, so unrelated ports do not contend on
+ * one selector.  Shard 0 is ser2net_sel/ser2net_o, which also runs
+ * the controller and the rotators.
+ */
+struct ser2net_shard {
+    struct selector_s *sel;
+    struct genio_os_funcs *o;
+    volatile int done; /* Set when the shard's thread has exited. */
+};
+
+extern int ser2net_num_shards;
+extern struct ser2net_shard *ser2net_shards;
+
 extern int ser2net_debug;
 extern int ser2net_debug_level;
 
 extern int ser2net_wake_sig;
 
 void start_maint_op(void);
+/*
+ * Like start_maint_op(), but returns EBUSY instead of waiting if
+ * called from inside a config reload, which holds the maint op while
+ * it runs the selector.  Returns 0 if the maint op was started.
+ */
+int try_start_maint_op(void);
 void end_maint_op(void);
 
 int init_dataxfer(void);
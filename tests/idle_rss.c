@@ -0,0 +1,252 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/*
+ * Idle port memory test.  Start ser2net with one port and then with
+ * a lot of raw ports (10000 by default) that nobody connects to, and
+ * print the resident memory of each and the difference per port.  The
+ * last port is on a pty, a connection to it tells when ser2net has
+ * set up all the ports, and the RSS is printed with it connected,
+ * too.
+ *
+ * Then do the ports again, all with the same large banner, strings
+ * and remote addresses.  The ports share one copy of those, so they
+ * should cost about the same as the plain ports.
+ *
+ * Usage: idle_rss [-P ports] [-p tcpport] [-m max-bytes-per-port]
+ *                 [-s max-shared-config-bytes-per-port] [ser2net-binary]
+ *
+ * If no ser2net binary is given, SER2NET_EXEC is used.  This fails
+ * if an idle port costs more than max-bytes-per-port, or the config
+ * adds more than max-shared-config-bytes-per-port to each, and skips
+ * if ser2net can't be run or enough file descriptors can't be had.
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include "testutil.h"
+
+static char *ser2net;
+static int tcpport = 13000;
+static int nports = 10000;
+static int pty_master = -1;
+
+/* Write a config string of the given length. */
+static void
+write_str(FILE *f, const char *type, const char *name, int len)
+{
+    int i;
+
+    fprintf(f, "%s:%s:", type, name);
+    for (i = 0; i < len; i++)
+	fputc('a' + i % 26, f);
+    fputc('\n', f);
+}
+
+#define SHARED_OPTIONS " idlebanner idlesig idleopen idleclose idlecloseon" \
+    " remaddr=127.0.0.1,0;127.0.0.2,0;127.0.0.3,0;127.0.0.4,0"
+
+static int
+write_config(int count, char *conffile, int shared)
+{
+    const char *options = shared ? SHARED_OPTIONS : "";
+    FILE *f;
+    int i;
+
+    f = fopen(conffile, "w");
+    if (!f) {
+	perror(conffile);
+	return -1;
+    }
+    if (shared) {
+	write_str(f, "BANNER", "idlebanner", 1024);
+	write_str(f, "SIGNATURE", "idlesig", 128);
+	write_str(f, "OPENSTR", "idleopen", 256);
+	write_str(f, "CLOSESTR", "idleclose", 256);
+	write_str(f, "CLOSEON", "idlecloseon", 32);
+    }
+    /* The idle devices are never opened, so they don't have to exist. */
+    for (i = 0; i < count - 1; i++)
+	fprintf(f, "%d:raw:0:/dev/ser2net_idle%d:9600%s\n", tcpport + i, i,
+		options);
+    fprintf(f, "%d:raw:0:%s:9600%s\n", tcpport + i, ptsname(pty_master),
+	    options);
+    fclose(f);
+
+    return 0;
+}
+
+/* Return the resident memory of the process in kB, 0 on error. */
+static unsigned long
+get_rss(pid_t pid)
+{
+    char fname[64], line[128];
+    unsigned long rss = 0;
+    FILE *f;
+
+    snprintf(fname, sizeof(fname), "/proc/%d/status", (int) pid);
+    f = fopen(fname, "r");
+    if (!f) {
+	perror(fname);
+	return 0;
+    }
+    while (fgets(line, sizeof(line), f)) {
+	if (strncmp(line, "VmRSS:", 6) == 0) {
+	    rss = strtoul(line + 6, NULL, 10);
+	    break;
+	}
+    }
+    fclose(f);
+    return rss;
+}
+
+/*
+ * Run ser2net with count ports and get its RSS with the last port
+ * connected and then with it idle again.
+ */
+static int
+measure(int count, int shared, unsigned long *conn_rss,
+	unsigned long *idle_rss)
+{
+    char conffile[] = "/tmp/idle_rssXXXXXX";
+    int fd, rv = SKIP;
+    pid_t pid;
+
+    if (make_conffile(conffile))
+	return 1;
+    if (write_config(count, conffile, shared))
+	goto out_unlink;
+
+    pid = start_ser2net(ser2net, conffile, "-p", "0", NULL);
+    if (pid == -1)
+	goto out_unlink;
+
+    /* Give ser2net some time to come up, it has a lot of ports. */
+    fd = connect_port(tcpport + count - 1, 30);
+    if (fd == -1)
+	goto out_kill;
+    /* Let ser2net open the device. */
+    usleep(200000);
+    *conn_rss = get_rss(pid);
+    close(fd);
+    usleep(500000);
+    *idle_rss = get_rss(pid);
+    if (*conn_rss && *idle_rss)
+	rv = 0;
+
+ out_kill:
+    stop_ser2net(pid);
+ out_unlink:
+    unlink(conffile);
+    return rv;
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned long conn1, idle1, conn, idle, per_port;
+    unsigned long sconn1, sidle1, sconn, sidle, shared_per_port;
+    unsigned long max_per_port = 16384, max_shared = 512;
+    int c, rv;
+
+    while ((c = getopt(argc, argv, "P:p:m:s:")) != -1) {
+	switch (c) {
+	case 'P':
+	    nports = atoi(optarg);
+	    break;
+	case 'p':
+	    tcpport = atoi(optarg);
+	    break;
+	case 'm':
+	    max_per_port = strtoul(optarg, NULL, 0);
+	    break;
+	case 's':
+	    max_shared = strtoul(optarg, NULL, 0);
+	    break;
+	default:
+	    goto usage;
+	}
+    }
+    if (argc - optind > 1 || nports < 2)
+	goto usage;
+    ser2net = find_ser2net(optind < argc ? argv[optind] : NULL);
+    if (!ser2net)
+	return SKIP;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (raise_fd_limit(nports + 64))
+	return SKIP;
+    pty_master = open_pty_master(O_RDWR | O_NOCTTY);
+    if (pty_master == -1)
+	return 1;
+
+    rv = measure(1, 0, &conn1, &idle1);
+    if (!rv)
+	rv = measure(nports, 0, &conn, &idle);
+    if (!rv)
+	rv = measure(1, 1, &sconn1, &sidle1);
+    if (!rv)
+	rv = measure(nports, 1, &sconn, &sidle);
+    close(pty_master);
+    if (rv)
+	return rv;
+
+    per_port = 0;
+    if (idle > idle1)
+	per_port = (idle - idle1) * 1024 / (nports - 1);
+    printf("1 port: %lu kB RSS idle, %lu kB connected\n", idle1, conn1);
+    printf("%d ports: %lu kB RSS idle, %lu kB connected\n", nports, idle,
+	   conn);
+    printf("%lu bytes per idle port\n", per_port);
+
+    shared_per_port = 0;
+    if (sidle > sidle1)
+	shared_per_port = (sidle - sidle1) * 1024 / (nports - 1);
+    printf("With a shared config:\n");
+    printf("1 port: %lu kB RSS idle, %lu kB connected\n", sidle1, sconn1);
+    printf("%d ports: %lu kB RSS idle, %lu kB connected\n", nports, sidle,
+	   sconn);
+    printf("%lu bytes per idle port\n", shared_per_port);
+
+    if (per_port > max_per_port) {
+	fprintf(stderr, "Idle ports take more than %lu bytes each\n",
+		max_per_port);
+	return 1;
+    }
+    if (shared_per_port > per_port + max_shared) {
+	fprintf(stderr, "The shared config adds more than %lu bytes to"
+		" each port\n", max_shared);
+	return 1;
+    }
+    return 0;
+
+ usage:
+    fprintf(stderr, "Usage: %s [-P ports] [-p tcpport] [-m max-bytes-per-port]"
+	    " [-s max-shared-config-bytes-per-port] [ser2net-binary]\n",
+	    argv[0]);
+    return 1;
+}
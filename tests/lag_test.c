@@ -0,0 +1,549 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/*
+ * Lag policy test.  Start ser2net with a port on a pty for each lag
+ * policy, with small dev-to-net buffers and max-connections=2.  For
+ * each one connect a client that never reads and one that does, and
+ * push data through the pty:
+ *
+ *  block - device reads stop until the stalled client goes away,
+ *    then the reader gets everything.
+ *  drop - the reader gets everything and the stalled client's
+ *    net_dropped in showstats is not zero.
+ *  disconnect - the reader gets everything and the stalled client is
+ *    closed.
+ *  drop on a telnet port - the data is mostly IACs, the reader gets
+ *    all of it and what the stalled client gets is still a valid
+ *    telnet stream.
+ *
+ * Usage: lag_test [-p tcpport] [-n bytes] [ser2net-binary]
+ *
+ * If no ser2net binary is given, SER2NET_EXEC is used.  The ports are
+ * tcpport to tcpport + 3, the control port is tcpport - 1.
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "testutil.h"
+
+#define TN_IAC	255
+#define TN_SB	250
+#define TN_SE	240
+#define TN_WILL	251
+
+enum { PORT_BLOCK, PORT_DROP, PORT_DISCONNECT, PORT_TELNET_DROP, NPORTS };
+
+static const char *port_setup[NPORTS] = {
+    "raw:0:%s:9600 lag-policy=block",
+    "raw:0:%s:9600 lag-policy=drop",
+    "raw:0:%s:9600 lag-policy=disconnect",
+    "telnet:0:%s:9600 lag-policy=drop"
+};
+
+static char *ser2net;
+static int tcpport = 13800;
+static unsigned long total = 8 * 1024 * 1024;
+static char conffile[] = "/tmp/lag_testXXXXXX";
+static int pty_master[NPORTS], pty_slave[NPORTS];
+static int ctl = -1;
+
+/* The telnet decoder states. */
+enum { TN_DATA, TN_GOT_IAC, TN_OPTION, TN_SUBNEG, TN_SUBNEG_IAC };
+
+struct xfer {
+    int master;
+    int sock;
+    int telnet;
+    int tnstate;
+    unsigned long sent;
+    unsigned long got;
+};
+
+/* A pattern that doesn't repeat with the ring size. */
+static unsigned char
+pattern(unsigned long pos)
+{
+    return (pos * 7 + (pos >> 8)) & 0xff;
+}
+
+/*
+ * For the telnet port, mostly IACs in runs of different lengths, so
+ * a drop to a random place will often land in the middle of a doubled
+ * one.  The other bytes are below 128 so they can't be mistaken for
+ * telnet commands.
+ */
+static unsigned char
+tn_pattern(unsigned long pos)
+{
+    unsigned char c = pattern(pos);
+
+    return (c & 3) ? TN_IAC : (c & 0x7f);
+}
+
+/*
+ * Decode a byte from a telnet stream.  Returns the data byte, -1 if
+ * it was part of a command, or -2 if an IAC is followed by something
+ * that isn't a command, as it is if a doubled IAC gets split.
+ */
+static int
+tn_decode(int *state, unsigned char c)
+{
+    switch (*state) {
+    case TN_DATA:
+	if (c != TN_IAC)
+	    return c;
+	*state = TN_GOT_IAC;
+	return -1;
+
+    case TN_GOT_IAC:
+	*state = TN_DATA;
+	if (c == TN_IAC)
+	    return c;
+	if (c < TN_SE)
+	    return -2;
+	if (c == TN_SB)
+	    *state = TN_SUBNEG;
+	else if (c >= TN_WILL)
+	    *state = TN_OPTION;
+	return -1;
+
+    case TN_OPTION:
+	*state = TN_DATA;
+	return -1;
+
+    case TN_SUBNEG:
+	if (c == TN_IAC)
+	    *state = TN_SUBNEG_IAC;
+	return -1;
+
+    case TN_SUBNEG_IAC:
+	*state = c == TN_SE ? TN_DATA : TN_SUBNEG;
+	return -1;
+    }
+    return -1;
+}
+
+static int
+write_config(void)
+{
+    FILE *f;
+    int i;
+
+    f = fopen(conffile, "w");
+    if (!f) {
+	perror(conffile);
+	return -1;
+    }
+    for (i = 0; i < NPORTS; i++) {
+	fprintf(f, "%d:", tcpport + i);
+	fprintf(f, port_setup[i], ptsname(pty_master[i]));
+	fprintf(f, " max-connections=2 dev-to-net-bufsize=256"
+		" dev-to-net-buffers=4\n");
+    }
+    fclose(f);
+
+    return 0;
+}
+
+/*
+ * Connect a client that won't read, with a small receive buffer so
+ * the data backs up into ser2net sooner.  The kernel still takes a
+ * megabyte or so on the ser2net side, so the default amount of data
+ * is a lot more than that.
+ */
+static int
+connect_stalled(int port)
+{
+    struct sockaddr_in addr;
+    int fd, size = 1024;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+	perror("socket");
+	return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+	perror("connect");
+	close(fd);
+	return -1;
+    }
+    return fd;
+}
+
+/*
+ * Write the pattern to the pty and check it comes out on the reader.
+ * Returns 0 when all of it has come through, 1 if nothing moved for
+ * stall_ms, or -1 on an error.
+ */
+static int
+transfer(struct xfer *x, int stall_ms)
+{
+    unsigned char wbuf[200], rbuf[1000];
+    struct pollfd fds[2];
+    int i, rv, c;
+
+    while (x->got < total) {
+	fds[0].fd = x->sock;
+	fds[0].events = POLLIN;
+	fds[1].fd = x->master;
+	fds[1].events = x->sent < total ? POLLOUT : 0;
+	rv = poll(fds, 2, stall_ms);
+	if (rv == 0)
+	    return 1;
+	if (rv < 0) {
+	    if (errno == EINTR)
+		continue;
+	    perror("poll");
+	    return -1;
+	}
+	if (fds[1].revents & POLLOUT) {
+	    size_t len = sizeof(wbuf);
+
+	    if (len > total - x->sent)
+		len = total - x->sent;
+	    for (i = 0; i < len; i++) {
+		if (x->telnet)
+		    wbuf[i] = tn_pattern(x->sent + i);
+		else
+		    wbuf[i] = pattern(x->sent + i);
+	    }
+	    rv = write(x->master, wbuf, len);
+	    if (rv > 0)
+		x->sent += rv;
+	}
+	if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+	    rv = read(x->sock, rbuf, sizeof(rbuf));
+	    if (rv <= 0) {
+		fprintf(stderr, "Reader closed, got %lu\n", x->got);
+		return -1;
+	    }
+	    for (i = 0; i < rv; i++) {
+		if (x->telnet) {
+		    c = tn_decode(&x->tnstate, rbuf[i]);
+		    if (c == -1)
+			continue;
+		    if (c != tn_pattern(x->got)) {
+			fprintf(stderr, "Telnet byte %lu is %d, expected"
+				" 0x%2.2x\n", x->got, c, tn_pattern(x->got));
+			return -1;
+		    }
+		} else if (rbuf[i] != pattern(x->got)) {
+		    fprintf(stderr, "Byte %lu is 0x%2.2x, expected"
+			    " 0x%2.2x\n", x->got, rbuf[i], pattern(x->got));
+		    return -1;
+		}
+		x->got++;
+	    }
+	}
+    }
+
+    return 0;
+}
+
+/*
+ * Read everything the stalled client has, up to when nothing comes
+ * for a while.  Returns the number of bytes, or -1 if the connection
+ * was closed (or -2 for an invalid telnet stream if tnstate is set).
+ */
+static long
+drain_stalled(int fd, int *tnstate)
+{
+    unsigned char buf[1000];
+    struct pollfd pfd;
+    long count = 0;
+    int i, rv;
+
+    for (;;) {
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	rv = poll(&pfd, 1, 500);
+	if (rv == 0)
+	    return count;
+	if (rv < 0) {
+	    if (errno == EINTR)
+		continue;
+	    perror("poll");
+	    return count;
+	}
+	rv = read(fd, buf, sizeof(buf));
+	if (rv <= 0)
+	    return -1;
+	if (!tnstate) {
+	    count += rv;
+	    continue;
+	}
+	for (i = 0; i < rv; i++, count++) {
+	    if (tn_decode(tnstate, buf[i]) == -2) {
+		fprintf(stderr, "Bad telnet command 0x%2.2x at byte %ld"
+			" on the stalled connection\n", buf[i], count);
+		return -2;
+	    }
+	}
+    }
+}
+
+/* Get a counter for the port from showstats, conn -1 is the device. */
+static int
+get_stat(int port, int conn, const char *name, unsigned long long *val)
+{
+    char cmd[50], reply[4096], match[50], *s, *v;
+
+    snprintf(cmd, sizeof(cmd), "showstats %d\r\n", tcpport + port);
+    if (control_cmd(ctl, cmd, reply, sizeof(reply)))
+	return -1;
+    if (conn == -1)
+	s = reply;
+    else {
+	snprintf(match, sizeof(match), " conn=%d ", conn);
+	s = strstr(reply, match);
+    }
+    if (s) {
+	snprintf(match, sizeof(match), " %s=", name);
+	v = strstr(s, match);
+	if (v) {
+	    *val = strtoull(v + strlen(match), NULL, 10);
+	    return 0;
+	}
+    }
+    fprintf(stderr, "No %s for conn %d in showstats: %s\n", name, conn,
+	    reply);
+    return -1;
+}
+
+/*
+ * Connect the stalled client and then the reader, so the stalled
+ * one is conn 0.
+ */
+static int
+setup_xfer(int port, struct xfer *x, int *stalled)
+{
+    memset(x, 0, sizeof(*x));
+    x->master = pty_master[port];
+    x->telnet = port == PORT_TELNET_DROP;
+    x->tnstate = TN_DATA;
+    x->sock = -1;
+    *stalled = connect_stalled(tcpport + port);
+    if (*stalled == -1)
+	return -1;
+    x->sock = connect_port(tcpport + port, 10);
+    if (x->sock == -1)
+	return -1;
+    /* Let ser2net open the device before sending. */
+    usleep(200000);
+    return 0;
+}
+
+static int
+check_block(void)
+{
+    unsigned long long reads1, reads2;
+    struct xfer x;
+    int stalled, rv = -1;
+
+    if (setup_xfer(PORT_BLOCK, &x, &stalled))
+	goto out;
+
+    if (transfer(&x, 1000) != 1) {
+	fprintf(stderr, "block: the transfer didn't stop\n");
+	goto out;
+    }
+    if (get_stat(PORT_BLOCK, -1, "dev_bytes_received", &reads1))
+	goto out;
+    usleep(500000);
+    if (get_stat(PORT_BLOCK, -1, "dev_bytes_received", &reads2))
+	goto out;
+    if (reads1 != reads2 || reads2 >= total) {
+	fprintf(stderr, "block: device reads didn't stop, %llu then %llu\n",
+		reads1, reads2);
+	goto out;
+    }
+
+    /* Once the stalled client is gone everything should come through. */
+    close(stalled);
+    stalled = -1;
+    if (transfer(&x, 5000) != 0) {
+	fprintf(stderr, "block: only got %lu after closing the stalled"
+		" client\n", x.got);
+	goto out;
+    }
+    rv = 0;
+
+ out:
+    if (stalled != -1)
+	close(stalled);
+    if (x.sock != -1)
+	close(x.sock);
+    return rv;
+}
+
+static int
+check_drop(int port, const char *name)
+{
+    unsigned long long dropped;
+    struct xfer x;
+    int stalled, tnstate = TN_DATA, rv = -1;
+    long count;
+
+    if (setup_xfer(port, &x, &stalled))
+	goto out;
+
+    if (transfer(&x, 5000) != 0) {
+	fprintf(stderr, "%s: reader only got %lu of %lu\n", name, x.got,
+		total);
+	goto out;
+    }
+    if (get_stat(port, 0, "net_dropped", &dropped))
+	goto out;
+    if (dropped == 0) {
+	fprintf(stderr, "%s: nothing was dropped\n", name);
+	goto out;
+    }
+
+    count = drain_stalled(stalled, x.telnet ? &tnstate : NULL);
+    if (count < 0) {
+	if (count == -1)
+	    fprintf(stderr, "%s: the stalled client was closed\n", name);
+	goto out;
+    }
+    rv = 0;
+
+ out:
+    if (stalled != -1)
+	close(stalled);
+    if (x.sock != -1)
+	close(x.sock);
+    return rv;
+}
+
+static int
+check_disconnect(void)
+{
+    struct xfer x;
+    int stalled, rv = -1;
+
+    if (setup_xfer(PORT_DISCONNECT, &x, &stalled))
+	goto out;
+
+    if (transfer(&x, 5000) != 0) {
+	fprintf(stderr, "disconnect: reader only got %lu of %lu\n", x.got,
+		total);
+	goto out;
+    }
+    if (drain_stalled(stalled, NULL) != -1) {
+	fprintf(stderr, "disconnect: the stalled client is still open\n");
+	goto out;
+    }
+    rv = 0;
+
+ out:
+    if (stalled != -1)
+	close(stalled);
+    if (x.sock != -1)
+	close(x.sock);
+    return rv;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char ctlport[10], reply[4096];
+    int c, i, rv = 1;
+    pid_t pid;
+
+    while ((c = getopt(argc, argv, "p:n:")) != -1) {
+	switch (c) {
+	case 'p':
+	    tcpport = atoi(optarg);
+	    break;
+	case 'n':
+	    total = strtoul(optarg, NULL, 0);
+	    break;
+	default:
+	    goto usage;
+	}
+    }
+    if (argc - optind > 1 || total == 0)
+	goto usage;
+    ser2net = find_ser2net(optind < argc ? argv[optind] : NULL);
+    if (!ser2net)
+	return SKIP;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    for (i = 0; i < NPORTS; i++) {
+	if (open_pty_pair(&pty_master[i], &pty_slave[i]))
+	    return SKIP;
+    }
+
+    if (make_conffile(conffile))
+	return 1;
+    if (write_config())
+	goto out_unlink;
+
+    snprintf(ctlport, sizeof(ctlport), "%d", tcpport - 1);
+    pid = start_ser2net(ser2net, conffile, "-p", ctlport, NULL);
+    if (pid == -1)
+	goto out_unlink;
+
+    ctl = connect_port(tcpport - 1, 10);
+    if (ctl == -1)
+	goto out_kill;
+    if (control_cmd(ctl, "", reply, sizeof(reply)))
+	goto out_kill;
+
+    if (check_block() || check_drop(PORT_DROP, "drop") ||
+		check_disconnect() ||
+		check_drop(PORT_TELNET_DROP, "telnet drop"))
+	goto out_kill;
+    printf("block, drop, disconnect and telnet drop passed\n");
+    rv = 0;
+
+ out_kill:
+    if (ctl != -1)
+	close(ctl);
+    stop_ser2net(pid);
+ out_unlink:
+    unlink(conffile);
+    for (i = 0; i < NPORTS; i++) {
+	close(pty_slave[i]);
+	close(pty_master[i]);
+    }
+    return rv;
+
+ usage:
+    fprintf(stderr, "Usage: %s [-p tcpport] [-n bytes] [ser2net-binary]\n",
+	    argv[0]);
+    return 1;
+}
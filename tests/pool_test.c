@@ -0,0 +1,176 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/*
+ * Memory pool test.  Checks that zalloc really zeroes reused blocks,
+ * that blocks freed in one thread can be used in another, and that
+ * the stats add up once everything is freed and the threads have
+ * exited.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "genio/genio_pool.h"
+
+#define NR_SIZES 9
+static unsigned int sizes[NR_SIZES] = {
+    1, 64, 65, 300, 1024, 4000, 65536, 65537, 200000
+};
+
+static int
+check_zeroed(void)
+{
+    unsigned int i, j, round;
+    unsigned char *p;
+
+    for (round = 0; round < 3; round++) {
+	for (i = 0; i < NR_SIZES; i++) {
+	    p = genio_pool_zalloc(sizes[i]);
+	    if (!p) {
+		fprintf(stderr, "Unable to allocate %u bytes\n", sizes[i]);
+		return 1;
+	    }
+	    for (j = 0; j < sizes[i]; j++) {
+		if (p[j]) {
+		    fprintf(stderr, "Byte %u of %u not zeroed\n", j,
+			    sizes[i]);
+		    return 1;
+		}
+	    }
+	    /* Dirty it so the next round gets a dirty block back. */
+	    memset(p, 0xa5, sizes[i]);
+	    genio_pool_free(p);
+	}
+    }
+    return 0;
+}
+
+#ifdef USE_PTHREADS
+#include <pthread.h>
+
+#define NR_THREADS	4
+#define NR_BLOCKS	2000
+#define ROUNDS		20
+
+/*
+ * Each thread frees the blocks the previous thread allocated, so
+ * most blocks are freed in a different thread than they came from.
+ */
+static void *blocks[NR_THREADS][NR_BLOCKS];
+static pthread_barrier_t barrier;
+
+static void *
+pool_thread(void *arg)
+{
+    unsigned int self = (unsigned long) arg, i, round;
+    unsigned int prev = (self + NR_THREADS - 1) % NR_THREADS;
+
+    for (round = 0; round < ROUNDS; round++) {
+	for (i = 0; i < NR_BLOCKS; i++) {
+	    unsigned int size = sizes[(i + self + round) % NR_SIZES];
+
+	    blocks[self][i] = genio_pool_alloc(size);
+	    if (!blocks[self][i]) {
+		fprintf(stderr, "Unable to allocate %u bytes\n", size);
+		exit(1);
+	    }
+	    memset(blocks[self][i], self, size);
+	}
+	pthread_barrier_wait(&barrier);
+	for (i = 0; i < NR_BLOCKS; i++)
+	    genio_pool_free(blocks[prev][i]);
+	pthread_barrier_wait(&barrier);
+    }
+    return NULL;
+}
+
+static int
+check_threads(void)
+{
+    pthread_t threads[NR_THREADS];
+    unsigned long i;
+
+    pthread_barrier_init(&barrier, NULL, NR_THREADS);
+    for (i = 0; i < NR_THREADS; i++) {
+	if (pthread_create(&threads[i], NULL, pool_thread, (void *) i)) {
+	    fprintf(stderr, "Unable to create thread\n");
+	    return 1;
+	}
+    }
+    for (i = 0; i < NR_THREADS; i++)
+	pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&barrier);
+    return 0;
+}
+#else
+static int
+check_threads(void)
+{
+    return 0;
+}
+#endif
+
+int
+main(int argc, char *argv[])
+{
+    struct genio_pool_stats stats[GENIO_POOL_NR_CLASSES];
+    uint64_t allocs = 0;
+    unsigned int i;
+    int rv = 0;
+
+    if (check_zeroed() || check_threads())
+	return 1;
+
+    genio_pool_get_stats(stats);
+    for (i = 0; i < GENIO_POOL_NR_CLASSES; i++) {
+	struct genio_pool_stats *s = &stats[i];
+
+	printf("class=%u allocs=%llu frees=%llu bytes_in_use=%llu"
+	       " bytes_free=%llu\n", s->size,
+	       (unsigned long long) s->allocs,
+	       (unsigned long long) s->frees,
+	       (unsigned long long) s->bytes_in_use,
+	       (unsigned long long) s->bytes_free);
+	allocs += s->allocs;
+	if (s->allocs != s->frees || s->bytes_in_use) {
+	    fprintf(stderr, "Class %u doesn't balance\n", s->size);
+	    rv = 1;
+	}
+	if (!s->size && s->bytes_free) {
+	    fprintf(stderr, "Large allocations were kept\n");
+	    rv = 1;
+	}
+    }
+    if (!stats[GENIO_POOL_NR_CLASSES - 1].allocs) {
+	fprintf(stderr, "No large allocations counted\n");
+	rv = 1;
+    }
+#ifdef USE_PTHREADS
+    if (allocs != NR_SIZES * 3 + NR_THREADS * NR_BLOCKS * ROUNDS) {
+	fprintf(stderr, "Expected %u allocations, got %llu\n",
+		NR_SIZES * 3 + NR_THREADS * NR_BLOCKS * ROUNDS,
+		(unsigned long long) allocs);
+	rv = 1;
+    }
+#endif
+
+    return rv;
+}
@@ -0,0 +1,184 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Device to network throughput benchmark.  Start ser2net on a pty
+ * with a raw port, push data into the master side of the pty, read
+ * it from a TCP connection to the port, and print the throughput and
+ * the CPU time ser2net used.  This is done once with the normal
+ * buffered path and once with the splice path.
+ *
+ * Usage: pty_bench [-n megabytes] [-p tcpport] ser2net-binary
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "testutil.h"
+
+static char *ser2net;
+static int tcpport = 3390;
+static unsigned long total;
+
+static int
+write_config(const char *devname, const char *options, char *conffile)
+{
+    FILE *f;
+
+    f = fopen(conffile, "w");
+    if (!f) {
+	perror(conffile);
+	return -1;
+    }
+    fprintf(f, "%d:raw:0:%s:9600 -chardelay dev-to-net-bufsize=65536 %s\n",
+	    tcpport, devname, options);
+    fclose(f);
+
+    return 0;
+}
+
+static int
+run_bench(const char *options)
+{
+    static unsigned char wbuf[16384], rbuf[65536];
+    char conffile[] = "/tmp/pty_benchXXXXXX";
+    struct pollfd fds[2];
+    struct timeval start, end;
+    struct rusage usage;
+    unsigned long sent = 0, got = 0;
+    double elapsed;
+    int master, slave, sock, rv, status;
+    pid_t pid;
+
+    if (open_pty_pair(&master, &slave))
+	return 1;
+    if (make_conffile(conffile))
+	return 1;
+    if (write_config(ptsname(master), options, conffile))
+	return 1;
+
+    pid = start_ser2net(ser2net, conffile, "-p", "0", NULL);
+    if (pid == -1)
+	return 1;
+
+    sock = connect_port(tcpport, 5);
+    if (sock == -1) {
+	stop_ser2net(pid);
+	return 1;
+    }
+    /* Let ser2net open the device before sending. */
+    usleep(200000);
+
+    memset(wbuf, 'x', sizeof(wbuf));
+    gettimeofday(&start, NULL);
+    while (got < total) {
+	fds[0].fd = sock;
+	fds[0].events = POLLIN;
+	fds[1].fd = master;
+	fds[1].events = sent < total ? POLLOUT : 0;
+	rv = poll(fds, 2, 2000);
+	if (rv == 0) {
+	    fprintf(stderr, "Timed out, sent %lu got %lu\n", sent, got);
+	    break;
+	}
+	if (rv < 0) {
+	    if (errno == EINTR)
+		continue;
+	    perror("poll");
+	    break;
+	}
+	if (fds[1].revents & POLLOUT) {
+	    size_t len = sizeof(wbuf);
+
+	    if (len > total - sent)
+		len = total - sent;
+	    rv = write(master, wbuf, len);
+	    if (rv > 0)
+		sent += rv;
+	}
+	if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+	    rv = read(sock, rbuf, sizeof(rbuf));
+	    if (rv <= 0) {
+		fprintf(stderr, "Connection closed, got %lu\n", got);
+		break;
+	    }
+	    got += rv;
+	}
+    }
+    gettimeofday(&end, NULL);
+
+    close(sock);
+    kill(pid, SIGKILL);
+    wait4(pid, &status, 0, &usage);
+    close(slave);
+    close(master);
+    unlink(conffile);
+
+    elapsed = tv_to_secs(&end) - tv_to_secs(&start);
+    printf("%-8s: %lu bytes in %.3fs, %.1f MB/s, ser2net cpu %.3fs user"
+	   " %.3fs sys\n", options, got, elapsed,
+	   got / elapsed / (1024 * 1024), tv_to_secs(&usage.ru_utime),
+	   tv_to_secs(&usage.ru_stime));
+
+    return got < total;
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned long megabytes = 64;
+    int c, rv;
+
+    while ((c = getopt(argc, argv, "n:p:")) != -1) {
+	switch (c) {
+	case 'n':
+	    megabytes = strtoul(optarg, NULL, 0);
+	    break;
+	case 'p':
+	    tcpport = atoi(optarg);
+	    break;
+	default:
+	    goto usage;
+	}
+    }
+    if (argc - optind != 1 || megabytes == 0)
+	goto usage;
+    ser2net = argv[optind];
+    total = megabytes * 1024 * 1024;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    rv = run_bench("-splice");
+    rv |= run_bench("splice");
+    return rv;
+
+ usage:
+    fprintf(stderr, "Usage: %s [-n megabytes] [-p tcpport] ser2net-binary\n",
+	    argv[0]);
+    return 1;
+}
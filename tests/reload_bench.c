@@ -0,0 +1,164 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/*
+ * Configuration reload benchmark.  Start ser2net with a lot of raw
+ * ports (10000 by default) and a control port, then repeatedly add a
+ * port to the config file, send SIGHUP, and time how long it takes
+ * until the control port shows the new port and no longer says a
+ * reload is in progress, which is the time the whole reload took.
+ * Each reload also removes the port the previous one added.
+ *
+ * Usage: reload_bench [-P ports] [-p tcpport] [-r reloads] ser2net-binary
+ *
+ * The control port is the port before tcpport.
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include "testutil.h"
+
+static char *ser2net;
+static int tcpport = 13000;
+static int nports = 10000;
+static char conffile[] = "/tmp/reload_benchXXXXXX";
+
+/* Write the config with the ports and one extra port at extra. */
+static int
+write_config(int extra)
+{
+    FILE *f;
+    int i;
+
+    f = fopen(conffile, "w");
+    if (!f) {
+	perror(conffile);
+	return -1;
+    }
+    for (i = 0; i < nports; i++)
+	fprintf(f, "%d:raw:0:/dev/ser2net_reload%d:9600\n", tcpport + i, i);
+    fprintf(f, "%d:raw:0:/dev/ser2net_reload%d:9600\n", extra, extra);
+    fclose(f);
+
+    return 0;
+}
+
+/* Ask the control port about the port until it exists. */
+static int
+wait_for_port(int ctl, int port)
+{
+    char cmd[32], buf[4096];
+
+    snprintf(cmd, sizeof(cmd), "showshortport %d\r\n", port);
+    for (;;) {
+	if (control_cmd(ctl, cmd, buf, sizeof(buf)))
+	    return -1;
+	/* The control port says so if the reload is still running. */
+	if (!strstr(buf, "Invalid port") && !strstr(buf, "in progress"))
+	    return 0;
+	usleep(1000);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct timeval start, end;
+    char buf[4096], ctlport[20];
+    int c, i, ctl, extra, reloads = 5, rv = 1;
+    pid_t pid;
+
+    while ((c = getopt(argc, argv, "P:p:r:")) != -1) {
+	switch (c) {
+	case 'P':
+	    nports = atoi(optarg);
+	    break;
+	case 'p':
+	    tcpport = atoi(optarg);
+	    break;
+	case 'r':
+	    reloads = atoi(optarg);
+	    break;
+	default:
+	    goto usage;
+	}
+    }
+    if (argc - optind != 1 || nports < 1 || reloads < 1)
+	goto usage;
+    ser2net = argv[optind];
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (raise_fd_limit(nports + reloads + 64))
+	return 1;
+
+    if (make_conffile(conffile))
+	return 1;
+
+    extra = tcpport + nports;
+    if (write_config(extra))
+	goto out_unlink;
+
+    snprintf(ctlport, sizeof(ctlport), "%d", tcpport - 1);
+    gettimeofday(&start, NULL);
+    pid = start_ser2net(ser2net, conffile, "-p", ctlport, NULL);
+    if (pid == -1)
+	goto out_unlink;
+    ctl = connect_port(tcpport - 1, 30);
+    if (ctl == -1)
+	goto out_kill;
+    if (read_to_prompt(ctl, buf, sizeof(buf)) || wait_for_port(ctl, extra))
+	goto out_close;
+    gettimeofday(&end, NULL);
+    printf("%d ports: startup took %.3fs\n", nports,
+	   tv_to_secs(&end) - tv_to_secs(&start));
+
+    for (i = 0; i < reloads; i++) {
+	extra++;
+	if (write_config(extra))
+	    goto out_close;
+	gettimeofday(&start, NULL);
+	kill(pid, SIGHUP);
+	if (wait_for_port(ctl, extra))
+	    goto out_close;
+	gettimeofday(&end, NULL);
+	printf("reload %d: %.3fs\n", i + 1,
+	       tv_to_secs(&end) - tv_to_secs(&start));
+    }
+    rv = 0;
+
+ out_close:
+    close(ctl);
+ out_kill:
+    stop_ser2net(pid);
+ out_unlink:
+    unlink(conffile);
+    return rv;
+
+ usage:
+    fprintf(stderr, "Usage: %s [-P ports] [-p tcpport] [-r reloads]"
+	    " ser2net-binary\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,244 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/*
+ * Incremental reload test.  Start ser2net with a few ports, the first
+ * on a pty, and connect to it.  Then reload the config a few ways and
+ * check what showreload says was changed, and that the connection
+ * still passes data when its port didn't change.  ser2net is run
+ * with two startup threads, so a port that is turned back on is
+ * started by one of them.
+ *
+ * Usage: reload_test [-p tcpport] [ser2net-binary]
+ *
+ * If no ser2net binary is given, SER2NET_EXEC is used.  The control
+ * port is the port before tcpport.
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include "testutil.h"
+
+#define NPORTS 5
+
+static char *ser2net;
+static int tcpport = 13500;
+static char conffile[] = "/tmp/reload_testXXXXXX";
+static int pty_master = -1;
+static pid_t pid;
+static int ctl = -1;
+static char reply[4096];
+
+#define BANNER_CONFIG "DEFAULT:kickolduser:true\nBANNER:unused:hello"
+
+static int
+write_config(const char *extra, int skip_port, int timeout0, int off_port)
+{
+    FILE *f;
+    int i;
+
+    f = fopen(conffile, "w");
+    if (!f) {
+	perror(conffile);
+	return -1;
+    }
+    if (extra)
+	fprintf(f, "%s\n", extra);
+    fprintf(f, "%d:raw:%d:%s:9600\n", tcpport, timeout0, ptsname(pty_master));
+    for (i = 1; i < NPORTS; i++) {
+	if (i != skip_port)
+	    fprintf(f, "%d:%s:0:/dev/ser2net_reload%d:9600\n", tcpport + i,
+		    i == off_port ? "off" : "raw", i);
+    }
+    fclose(f);
+
+    return 0;
+}
+
+/*
+ * Reload the config and wait for showreload to show a new time, and
+ * check its counts.
+ */
+static int
+reload(const char *name, unsigned int added, unsigned int changed,
+       unsigned int removed, unsigned int unchanged)
+{
+    char old[sizeof(reply)], *s;
+    unsigned int a, c, r, u;
+    int i;
+
+    if (control_cmd(ctl, "showreload\r\n", reply, sizeof(reply)))
+	return -1;
+    strcpy(old, reply);
+
+    /* The time only has seconds, make sure it changes. */
+    sleep(1);
+    kill(pid, SIGHUP);
+    for (i = 0; i < 100; i++) {
+	usleep(50000);
+	if (control_cmd(ctl, "showreload\r\n", reply, sizeof(reply)))
+	    return -1;
+	if (!strstr(reply, "in progress") && strcmp(reply, old) != 0)
+	    break;
+    }
+    s = strstr(reply, "added=");
+    if (!s || sscanf(s, "added=%u changed=%u removed=%u unchanged=%u",
+		     &a, &c, &r, &u) != 4) {
+	fprintf(stderr, "%s: bad showreload output: %s\n", name, reply);
+	return -1;
+    }
+    if (a != added || c != changed || r != removed || u != unchanged) {
+	fprintf(stderr, "%s: expected added=%u changed=%u removed=%u"
+		" unchanged=%u, got %s\n", name, added, changed, removed,
+		unchanged, s);
+	return -1;
+    }
+    return 0;
+}
+
+/* Send data over the connection and make sure it comes out the pty. */
+static int
+check_data(int fd, const char *name)
+{
+    char buf[16];
+    int rv;
+
+    if (write(fd, "hello", 5) != 5) {
+	fprintf(stderr, "%s: write to port failed\n", name);
+	return -1;
+    }
+    usleep(200000);
+    rv = read(pty_master, buf, sizeof(buf));
+    if (rv != 5 || memcmp(buf, "hello", 5) != 0) {
+	fprintf(stderr, "%s: data did not get to the device\n", name);
+	return -1;
+    }
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char ctlport[20];
+    int c, conn = -1, fd, rv = 1;
+
+    while ((c = getopt(argc, argv, "p:")) != -1) {
+	switch (c) {
+	case 'p':
+	    tcpport = atoi(optarg);
+	    break;
+	default:
+	    goto usage;
+	}
+    }
+    if (argc - optind > 1)
+	goto usage;
+    ser2net = find_ser2net(optind < argc ? argv[optind] : NULL);
+    if (!ser2net)
+	return SKIP;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    pty_master = open_pty_master(O_RDWR | O_NOCTTY);
+    if (pty_master == -1)
+	return SKIP;
+
+    if (make_conffile(conffile))
+	return 1;
+    if (write_config(NULL, -1, 0, -1))
+	goto out_unlink;
+
+    snprintf(ctlport, sizeof(ctlport), "%d", tcpport - 1);
+    pid = start_ser2net(ser2net, conffile, "-p", ctlport, "-W", "2", NULL);
+    if (pid == -1)
+	goto out_unlink;
+
+    ctl = connect_port(tcpport - 1, 10);
+    if (ctl == -1)
+	goto out_kill;
+    if (control_cmd(ctl, "", reply, sizeof(reply)))
+	goto out;
+    conn = connect_port(tcpport, 10);
+    if (conn == -1)
+	goto out;
+    usleep(200000);
+    if (check_data(conn, "startup"))
+	goto out;
+
+    /* Nothing changed, nothing should be touched. */
+    if (reload("same", 0, 0, 0, NPORTS) || check_data(conn, "same"))
+	goto out;
+
+    /* Remove a port. */
+    if (write_config(NULL, 2, 0, -1) || reload("remove", 0, 0, 1, NPORTS - 1))
+	goto out;
+
+    /* Put it back and change the connected port. */
+    if (write_config(NULL, -1, 10, -1) || reload("change", 1, 1, 0, NPORTS - 2)
+		|| check_data(conn, "change"))
+	goto out;
+
+    /* A default before the ports changes all of them. */
+    if (write_config("DEFAULT:kickolduser:true", -1, 10, -1)
+		|| reload("default", 0, NPORTS, 0, 0))
+	goto out;
+
+    /* A banner none of the ports use doesn't change any of them. */
+    if (write_config(BANNER_CONFIG, -1, 10, -1)
+		|| reload("banner", 0, 0, 0, NPORTS) || check_data(conn, "banner"))
+	goto out;
+
+    /* Turn a port off and back on, it has to be started again. */
+    if (write_config(BANNER_CONFIG, -1, 10, 1)
+		|| reload("off", 0, 1, 0, NPORTS - 1))
+	goto out;
+    if (write_config(BANNER_CONFIG, -1, 10, -1)
+		|| reload("on", 0, 1, 0, NPORTS - 1))
+	goto out;
+    fd = connect_port(tcpport + 1, 2);
+    if (fd == -1) {
+	fprintf(stderr, "on: the port was not started\n");
+	goto out;
+    }
+    close(fd);
+
+    rv = 0;
+
+ out:
+    if (conn != -1)
+	close(conn);
+    close(ctl);
+ out_kill:
+    stop_ser2net(pid);
+ out_unlink:
+    unlink(conffile);
+    close(pty_master);
+    return rv;
+
+ usage:
+    fprintf(stderr, "Usage: %s [-p tcpport] [ser2net-binary]\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,200 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/*
+ * dev_to_net ring wrap test.  Run a ser2net built with the ring
+ * counters starting 1k below 2^32, on a port whose ring is three 100
+ * byte buffers, so not a power of two.  Push data through it from a
+ * pty to a TCP connection, well past where 32-bit counters would
+ * wrap, and check every byte comes out in order.  The data is
+ * written in small pieces so the chardelay batches up several device
+ * reads before they are sent, a read put at the wrong ring position
+ * then gets sent from the wrong place.
+ *
+ * Usage: ring_wrap_test [-p tcpport] [-n bytes] [ser2net-binary]
+ *
+ * If no ser2net binary is given, SER2NET_RINGWRAP_EXEC is used, it
+ * has to be built with DEV_TO_NET_START set for this to test
+ * anything.
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include "testutil.h"
+
+static int tcpport = 13700;
+static unsigned long total = 16 * 1024;
+static char conffile[] = "/tmp/ring_wrap_testXXXXXX";
+
+/* A pattern that doesn't repeat with the ring size. */
+static unsigned char
+pattern(unsigned long pos)
+{
+    return (pos * 7 + (pos >> 8)) & 0xff;
+}
+
+static int
+write_config(const char *devname)
+{
+    FILE *f;
+
+    f = fopen(conffile, "w");
+    if (!f) {
+	perror(conffile);
+	return -1;
+    }
+    fprintf(f, "%d:raw:0:%s:9600 dev-to-net-bufsize=100"
+	    " dev-to-net-buffers=3\n", tcpport, devname);
+    fclose(f);
+
+    return 0;
+}
+
+static int
+transfer(int master, int sock)
+{
+    unsigned char wbuf[37], rbuf[1000];
+    struct pollfd fds[2];
+    unsigned long sent = 0, got = 0;
+    int i, rv;
+
+    while (got < total) {
+	fds[0].fd = sock;
+	fds[0].events = POLLIN;
+	fds[1].fd = master;
+	fds[1].events = sent < total ? POLLOUT : 0;
+	rv = poll(fds, 2, 5000);
+	if (rv == 0) {
+	    fprintf(stderr, "Timed out, sent %lu got %lu\n", sent, got);
+	    return -1;
+	}
+	if (rv < 0) {
+	    if (errno == EINTR)
+		continue;
+	    perror("poll");
+	    return -1;
+	}
+	if (fds[1].revents & POLLOUT) {
+	    size_t len = sizeof(wbuf);
+
+	    if (len > total - sent)
+		len = total - sent;
+	    for (i = 0; i < len; i++)
+		wbuf[i] = pattern(sent + i);
+	    rv = write(master, wbuf, len);
+	    if (rv > 0)
+		sent += rv;
+	    /* Give ser2net time to read each piece separately. */
+	    usleep(500);
+	}
+	if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+	    rv = read(sock, rbuf, sizeof(rbuf));
+	    if (rv <= 0) {
+		fprintf(stderr, "Connection closed, got %lu\n", got);
+		return -1;
+	    }
+	    for (i = 0; i < rv; i++, got++) {
+		if (rbuf[i] != pattern(got)) {
+		    fprintf(stderr, "Byte %lu is 0x%2.2x, expected"
+			    " 0x%2.2x\n", got, rbuf[i], pattern(got));
+		    return -1;
+		}
+	    }
+	}
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char *ser2net;
+    int c, master, slave, sock, rv = 1;
+    pid_t pid;
+
+    while ((c = getopt(argc, argv, "p:n:")) != -1) {
+	switch (c) {
+	case 'p':
+	    tcpport = atoi(optarg);
+	    break;
+	case 'n':
+	    total = strtoul(optarg, NULL, 0);
+	    break;
+	default:
+	    goto usage;
+	}
+    }
+    if (argc - optind > 1 || total == 0)
+	goto usage;
+    if (optind < argc)
+	ser2net = argv[optind];
+    else
+	ser2net = getenv("SER2NET_RINGWRAP_EXEC");
+    /* Don't let find_ser2net() fall back to the normal binary. */
+    if (!ser2net || !find_ser2net(ser2net)) {
+	fprintf(stderr, "No ring wrap ser2net binary to run\n");
+	return SKIP;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (open_pty_pair(&master, &slave))
+	return SKIP;
+    if (make_conffile(conffile))
+	return 1;
+    if (write_config(ptsname(master)))
+	goto out_unlink;
+
+    pid = start_ser2net(ser2net, conffile, "-p", "0", NULL);
+    if (pid == -1)
+	goto out_unlink;
+    sock = connect_port(tcpport, 10);
+    if (sock == -1)
+	goto out_kill;
+    /* Let ser2net open the device before sending. */
+    usleep(200000);
+
+    if (transfer(master, sock) == 0) {
+	printf("%lu bytes through the ring\n", total);
+	rv = 0;
+    }
+
+    close(sock);
+ out_kill:
+    stop_ser2net(pid);
+ out_unlink:
+    unlink(conffile);
+    close(slave);
+    close(master);
+    return rv;
+
+ usage:
+    fprintf(stderr, "Usage: %s [-p tcpport] [-n bytes] [ser2net-binary]\n",
+	    argv[0]);
+    return 1;
+}
@@ -0,0 +1,255 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/*
+ * Rotator strategy test.  Start ser2net with four ports on ptys, a
+ * least-connections rotator over the first two and a weighted
+ * rotator over the last two.  Connect through the rotators and check
+ * which pty each connection's data comes out on.
+ *
+ * Usage: rotator_test [-p tcpport] [ser2net-binary]
+ *
+ * If no ser2net binary is given, SER2NET_EXEC is used.  The rotators
+ * are on tcpport + 10 and tcpport + 11.
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include "testutil.h"
+
+#define NPTYS 4
+
+static char *ser2net;
+static int tcpport = 13600;
+static char conffile[] = "/tmp/rotator_testXXXXXX";
+static int pty_master[NPTYS];
+
+static int
+write_config(void)
+{
+    FILE *f;
+    int i;
+
+    f = fopen(conffile, "w");
+    if (!f) {
+	perror(conffile);
+	return -1;
+    }
+    for (i = 0; i < NPTYS; i++)
+	fprintf(f, "%d:raw:0:%s:9600 max-connections=4\n", tcpport + i,
+		ptsname(pty_master[i]));
+    fprintf(f, "ROTATOR:%d:%d %d strategy=least-connections\n",
+	    tcpport + 10, tcpport, tcpport + 1);
+    fprintf(f, "ROTATOR:%d:%d*3 %d strategy=weighted\n",
+	    tcpport + 11, tcpport + 2, tcpport + 3);
+    fclose(f);
+
+    return 0;
+}
+
+/*
+ * Connect through the rotator and return which pty the connection
+ * went to, or -1 on error.  The connection is returned in fd.
+ */
+static int
+rotator_connect(int port, int *fd)
+{
+    char buf[16];
+    int i, j, rv;
+
+    *fd = connect_port(port, 10);
+    if (*fd == -1)
+	return -1;
+    usleep(100000);
+    if (write(*fd, "x", 1) != 1) {
+	fprintf(stderr, "write to rotator failed\n");
+	return -1;
+    }
+    for (j = 0; j < 20; j++) {
+	usleep(50000);
+	for (i = 0; i < NPTYS; i++) {
+	    rv = read(pty_master[i], buf, sizeof(buf));
+	    if (rv > 0)
+		return i;
+	}
+    }
+    fprintf(stderr, "Data from rotator %d did not come out\n", port);
+    return -1;
+}
+
+static int
+check_least_connections(void)
+{
+    static const int expect[] = { 0, 1, 0 };
+    int fds[3], fd, i, n, rv = -1;
+
+    for (i = 0; i < 3; i++)
+	fds[i] = -1;
+
+    /*
+     * A connection straight to the first port counts, even before
+     * the rotator has picked anything.
+     */
+    fd = connect_port(tcpport, 10);
+    if (fd == -1)
+	goto out;
+    usleep(100000);
+    n = rotator_connect(tcpport + 10, &fds[0]);
+    close(fd);
+    if (fds[0] != -1)
+	close(fds[0]);
+    fds[0] = -1;
+    if (n != 1) {
+	fprintf(stderr, "least-connections: went to %d with a direct"
+		" connection on 0, expected 1\n", n);
+	goto out;
+    }
+    usleep(200000);
+
+    /* Ties go to the first port, so this alternates. */
+    for (i = 0; i < 3; i++) {
+	n = rotator_connect(tcpport + 10, &fds[i]);
+	if (n != expect[i]) {
+	    fprintf(stderr, "least-connections: connection %d went to"
+		    " %d, expected %d\n", i, n, expect[i]);
+	    goto out;
+	}
+    }
+
+    /*
+     * Now the first port has none and the second one has one.
+     * Round-robin would go to the second port.
+     */
+    close(fds[0]);
+    close(fds[2]);
+    fds[0] = fds[2] = -1;
+    usleep(200000);
+    n = rotator_connect(tcpport + 10, &fd);
+    if (fd != -1)
+	close(fd);
+    if (n != 0) {
+	fprintf(stderr, "least-connections: went to %d after close,"
+		" expected 0\n", n);
+	goto out;
+    }
+    rv = 0;
+
+ out:
+    for (i = 0; i < 3; i++) {
+	if (fds[i] != -1)
+	    close(fds[i]);
+    }
+    return rv;
+}
+
+static int
+check_weighted(void)
+{
+    int fds[8], counts[NPTYS], i, n, rv = -1;
+
+    memset(counts, 0, sizeof(counts));
+    for (i = 0; i < 8; i++)
+	fds[i] = -1;
+
+    /* Connect and close so the ports never fill up. */
+    for (i = 0; i < 8; i++) {
+	n = rotator_connect(tcpport + 11, &fds[i]);
+	if (n < 0)
+	    goto out;
+	counts[n]++;
+	close(fds[i]);
+	fds[i] = -1;
+	usleep(100000);
+    }
+    if (counts[2] != 6 || counts[3] != 2) {
+	fprintf(stderr, "weighted: got %d and %d connections, expected"
+		" 6 and 2\n", counts[2], counts[3]);
+	goto out;
+    }
+    rv = 0;
+
+ out:
+    for (i = 0; i < 8; i++) {
+	if (fds[i] != -1)
+	    close(fds[i]);
+    }
+    return rv;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int c, i, rv = 1;
+    pid_t pid;
+
+    while ((c = getopt(argc, argv, "p:")) != -1) {
+	switch (c) {
+	case 'p':
+	    tcpport = atoi(optarg);
+	    break;
+	default:
+	    goto usage;
+	}
+    }
+    if (argc - optind > 1)
+	goto usage;
+    ser2net = find_ser2net(optind < argc ? argv[optind] : NULL);
+    if (!ser2net)
+	return SKIP;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    for (i = 0; i < NPTYS; i++) {
+	pty_master[i] = open_pty_master(O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (pty_master[i] == -1)
+	    return SKIP;
+    }
+
+    if (make_conffile(conffile))
+	return 1;
+    if (write_config())
+	goto out_unlink;
+
+    pid = start_ser2net(ser2net, conffile, NULL);
+    if (pid == -1)
+	goto out_unlink;
+
+    if (check_least_connections() || check_weighted())
+	goto out_kill;
+    rv = 0;
+
+ out_kill:
+    stop_ser2net(pid);
+ out_unlink:
+    unlink(conffile);
+    for (i = 0; i < NPTYS; i++)
+	close(pty_master[i]);
+    return rv;
+
+ usage:
+    fprintf(stderr, "Usage: %s [-p tcpport] [ser2net-binary]\n", argv[0]);
+    return 1;
+}
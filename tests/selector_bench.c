@@ -0,0 +1,156 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Selector benchmark.  Open a bunch of pipes, write a byte into each
+ * one, and count how many times sel_select() has to be called to
+ * deliver all of them.  This is run with different epoll batch sizes
+ * to show how many waits are saved per delivered byte.
+ *
+ * Usage: selector_bench [npipes [rounds]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/time.h>
+#include "utils/selector.h"
+
+static unsigned long bytes_read;
+
+static void
+bench_read(int fd, void *data)
+{
+    char buf[16];
+    int rv;
+
+    rv = read(fd, buf, sizeof(buf));
+    if (rv > 0)
+	bytes_read += rv;
+}
+
+static int
+run_bench(int npipes, int rounds, unsigned int batch)
+{
+    struct selector_s *sel;
+    int (*fds)[2];
+    unsigned long calls = 0, expected;
+    struct timeval start, end, timeout;
+    double elapsed;
+    int i, r, rv;
+
+    rv = sel_alloc_selector_nothread(&sel);
+    if (rv) {
+	fprintf(stderr, "Unable to allocate selector: %s\n", strerror(rv));
+	return 1;
+    }
+    sel_set_epoll_batch(sel, batch);
+
+    fds = calloc(npipes, sizeof(*fds));
+    if (!fds) {
+	fprintf(stderr, "Out of memory\n");
+	return 1;
+    }
+
+    for (i = 0; i < npipes; i++) {
+	if (pipe(fds[i]) == -1) {
+	    perror("pipe");
+	    return 1;
+	}
+	fcntl(fds[i][0], F_SETFL, O_NONBLOCK);
+	rv = sel_set_fd_handlers(sel, fds[i][0], NULL, bench_read,
+				 NULL, NULL, NULL);
+	if (rv) {
+	    fprintf(stderr, "Unable to set fd handlers: %s\n", strerror(rv));
+	    return 1;
+	}
+	sel_set_fd_read_handler(sel, fds[i][0], SEL_FD_HANDLER_ENABLED);
+    }
+
+    bytes_read = 0;
+    expected = 0;
+    gettimeofday(&start, NULL);
+    for (r = 0; r < rounds; r++) {
+	for (i = 0; i < npipes; i++) {
+	    if (write(fds[i][1], "x", 1) != 1) {
+		perror("write");
+		return 1;
+	    }
+	}
+	expected += npipes;
+	while (bytes_read < expected) {
+	    timeout.tv_sec = 1;
+	    timeout.tv_usec = 0;
+	    rv = sel_select(sel, NULL, 0, NULL, &timeout);
+	    if (rv < 0 && errno != EINTR) {
+		perror("sel_select");
+		return 1;
+	    }
+	    if (rv == 0) {
+		fprintf(stderr, "Timed out waiting for data\n");
+		return 1;
+	    }
+	    calls++;
+	}
+    }
+    gettimeofday(&end, NULL);
+
+    elapsed = (end.tv_sec - start.tv_sec) +
+	((double) (end.tv_usec - start.tv_usec) / 1000000.0);
+    printf("batch %3u: %lu bytes, %lu waits, %.4f waits/byte, %.3fs\n",
+	   batch, bytes_read, calls, (double) calls / bytes_read, elapsed);
+
+    for (i = 0; i < npipes; i++) {
+	sel_clear_fd_handlers(sel, fds[i][0]);
+	close(fds[i][0]);
+	close(fds[i][1]);
+    }
+    free(fds);
+    sel_free_selector(sel);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int npipes = 64, rounds = 1000;
+    unsigned int batches[] = { 1, 4, SEL_DEFAULT_EPOLL_BATCH,
+			       SEL_MAX_EPOLL_BATCH };
+    unsigned int i;
+
+    if (argc > 1)
+	npipes = atoi(argv[1]);
+    if (argc > 2)
+	rounds = atoi(argv[2]);
+    if (npipes <= 0 || rounds <= 0) {
+	fprintf(stderr, "Usage: %s [npipes [rounds]]\n", argv[0]);
+	return 1;
+    }
+
+    printf("%d pipes, %d rounds\n", npipes, rounds);
+    for (i = 0; i < sizeof(batches) / sizeof(batches[0]); i++) {
+	if (run_bench(npipes, rounds, batches[i]))
+	    return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,356 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Selector stress test.  Open a lot more TCP connections over
+ * loopback than fit in an fd_set, register both ends of all of them
+ * with the selector, and make sure data sent on every connection gets
+ * delivered to the right handler.  The fd limit is raised to the hard
+ * limit first, the test is skipped if that is not enough.
+ *
+ * Then check that when a handler closes an fd that has an event
+ * waiting later in the same batch, and a new fd gets the same number,
+ * the stale event doesn't get applied to the new fd.
+ *
+ * Built with SEL_TEST_URING this runs against the io_uring backend,
+ * and is skipped if the kernel doesn't support it.
+ *
+ * Usage: selector_stress [nconns]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "utils/selector.h"
+
+/* Automake's exit code for a skipped test. */
+#define TEST_SKIPPED 77
+
+struct conn {
+    int fd;
+    int peer;		/* Index of the other end. */
+    unsigned long got;
+};
+
+static struct conn *conns;
+static unsigned long total_got;
+static int errors;
+
+static void
+conn_read(int fd, void *cbdata)
+{
+    struct conn *c = cbdata;
+    char buf[64];
+    int rv;
+
+    rv = read(fd, buf, sizeof(buf));
+    if (rv <= 0)
+	return;
+    /* Every byte sent is the low byte of the receiver's index. */
+    while (rv-- > 0) {
+	if ((unsigned char) buf[rv] != ((c - conns) & 0xff))
+	    errors++;
+	c->got++;
+	total_got++;
+    }
+}
+
+/*
+ * Two fds whose peers are closed, so both have a hangup waiting and
+ * come out of the same batch.  Whichever handler runs first replaces
+ * the other fd with a new socket with the same number.
+ */
+struct reuse {
+    int fd;
+    int peer;		/* Index of the other one. */
+};
+
+static struct selector_s *reuse_sel;
+static struct reuse reuses[2];
+static int reuse_fd = -1, reuse_writer = -1, reuse_got;
+
+static void
+reuse_new_read(int fd, void *cbdata)
+{
+    char buf[16];
+
+    if (read(fd, buf, sizeof(buf)) > 0)
+	reuse_got = 1;
+}
+
+static void
+reuse_read(int fd, void *cbdata)
+{
+    struct reuse *r = cbdata;
+    struct reuse *other = &reuses[r->peer];
+    int sv[2];
+
+    sel_clear_fd_handlers(reuse_sel, fd);
+    if (reuse_fd != -1)
+	return;
+
+    sel_clear_fd_handlers(reuse_sel, other->fd);
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+	perror("socketpair");
+	errors++;
+	return;
+    }
+    if (dup2(sv[0], other->fd) == -1) {
+	perror("dup2");
+	errors++;
+	return;
+    }
+    close(sv[0]);
+    reuse_fd = other->fd;
+    reuse_writer = sv[1];
+    fcntl(reuse_fd, F_SETFL, O_NONBLOCK);
+    if (sel_set_fd_handlers(reuse_sel, reuse_fd, NULL, reuse_new_read,
+			    NULL, NULL, NULL)) {
+	errors++;
+	return;
+    }
+    sel_set_fd_read_handler(reuse_sel, reuse_fd, SEL_FD_HANDLER_ENABLED);
+}
+
+static int
+check_fd_reuse(struct selector_s *sel)
+{
+    struct timeval timeout;
+    int sv[2], i;
+
+    reuse_sel = sel;
+    for (i = 0; i < 2; i++) {
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+	    perror("socketpair");
+	    return -1;
+	}
+	close(sv[1]);
+	fcntl(sv[0], F_SETFL, O_NONBLOCK);
+	reuses[i].fd = sv[0];
+	reuses[i].peer = !i;
+	if (sel_set_fd_handlers(sel, sv[0], &reuses[i], reuse_read,
+				NULL, NULL, NULL))
+	    return -1;
+	sel_set_fd_read_handler(sel, sv[0], SEL_FD_HANDLER_ENABLED);
+    }
+
+    timeout.tv_sec = 5;
+    timeout.tv_usec = 0;
+    while (reuse_fd == -1 && sel_select(sel, NULL, 0, NULL, &timeout) > 0)
+	;
+    if (reuse_fd == -1) {
+	fprintf(stderr, "fd reuse: no hangup seen\n");
+	return -1;
+    }
+
+    /* Only written now, so only a live registration can see it. */
+    if (write(reuse_writer, "x", 1) != 1) {
+	perror("write");
+	return -1;
+    }
+    timeout.tv_sec = 2;
+    timeout.tv_usec = 0;
+    while (!reuse_got && sel_select(sel, NULL, 0, NULL, &timeout) > 0)
+	;
+    if (!reuse_got) {
+	fprintf(stderr, "fd reuse: the new fd %d never got its data\n",
+		reuse_fd);
+	return -1;
+    }
+
+    sel_clear_fd_handlers(sel, reuse_fd);
+    for (i = 0; i < 2; i++)
+	close(reuses[i].fd);
+    close(reuse_writer);
+    return 0;
+}
+
+static int
+open_conns(int lfd, struct sockaddr_in *addr, int nconns)
+{
+    int i, fd, afd;
+
+    for (i = 0; i < nconns; i++) {
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1) {
+	    perror("socket");
+	    return -1;
+	}
+	if (connect(fd, (struct sockaddr *) addr, sizeof(*addr)) == -1) {
+	    perror("connect");
+	    return -1;
+	}
+	afd = accept(lfd, NULL, NULL);
+	if (afd == -1) {
+	    perror("accept");
+	    return -1;
+	}
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	fcntl(afd, F_SETFL, O_NONBLOCK);
+	conns[i * 2].fd = fd;
+	conns[i * 2].peer = i * 2 + 1;
+	conns[i * 2 + 1].fd = afd;
+	conns[i * 2 + 1].peer = i * 2;
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct selector_s *sel;
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    struct rlimit lim;
+    struct timeval timeout, start, end;
+    unsigned long expected;
+    const char *backend;
+    int nconns = 2000, nfds, i, lfd, rv, maxfd = 0;
+
+    if (argc > 1)
+	nconns = atoi(argv[1]);
+    if (nconns <= 0) {
+	fprintf(stderr, "Usage: %s [nconns]\n", argv[0]);
+	return 1;
+    }
+    nfds = nconns * 2;
+
+    /* Two fds per connection, plus some slack for the listener, etc. */
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0) {
+	lim.rlim_cur = lim.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &lim);
+	getrlimit(RLIMIT_NOFILE, &lim);
+	if (lim.rlim_cur != RLIM_INFINITY &&
+		lim.rlim_cur < (rlim_t) nfds + 16) {
+	    printf("fd limit %lu is too small for %d connections, skipping\n",
+		   (unsigned long) lim.rlim_cur, nconns);
+	    return TEST_SKIPPED;
+	}
+    }
+
+    conns = calloc(nfds, sizeof(*conns));
+    if (!conns) {
+	fprintf(stderr, "Out of memory\n");
+	return 1;
+    }
+
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd == -1) {
+	perror("socket");
+	return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+		listen(lfd, 128) == -1 ||
+		getsockname(lfd, (struct sockaddr *) &addr, &addrlen) == -1) {
+	perror("listen");
+	return 1;
+    }
+
+    if (open_conns(lfd, &addr, nconns))
+	return 1;
+
+#ifdef SEL_TEST_URING
+    sel_set_default_backend(SEL_BACKEND_URING);
+#endif
+    rv = sel_alloc_selector_nothread(&sel);
+    if (rv) {
+	fprintf(stderr, "Unable to allocate selector: %s\n", strerror(rv));
+	return 1;
+    }
+#ifdef SEL_TEST_URING
+    if (strcmp(sel_backend_name(sel), "io_uring") != 0) {
+	printf("io_uring is not available, skipping\n");
+	return TEST_SKIPPED;
+    }
+#endif
+
+    for (i = 0; i < nfds; i++) {
+	if (conns[i].fd > maxfd)
+	    maxfd = conns[i].fd;
+	rv = sel_set_fd_handlers(sel, conns[i].fd, &conns[i], conn_read,
+				 NULL, NULL, NULL);
+	if (rv) {
+	    fprintf(stderr, "Unable to set handlers for fd %d: %s\n",
+		    conns[i].fd, strerror(rv));
+	    return 1;
+	}
+	sel_set_fd_read_handler(sel, conns[i].fd, SEL_FD_HANDLER_ENABLED);
+    }
+
+    /* Send each end a byte from its peer, a few times around. */
+    expected = 0;
+    gettimeofday(&start, NULL);
+    for (rv = 0; rv < 4; rv++) {
+	for (i = 0; i < nfds; i++) {
+	    unsigned char b = conns[i].peer & 0xff;
+
+	    if (write(conns[i].fd, &b, 1) != 1) {
+		perror("write");
+		return 1;
+	    }
+	}
+	expected += nfds;
+	while (total_got < expected) {
+	    timeout.tv_sec = 5;
+	    timeout.tv_usec = 0;
+	    if (sel_select(sel, NULL, 0, NULL, &timeout) == 0) {
+		fprintf(stderr, "Timed out, got %lu of %lu\n",
+			total_got, expected);
+		return 1;
+	    }
+	}
+    }
+    gettimeofday(&end, NULL);
+
+    for (i = 0; i < nfds; i++) {
+	if (conns[i].got != 4) {
+	    fprintf(stderr, "fd %d got %lu bytes, expected 4\n",
+		    conns[i].fd, conns[i].got);
+	    errors++;
+	}
+	sel_clear_fd_handlers(sel, conns[i].fd);
+	close(conns[i].fd);
+    }
+    close(lfd);
+    if (check_fd_reuse(sel))
+	errors++;
+    backend = sel_backend_name(sel);
+    sel_free_selector(sel);
+
+    printf("%s: %d connections, highest fd %d, %lu bytes in %.3fs,"
+	   " %d errors\n",
+	   backend, nconns, maxfd, total_got,
+	   (end.tv_sec - start.tv_sec) +
+	   ((double) (end.tv_usec - start.tv_usec) / 1000000.0),
+	   errors);
+
+    return errors != 0;
+}
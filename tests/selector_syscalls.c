@@ -0,0 +1,266 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Count the system calls the selector makes to deliver events with
+ * each backend.  A set of pipes is registered with the selector and
+ * each round a byte is written into every pipe and the selector is
+ * run until all the bytes have been read.  This is done once in a
+ * child traced with ptrace to count the system calls, and once
+ * untraced to time it.  The writes and the reads in the handlers are
+ * the same for every backend, they are counted separately so the
+ * selector's own calls can be seen.
+ *
+ * With -t the read handler also turns writing on and back off and
+ * reading off and back on, like the data path does while it passes
+ * data between two fds.
+ *
+ * Usage: selector_syscalls [-t] [-p pipes] [-r rounds]
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include "utils/selector.h"
+
+static int npipes = 64;
+static int rounds = 1000;
+static int toggle;
+static int (*pipes)[2];
+static unsigned long total_got;
+static struct selector_s *cur_sel;
+
+static void
+pipe_read(int fd, void *cb_data)
+{
+    unsigned char buf[16];
+    int rv;
+
+    if (toggle) {
+	sel_set_fd_read_handler(cur_sel, fd, SEL_FD_HANDLER_DISABLED);
+	sel_set_fd_write_handler(cur_sel, fd, SEL_FD_HANDLER_ENABLED);
+    }
+    rv = read(fd, buf, sizeof(buf));
+    if (rv > 0)
+	total_got += rv;
+    if (toggle) {
+	sel_set_fd_write_handler(cur_sel, fd, SEL_FD_HANDLER_DISABLED);
+	sel_set_fd_read_handler(cur_sel, fd, SEL_FD_HANDLER_ENABLED);
+    }
+}
+
+/*
+ * Run the rounds on the given backend.  Returns -1 on error or if
+ * the backend is not available, otherwise 0 with the time taken in
+ * elapsed.  If stop is set the child stops itself before and after
+ * the rounds, so the tracer only counts what is in between.
+ */
+static int
+run_rounds(int backend, int stop, double *elapsed)
+{
+    struct selector_s *sel;
+    struct timeval timeout, start, end;
+    unsigned long expected = 0;
+    int i, r, rv = -1;
+
+    sel_set_default_backend(backend);
+    if (sel_alloc_selector_nothread(&sel))
+	return -1;
+    cur_sel = sel;
+    if (backend == SEL_BACKEND_URING &&
+		strcmp(sel_backend_name(sel), "io_uring") != 0)
+	goto out;
+
+    for (i = 0; i < npipes; i++) {
+	if (sel_set_fd_handlers(sel, pipes[i][0], NULL, pipe_read,
+				NULL, NULL, NULL))
+	    goto out;
+	sel_set_fd_read_handler(sel, pipes[i][0], SEL_FD_HANDLER_ENABLED);
+    }
+    /* Get the registrations in before counting. */
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 0;
+    sel_select(sel, NULL, 0, NULL, &timeout);
+
+    total_got = 0;
+    if (stop)
+	raise(SIGSTOP);
+    gettimeofday(&start, NULL);
+    for (r = 0; r < rounds; r++) {
+	for (i = 0; i < npipes; i++) {
+	    if (write(pipes[i][1], "x", 1) != 1)
+		goto out_clear;
+	}
+	expected += npipes;
+	while (total_got < expected) {
+	    timeout.tv_sec = 5;
+	    timeout.tv_usec = 0;
+	    if (sel_select(sel, NULL, 0, NULL, &timeout) == 0) {
+		fprintf(stderr, "Timed out, got %lu of %lu\n",
+			total_got, expected);
+		goto out_clear;
+	    }
+	}
+    }
+    gettimeofday(&end, NULL);
+    if (stop)
+	raise(SIGSTOP);
+    *elapsed = (end.tv_sec - start.tv_sec) +
+	((double) (end.tv_usec - start.tv_usec) / 1000000.0);
+    rv = 0;
+
+ out_clear:
+    for (i = 0; i < npipes; i++)
+	sel_clear_fd_handlers(sel, pipes[i][0]);
+ out:
+    sel_free_selector(sel);
+    return rv;
+}
+
+/*
+ * Count the system calls the child makes between its two stops, and
+ * how many of them were the pipe writes and reads.
+ */
+static int
+count_syscalls(pid_t pid, unsigned long *total, unsigned long *io)
+{
+    struct __ptrace_syscall_info info;
+    int status, stops = 1;
+
+    *total = 0;
+    *io = 0;
+    /* The first stop, the child is about to start the rounds. */
+    if (waitpid(pid, &status, 0) == -1 || !WIFSTOPPED(status))
+	return -1;
+    ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACE_O_TRACESYSGOOD);
+    for (;;) {
+	if (ptrace(PTRACE_SYSCALL, pid, 0, 0) == -1)
+	    return -1;
+	if (waitpid(pid, &status, 0) == -1)
+	    return -1;
+	if (WIFEXITED(status) || WIFSIGNALED(status))
+	    return stops == 2 ? 0 : -1;
+	if (WSTOPSIG(status) == SIGSTOP) {
+	    stops++;
+	    continue;
+	}
+	if (WSTOPSIG(status) != (SIGTRAP | 0x80) || stops != 1)
+	    continue;
+	if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info) <= 0)
+	    return -1;
+	if (info.op != PTRACE_SYSCALL_INFO_ENTRY)
+	    continue;
+	(*total)++;
+	if (info.entry.nr == SYS_write || info.entry.nr == SYS_read)
+	    (*io)++;
+    }
+}
+
+static int
+bench(int backend, const char *name)
+{
+    unsigned long total, io, events = (unsigned long) npipes * rounds;
+    double elapsed;
+    int status;
+    pid_t pid;
+
+    if (run_rounds(backend, 0, &elapsed)) {
+	printf("%-8s: not available\n", name);
+	return 0;
+    }
+
+    pid = fork();
+    if (pid == -1) {
+	perror("fork");
+	return 1;
+    }
+    if (pid == 0) {
+	double dummy;
+
+	if (ptrace(PTRACE_TRACEME, 0, 0, 0) == -1)
+	    _exit(1);
+	_exit(run_rounds(backend, 1, &dummy) ? 1 : 0);
+    }
+    if (count_syscalls(pid, &total, &io)) {
+	fprintf(stderr, "Unable to trace the %s run\n", name);
+	kill(pid, SIGKILL);
+	waitpid(pid, &status, 0);
+	return 1;
+    }
+
+    printf("%-8s: %lu events in %.3fs, %.3f us/event, %.3f syscalls/event"
+	   " (%.3f excluding the pipe I/O)\n", name, events, elapsed,
+	   elapsed * 1000000.0 / events, (double) total / events,
+	   (double) (total - io) / events);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int c, i, rv;
+
+    while ((c = getopt(argc, argv, "tp:r:")) != -1) {
+	switch (c) {
+	case 'p':
+	    npipes = atoi(optarg);
+	    break;
+	case 'r':
+	    rounds = atoi(optarg);
+	    break;
+	case 't':
+	    toggle = 1;
+	    break;
+	default:
+	    goto usage;
+	}
+    }
+    if (optind != argc || npipes <= 0 || rounds <= 0)
+	goto usage;
+
+    pipes = calloc(npipes, sizeof(*pipes));
+    if (!pipes) {
+	fprintf(stderr, "Out of memory\n");
+	return 1;
+    }
+    for (i = 0; i < npipes; i++) {
+	if (pipe(pipes[i]) == -1) {
+	    perror("pipe");
+	    return 1;
+	}
+	fcntl(pipes[i][0], F_SETFL, O_NONBLOCK);
+    }
+
+    rv = bench(SEL_BACKEND_EPOLL, "epoll");
+    rv |= bench(SEL_BACKEND_URING, "io_uring");
+    return rv;
+
+ usage:
+    fprintf(stderr, "Usage: %s [-t] [-p pipes] [-r rounds]\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,222 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/*
+ * Selector wakeup test.  Two threads wait in a shared selector, one
+ * in sel_select() and one in a waiter.  The main thread starts timers
+ * and wakes the waiter and checks that the right thread notices in
+ * time.  The wake signal has no handler, so if the selector falls
+ * back to sending it the test dies.
+ *
+ * Built with SEL_TEST_URING this runs against the io_uring backend.
+ *
+ * Exits 77 (skipped) if the selector has no wake eventfd, or for
+ * SEL_TEST_URING if the kernel doesn't support io_uring.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include "utils/selector.h"
+#include "utils/waiter.h"
+
+#if defined(USE_PTHREADS) && defined(HAVE_EPOLL_PWAIT) && defined(HAVE_EVENTFD)
+#include <pthread.h>
+
+#define ROUNDS 200
+
+static struct selector_s *sel;
+static waiter_t *waiter;
+static volatile int done;
+static volatile unsigned int fired, woken, exited;
+
+struct sel_lock_s
+{
+    pthread_mutex_t lock;
+};
+
+static sel_lock_t *
+slock_alloc(void *cb_data)
+{
+    sel_lock_t *l = malloc(sizeof(*l));
+
+    if (l)
+	pthread_mutex_init(&l->lock, NULL);
+    return l;
+}
+
+static void
+slock_free(sel_lock_t *l)
+{
+    pthread_mutex_destroy(&l->lock);
+    free(l);
+}
+
+static void
+slock_lock(sel_lock_t *l)
+{
+    pthread_mutex_lock(&l->lock);
+}
+
+static void
+slock_unlock(sel_lock_t *l)
+{
+    pthread_mutex_unlock(&l->lock);
+}
+
+static void
+send_sig(long thread_id, void *cb_data)
+{
+    pthread_kill(*((pthread_t *) thread_id), SIGUSR1);
+}
+
+static void *
+select_thread(void *dummy)
+{
+    pthread_t self = pthread_self();
+
+    while (!done)
+	sel_select(sel, send_sig, (long) &self, NULL, NULL);
+    __atomic_add_fetch(&exited, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+static void *
+waiter_thread(void *dummy)
+{
+    while (!done) {
+	wait_for_waiter(waiter, 1);
+	__atomic_add_fetch(&woken, 1, __ATOMIC_SEQ_CST);
+    }
+    return NULL;
+}
+
+static void
+timeout(struct selector_s *sel, sel_timer_t *timer, void *data)
+{
+    __atomic_add_fetch(&fired, 1, __ATOMIC_SEQ_CST);
+}
+
+/* Wait up to a second for *val to get to expect. */
+static int
+wait_for(volatile unsigned int *val, unsigned int expect)
+{
+    struct timespec delay = { 0, 1000000 };
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+	if (__atomic_load_n(val, __ATOMIC_SEQ_CST) >= expect)
+	    return 0;
+	nanosleep(&delay, NULL);
+    }
+    return -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+    pthread_t sthread, wthread;
+    sel_timer_t *timer;
+    struct timeval then;
+    struct timespec delay = { 0, 2000000 };
+    unsigned int i;
+    int rv;
+
+#ifdef SEL_TEST_URING
+    sel_set_default_backend(SEL_BACKEND_URING);
+#endif
+    rv = sel_alloc_selector_thread(&sel, SIGUSR1, slock_alloc, slock_free,
+				   slock_lock, slock_unlock, NULL);
+    if (rv) {
+	fprintf(stderr, "Unable to allocate selector: %s\n", strerror(rv));
+	return 1;
+    }
+#ifdef SEL_TEST_URING
+    if (strcmp(sel_backend_name(sel), "io_uring") != 0) {
+	printf("io_uring is not available, skipping\n");
+	return 77;
+    }
+#endif
+    waiter = alloc_waiter(sel, SIGUSR1);
+    if (!waiter) {
+	fprintf(stderr, "Unable to allocate waiter\n");
+	return 1;
+    }
+    rv = sel_alloc_timer(sel, timeout, NULL, &timer);
+    if (rv) {
+	fprintf(stderr, "Unable to allocate timer: %s\n", strerror(rv));
+	return 1;
+    }
+
+    pthread_create(&sthread, NULL, select_thread, NULL);
+    pthread_create(&wthread, NULL, waiter_thread, NULL);
+
+    for (i = 0; i < ROUNDS; i++) {
+	/* Let both threads go to sleep with no timeout. */
+	nanosleep(&delay, NULL);
+
+	/* A new timer at the top of the heap must wake someone. */
+	sel_get_monotonic_time(&then);
+	then.tv_usec += 1000;
+	sel_start_timer(timer, &then);
+	if (wait_for(&fired, i + 1)) {
+	    fprintf(stderr, "Timer %u didn't go off\n", i);
+	    return 1;
+	}
+
+	nanosleep(&delay, NULL);
+
+	/* This one has to wake up the waiter thread in particular. */
+	wake_waiter(waiter);
+	if (wait_for(&woken, i + 1)) {
+	    fprintf(stderr, "Waiter %u didn't wake up\n", i);
+	    return 1;
+	}
+    }
+
+    /* The select thread may not be waiting yet, keep poking it. */
+    done = 1;
+    wake_waiter(waiter);
+    while (!exited) {
+	sel_wake_all(sel);
+	nanosleep(&delay, NULL);
+    }
+    pthread_join(sthread, NULL);
+    pthread_join(wthread, NULL);
+
+    printf("%u timers and %u waiter wakeups delivered with %s\n", fired,
+	   woken, sel_backend_name(sel));
+    return 0;
+}
+
+#else
+
+int
+main(int argc, char *argv[])
+{
+    fprintf(stderr, "No selector wake fd, skipping\n");
+    return 77;
+}
+
+#endif
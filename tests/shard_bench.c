@@ -0,0 +1,262 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/*
+ * Shard scaling benchmark.  Start ser2net with a number of raw ports,
+ * each on its own pty, push data into all the ptys at once and read
+ * it from a TCP connection to each port.  This is done with 1, 2, 4,
+ * and 8 shards (the -S option) and prints the total throughput and
+ * the CPU time ser2net used for each.
+ *
+ * Usage: shard_bench [-n megabytes] [-P ports] [-p tcpport] [-a]
+ *                    ser2net-binary
+ *
+ * The megabytes are per port, -a passes -a to ser2net to pin the
+ * shards to CPUs.
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "testutil.h"
+
+#define MAX_PORTS 64
+
+struct bench_port {
+    int master;
+    int slave;
+    int sock;
+    unsigned long sent;
+    unsigned long got;
+};
+
+static char *ser2net;
+static int tcpport = 3390;
+static int nports = 16;
+static int pin;
+static unsigned long total;
+static struct bench_port ports[MAX_PORTS];
+
+static int
+open_ptys(void)
+{
+    int i;
+
+    for (i = 0; i < nports; i++) {
+	if (open_pty_pair(&ports[i].master, &ports[i].slave))
+	    return -1;
+    }
+
+    return 0;
+}
+
+static void
+close_ptys(void)
+{
+    int i;
+
+    for (i = 0; i < nports; i++) {
+	close(ports[i].slave);
+	close(ports[i].master);
+    }
+}
+
+static int
+write_config(int shards, char *conffile)
+{
+    FILE *f;
+    int i;
+
+    f = fopen(conffile, "w");
+    if (!f) {
+	perror(conffile);
+	return -1;
+    }
+    for (i = 0; i < nports; i++)
+	fprintf(f, "%d:raw:0:%s:9600 -chardelay dev-to-net-bufsize=65536"
+		" shard=%d\n", tcpport + i, ptsname(ports[i].master),
+		i % shards);
+    fclose(f);
+
+    return 0;
+}
+
+static int
+run_bench(int shards)
+{
+    static unsigned char wbuf[16384], rbuf[65536];
+    char conffile[] = "/tmp/shard_benchXXXXXX", shardstr[20];
+    struct pollfd fds[MAX_PORTS * 2];
+    struct timeval start, end;
+    struct rusage usage;
+    unsigned long got = 0;
+    double elapsed;
+    int i, rv, status, done = 0;
+    pid_t pid;
+
+    if (make_conffile(conffile))
+	return 1;
+    if (write_config(shards, conffile))
+	goto out_unlink;
+
+    snprintf(shardstr, sizeof(shardstr), "%d", shards);
+    pid = start_ser2net(ser2net, conffile, "-p", "0", "-S", shardstr,
+			pin ? "-a" : NULL, NULL);
+    if (pid == -1)
+	goto out_unlink;
+
+    for (i = 0; i < nports; i++) {
+	ports[i].sent = 0;
+	ports[i].got = 0;
+	ports[i].sock = connect_port(tcpport + i, 5);
+	if (ports[i].sock == -1) {
+	    while (--i >= 0)
+		close(ports[i].sock);
+	    stop_ser2net(pid);
+	    goto out_unlink;
+	}
+    }
+    /* Let ser2net open the devices before sending. */
+    usleep(200000);
+
+    memset(wbuf, 'x', sizeof(wbuf));
+    gettimeofday(&start, NULL);
+    while (done < nports) {
+	for (i = 0; i < nports; i++) {
+	    fds[i * 2].fd = ports[i].sock;
+	    fds[i * 2].events = ports[i].got < total ? POLLIN : 0;
+	    fds[i * 2 + 1].fd = ports[i].master;
+	    fds[i * 2 + 1].events = ports[i].sent < total ? POLLOUT : 0;
+	}
+	rv = poll(fds, nports * 2, 2000);
+	if (rv == 0) {
+	    fprintf(stderr, "Timed out, %d of %d ports done\n", done, nports);
+	    break;
+	}
+	if (rv < 0) {
+	    if (errno == EINTR)
+		continue;
+	    perror("poll");
+	    break;
+	}
+	for (i = 0; i < nports; i++) {
+	    struct bench_port *p = &ports[i];
+
+	    if (fds[i * 2 + 1].revents & POLLOUT) {
+		size_t len = sizeof(wbuf);
+
+		if (len > total - p->sent)
+		    len = total - p->sent;
+		rv = write(p->master, wbuf, len);
+		if (rv > 0)
+		    p->sent += rv;
+	    }
+	    if (fds[i * 2].revents & (POLLIN | POLLHUP | POLLERR)) {
+		rv = read(p->sock, rbuf, sizeof(rbuf));
+		if (rv <= 0) {
+		    fprintf(stderr, "Connection %d closed, got %lu\n", i,
+			    p->got);
+		    p->got = total;
+		} else {
+		    p->got += rv;
+		    got += rv;
+		}
+		if (p->got >= total)
+		    done++;
+	    }
+	}
+    }
+    gettimeofday(&end, NULL);
+
+    for (i = 0; i < nports; i++)
+	close(ports[i].sock);
+    kill(pid, SIGKILL);
+    wait4(pid, &status, 0, &usage);
+    unlink(conffile);
+
+    elapsed = tv_to_secs(&end) - tv_to_secs(&start);
+    printf("%d shard%s: %lu bytes in %.3fs, %.1f MB/s, ser2net cpu %.3fs user"
+	   " %.3fs sys\n", shards, shards == 1 ? " " : "s", got, elapsed,
+	   got / elapsed / (1024 * 1024), tv_to_secs(&usage.ru_utime),
+	   tv_to_secs(&usage.ru_stime));
+
+    return got < total * nports;
+
+ out_unlink:
+    unlink(conffile);
+    return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static int shards[] = { 1, 2, 4, 8 };
+    unsigned long megabytes = 8;
+    int c, i, rv = 0;
+
+    while ((c = getopt(argc, argv, "n:P:p:a")) != -1) {
+	switch (c) {
+	case 'n':
+	    megabytes = strtoul(optarg, NULL, 0);
+	    break;
+	case 'P':
+	    nports = atoi(optarg);
+	    break;
+	case 'p':
+	    tcpport = atoi(optarg);
+	    break;
+	case 'a':
+	    pin = 1;
+	    break;
+	default:
+	    goto usage;
+	}
+    }
+    if (argc - optind != 1 || megabytes == 0 || nports < 1 ||
+	nports > MAX_PORTS)
+	goto usage;
+    ser2net = argv[optind];
+    total = megabytes * 1024 * 1024;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (open_ptys())
+	return 1;
+
+    for (i = 0; i < sizeof(shards) / sizeof(shards[0]); i++)
+	rv |= run_bench(shards[i]);
+
+    close_ptys();
+    return rv;
+
+ usage:
+    fprintf(stderr, "Usage: %s [-n megabytes] [-P ports] [-p tcpport] [-a]"
+	    " ser2net-binary\n", argv[0]);
+    return 1;
+}
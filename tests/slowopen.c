@@ -0,0 +1,84 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * An LD_PRELOAD library that makes opening a pty slave block for
+ * SER2NET_SLOWOPEN_MS milliseconds, like a device that is slow to
+ * open.  Ptys open at once even without O_NONBLOCK, so there is no
+ * other way to get this without real hardware.  Used by
+ * startup_bench.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+
+#define SLOW_PREFIX "/dev/pts/"
+
+static void
+slow_open(const char *path)
+{
+    char *ms;
+
+    if (strncmp(path, SLOW_PREFIX, strlen(SLOW_PREFIX)) != 0)
+	return;
+    ms = getenv("SER2NET_SLOWOPEN_MS");
+    if (ms)
+	usleep(strtoul(ms, NULL, 10) * 1000);
+}
+
+int
+open(const char *path, int flags, ...)
+{
+    static int (*real_open)(const char *, int, ...);
+    mode_t mode = 0;
+    va_list ap;
+
+    if (flags & O_CREAT) {
+	va_start(ap, flags);
+	mode = va_arg(ap, int);
+	va_end(ap);
+    }
+    if (!real_open)
+	real_open = dlsym(RTLD_NEXT, "open");
+    slow_open(path);
+    return real_open(path, flags, mode);
+}
+
+int
+open64(const char *path, int flags, ...)
+{
+    static int (*real_open64)(const char *, int, ...);
+    mode_t mode = 0;
+    va_list ap;
+
+    if (flags & O_CREAT) {
+	va_start(ap, flags);
+	mode = va_arg(ap, int);
+	va_end(ap);
+    }
+    if (!real_open64)
+	real_open64 = dlsym(RTLD_NEXT, "open64");
+    slow_open(path);
+    return real_open64(path, flags, mode);
+}
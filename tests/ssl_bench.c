@@ -0,0 +1,204 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * SSL accept benchmark.  Run a number of in-memory SSL handshakes
+ * against a server context, once building a new context for every
+ * connection (the way the SSL acceptor used to work) and once
+ * sharing one context for all connections, and print the handshake
+ * rate for each.
+ *
+ * Usage: ssl_bench [-n count] keyfile certfile CAfile
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "genio/genio_selector.h"
+#include "genio/genio_internal.h"
+#include "genio/genio_base.h"
+
+#ifdef HAVE_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/bio.h>
+
+static char *keyfile, *certfile, *CAfile;
+
+static int
+do_handshake(SSL_CTX *cctx, SSL_CTX *sctx)
+{
+    SSL *client, *server;
+    BIO *cbio, *sbio;
+    int cdone = 0, sdone = 0, rv = -1, i;
+
+    client = SSL_new(cctx);
+    server = SSL_new(sctx);
+    if (!client || !server)
+	goto out;
+
+    if (!BIO_new_bio_pair(&cbio, 0, &sbio, 0))
+	goto out;
+    SSL_set_bio(client, cbio, cbio);
+    SSL_set_bio(server, sbio, sbio);
+    SSL_set_connect_state(client);
+    SSL_set_accept_state(server);
+
+    for (i = 0; i < 100 && (!cdone || !sdone); i++) {
+	if (!cdone) {
+	    rv = SSL_do_handshake(client);
+	    if (rv == 1)
+		cdone = 1;
+	    else if (SSL_get_error(client, rv) != SSL_ERROR_WANT_READ)
+		goto out;
+	}
+	if (!sdone) {
+	    rv = SSL_do_handshake(server);
+	    if (rv == 1)
+		sdone = 1;
+	    else if (SSL_get_error(server, rv) != SSL_ERROR_WANT_READ)
+		goto out;
+	}
+    }
+    rv = (cdone && sdone) ? 0 : -1;
+
+ out:
+    if (client)
+	SSL_free(client);
+    if (server)
+	SSL_free(server);
+    return rv;
+}
+
+static double
+elapsed_since(struct timeval *start)
+{
+    struct timeval end;
+
+    gettimeofday(&end, NULL);
+    return (end.tv_sec - start->tv_sec) +
+	((double) (end.tv_usec - start->tv_usec) / 1000000.0);
+}
+
+static int
+run_bench(struct genio_os_funcs *o, SSL_CTX *cctx, int count, int shared)
+{
+    SSL_CTX *sctx = NULL;
+    struct timeval start;
+    double elapsed;
+    int i, err;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < count; i++) {
+	if (!sctx) {
+	    err = genio_ssl_server_ctx_alloc(o, keyfile, certfile, CAfile,
+					     &sctx);
+	    if (err) {
+		fprintf(stderr, "Unable to set up server ctx: %s\n",
+			strerror(err));
+		return 1;
+	    }
+	}
+	if (do_handshake(cctx, sctx)) {
+	    fprintf(stderr, "Handshake failed\n");
+	    return 1;
+	}
+	if (!shared) {
+	    genio_ssl_server_ctx_free(sctx);
+	    sctx = NULL;
+	}
+    }
+    if (sctx)
+	genio_ssl_server_ctx_free(sctx);
+    elapsed = elapsed_since(&start);
+
+    printf("%s ctx: %d handshakes in %.3fs, %.1f handshakes/s\n",
+	   shared ? "shared" : "per-connection", count, elapsed,
+	   count / elapsed);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct selector_s *sel;
+    struct genio_os_funcs *o;
+    SSL_CTX *cctx;
+    int count = 1000, c, rv;
+
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+	switch (c) {
+	case 'n':
+	    count = atoi(optarg);
+	    break;
+	default:
+	    goto usage;
+	}
+    }
+    if (argc - optind != 3 || count <= 0)
+	goto usage;
+    keyfile = argv[optind];
+    certfile = argv[optind + 1];
+    CAfile = argv[optind + 2];
+
+    rv = sel_alloc_selector_nothread(&sel);
+    if (rv) {
+	fprintf(stderr, "Unable to allocate selector: %s\n", strerror(rv));
+	return 1;
+    }
+
+    o = genio_selector_alloc(sel, 0);
+    if (!o) {
+	fprintf(stderr, "Unable to allocate os funcs\n");
+	return 1;
+    }
+
+    /* The client side is the same for both runs, only set it up once. */
+    SSL_library_init();
+    cctx = SSL_CTX_new(SSLv23_client_method());
+    if (!cctx) {
+	fprintf(stderr, "Unable to allocate client ctx\n");
+	return 1;
+    }
+
+    if (run_bench(o, cctx, count, 0))
+	return 1;
+    if (run_bench(o, cctx, count, 1))
+	return 1;
+
+    SSL_CTX_free(cctx);
+    return 0;
+
+ usage:
+    fprintf(stderr, "Usage: %s [-n count] keyfile certfile CAfile\n",
+	    argv[0]);
+    return 1;
+}
+
+#else /* HAVE_OPENSSL */
+
+int
+main(int argc, char *argv[])
+{
+    fprintf(stderr, "SSL support not compiled in\n");
+    return 1;
+}
+
+#endif /* HAVE_OPENSSL */
@@ -0,0 +1,237 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/*
+ * Startup benchmark.  Start ser2net with a lot of ports (1000 by
+ * default) on ptys, each with a connect back address so its device
+ * is opened when the port is started, and time how long it takes
+ * until the control port comes up, which is after all the ports are
+ * started.  Some ports on devices that don't exist can be added to
+ * see that they fail without holding up the others.
+ *
+ * Ptys open at once, with -d every device open takes the given number
+ * of milliseconds, by preloading the slowopen library into ser2net.
+ * Compare -W 1 and a bigger -W to see what the startup threads buy.
+ * The library is .libs/slowopen.so next to this program, or
+ * SER2NET_SLOWOPEN_LIB if that is set.
+ *
+ * Usage: startup_bench [-P ports] [-b badports] [-p tcpport]
+ *                      [-W startup threads] [-d open delay ms]
+ *                      ser2net-binary
+ *
+ * The control port is the port before tcpport.
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <libgen.h>
+#include <sys/time.h>
+#include "testutil.h"
+
+static char *ser2net;
+static int tcpport = 14000;
+static int nports = 1000;
+static int nbad = 0;
+static char *startup_threads;
+static char *open_delay;
+static char conffile[] = "/tmp/startup_benchXXXXXX";
+static int *pty_masters;
+
+static int
+open_ptys(void)
+{
+    int i;
+
+    pty_masters = malloc(sizeof(*pty_masters) * nports);
+    if (!pty_masters) {
+	fprintf(stderr, "Out of memory\n");
+	return -1;
+    }
+    for (i = 0; i < nports; i++) {
+	pty_masters[i] = open_pty_master(O_RDWR | O_NOCTTY);
+	if (pty_masters[i] == -1)
+	    return -1;
+    }
+    return 0;
+}
+
+/*
+ * The connect back address is never used, it only makes ser2net open
+ * the device when the port starts.
+ */
+static int
+write_config(void)
+{
+    FILE *f;
+    int i;
+
+    f = fopen(conffile, "w");
+    if (!f) {
+	perror(conffile);
+	return -1;
+    }
+    for (i = 0; i < nports; i++)
+	fprintf(f, "%d:raw:0:%s:9600 remaddr=!127.0.0.1,%d\n", tcpport + i,
+		ptsname(pty_masters[i]), tcpport - 2);
+    for (i = 0; i < nbad; i++)
+	fprintf(f, "%d:raw:0:/dev/ser2net_startup%d:9600"
+		" remaddr=!127.0.0.1,%d\n", tcpport + nports + i, i,
+		tcpport - 2);
+    fclose(f);
+
+    return 0;
+}
+
+/* Make ser2net's device opens take open_delay milliseconds. */
+static int
+preload_slowopen(const char *prog)
+{
+    char *lib = getenv("SER2NET_SLOWOPEN_LIB"), *dir, path[4096];
+
+    if (!lib) {
+	dir = strdup(prog);
+	if (!dir) {
+	    fprintf(stderr, "Out of memory\n");
+	    return -1;
+	}
+	snprintf(path, sizeof(path), "%s/.libs/slowopen.so", dirname(dir));
+	free(dir);
+	lib = path;
+    }
+    if (access(lib, R_OK) == -1) {
+	perror(lib);
+	return -1;
+    }
+    /* Only ser2net gets these, it is started after this. */
+    setenv("LD_PRELOAD", lib, 1);
+    setenv("SER2NET_SLOWOPEN_MS", open_delay, 1);
+    return 0;
+}
+
+/* Print the line in buf that has str in it. */
+static void
+print_line(char *buf, const char *str)
+{
+    char *s = strstr(buf, str), *e;
+
+    if (!s)
+	return;
+    e = strchr(s, '\r');
+    if (e)
+	*e = '\0';
+    printf("%s\n", s);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct timeval start, end;
+    char buf[4096], cmd[64], ctlport[20];
+    int c, ctl, rv = 1;
+    pid_t pid;
+
+    while ((c = getopt(argc, argv, "P:b:p:W:d:")) != -1) {
+	switch (c) {
+	case 'P':
+	    nports = atoi(optarg);
+	    break;
+	case 'b':
+	    nbad = atoi(optarg);
+	    break;
+	case 'p':
+	    tcpport = atoi(optarg);
+	    break;
+	case 'W':
+	    startup_threads = optarg;
+	    break;
+	case 'd':
+	    open_delay = optarg;
+	    break;
+	default:
+	    goto usage;
+	}
+    }
+    if (argc - optind != 1 || nports < 1 || nbad < 0)
+	goto usage;
+    ser2net = argv[optind];
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (raise_fd_limit(nports * 3 + nbad + 64))
+	return 1;
+    if (open_ptys())
+	return 1;
+    if (open_delay && preload_slowopen(argv[0]))
+	return 1;
+
+    if (make_conffile(conffile))
+	return 1;
+    if (write_config())
+	goto out_unlink;
+
+    snprintf(ctlport, sizeof(ctlport), "%d", tcpport - 1);
+    gettimeofday(&start, NULL);
+    if (startup_threads)
+	pid = start_ser2net(ser2net, conffile, "-p", ctlport,
+			    "-W", startup_threads, NULL);
+    else
+	pid = start_ser2net(ser2net, conffile, "-p", ctlport, NULL);
+    if (pid == -1)
+	goto out_unlink;
+    /* The control port is started after all the ports are. */
+    ctl = connect_port(tcpport - 1, 60);
+    if (ctl == -1)
+	goto out_kill;
+    gettimeofday(&end, NULL);
+    printf("%d ports, %d bad, %sms opens: startup took %.3fs\n", nports,
+	   nbad, open_delay ? open_delay : "0",
+	   tv_to_secs(&end) - tv_to_secs(&start));
+
+    if (read_to_prompt(ctl, buf, sizeof(buf)))
+	goto out_close;
+    if (control_cmd(ctl, "showreload\r\n", buf, sizeof(buf)))
+	goto out_close;
+    print_line(buf, "time=");
+    snprintf(cmd, sizeof(cmd), "showport %d\r\n", tcpport + nports - 1);
+    if (control_cmd(ctl, cmd, buf, sizeof(buf)))
+	goto out_close;
+    print_line(buf, "started after");
+    rv = 0;
+
+ out_close:
+    close(ctl);
+ out_kill:
+    stop_ser2net(pid);
+ out_unlink:
+    unlink(conffile);
+    return rv;
+
+ usage:
+    fprintf(stderr, "Usage: %s [-P ports] [-b badports] [-p tcpport]"
+	    " [-W startup threads] [-d open delay ms] ser2net-binary\n",
+	    argv[0]);
+    return 1;
+}
@@ -0,0 +1,136 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Telnet encode/decode benchmark.  Run a buffer of data with various
+ * densities of IAC characters through process_telnet_data() and
+ * process_telnet_xmit() and print the throughput of each.
+ *
+ * Usage: telnet_bench [megabytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "utils/telnet.h"
+
+#define BUFSIZE 65536
+
+static double
+elapsed_since(struct timeval *start)
+{
+    struct timeval end;
+
+    gettimeofday(&end, NULL);
+    return (end.tv_sec - start->tv_sec) +
+	((double) (end.tv_usec - start->tv_usec) / 1000000.0);
+}
+
+static void
+tn_output_ready(void *cb_data)
+{
+}
+
+static void
+tn_cmd_handler(void *cb_data, unsigned char cmd)
+{
+}
+
+static const struct telnet_cmd tn_cmds[] =
+{
+    { TELNET_CMD_END_OPTION }
+};
+
+static void
+run_bench(unsigned long total, unsigned int iac_rate)
+{
+    static unsigned char in[BUFSIZE], out[BUFSIZE * 2];
+    static telnet_data_t td;
+    unsigned char *ip;
+    const unsigned char *cip;
+    unsigned long done;
+    unsigned int i, len;
+    struct timeval start;
+    double rx, tx;
+
+    /*
+     * IACs come in pairs so the receive side sees them as data and
+     * doesn't go off processing commands.
+     */
+    for (i = 0; i < BUFSIZE; i++) {
+	if (iac_rate && i + 1 < BUFSIZE && (rand() % iac_rate) == 0) {
+	    in[i++] = TN_IAC;
+	    in[i] = TN_IAC;
+	} else {
+	    in[i] = rand() % TN_IAC;
+	}
+    }
+
+    memset(&td, 0, sizeof(td));
+    telnet_init(&td, NULL, tn_output_ready, tn_cmd_handler, tn_cmds,
+		NULL, 0);
+
+    gettimeofday(&start, NULL);
+    for (done = 0; done < total; done += BUFSIZE) {
+	ip = in;
+	len = BUFSIZE;
+	while (len > 0)
+	    process_telnet_data(out, sizeof(out), &ip, &len, &td);
+    }
+    rx = elapsed_since(&start);
+
+    gettimeofday(&start, NULL);
+    for (done = 0; done < total; done += BUFSIZE) {
+	cip = in;
+	len = BUFSIZE;
+	while (len > 0)
+	    process_telnet_xmit(out, sizeof(out), &cip, &len);
+    }
+    tx = elapsed_since(&start);
+
+    telnet_cleanup(&td);
+
+    if (iac_rate)
+	printf("IAC rate 1/%-5u", iac_rate);
+    else
+	printf("IAC rate none  ");
+    printf(": receive %8.1f MB/s, transmit %8.1f MB/s\n",
+	   total / rx / (1024 * 1024), total / tx / (1024 * 1024));
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned int iac_rates[] = { 0, 1000, 100, 10, 2 };
+    unsigned long megabytes = 256;
+    unsigned int i;
+
+    if (argc > 1)
+	megabytes = strtoul(argv[1], NULL, 0);
+    if (megabytes == 0) {
+	fprintf(stderr, "Usage: %s [megabytes]\n", argv[0]);
+	return 1;
+    }
+
+    for (i = 0; i < sizeof(iac_rates) / sizeof(iac_rates[0]); i++)
+	run_bench(megabytes * 1024 * 1024, iac_rates[i]);
+
+    return 0;
+}
@@ -0,0 +1,335 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Telnet encode/decode test.  Run random data with various densities
+ * of IAC characters through process_telnet_data() and
+ * process_telnet_xmit() and compare the results against the simple
+ * byte at a time versions of the routines below.  The output, the
+ * amount of input consumed, the commands received, and the telnet
+ * command state must all match.
+ *
+ * Usage: telnet_test [iterations [seed]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils/telnet.h"
+
+#define MAX_LOG 4096
+
+struct cmd_log {
+    unsigned char data[MAX_LOG];
+    unsigned int len;
+};
+
+static void
+log_bytes(struct cmd_log *log, unsigned char type,
+	  const unsigned char *data, unsigned int len)
+{
+    if (log->len + len + 2 > MAX_LOG)
+	return;
+    log->data[log->len++] = type;
+    log->data[log->len++] = len;
+    memcpy(log->data + log->len, data, len);
+    log->len += len;
+}
+
+/*
+ * Reference versions, the byte at a time versions of the telnet
+ * routines.  Commands are logged the same way the callbacks below do.
+ */
+static void
+ref_handle_cmd(telnet_data_t *td, struct cmd_log *log)
+{
+    int size = td->telnet_cmd_pos;
+    unsigned char *cmd_str = td->telnet_cmd;
+
+    if (size < 2)
+	return;
+
+    if (cmd_str[1] < TN_SB)
+	log_bytes(log, 'C', cmd_str + 1, 1);
+    else if (cmd_str[1] == TN_SB && cmd_str[2] == TN_OPT_COM_PORT)
+	log_bytes(log, 'S', cmd_str + 2, size - 2);
+    else if (cmd_str[1] != TN_SB && cmd_str[2] == TN_OPT_COM_PORT)
+	log_bytes(log, 'W', cmd_str + 1, 1);
+}
+
+static unsigned int
+ref_process_telnet_data(unsigned char *outdata, unsigned int outlen,
+			unsigned char **r_indata, unsigned int *inlen,
+			telnet_data_t *td, struct cmd_log *log)
+{
+    unsigned int i, j;
+    unsigned char *indata = *r_indata;
+
+    for (i = 0, j = 0; i < *inlen && j < outlen; i++) {
+	if (td->telnet_cmd_pos != 0) {
+	    unsigned char tn_byte;
+
+	    tn_byte = indata[i];
+
+	    if ((td->telnet_cmd_pos == 1) && (tn_byte == TN_IAC)) {
+		outdata[j++] = tn_byte;
+		td->telnet_cmd_pos = 0;
+		continue;
+	    }
+
+	    if (td->telnet_cmd_pos == 1) {
+		td->telnet_cmd[td->telnet_cmd_pos++] = tn_byte;
+		if (tn_byte < TN_SB) {
+		    ref_handle_cmd(td, log);
+		    td->telnet_cmd_pos = 0;
+		}
+	    } else if (td->telnet_cmd_pos == 2) {
+		td->telnet_cmd[td->telnet_cmd_pos++] = tn_byte;
+		if (td->telnet_cmd[1] != TN_SB) {
+		    ref_handle_cmd(td, log);
+		    td->telnet_cmd_pos = 0;
+		}
+	    } else {
+		if (td->suboption_iac) {
+		    if (tn_byte == TN_SE) {
+			td->telnet_cmd_pos--;
+			ref_handle_cmd(td, log);
+			td->telnet_cmd_pos = 0;
+		    } else if (tn_byte != TN_IAC) {
+			td->telnet_cmd_pos--;
+		    }
+		    td->suboption_iac = 0;
+		} else {
+		    if (td->telnet_cmd_pos > MAX_TELNET_CMD_SIZE)
+			td->telnet_cmd_pos = MAX_TELNET_CMD_SIZE;
+
+		    td->telnet_cmd[td->telnet_cmd_pos++] = tn_byte;
+		    if (tn_byte == TN_IAC)
+			td->suboption_iac = 1;
+		}
+	    }
+	} else if (indata[i] == TN_IAC) {
+	    td->telnet_cmd[td->telnet_cmd_pos++] = TN_IAC;
+	    td->suboption_iac = 0;
+	} else {
+	    outdata[j++] = indata[i];
+	}
+    }
+
+    *inlen -= i;
+    *r_indata = indata + i;
+
+    return j;
+}
+
+static unsigned int
+ref_process_telnet_xmit(unsigned char *outdata, unsigned int outlen,
+			const unsigned char **indata, unsigned int *r_inlen)
+{
+    unsigned int i, j = 0;
+    unsigned int inlen = *r_inlen;
+    const unsigned char *ibuf = *indata;
+
+    for (i = 0; i < inlen; i++) {
+	if (ibuf[i] == TN_IAC) {
+	    if (outlen < 2)
+		break;
+	    outdata[j++] = TN_IAC;
+	    outdata[j++] = TN_IAC;
+	    outlen -= 2;
+	} else {
+	    if (outlen < 1)
+		break;
+	    outdata[j++] = ibuf[i];
+	    outlen--;
+	}
+    }
+
+    *indata = ibuf + i;
+    *r_inlen = inlen - i;
+
+    return j;
+}
+
+static struct cmd_log tn_log;
+
+static void
+tn_output_ready(void *cb_data)
+{
+}
+
+static void
+tn_cmd_handler(void *cb_data, unsigned char cmd)
+{
+    log_bytes(&tn_log, 'C', &cmd, 1);
+}
+
+static void
+tn_option_handler(void *cb_data, unsigned char *option, int len)
+{
+    log_bytes(&tn_log, 'S', option, len);
+}
+
+static int
+tn_will_do_handler(void *cb_data, unsigned char cmd)
+{
+    log_bytes(&tn_log, 'W', &cmd, 1);
+    return 0;
+}
+
+static const struct telnet_cmd tn_cmds[] =
+{
+    /*                        I will,  I do,  sent will, sent do */
+    { TN_OPT_COM_PORT,           0,     0,     0,       0,  0, 0,
+      tn_option_handler, tn_will_do_handler },
+    { TELNET_CMD_END_OPTION }
+};
+
+/* Generate data with roughly one IAC per iac_rate bytes. */
+static void
+gen_data(unsigned char *buf, unsigned int len, unsigned int iac_rate)
+{
+    unsigned int i;
+
+    for (i = 0; i < len; i++) {
+	if (iac_rate && (rand() % iac_rate) == 0) {
+	    buf[i] = TN_IAC;
+	} else if (iac_rate && (rand() % iac_rate) == 0) {
+	    /* Sprinkle in command bytes so commands get built. */
+	    buf[i] = TN_SE + rand() % (TN_IAC - TN_SE);
+	} else {
+	    buf[i] = rand() % TN_IAC;
+	    /* Make sure the option we handle gets exercised. */
+	    if (buf[i] < 8)
+		buf[i] = TN_OPT_COM_PORT;
+	}
+    }
+}
+
+static int
+check_data(unsigned char *in, unsigned int len)
+{
+    static telnet_data_t td, ref_td;
+    static struct cmd_log ref_log;
+    unsigned char out[1024], ref_out[1024];
+    unsigned char *ip = in, *rp = in;
+    unsigned int ilen = len, rlen = len, olen, rolen, outlen;
+
+    memset(&td, 0, sizeof(td));
+    memset(&ref_td, 0, sizeof(ref_td));
+    telnet_init(&td, NULL, tn_output_ready, tn_cmd_handler, tn_cmds,
+		NULL, 0);
+    tn_log.len = 0;
+    ref_log.len = 0;
+
+    while (ilen > 0) {
+	outlen = 1 + rand() % sizeof(out);
+	/* Feed the data in random chunks. */
+	if (rand() % 2) {
+	    unsigned int chunk = 1 + rand() % ilen;
+	    unsigned int left = ilen - chunk, rleft = rlen - chunk;
+
+	    ilen = chunk;
+	    rlen = chunk;
+	    olen = process_telnet_data(out, outlen, &ip, &ilen, &td);
+	    rolen = ref_process_telnet_data(ref_out, outlen, &rp, &rlen,
+					    &ref_td, &ref_log);
+	    ilen += left;
+	    rlen += rleft;
+	} else {
+	    olen = process_telnet_data(out, outlen, &ip, &ilen, &td);
+	    rolen = ref_process_telnet_data(ref_out, outlen, &rp, &rlen,
+					    &ref_td, &ref_log);
+	}
+
+	if (olen != rolen || ilen != rlen || ip != rp
+	    || memcmp(out, ref_out, olen) != 0) {
+	    fprintf(stderr, "Receive data mismatch at offset %ld\n",
+		    (long) (rp - in));
+	    return 1;
+	}
+	if (td.telnet_cmd_pos != ref_td.telnet_cmd_pos
+	    || td.suboption_iac != ref_td.suboption_iac
+	    || memcmp(td.telnet_cmd, ref_td.telnet_cmd,
+		      td.telnet_cmd_pos) != 0) {
+	    fprintf(stderr, "Receive state mismatch at offset %ld\n",
+		    (long) (rp - in));
+	    return 1;
+	}
+	if (tn_log.len != ref_log.len
+	    || memcmp(tn_log.data, ref_log.data, tn_log.len) != 0) {
+	    fprintf(stderr, "Receive command mismatch at offset %ld\n",
+		    (long) (rp - in));
+	    return 1;
+	}
+    }
+
+    telnet_cleanup(&td);
+    return 0;
+}
+
+static int
+check_xmit(unsigned char *in, unsigned int len)
+{
+    unsigned char out[1024], ref_out[1024];
+    const unsigned char *ip = in, *rp = in;
+    unsigned int ilen = len, rlen = len, olen, rolen, outlen;
+
+    while (ilen > 0) {
+	outlen = rand() % sizeof(out);
+	olen = process_telnet_xmit(out, outlen, &ip, &ilen);
+	rolen = ref_process_telnet_xmit(ref_out, outlen, &rp, &rlen);
+	if (olen != rolen || ilen != rlen || ip != rp
+	    || memcmp(out, ref_out, olen) != 0) {
+	    fprintf(stderr, "Transmit mismatch at offset %ld\n",
+		    (long) (rp - in));
+	    return 1;
+	}
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static unsigned char buf[8192];
+    unsigned int iac_rates[] = { 0, 1000, 100, 10, 3, 2, 1 };
+    unsigned int iterations = 1000, seed = 1, i, j, len;
+
+    if (argc > 1)
+	iterations = strtoul(argv[1], NULL, 0);
+    if (argc > 2)
+	seed = strtoul(argv[2], NULL, 0);
+    srand(seed);
+
+    for (i = 0; i < iterations; i++) {
+	for (j = 0; j < sizeof(iac_rates) / sizeof(iac_rates[0]); j++) {
+	    len = 1 + rand() % sizeof(buf);
+	    gen_data(buf, len, iac_rates[j]);
+	    if (check_data(buf, len) || check_xmit(buf, len)) {
+		fprintf(stderr, "Failed with IAC rate %u, iteration %u,"
+			" seed %u\n", iac_rates[j], i, seed);
+		return 1;
+	    }
+	}
+    }
+
+    return 0;
+}
@@ -0,0 +1,246 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "testutil.h"
+
+#define MAX_SER2NET_ARGS 16
+
+double
+tv_to_secs(struct timeval *tv)
+{
+    return tv->tv_sec + ((double) tv->tv_usec / 1000000.0);
+}
+
+char *
+find_ser2net(char *arg)
+{
+    char *ser2net = arg;
+
+    if (!ser2net)
+	ser2net = getenv("SER2NET_EXEC");
+    if (!ser2net || access(ser2net, X_OK) == -1) {
+	fprintf(stderr, "No ser2net binary to run\n");
+	return NULL;
+    }
+    return ser2net;
+}
+
+int
+raise_fd_limit(int count)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1) {
+	perror("getrlimit");
+	return -1;
+    }
+    if (rl.rlim_max != RLIM_INFINITY && rl.rlim_max < count) {
+	fprintf(stderr, "Only %lu file descriptors allowed, need %d\n",
+		(unsigned long) rl.rlim_max, count);
+	return -1;
+    }
+    if (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur >= count)
+	return 0;
+    rl.rlim_cur = count;
+    if (setrlimit(RLIMIT_NOFILE, &rl) == -1) {
+	perror("setrlimit");
+	return -1;
+    }
+    return 0;
+}
+
+int
+make_conffile(char *conffile)
+{
+    int fd = mkstemp(conffile);
+
+    if (fd == -1) {
+	perror("mkstemp");
+	return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+int
+open_pty_master(int flags)
+{
+    int fd = posix_openpt(flags);
+
+    if (fd == -1 || grantpt(fd) == -1 || unlockpt(fd) == -1) {
+	perror("pty");
+	if (fd != -1)
+	    close(fd);
+	return -1;
+    }
+    return fd;
+}
+
+int
+open_pty_pair(int *master, int *slave)
+{
+    struct termios termio;
+
+    *master = open_pty_master(O_RDWR | O_NOCTTY);
+    if (*master == -1)
+	return -1;
+    *slave = open(ptsname(*master), O_RDWR | O_NOCTTY);
+    if (*slave == -1) {
+	perror(ptsname(*master));
+	close(*master);
+	return -1;
+    }
+    tcgetattr(*slave, &termio);
+    cfmakeraw(&termio);
+    tcsetattr(*slave, TCSANOW, &termio);
+    fcntl(*master, F_SETFL, O_NONBLOCK);
+    return 0;
+}
+
+pid_t
+start_ser2net(const char *ser2net, const char *conffile, ...)
+{
+    const char *argv[MAX_SER2NET_ARGS + 5];
+    va_list ap;
+    pid_t pid;
+    int i = 0, fd;
+
+    argv[i++] = ser2net;
+    argv[i++] = "-n";
+    argv[i++] = "-c";
+    argv[i++] = conffile;
+    va_start(ap, conffile);
+    while ((argv[i] = va_arg(ap, const char *))) {
+	if (++i > MAX_SER2NET_ARGS + 3) {
+	    va_end(ap);
+	    fprintf(stderr, "Too many ser2net arguments\n");
+	    return -1;
+	}
+    }
+    va_end(ap);
+
+    pid = fork();
+    if (pid == -1) {
+	perror("fork");
+	return -1;
+    }
+    if (pid == 0) {
+	fd = open("/dev/null", O_RDWR);
+	if (fd != -1) {
+	    dup2(fd, 1);
+	    dup2(fd, 2);
+	}
+	execv(ser2net, (char **) argv);
+	_exit(1);
+    }
+
+    return pid;
+}
+
+void
+stop_ser2net(pid_t pid)
+{
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+int
+connect_port(int port, int secs)
+{
+    struct sockaddr_in addr;
+    struct timeval start, now;
+    useconds_t delay = 1000;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    /*
+     * Some callers time how long ser2net takes to come up, so don't
+     * back off too far.
+     */
+    gettimeofday(&start, NULL);
+    for (;;) {
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1) {
+	    perror("socket");
+	    return -1;
+	}
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0)
+	    return fd;
+	close(fd);
+	gettimeofday(&now, NULL);
+	if (tv_to_secs(&now) - tv_to_secs(&start) >= secs)
+	    break;
+	usleep(delay);
+	if (delay < 10000)
+	    delay *= 2;
+    }
+
+    fprintf(stderr, "Unable to connect to ser2net on port %d\n", port);
+    return -1;
+}
+
+int
+read_to_prompt(int fd, char *buf, int size)
+{
+    int len = 0, rv;
+
+    for (;;) {
+	rv = read(fd, buf + len, size - len - 1);
+	if (rv <= 0) {
+	    fprintf(stderr, "Control port closed\n");
+	    return -1;
+	}
+	len += rv;
+	buf[len] = '\0';
+	if (len >= 3 && strcmp(buf + len - 3, "-> ") == 0)
+	    return 0;
+	if (len >= size - 1)
+	    /* Throw away the start, we only need the end. */
+	    len = 0;
+    }
+}
+
+int
+control_cmd(int ctl, const char *cmd, char *buf, int size)
+{
+    if (write(ctl, cmd, strlen(cmd)) != strlen(cmd)) {
+	perror("control write");
+	return -1;
+    }
+    return read_to_prompt(ctl, buf, size);
+}
@@ -0,0 +1,81 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Helpers for the tests and benchmarks that run a ser2net binary.
+ */
+
+#ifndef _SER2NET_TESTUTIL_H
+#define _SER2NET_TESTUTIL_H
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+/* Automake's exit code for a skipped test. */
+#define SKIP 77
+
+double tv_to_secs(struct timeval *tv);
+
+/*
+ * Return the ser2net binary to run, arg if it is not NULL, otherwise
+ * SER2NET_EXEC from the environment.  NULL if there is nothing that
+ * can be run.
+ */
+char *find_ser2net(char *arg);
+
+/* Raise the fd limit to at least count, -1 if it can't be. */
+int raise_fd_limit(int count);
+
+/* Create an empty temporary file from the mkstemp() template. */
+int make_conffile(char *conffile);
+
+/* Open a pty master with the given open() flags, -1 on error. */
+int open_pty_master(int flags);
+
+/*
+ * Open a non-blocking pty master and its slave, set raw.  The slave
+ * is kept open so data written to the master is kept.
+ */
+int open_pty_pair(int *master, int *slave);
+
+/*
+ * Run ser2net -n -c conffile with the NULL-terminated extra
+ * arguments after it, with its output going to /dev/null.
+ */
+pid_t start_ser2net(const char *ser2net, const char *conffile, ...);
+
+/* Kill ser2net and wait for it. */
+void stop_ser2net(pid_t pid);
+
+/*
+ * Connect to the TCP port on localhost, retrying for up to secs
+ * seconds while ser2net comes up.  Returns the fd, or -1.
+ */
+int connect_port(int port, int secs);
+
+/*
+ * Read from the control port until the prompt.  If the reply doesn't
+ * fit, the start is thrown away.
+ */
+int read_to_prompt(int fd, char *buf, int size);
+
+/* Send a control port command and read the reply up to the prompt. */
+int control_cmd(int ctl, const char *cmd, char *buf, int size);
+
+#endif /* _SER2NET_TESTUTIL_H */
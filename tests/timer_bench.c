@@ -0,0 +1,258 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/*
+ * Timer benchmark.  Model the per-port one-second housekeeping timers
+ * with a number of timers that re-arm themselves every second, once
+ * with heap timers and once with wheel timers, and print the CPU time
+ * used.  Then restart every timer a number of times with random
+ * timeouts, the way idle timeouts get pushed back, and print how long
+ * that took for each.
+ *
+ * Usage: timer_bench [-n timers] [-s seconds] [-r restarts]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "utils/selector.h"
+
+static unsigned long fired;
+
+static double
+tv_to_secs(struct timeval *tv)
+{
+    return tv->tv_sec + ((double) tv->tv_usec / 1000000.0);
+}
+
+static double
+cpu_secs(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return tv_to_secs(&usage.ru_utime) + tv_to_secs(&usage.ru_stime);
+}
+
+static double
+wall_secs(void)
+{
+    struct timeval now;
+
+    sel_get_monotonic_time(&now);
+    return tv_to_secs(&now);
+}
+
+static void
+heap_timeout(struct selector_s *sel, sel_timer_t *timer, void *data)
+{
+    struct timeval then;
+
+    fired++;
+    sel_get_monotonic_time(&then);
+    then.tv_sec += 1;
+    sel_start_timer(timer, &then);
+}
+
+static void
+wheel_timeout(struct selector_s *sel, sel_wheel_timer_t *timer, void *data)
+{
+    fired++;
+    sel_start_wheel_timer(timer, 1000);
+}
+
+/* Spread the first timeouts over a second, like ports opened over time. */
+static unsigned int
+first_msecs(int i, int ntimers)
+{
+    return 1 + (unsigned int) ((long) i * 1000 / ntimers);
+}
+
+static int
+run_loop(struct selector_s *sel, int seconds, double *cpu)
+{
+    struct timeval timeout;
+    double start, start_cpu;
+    int rv;
+
+    start = wall_secs();
+    start_cpu = cpu_secs();
+    fired = 0;
+    while (wall_secs() - start < seconds) {
+	timeout.tv_sec = 0;
+	timeout.tv_usec = 100000;
+	rv = sel_select(sel, NULL, 0, NULL, &timeout);
+	if (rv < 0 && errno != EINTR) {
+	    perror("sel_select");
+	    return 1;
+	}
+    }
+    *cpu = cpu_secs() - start_cpu;
+    return 0;
+}
+
+static int
+run_heap(int ntimers, int seconds, int restarts)
+{
+    struct selector_s *sel;
+    sel_timer_t **timers;
+    struct timeval then, now;
+    double cpu, start;
+    int i, r, rv;
+
+    rv = sel_alloc_selector_nothread(&sel);
+    if (rv) {
+	fprintf(stderr, "Unable to allocate selector: %s\n", strerror(rv));
+	return 1;
+    }
+    timers = calloc(ntimers, sizeof(*timers));
+    if (!timers) {
+	fprintf(stderr, "Out of memory\n");
+	return 1;
+    }
+
+    sel_get_monotonic_time(&now);
+    for (i = 0; i < ntimers; i++) {
+	rv = sel_alloc_timer(sel, heap_timeout, NULL, &timers[i]);
+	if (rv) {
+	    fprintf(stderr, "Unable to allocate timer: %s\n", strerror(rv));
+	    return 1;
+	}
+	then = now;
+	then.tv_usec += first_msecs(i, ntimers) * 1000;
+	then.tv_sec += then.tv_usec / 1000000;
+	then.tv_usec %= 1000000;
+	sel_start_timer(timers[i], &then);
+    }
+
+    if (run_loop(sel, seconds, &cpu))
+	return 1;
+    printf("heap : %d timers, %lu timeouts in %ds, cpu %.3fs\n",
+	   ntimers, fired, seconds, cpu);
+
+    srandom(1);
+    start = wall_secs();
+    for (r = 0; r < restarts; r++) {
+	for (i = 0; i < ntimers; i++) {
+	    sel_stop_timer(timers[i]);
+	    sel_get_monotonic_time(&then);
+	    then.tv_sec += 1 + random() % 600;
+	    sel_start_timer(timers[i], &then);
+	}
+    }
+    printf("heap : %lu restarts in %.3fs\n",
+	   (unsigned long) restarts * ntimers, wall_secs() - start);
+
+    for (i = 0; i < ntimers; i++)
+	sel_free_timer(timers[i]);
+    free(timers);
+    sel_free_selector(sel);
+    return 0;
+}
+
+static int
+run_wheel(int ntimers, int seconds, int restarts)
+{
+    struct selector_s *sel;
+    sel_wheel_timer_t **timers;
+    double cpu, start;
+    int i, r, rv;
+
+    rv = sel_alloc_selector_nothread(&sel);
+    if (rv) {
+	fprintf(stderr, "Unable to allocate selector: %s\n", strerror(rv));
+	return 1;
+    }
+    timers = calloc(ntimers, sizeof(*timers));
+    if (!timers) {
+	fprintf(stderr, "Out of memory\n");
+	return 1;
+    }
+
+    for (i = 0; i < ntimers; i++) {
+	rv = sel_alloc_wheel_timer(sel, wheel_timeout, NULL, &timers[i]);
+	if (rv) {
+	    fprintf(stderr, "Unable to allocate timer: %s\n", strerror(rv));
+	    return 1;
+	}
+	sel_start_wheel_timer(timers[i], first_msecs(i, ntimers));
+    }
+
+    if (run_loop(sel, seconds, &cpu))
+	return 1;
+    printf("wheel: %d timers, %lu timeouts in %ds, cpu %.3fs\n",
+	   ntimers, fired, seconds, cpu);
+
+    srandom(1);
+    start = wall_secs();
+    for (r = 0; r < restarts; r++) {
+	for (i = 0; i < ntimers; i++) {
+	    sel_stop_wheel_timer(timers[i]);
+	    sel_start_wheel_timer(timers[i], (1 + random() % 600) * 1000);
+	}
+    }
+    printf("wheel: %lu restarts in %.3fs\n",
+	   (unsigned long) restarts * ntimers, wall_secs() - start);
+
+    for (i = 0; i < ntimers; i++)
+	sel_free_wheel_timer(timers[i]);
+    free(timers);
+    sel_free_selector(sel);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int ntimers = 10000, seconds = 3, restarts = 100, c;
+
+    while ((c = getopt(argc, argv, "n:s:r:")) != -1) {
+	switch (c) {
+	case 'n':
+	    ntimers = atoi(optarg);
+	    break;
+	case 's':
+	    seconds = atoi(optarg);
+	    break;
+	case 'r':
+	    restarts = atoi(optarg);
+	    break;
+	default:
+	    goto usage;
+	}
+    }
+    if (optind != argc || ntimers <= 0 || seconds <= 0 || restarts < 0)
+	goto usage;
+
+    if (run_heap(ntimers, seconds, restarts))
+	return 1;
+    if (run_wheel(ntimers, seconds, restarts))
+	return 1;
+    return 0;
+
+ usage:
+    fprintf(stderr, "Usage: %s [-n timers] [-s seconds] [-r restarts]\n",
+	    argv[0]);
+    return 1;
+}
@@ -0,0 +1,683 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Trace file handling.  Tracing appends records to a ring for each
+ * trace file, the hexdump and timestamp formatting and the writes to
+ * the file are done later by a writer thread (or right away if
+ * threads are not available), in as big a batch as is available.
+ *
+ * Capture files are different, they are mmap-ed and binary records
+ * are put straight into them, see utils/capture.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ctype.h>
+#include <time.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "utils/locking.h"
+#include "utils/capture.h"
+#include "trace.h"
+
+/* Size of the ring for each trace file. */
+#define TRACE_RING_SIZE		65536
+
+/*
+ * Data bigger than this is split into multiple records.  This must
+ * be a multiple of 8 so hexdump lines are not split.
+ */
+#define TRACE_MAX_REC		4096
+
+/* Size of the buffer the output is formatted into for writing. */
+#define TRACE_OUT_SIZE		65536
+
+/* The maximum size of one formatted hexdump line. */
+#define TRACE_MAX_LINE		128
+
+enum trace_rec_type {
+    TRACE_REC_RAW,
+    TRACE_REC_HEXDUMP,
+    TRACE_REC_TEXT
+};
+
+/* Each record in the ring is this followed by len bytes of data. */
+struct trace_rec {
+    time_t time;
+    const char *prefix;
+    unsigned int len;
+    unsigned char type;
+    bool timestamp;
+};
+
+struct trace_file {
+    struct trace_file *next;
+
+    DEFINE_LOCK(, lock)
+
+    int fd;
+    char *portname;
+
+    /*
+     * head counts the bytes put into the ring and tail the bytes
+     * taken out by the writer.  These are free-running, the position
+     * in the ring is the counter modulo the ring size.
+     */
+    unsigned long head;
+    unsigned long tail;
+
+    /* Bytes of trace data thrown away because the ring was full. */
+    unsigned long dropped;
+
+    /* The file has been closed, free it when the ring is empty. */
+    bool closing;
+
+    /* Writing the file failed, nothing more will be written. */
+    bool failed;
+
+    unsigned char *ring;
+
+    /* The mapped file if this is a capture file, NULL if not. */
+    struct capture_header *cap;
+    size_t cap_size;
+};
+
+#ifdef USE_PTHREADS
+/* Protects the variables below. */
+DEFINE_LOCK_INIT(static, trace_lock)
+static pthread_cond_t trace_cond = PTHREAD_COND_INITIALIZER;
+static struct trace_file *trace_files;
+static pthread_t trace_thread_id;
+static bool trace_thread_running;
+static bool trace_work;
+static bool trace_stop;
+#endif
+
+static void
+ring_put(struct trace_file *tf, const void *data, unsigned int len)
+{
+    unsigned int pos = tf->head % TRACE_RING_SIZE;
+    unsigned int left = TRACE_RING_SIZE - pos;
+
+    if (len > left) {
+	memcpy(tf->ring + pos, data, left);
+	memcpy(tf->ring, ((const unsigned char *) data) + left, len - left);
+    } else {
+	memcpy(tf->ring + pos, data, len);
+    }
+    tf->head += len;
+}
+
+static void
+ring_get(struct trace_file *tf, unsigned long tail, void *data,
+	 unsigned int len)
+{
+    unsigned int pos = tail % TRACE_RING_SIZE;
+    unsigned int left = TRACE_RING_SIZE - pos;
+
+    if (len > left) {
+	memcpy(data, tf->ring + pos, left);
+	memcpy(((unsigned char *) data) + left, tf->ring, len - left);
+    } else {
+	memcpy(data, tf->ring + pos, len);
+    }
+}
+
+static void
+trace_out(struct trace_file *tf, const char *buf, unsigned int len)
+{
+    ssize_t rv;
+
+    /* Only the writer sets failed, no need to lock to check it. */
+    if (tf->failed)
+	return;
+
+    while (len > 0) {
+	rv = write(tf->fd, buf, len);
+	if (rv == -1) {
+	    char errbuf[128];
+	    int err = errno;
+
+	    if (err == EINTR)
+		continue;
+
+	    /* Fatal error writing to the file, log it and stop. */
+	    if (strerror_r(err, errbuf, sizeof(errbuf)) == -1)
+		syslog(LOG_ERR, "Unable write to trace file on port %s: %d",
+		       tf->portname, err);
+	    else
+		syslog(LOG_ERR, "Unable to write to trace file on port %s: %s",
+		       tf->portname, errbuf);
+
+	    LOCK(tf->lock);
+	    tf->failed = true;
+	    UNLOCK(tf->lock);
+	    return;
+	}
+
+	/* Handle a partial write */
+	len -= rv;
+	buf += rv;
+    }
+}
+
+/* Make sure there are len bytes available in out, returns the position. */
+static unsigned int
+out_room(struct trace_file *tf, char *out, unsigned int pos, unsigned int len)
+{
+    if (pos + len > TRACE_OUT_SIZE) {
+	trace_out(tf, out, pos);
+	pos = 0;
+    }
+    return pos;
+}
+
+static unsigned int
+format_timestamp(char *out, time_t time)
+{
+    struct tm tm;
+
+    return strftime(out, TRACE_MAX_LINE / 2, "%Y/%m/%d %H:%M:%S ",
+		    localtime_r(&time, &tm));
+}
+
+static unsigned int
+format_rec(struct trace_file *tf, char *out, unsigned int pos,
+	   struct trace_rec *rec, const unsigned char *data)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned int q, w, col, plen;
+
+    switch (rec->type) {
+    case TRACE_REC_RAW:
+	pos = out_room(tf, out, pos, rec->len);
+	memcpy(out + pos, data, rec->len);
+	pos += rec->len;
+	break;
+
+    case TRACE_REC_TEXT:
+	pos = out_room(tf, out, pos, rec->len + TRACE_MAX_LINE);
+	pos += format_timestamp(out + pos, rec->time);
+	memcpy(out + pos, data, rec->len);
+	pos += rec->len;
+	break;
+
+    case TRACE_REC_HEXDUMP:
+	plen = strlen(rec->prefix);
+	for (q = 0; q < rec->len; q += 8) {
+	    col = rec->len - q;
+	    if (col > 8)
+		col = 8;
+
+	    pos = out_room(tf, out, pos, TRACE_MAX_LINE + plen);
+	    if (rec->timestamp)
+		pos += format_timestamp(out + pos, rec->time);
+	    memcpy(out + pos, rec->prefix, plen);
+	    pos += plen;
+	    out[pos++] = ' ';
+	    for (w = 0; w < 8; w++) {
+		if (w < col) {
+		    out[pos++] = hex[data[q + w] >> 4];
+		    out[pos++] = hex[data[q + w] & 0xf];
+		} else {
+		    out[pos++] = ' ';
+		    out[pos++] = ' ';
+		}
+		out[pos++] = ' ';
+	    }
+	    out[pos++] = ' ';
+	    out[pos++] = '|';
+	    for (w = 0; w < col; w++)
+		out[pos++] = isprint(data[q + w]) ? data[q + w] : '.';
+	    out[pos++] = '|';
+	    out[pos++] = '\n';
+	}
+	break;
+    }
+
+    return pos;
+}
+
+static void
+trace_file_free(struct trace_file *tf)
+{
+    if (tf->dropped)
+	syslog(LOG_WARNING, "Dropped %lu bytes of trace data on port %s",
+	       tf->dropped, tf->portname);
+    if (tf->cap)
+	munmap(tf->cap, tf->cap_size);
+    close(tf->fd);
+    FREE_LOCK(tf->lock);
+    free(tf->portname);
+    if (tf->ring)
+	free(tf->ring);
+    free(tf);
+}
+
+/*
+ * Write out everything in the ring.  more is set if data was added
+ * while this was running.  Returns true if the file was closed and
+ * is done, meaning it should be freed.
+ */
+static bool
+trace_file_flush(struct trace_file *tf, bool *more)
+{
+    static char out[TRACE_OUT_SIZE];
+    unsigned char data[TRACE_MAX_REC];
+    struct trace_rec rec;
+    unsigned long head, tail;
+    unsigned int pos = 0;
+    bool closing, failed;
+
+    LOCK(tf->lock);
+    head = tf->head;
+    tail = tf->tail;
+    closing = tf->closing;
+    failed = tf->failed;
+    UNLOCK(tf->lock);
+
+    if (failed)
+	/* Just throw the data away. */
+	tail = head;
+
+    while (tail != head) {
+	ring_get(tf, tail, &rec, sizeof(rec));
+	tail += sizeof(rec);
+	ring_get(tf, tail, data, rec.len);
+	tail += rec.len;
+	pos = format_rec(tf, out, pos, &rec, data);
+    }
+    if (pos > 0)
+	trace_out(tf, out, pos);
+
+    LOCK(tf->lock);
+    tf->tail = tail;
+    *more = tf->head != tail;
+    failed = tf->failed;
+    UNLOCK(tf->lock);
+
+    return closing && (!*more || failed);
+}
+
+#ifdef USE_PTHREADS
+static void
+trace_unlink(struct trace_file *tf)
+{
+    struct trace_file **tfp = &trace_files;
+
+    while (*tfp != tf)
+	tfp = &(*tfp)->next;
+    *tfp = tf->next;
+}
+
+static void *
+trace_thread(void *dummy)
+{
+    struct trace_file *tf, *next;
+    bool more, done;
+
+    LOCK(trace_lock);
+    for (;;) {
+	while (!trace_work && !trace_stop)
+	    pthread_cond_wait(&trace_cond, &trace_lock);
+	if (!trace_work)
+	    break;
+	trace_work = false;
+
+	for (tf = trace_files; tf; tf = next) {
+	    /*
+	     * Only this thread frees trace files, so tf stays good
+	     * while the lock is released to do the writes.
+	     */
+	    UNLOCK(trace_lock);
+	    done = trace_file_flush(tf, &more);
+	    LOCK(trace_lock);
+	    next = tf->next;
+	    if (done) {
+		trace_unlink(tf);
+		trace_file_free(tf);
+	    } else if (more) {
+		trace_work = true;
+	    }
+	}
+    }
+
+    /* Shutting down, write out whatever is left. */
+    while (trace_files) {
+	tf = trace_files;
+	trace_files = tf->next;
+	trace_file_flush(tf, &more);
+	trace_file_free(tf);
+    }
+    UNLOCK(trace_lock);
+
+    return NULL;
+}
+#endif
+
+/* Data has been added to an empty ring or the file closed. */
+static void
+trace_kick(struct trace_file *tf)
+{
+#ifdef USE_PTHREADS
+    LOCK(trace_lock);
+    trace_work = true;
+    pthread_cond_signal(&trace_cond);
+    UNLOCK(trace_lock);
+#else
+    bool more;
+
+    if (trace_file_flush(tf, &more))
+	trace_file_free(tf);
+#endif
+}
+
+static void
+trace_add(struct trace_file *tf, struct trace_rec *rec,
+	  const unsigned char *data)
+{
+    bool was_empty;
+
+    LOCK(tf->lock);
+    if (tf->failed) {
+	UNLOCK(tf->lock);
+	return;
+    }
+    if (TRACE_RING_SIZE - (tf->head - tf->tail) < sizeof(*rec) + rec->len) {
+	tf->dropped += rec->len;
+	UNLOCK(tf->lock);
+	return;
+    }
+    was_empty = tf->head == tf->tail;
+    ring_put(tf, rec, sizeof(*rec));
+    ring_put(tf, data, rec->len);
+    UNLOCK(tf->lock);
+
+    if (was_empty)
+	trace_kick(tf);
+}
+
+void
+trace_file_data(struct trace_file *tf, bool hexdump, bool timestamp,
+		const char *prefix, const unsigned char *buf,
+		unsigned int len)
+{
+    struct trace_rec rec;
+
+    rec.type = hexdump ? TRACE_REC_HEXDUMP : TRACE_REC_RAW;
+    rec.timestamp = timestamp;
+    rec.prefix = prefix;
+    rec.time = 0;
+    if (hexdump && timestamp)
+	rec.time = time(NULL);
+
+    while (len > 0) {
+	rec.len = len;
+	if (rec.len > TRACE_MAX_REC)
+	    rec.len = TRACE_MAX_REC;
+	trace_add(tf, &rec, buf);
+	buf += rec.len;
+	len -= rec.len;
+    }
+}
+
+static uint64_t
+clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void
+trace_file_capture(struct trace_file *tf, bool from_net, unsigned int netcon,
+		   const unsigned char *buf, unsigned int len)
+{
+    uint64_t now = clock_ns(CLOCK_MONOTONIC);
+    unsigned int count;
+
+    LOCK(tf->lock);
+    while (len > 0) {
+	count = len;
+	if (count > CAPTURE_MAX_DATA)
+	    count = CAPTURE_MAX_DATA;
+	capture_add(tf->cap, from_net ? CAPTURE_NET : CAPTURE_TERM, netcon,
+		    now, buf, count);
+	buf += count;
+	len -= count;
+    }
+    UNLOCK(tf->lock);
+}
+
+void
+trace_file_text(struct trace_file *tf, const char *text, unsigned int len)
+{
+    struct trace_rec rec;
+
+    if (tf->cap) {
+	if (len > CAPTURE_MAX_DATA)
+	    len = CAPTURE_MAX_DATA;
+	LOCK(tf->lock);
+	capture_add(tf->cap, CAPTURE_TEXT, 0, clock_ns(CLOCK_MONOTONIC),
+		    text, len);
+	UNLOCK(tf->lock);
+	return;
+    }
+
+    if (len > TRACE_MAX_REC)
+	len = TRACE_MAX_REC;
+
+    rec.type = TRACE_REC_TEXT;
+    rec.timestamp = true;
+    rec.prefix = NULL;
+    rec.time = time(NULL);
+    rec.len = len;
+    trace_add(tf, &rec, (const unsigned char *) text);
+}
+
+unsigned long
+trace_file_dropped(struct trace_file *tf)
+{
+    unsigned long dropped;
+
+    LOCK(tf->lock);
+    dropped = tf->dropped;
+    UNLOCK(tf->lock);
+
+    return dropped;
+}
+
+int
+trace_file_open(const char *filename, const char *portname,
+		struct trace_file **rtf)
+{
+    struct trace_file *tf;
+    int rv;
+
+    tf = malloc(sizeof(*tf));
+    if (!tf)
+	return ENOMEM;
+    memset(tf, 0, sizeof(*tf));
+
+    tf->portname = strdup(portname);
+    tf->ring = malloc(TRACE_RING_SIZE);
+    if (!tf->portname || !tf->ring) {
+	rv = ENOMEM;
+	goto out_err;
+    }
+
+    tf->fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (tf->fd == -1) {
+	rv = errno;
+	goto out_err;
+    }
+
+    INIT_LOCK(tf->lock);
+
+#ifdef USE_PTHREADS
+    LOCK(trace_lock);
+    if (!trace_thread_running) {
+	rv = pthread_create(&trace_thread_id, NULL, trace_thread, NULL);
+	if (rv) {
+	    UNLOCK(trace_lock);
+	    FREE_LOCK(tf->lock);
+	    close(tf->fd);
+	    goto out_err;
+	}
+	trace_thread_running = true;
+    }
+    tf->next = trace_files;
+    trace_files = tf;
+    UNLOCK(trace_lock);
+#endif
+
+    *rtf = tf;
+    return 0;
+
+ out_err:
+    if (tf->portname)
+	free(tf->portname);
+    if (tf->ring)
+	free(tf->ring);
+    free(tf);
+    return rv;
+}
+
+int
+trace_file_open_capture(const char *filename, const char *portname,
+			unsigned long size, struct trace_file **rtf)
+{
+    struct trace_file *tf;
+    struct stat st;
+    uint64_t clocks[2];
+    int rv;
+
+    if (size < CAPTURE_MIN_SIZE)
+	size = CAPTURE_MIN_SIZE;
+
+    tf = malloc(sizeof(*tf));
+    if (!tf)
+	return ENOMEM;
+    memset(tf, 0, sizeof(*tf));
+    tf->cap_size = size;
+
+    tf->portname = strdup(portname);
+    if (!tf->portname) {
+	rv = ENOMEM;
+	goto out_err;
+    }
+
+    tf->fd = open(filename, O_RDWR | O_CREAT, 0600);
+    if (tf->fd == -1) {
+	rv = errno;
+	goto out_err;
+    }
+
+    if (fstat(tf->fd, &st) == -1) {
+	rv = errno;
+	goto out_err_close;
+    }
+    if (st.st_size != size && ftruncate(tf->fd, size) == -1) {
+	rv = errno;
+	goto out_err_close;
+    }
+
+    /*
+     * Allocate all the space now, running out of space on the disk
+     * while writing to the mapping would result in a SIGBUS.
+     */
+    rv = posix_fallocate(tf->fd, 0, size);
+    if (rv)
+	goto out_err_close;
+
+    tf->cap = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, tf->fd, 0);
+    if (tf->cap == MAP_FAILED) {
+	tf->cap = NULL;
+	rv = errno;
+	goto out_err_close;
+    }
+
+    /* Keep the old records if the file is usable. */
+    if (st.st_size != size || !capture_valid(tf->cap, size))
+	capture_init(tf->cap, size, portname);
+
+    clocks[0] = clock_ns(CLOCK_REALTIME);
+    clocks[1] = clock_ns(CLOCK_MONOTONIC);
+    tf->cap->realtime_base = clocks[0];
+    tf->cap->monotonic_base = clocks[1];
+    capture_add(tf->cap, CAPTURE_CLOCK, 0, clocks[1], clocks, sizeof(clocks));
+
+    INIT_LOCK(tf->lock);
+
+    *rtf = tf;
+    return 0;
+
+ out_err_close:
+    close(tf->fd);
+ out_err:
+    if (tf->portname)
+	free(tf->portname);
+    free(tf);
+    return rv;
+}
+
+void
+trace_file_close(struct trace_file *tf)
+{
+    if (tf->cap) {
+	/* Nothing is buffered, just get rid of it. */
+	trace_file_free(tf);
+	return;
+    }
+
+    LOCK(tf->lock);
+    tf->closing = true;
+    UNLOCK(tf->lock);
+
+    trace_kick(tf);
+}
+
+void
+trace_shutdown(void)
+{
+#ifdef USE_PTHREADS
+    LOCK(trace_lock);
+    if (!trace_thread_running) {
+	UNLOCK(trace_lock);
+	return;
+    }
+    trace_stop = true;
+    pthread_cond_signal(&trace_cond);
+    UNLOCK(trace_lock);
+
+    pthread_join(trace_thread_id, NULL);
+
+    trace_thread_running = false;
+    trace_stop = false;
+#endif
+}
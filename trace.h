@@ -0,0 +1,84 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+
+/*
+ * A trace file.  Trace data is appended to an in-memory ring and
+ * written to the file later, by a writer thread if threads are
+ * available, so tracing never blocks the data path on file I/O.  If
+ * the ring is full the data is dropped and counted.
+ */
+struct trace_file;
+
+/*
+ * Open the given file for tracing, appending to it.  The port name
+ * is used for logging.  Returns an errno on failure.
+ */
+int trace_file_open(const char *filename, const char *portname,
+		    struct trace_file **rtf);
+
+/*
+ * Open the given file as a binary capture file of the given size.
+ * The file is preallocated and mapped, and data is written into it
+ * directly, overwriting the oldest data when full.  If the file is
+ * already a capture file of the same size, the data in it is kept.
+ * Returns an errno on failure.
+ */
+int trace_file_open_capture(const char *filename, const char *portname,
+			    unsigned long size, struct trace_file **rtf);
+
+/*
+ * Write out anything left and close the file.  The close may be done
+ * later by the writer thread, tf may not be used after this.
+ */
+void trace_file_close(struct trace_file *tf);
+
+/*
+ * Trace some data.  If hexdump is set, the data is written as a
+ * hexdump with prefix at the beginning of each line (and a timestamp
+ * before that if timestamp is set), otherwise the data is written
+ * as-is.  prefix must be a static string.
+ */
+void trace_file_data(struct trace_file *tf, bool hexdump, bool timestamp,
+		     const char *prefix, const unsigned char *buf,
+		     unsigned int len);
+
+/*
+ * Put some data into a capture file.  netcon is the network
+ * connection number the data came from, 0 for data from the device.
+ */
+void trace_file_capture(struct trace_file *tf, bool from_net,
+			unsigned int netcon, const unsigned char *buf,
+			unsigned int len);
+
+/* Trace a line of text, preceeded by a timestamp. */
+void trace_file_text(struct trace_file *tf, const char *text,
+		     unsigned int len);
+
+/* The number of bytes dropped because the ring was full. */
+unsigned long trace_file_dropped(struct trace_file *tf);
+
+/* Write out everything pending and stop the writer thread. */
+void trace_shutdown(void);
+
+#endif /* TRACE_H */
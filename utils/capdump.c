@@ -0,0 +1,233 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Decode a ser2net binary capture file.  By default the records are
+ * printed in the same hexdump format ser2net uses for hexdump trace
+ * files, with timestamps.  With -p a pcap file is written instead,
+ * using LINKTYPE_USER0.  Each packet starts with a 4 byte header, the
+ * record type (0 for data from the device, 1 for data from the
+ * network, 2 for open/close messages), a zero byte, and the network
+ * connection number as a 16-bit big-endian value, followed by the
+ * data.
+ *
+ * Usage: ser2net-capdump [-p] capfile
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "capture.h"
+
+#define PCAP_MAGIC_NSEC		0xa1b23c4d
+#define LINKTYPE_USER0		147
+
+static void
+hexdump_rec(struct capture_rec *rec, uint64_t realtime)
+{
+    const unsigned char *data = (const unsigned char *) (rec + 1);
+    time_t secs = realtime / 1000000000;
+    char stamp[64];
+    struct tm tm;
+    const char *prefix;
+    unsigned int q, w, col;
+
+    strftime(stamp, sizeof(stamp), "%Y/%m/%d %H:%M:%S ",
+	     localtime_r(&secs, &tm));
+
+    if (rec->type == CAPTURE_TEXT) {
+	printf("%s%.*s", stamp, (int) rec->len, (const char *) data);
+	return;
+    }
+
+    prefix = rec->type == CAPTURE_NET ? "tcp " : "term";
+    for (q = 0; q < rec->len; q += 8) {
+	col = rec->len - q;
+	if (col > 8)
+	    col = 8;
+	printf("%s%s ", stamp, prefix);
+	for (w = 0; w < 8; w++) {
+	    if (w < col)
+		printf("%02x ", data[q + w]);
+	    else
+		printf("   ");
+	}
+	printf(" |");
+	for (w = 0; w < col; w++)
+	    putchar(isprint(data[q + w]) ? data[q + w] : '.');
+	printf("|\n");
+    }
+}
+
+static void
+pcap_header(void)
+{
+    uint32_t hdr[6];
+
+    hdr[0] = PCAP_MAGIC_NSEC;
+    hdr[1] = 2 | (4 << 16); /* Version 2.4 */
+    hdr[2] = 0; /* Timezone */
+    hdr[3] = 0; /* Timestamp accuracy */
+    hdr[4] = CAPTURE_MAX_DATA + 4;
+    hdr[5] = LINKTYPE_USER0;
+    fwrite(hdr, sizeof(hdr), 1, stdout);
+}
+
+static void
+pcap_rec(struct capture_rec *rec, uint64_t realtime)
+{
+    uint32_t hdr[4];
+    unsigned char phdr[4];
+
+    hdr[0] = realtime / 1000000000;
+    hdr[1] = realtime % 1000000000;
+    hdr[2] = rec->len + sizeof(phdr);
+    hdr[3] = rec->len + sizeof(phdr);
+    phdr[0] = rec->type;
+    phdr[1] = 0;
+    phdr[2] = rec->netcon >> 8;
+    phdr[3] = rec->netcon & 0xff;
+    fwrite(hdr, sizeof(hdr), 1, stdout);
+    fwrite(phdr, sizeof(phdr), 1, stdout);
+    fwrite(rec + 1, rec->len, 1, stdout);
+}
+
+static void *
+read_file(const char *filename, uint64_t *size)
+{
+    struct stat st;
+    unsigned char *buf;
+    ssize_t rv;
+    size_t pos = 0;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+	perror(filename);
+	return NULL;
+    }
+    if (fstat(fd, &st) == -1) {
+	perror(filename);
+	goto out_err;
+    }
+    if (st.st_size < CAPTURE_MIN_SIZE) {
+	fprintf(stderr, "%s: Too small to be a capture file\n", filename);
+	goto out_err;
+    }
+
+    /* Read a copy, ser2net may be writing the file. */
+    buf = malloc(st.st_size);
+    if (!buf) {
+	fprintf(stderr, "Out of memory\n");
+	goto out_err;
+    }
+    while (pos < st.st_size) {
+	rv = read(fd, buf + pos, st.st_size - pos);
+	if (rv <= 0) {
+	    perror(filename);
+	    free(buf);
+	    goto out_err;
+	}
+	pos += rv;
+    }
+    close(fd);
+
+    *size = st.st_size;
+    return buf;
+
+ out_err:
+    close(fd);
+    return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct capture_header *hdr;
+    struct capture_rec *rec;
+    uint64_t size, pos, realtime_base, monotonic_base, *clocks;
+    int c, pcap = 0;
+
+    while ((c = getopt(argc, argv, "p")) != -1) {
+	switch (c) {
+	case 'p':
+	    pcap = 1;
+	    break;
+	default:
+	    goto usage;
+	}
+    }
+    if (argc - optind != 1)
+	goto usage;
+
+    hdr = read_file(argv[optind], &size);
+    if (!hdr)
+	return 1;
+    if (!capture_valid(hdr, size)) {
+	fprintf(stderr, "%s: Not a valid capture file\n", argv[optind]);
+	return 1;
+    }
+
+    if (pcap)
+	pcap_header();
+
+    realtime_base = hdr->realtime_base;
+    monotonic_base = hdr->monotonic_base;
+    for (pos = hdr->tail; pos != hdr->head; pos = capture_next(hdr, pos)) {
+	uint64_t realtime;
+
+	if (pos > hdr->head) {
+	    fprintf(stderr, "%s: Corrupt record chain\n", argv[optind]);
+	    return 1;
+	}
+
+	rec = capture_rec(hdr, pos);
+	if (!rec)
+	    continue;
+
+	if (rec->type == CAPTURE_CLOCK) {
+	    clocks = (uint64_t *) (rec + 1);
+	    realtime_base = clocks[0];
+	    monotonic_base = clocks[1];
+	    continue;
+	}
+
+	realtime = realtime_base + (int64_t) (rec->time - monotonic_base);
+	if (pcap)
+	    pcap_rec(rec, realtime);
+	else
+	    hexdump_rec(rec, realtime);
+    }
+
+    if (hdr->overwritten && !pcap)
+	fprintf(stderr, "%llu older records were overwritten\n",
+		(unsigned long long) hdr->overwritten);
+
+    free(hdr);
+    return 0;
+
+ usage:
+    fprintf(stderr, "Usage: %s [-p] capfile\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,142 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+#include "capture.h"
+
+static unsigned char *
+capture_data(struct capture_header *hdr)
+{
+    return ((unsigned char *) hdr) + hdr->header_size;
+}
+
+void
+capture_init(struct capture_header *hdr, uint64_t file_size,
+	     const char *portname)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = CAPTURE_MAGIC;
+    hdr->version = CAPTURE_VERSION;
+    hdr->header_size = CAPTURE_ALIGN(sizeof(*hdr));
+    hdr->data_size = (file_size - hdr->header_size) & ~7ULL;
+    strncpy(hdr->portname, portname, sizeof(hdr->portname) - 1);
+}
+
+bool
+capture_valid(struct capture_header *hdr, uint64_t file_size)
+{
+    struct capture_rec *rec;
+    uint64_t pos, left;
+
+    if (file_size < CAPTURE_MIN_SIZE)
+	return false;
+    if (hdr->magic != CAPTURE_MAGIC || hdr->version != CAPTURE_VERSION)
+	return false;
+    if (hdr->header_size != CAPTURE_ALIGN(sizeof(*hdr)))
+	return false;
+    if (hdr->data_size != ((file_size - hdr->header_size) & ~7ULL))
+	return false;
+    if (hdr->head < hdr->tail || hdr->head - hdr->tail > hdr->data_size)
+	return false;
+    if ((hdr->head | hdr->tail) & 7)
+	return false;
+
+    /*
+     * The record lengths come from the file, make sure every record
+     * fits in the ring and the chain ends exactly at head.
+     */
+    for (pos = hdr->tail; pos != hdr->head; pos = capture_next(hdr, pos)) {
+	if (pos > hdr->head)
+	    return false;
+	rec = capture_rec(hdr, pos);
+	if (!rec)
+	    continue;
+	left = hdr->data_size - (pos % hdr->data_size);
+	if (rec->len > CAPTURE_MAX_DATA ||
+		left < sizeof(*rec) + CAPTURE_ALIGN(rec->len))
+	    return false;
+	if (rec->type == CAPTURE_CLOCK && rec->len != 2 * sizeof(uint64_t))
+	    return false;
+    }
+    return true;
+}
+
+struct capture_rec *
+capture_rec(struct capture_header *hdr, uint64_t pos)
+{
+    uint64_t offset = pos % hdr->data_size;
+    struct capture_rec *rec;
+
+    if (hdr->data_size - offset < sizeof(*rec))
+	return NULL;
+    rec = (struct capture_rec *) (capture_data(hdr) + offset);
+    if (rec->type == CAPTURE_WRAP)
+	return NULL;
+    return rec;
+}
+
+uint64_t
+capture_next(struct capture_header *hdr, uint64_t pos)
+{
+    struct capture_rec *rec = capture_rec(hdr, pos);
+
+    if (!rec)
+	/* Skip to the start of the ring. */
+	return pos + hdr->data_size - (pos % hdr->data_size);
+    return pos + sizeof(*rec) + CAPTURE_ALIGN(rec->len);
+}
+
+void
+capture_add(struct capture_header *hdr, uint16_t type, uint16_t netcon,
+	    uint64_t time, const void *data, uint32_t len)
+{
+    uint64_t pos = hdr->head, end, left;
+    struct capture_rec *rec;
+
+    left = hdr->data_size - (pos % hdr->data_size);
+    if (left < sizeof(*rec) + CAPTURE_ALIGN(len))
+	/* Won't fit before the end of the ring, put it at the start. */
+	pos += left;
+    end = pos + sizeof(*rec) + CAPTURE_ALIGN(len);
+
+    /* Throw away old records to make room. */
+    while (end - hdr->tail > hdr->data_size && hdr->tail != hdr->head) {
+	if (capture_rec(hdr, hdr->tail))
+	    hdr->overwritten++;
+	hdr->tail = capture_next(hdr, hdr->tail);
+    }
+    if (hdr->tail == hdr->head)
+	/* Everything is gone, start the ring with this record. */
+	hdr->tail = pos;
+
+    if (pos != hdr->head && left >= sizeof(*rec)) {
+	rec = (struct capture_rec *) (capture_data(hdr) +
+				      (hdr->head % hdr->data_size));
+	rec->type = CAPTURE_WRAP;
+    }
+
+    rec = (struct capture_rec *) (capture_data(hdr) + (pos % hdr->data_size));
+    rec->time = time;
+    rec->len = len;
+    rec->type = type;
+    rec->netcon = netcon;
+    memcpy(rec + 1, data, len);
+
+    hdr->head = end;
+}
@@ -0,0 +1,116 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Binary capture files.  A capture file is a fixed size file holding
+ * a header followed by a ring of records.  Each record is a
+ * capture_rec followed by the data, padded out to 8 bytes.  When the
+ * ring fills up the oldest records are overwritten.
+ *
+ * head and tail in the header are free-running byte counts, the
+ * position of a record in the ring is the count modulo data_size.  A
+ * record never wraps around the end of the ring; if it won't fit, a
+ * CAPTURE_WRAP record is put at the end (if there is room for one)
+ * and the record goes at the start of the ring.
+ *
+ * Record times are CLOCK_MONOTONIC in nanoseconds.  A CAPTURE_CLOCK
+ * record, holding the CLOCK_REALTIME and CLOCK_MONOTONIC times as two
+ * 64-bit values, is written every time the file is opened so the
+ * times can be converted to wall clock time.  The same pair is kept
+ * in the header for records before the first CAPTURE_CLOCK record.
+ *
+ * Everything is in host byte order, the magic number is used to tell
+ * if the byte order doesn't match.
+ */
+
+#ifndef _SER2NET_CAPTURE_H
+#define _SER2NET_CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CAPTURE_MAGIC		0x53324e4341505431ULL /* "S2NCAPT1" */
+#define CAPTURE_VERSION		1
+
+/* The smallest allowed capture file. */
+#define CAPTURE_MIN_SIZE	65536
+
+/* Larger data is split into multiple records. */
+#define CAPTURE_MAX_DATA	4096
+
+#define CAPTURE_ALIGN(len)	(((len) + 7) & ~7)
+
+struct capture_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t header_size;	/* Offset of the ring in the file. */
+    uint64_t data_size;		/* Size of the ring. */
+    uint64_t head;		/* Where the next record goes. */
+    uint64_t tail;		/* The oldest record. */
+    uint64_t overwritten;	/* Number of records overwritten. */
+    uint64_t realtime_base;	/* Clock times when the file was opened. */
+    uint64_t monotonic_base;
+    char portname[64];
+};
+
+enum capture_type {
+    CAPTURE_TERM = 0,		/* Data read from the device. */
+    CAPTURE_NET = 1,		/* Data read from the network. */
+    CAPTURE_TEXT = 2,		/* Connection open and close messages. */
+    CAPTURE_CLOCK = 3,		/* Realtime and monotonic clock times. */
+    CAPTURE_WRAP = 0xffff	/* Skip to the start of the ring. */
+};
+
+struct capture_rec {
+    uint64_t time;
+    uint32_t len;		/* Length of the data, without padding. */
+    uint16_t type;
+    uint16_t netcon;		/* Network connection, 0 for the device. */
+};
+
+/*
+ * Set up a new capture file header for a file of the given size.
+ * Any old data is thrown away.
+ */
+void capture_init(struct capture_header *hdr, uint64_t file_size,
+		  const char *portname);
+
+/*
+ * Check that the header is valid for a file of the given size, and
+ * that the records from tail to head are all within the ring.
+ */
+bool capture_valid(struct capture_header *hdr, uint64_t file_size);
+
+/*
+ * Add a record, overwriting old records if necessary.  len must be
+ * no more than CAPTURE_MAX_DATA.
+ */
+void capture_add(struct capture_header *hdr, uint16_t type, uint16_t netcon,
+		 uint64_t time, const void *data, uint32_t len);
+
+/*
+ * Return the record at the given position, or NULL if the position
+ * is at a wrap point.
+ */
+struct capture_rec *capture_rec(struct capture_header *hdr, uint64_t pos);
+
+/* Return the position of the record after the one at pos. */
+uint64_t capture_next(struct capture_header *hdr, uint64_t pos);
+
+#endif /* _SER2NET_CAPTURE_H */
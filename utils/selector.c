@@ -51,14 +51,41 @@
 #include <signal.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
 #ifdef HAVE_EPOLL_PWAIT
 #include <sys/epoll.h>
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
 #else
 #define EPOLL_CTL_ADD 0
 #define EPOLL_CTL_DEL 0
 #define EPOLL_CTL_MOD 0
 #endif
 
+/*
+ * io_uring is used directly through the system calls, there is no
+ * need for liburing for the little bit done here.  It sits on top
+ * of the epoll support for the event handling and signal mask.
+ */
+#if defined(HAVE_EPOLL_PWAIT) && defined(HAVE_LINUX_IO_URING_H)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <poll.h>
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_EXT_ARG)
+#define SEL_URING
+#endif
+#endif
+
+#ifdef SEL_URING
+#define sel_uses_uring(sel) ((sel)->uring.fd >= 0)
+#else
+#define sel_uses_uring(sel) 0
+#endif
+
+static int sel_default_backend = SEL_BACKEND_EPOLL;
+
 struct sel_runner_s
 {
     struct selector_s *sel;
@@ -89,11 +116,54 @@ typedef struct fd_control_s
     sel_fd_handler_t handle_read;
     sel_fd_handler_t handle_write;
     sel_fd_handler_t handle_except;
+    unsigned int     enabled;		/* SEL_FD_xxx_ENABLED bits. */
 #ifdef HAVE_EPOLL_PWAIT
     uint32_t saved_events;
+    /*
+     * Bumped every time the fd is cleared.  An event harvested in a
+     * batch is only handled if this hasn't changed since, otherwise a
+     * handler earlier in the batch closed the fd and the number may
+     * already belong to a new one.
+     */
+    uint32_t seq;
+    /*
+     * The events armed in epoll, zero if it is disarmed (the
+     * EPOLLONESHOT fired or it was never armed).  Used to skip
+     * epoll_ctl() calls that would change nothing.
+     */
+    uint32_t epoll_events;
+    /*
+     * Set if a change to the enables has not been given to epoll yet,
+     * the fd is on the selector's dirty list, linked by
+     * next_dirty.  See sel_set_fd_enabled().
+     */
+    int dirty;
+    int next_dirty;
+#endif
+#ifdef SEL_URING
+    /*
+     * The poll for the fd that is in the ring, if armed is set.  The
+     * generation goes in the request's user data, so completions for
+     * a poll that was replaced or removed can be told apart.
+     */
+    uint32_t uring_gen;
+    uint32_t uring_mask;
+    int uring_armed;
 #endif
 } fd_control_t;
 
+#define SEL_FD_READ_ENABLED	(1 << 0)
+#define SEL_FD_WRITE_ENABLED	(1 << 1)
+#define SEL_FD_EXCEPT_ENABLED	(1 << 2)
+
+/*
+ * The fd control structures are kept in pages that are allocated as
+ * fds get used, so there is no limit on the fd number other than the
+ * process's fd limit.  Pages are never freed until the selector is.
+ */
+#define SEL_FD_PAGE_SHIFT	8
+#define SEL_FD_PAGE_SIZE	(1 << SEL_FD_PAGE_SHIFT)
+
 typedef struct heap_val_s
 {
     /* Set this to the function to call when the timeout occurs. */
@@ -159,6 +229,55 @@ heap_cmp_key(heap_val_t *v1, heap_val_t *v2)
 
 #include "heap.h"
 
+/*
+ * The timing wheel for coarse timers.  This is the classic
+ * hierarchical layout: the first level has a slot for each of the
+ * next 256 ticks, and each of the following levels has 64 slots, each
+ * covering a whole turn of the level below it.  When the first level
+ * wraps around, the next slot of the level above is cascaded down
+ * into it.  Starting and stopping a timer is just a list operation.
+ */
+#define SEL_WHEEL_TV1_BITS	8
+#define SEL_WHEEL_TVN_BITS	6
+#define SEL_WHEEL_TV1_SIZE	(1 << SEL_WHEEL_TV1_BITS)
+#define SEL_WHEEL_TVN_SIZE	(1 << SEL_WHEEL_TVN_BITS)
+#define SEL_WHEEL_TV1_MASK	(SEL_WHEEL_TV1_SIZE - 1)
+#define SEL_WHEEL_TVN_MASK	(SEL_WHEEL_TVN_SIZE - 1)
+#define SEL_WHEEL_TVN_LEVELS	3
+/* Longer timeouts are cut to this, about 77 days. */
+#define SEL_WHEEL_MAX_TICKS \
+    ((1ULL << (SEL_WHEEL_TV1_BITS + SEL_WHEEL_TVN_LEVELS * SEL_WHEEL_TVN_BITS)) \
+     - SEL_WHEEL_TV1_SIZE - 1)
+
+typedef unsigned long long sel_tick_t;
+
+typedef struct sel_wheel_link_s
+{
+    struct sel_wheel_link_s *next, *prev;
+} sel_wheel_link_t;
+
+struct sel_wheel_timer_s
+{
+    /* Must be first, the wheel slots are lists of these. */
+    sel_wheel_link_t link;
+
+    sel_wheel_handler_t handler;
+    void *user_data;
+
+    /* The tick this goes off on. */
+    sel_tick_t expires;
+
+    struct selector_s *sel;
+
+    int in_wheel;
+    int stopped;
+    int freed;
+    int in_handler;
+
+    sel_wheel_handler_t done_handler;
+    void *done_cb_data;
+};
+
 /* Used to build a list of threads that may need to be woken if a
    timer on the top of the heap changes, or an FD is added/removed.
    See i_wake_sel_thread() for more info. */
@@ -175,21 +294,19 @@ typedef struct sel_wait_list_s
        operation. */
     volatile struct timeval *timeout;
 
+    /* Set when the wake eventfd has been written for this waiter and
+       it hasn't woken up yet. */
+    int wake_needed;
+
     struct sel_wait_list_s *next, *prev;
 } sel_wait_list_t;
 
 struct selector_s
 {
-    /* This is an array of all the file descriptors possible.  This is
-       moderately wasteful of space, but easy to do.  Hey, memory is
-       cheap. */
-    volatile fd_control_t fds[FD_SETSIZE];
-
-  /* These are the offical fd_sets used to track what file descriptors
-       need to be monitored. */
-    volatile fd_set read_set;
-    volatile fd_set write_set;
-    volatile fd_set except_set;
+    /* Pages of fd control structures, see SEL_FD_PAGE_SIZE.  Only
+       touch these with the fd lock held. */
+    fd_control_t **fd_pages;
+    unsigned int nr_fd_pages;
 
     volatile int maxfd; /* The largest file descriptor registered with
 			   this code. */
@@ -199,6 +316,13 @@ struct selector_s
     /* The timer heap. */
     theap_t timer_heap;
 
+    /* The coarse timer wheel, protected by the timer lock. */
+    sel_wheel_link_t wheel_tv1[SEL_WHEEL_TV1_SIZE];
+    sel_wheel_link_t wheel_tvn[SEL_WHEEL_TVN_LEVELS][SEL_WHEEL_TVN_SIZE];
+    sel_tick_t wheel_tick;	/* The next tick to process. */
+    sel_tick_t wheel_next_tick;	/* When the wheel needs attention. */
+    unsigned int wheel_count;	/* Number of timers in the wheel. */
+
     /* This is a list of items waiting to be woken up because they are
        sitting in a select.  See i_wake_sel_thread() for more info. */
     sel_wait_list_t wait_list;
@@ -212,6 +336,39 @@ struct selector_s
 
 #ifdef HAVE_EPOLL_PWAIT
     int epollfd;
+    int epoll_batch; /* Max events to harvest per epoll_pwait() call. */
+    sigset_t wait_sigmask; /* The sigmask to wait with, wake_sig open. */
+
+    /*
+     * An eventfd in the epoll set used to wake up threads waiting in
+     * the selector, -1 if not available and signals are used.  See
+     * i_wake_sel_thread().
+     */
+    int wake_fd;
+
+    /*
+     * Fds whose enables changed while no thread was waiting in
+     * epoll, linked through next_dirty and -1 terminated.  They are
+     * given to epoll before the next wait.  Both of these are
+     * protected by the fd lock.
+     */
+    int dirty_head;
+    unsigned int nr_epoll_waiting;
+#endif
+#ifdef SEL_URING
+    /* Only touch the ring with the fd lock held. */
+    struct sel_uring {
+	int fd; /* -1 if io_uring is not in use. */
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int sq_entries;
+	struct io_uring_sqe *sqes;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+	/* Threads in io_uring_enter(), see sel_uring_queued(). */
+	unsigned int nr_waiting;
+    } uring;
 #endif
     sel_lock_t *(*sel_lock_alloc)(void *cb_data);
     void (*sel_lock_free)(sel_lock_t *);
@@ -263,15 +420,36 @@ static void
 i_wake_sel_thread(struct selector_s *sel)
 {
     sel_wait_list_t *item;
+    int use_wake_fd = 0;
+
+#ifdef HAVE_EPOLL_PWAIT
+    use_wake_fd = sel->wake_fd >= 0;
+#endif
 
     item = sel->wait_list.next;
     while (item != &sel->wait_list) {
 	item->timeout->tv_sec = 0;
 	item->timeout->tv_usec = 0;
-	if (item->send_sig)
+	if (use_wake_fd)
+	    item->wake_needed = 1;
+	else if (item->send_sig)
 	    item->send_sig(item->thread_id, item->send_sig_cb_data);
 	item = item->next;
     }
+
+#ifdef HAVE_EPOLL_PWAIT
+    /*
+     * One write wakes all of them.  The eventfd is level triggered in
+     * the epoll set, and isn't read until every waiter marked above
+     * has woken up, see sel_handle_wake_fd().
+     */
+    if (use_wake_fd && sel->wait_list.next != &sel->wait_list) {
+	uint64_t val = 1;
+
+	if (write(sel->wake_fd, &val, sizeof(val)) == -1 && errno != EAGAIN)
+	    syslog(LOG_ERR, "Unable to write selector wake fd: %m");
+    }
+#endif
 }
 
 void
@@ -308,6 +486,7 @@ add_sel_wait_list(struct selector_s *sel, sel_wait_list_t *item,
 {
     item->thread_id = thread_id;
     item->timeout = timeout;
+    item->wake_needed = 0;
     item->send_sig = send_sig;
     item->send_sig_cb_data = cb_data;
     item->next = sel->wait_list.next;
@@ -331,43 +510,343 @@ init_fd(fd_control_t *fd)
     fd->handle_read = NULL;
     fd->handle_write = NULL;
     fd->handle_except = NULL;
+    fd->enabled = 0;
+#ifdef HAVE_EPOLL_PWAIT
+    fd->saved_events = 0;
+#endif
+}
+
+/*
+ * Return the control structure for the fd, or NULL if its page has
+ * never been allocated (so the fd has never been set).  Must be
+ * called with the fd lock held.
+ */
+static fd_control_t *
+sel_fdc(struct selector_s *sel, int fd)
+{
+    unsigned int page = fd >> SEL_FD_PAGE_SHIFT;
+
+    if (fd < 0 || page >= sel->nr_fd_pages || !sel->fd_pages[page])
+	return NULL;
+    return &sel->fd_pages[page][fd & (SEL_FD_PAGE_SIZE - 1)];
+}
+
+/* Like sel_fdc(), but allocate the page if it doesn't exist. */
+static fd_control_t *
+sel_alloc_fdc(struct selector_s *sel, int fd)
+{
+    unsigned int i, page = fd >> SEL_FD_PAGE_SHIFT;
+
+    if (page >= sel->nr_fd_pages) {
+	unsigned int new_nr = sel->nr_fd_pages * 2;
+	fd_control_t **new_pages;
+
+	if (new_nr <= page)
+	    new_nr = page + 1;
+	new_pages = realloc(sel->fd_pages, new_nr * sizeof(*new_pages));
+	if (!new_pages)
+	    return NULL;
+	memset(new_pages + sel->nr_fd_pages, 0,
+	       (new_nr - sel->nr_fd_pages) * sizeof(*new_pages));
+	sel->fd_pages = new_pages;
+	sel->nr_fd_pages = new_nr;
+    }
+
+    if (!sel->fd_pages[page]) {
+	sel->fd_pages[page] = calloc(SEL_FD_PAGE_SIZE,
+				     sizeof(fd_control_t));
+	if (!sel->fd_pages[page])
+	    return NULL;
+	for (i = 0; i < SEL_FD_PAGE_SIZE; i++)
+	    init_fd(&sel->fd_pages[page][i]);
+    }
+
+    return &sel->fd_pages[page][fd & (SEL_FD_PAGE_SIZE - 1)];
+}
+
+#ifdef SEL_URING
+/* User data for requests whose completion is of no interest. */
+#define SEL_URING_IGNORE	((uint64_t) -1)
+/* User data for the poll on the wake fd. */
+#define SEL_URING_WAKE		((uint64_t) -2)
+
+static int
+sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+		   unsigned int flags, void *arg, size_t argsz)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+		   arg, argsz);
+}
+
+/* Requests queued that the kernel has not picked up yet. */
+static unsigned int
+sel_uring_unsubmitted(struct sel_uring *u)
+{
+    return *u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+}
+
+static void
+sel_uring_submit(struct sel_uring *u)
+{
+    unsigned int n = sel_uring_unsubmitted(u);
+
+    if (n && sys_io_uring_enter(u->fd, n, 0, 0, NULL, 0) == -1 &&
+		errno != EINTR && errno != EAGAIN && errno != EBUSY)
+	syslog(LOG_ERR, "Unable to submit to io_uring: %m");
+}
+
+static struct io_uring_sqe *
+sel_uring_get_sqe(struct sel_uring *u)
+{
+    struct io_uring_sqe *sqe;
+
+    if (sel_uring_unsubmitted(u) >= u->sq_entries) {
+	/* Full, push what is there to the kernel to make room. */
+	sel_uring_submit(u);
+	if (sel_uring_unsubmitted(u) >= u->sq_entries) {
+	    syslog(LOG_ERR, "io_uring submission queue is full");
+	    return NULL;
+	}
+    }
+    sqe = &u->sqes[*u->sq_tail & *u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void
+sel_uring_commit_sqe(struct sel_uring *u)
+{
+    __atomic_store_n(u->sq_tail, *u->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+static uint64_t
+sel_uring_user_data(fd_control_t *fdc, int fd)
+{
+    return ((uint64_t) fdc->uring_gen << 32) | (uint32_t) fd;
+}
+
+static void
+sel_uring_poll_add(struct selector_s *sel, fd_control_t *fdc, int fd,
+		   uint32_t mask)
+{
+    struct io_uring_sqe *sqe = sel_uring_get_sqe(&sel->uring);
+
+    if (!sqe)
+	return;
+    fdc->uring_gen++;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+#if __BYTE_ORDER == __BIG_ENDIAN
+    sqe->poll32_events = (mask << 16) | (mask >> 16);
+#else
+    sqe->poll32_events = mask;
+#endif
+    sqe->user_data = sel_uring_user_data(fdc, fd);
+    sel_uring_commit_sqe(&sel->uring);
+    fdc->uring_mask = mask;
+    fdc->uring_armed = 1;
+}
+
+static void
+sel_uring_poll_remove(struct selector_s *sel, fd_control_t *fdc, int fd)
+{
+    struct io_uring_sqe *sqe = sel_uring_get_sqe(&sel->uring);
+
+    /* Even if this fails the generation keeps a late event out. */
+    fdc->uring_armed = 0;
+    if (!sqe)
+	return;
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = sel_uring_user_data(fdc, fd);
+    sqe->user_data = SEL_URING_IGNORE;
+    sel_uring_commit_sqe(&sel->uring);
+}
+
+/*
+ * Poll for the wake fd.  The poll is single-shot, it is put back each
+ * time it goes off, so while the eventfd is set every new poll
+ * completes at once, like the level triggered one in epoll.
+ */
+static void
+sel_uring_wake_arm(struct selector_s *sel)
+{
+    struct io_uring_sqe *sqe = sel_uring_get_sqe(&sel->uring);
+
+    if (!sqe)
+	return;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = sel->wake_fd;
+#if __BYTE_ORDER == __BIG_ENDIAN
+    sqe->poll32_events = POLLIN << 16;
+#else
+    sqe->poll32_events = POLLIN;
+#endif
+    sqe->user_data = SEL_URING_WAKE;
+    sel_uring_commit_sqe(&sel->uring);
+}
+
+/*
+ * Requests are normally left in the ring and submitted with the next
+ * wait, so a batch of handlers changing their fds costs nothing
+ * extra.  But if some thread is already waiting it has to be done
+ * now, or that thread would wait on the old state.
+ */
+static void
+sel_uring_queued(struct selector_s *sel)
+{
+    if (sel->uring.nr_waiting)
+	sel_uring_submit(&sel->uring);
+}
+
+/*
+ * The io_uring version of sel_update_epoll().  The polls are
+ * single-shot like the EPOLLONESHOT registrations, a poll is only
+ * replaced if the events wanted change.
+ */
+static int
+sel_update_uring(struct selector_s *sel, fd_control_t *fdc, int fd, int op,
+		 int read_enable)
+{
+    uint32_t mask = 0;
+
+    if (op != EPOLL_CTL_DEL) {
+	if (fdc->saved_events) {
+	    if (!read_enable)
+		return 0;
+	    mask = POLLIN | POLLHUP;
+	} else {
+	    if (fdc->enabled & SEL_FD_READ_ENABLED)
+		mask |= POLLIN | POLLHUP;
+	    if (fdc->enabled & SEL_FD_WRITE_ENABLED)
+		mask |= POLLOUT;
+	    if (fdc->enabled & SEL_FD_EXCEPT_ENABLED)
+		mask |= POLLERR | POLLPRI;
+	}
+    }
+
+    if (fdc->uring_armed) {
+	if (fdc->uring_mask == mask)
+	    return 0;
+	sel_uring_poll_remove(sel, fdc, fd);
+    }
+    if (mask)
+	sel_uring_poll_add(sel, fdc, fd, mask);
+    sel_uring_queued(sel);
+    return 0;
 }
+#endif
 
 #ifdef HAVE_EPOLL_PWAIT
 static int
 sel_update_epoll(struct selector_s *sel, int fd, int op, int read_enable)
 {
-    fd_control_t *fdc = (fd_control_t *) &sel->fds[fd];
+    fd_control_t *fdc = sel_fdc(sel, fd);
     struct epoll_event event;
 
+#ifdef SEL_URING
+    if (sel_uses_uring(sel))
+	return sel_update_uring(sel, fdc, fd, op, read_enable);
+#endif
     if (sel->epollfd < 0)
 	return 1;
 
     memset(&event, 0, sizeof(event));
     event.events = EPOLLONESHOT;
     event.data.fd = fd;
-    if (fdc->saved_events) {
+    if (op == EPOLL_CTL_DEL) {
+	fdc->epoll_events = 0;
+    } else if (fdc->saved_events) {
 	if (!read_enable)
 	    return 0;
 	op = EPOLL_CTL_ADD;
 	event.events = EPOLLIN | EPOLLHUP;
     } else {
-	if (FD_ISSET(fd, &sel->read_set))
+	if (fdc->enabled & SEL_FD_READ_ENABLED)
 	    event.events |= EPOLLIN | EPOLLHUP;
-	if (FD_ISSET(fd, &sel->write_set))
+	if (fdc->enabled & SEL_FD_WRITE_ENABLED)
 	    event.events |= EPOLLOUT;
-	if (FD_ISSET(fd, &sel->except_set))
+	if (fdc->enabled & SEL_FD_EXCEPT_ENABLED)
 	    event.events |= EPOLLERR | EPOLLPRI;
+	/*
+	 * Disarming an fd that already fired, or rearming with the
+	 * events that are already armed, does nothing.
+	 */
+	if (op == EPOLL_CTL_MOD &&
+		(event.events & ~EPOLLONESHOT) == fdc->epoll_events)
+	    return 0;
     }
+    if (op != EPOLL_CTL_DEL)
+	fdc->epoll_events = event.events & ~EPOLLONESHOT;
     epoll_ctl(sel->epollfd, op, fd, &event);
     return 0;
 }
+
+/*
+ * Apply the enables of the fds changed since the last wait.  Must
+ * be called with the fd lock held.
+ */
+static void
+sel_flush_dirty(struct selector_s *sel)
+{
+    while (sel->dirty_head >= 0) {
+	int fd = sel->dirty_head;
+	fd_control_t *fdc = sel_fdc(sel, fd);
+
+	sel->dirty_head = fdc->next_dirty;
+	fdc->dirty = 0;
+	/* It may have been cleared since it was put on the list. */
+	if (fdc->state)
+	    sel_update_epoll(sel, fd, EPOLL_CTL_MOD, 0);
+    }
+}
+
+/*
+ * Called when an fd's enables change.  The data path turns read and
+ * write on and off for nearly every chunk it moves, and often back to
+ * where it was before the selector waits again, so if nothing is
+ * waiting in epoll the change is only recorded and applied with
+ * sel_flush_dirty() right before the next wait.  If something is
+ * waiting it would miss the change, so it is applied right away.
+ * Returns like sel_update_epoll().
+ */
+static int
+sel_update_enables(struct selector_s *sel, int fd, int read_enable)
+{
+    fd_control_t *fdc = sel_fdc(sel, fd);
+
+    if (sel->epollfd < 0 || fdc->saved_events || sel->nr_epoll_waiting
+#ifdef SEL_URING
+	|| sel_uses_uring(sel)
+#endif
+	)
+	return sel_update_epoll(sel, fd, EPOLL_CTL_MOD, read_enable);
+
+    if (!fdc->dirty) {
+	fdc->dirty = 1;
+	fdc->next_dirty = sel->dirty_head;
+	sel->dirty_head = fd;
+    }
+    return 0;
+}
 #else
 static int
 sel_update_epoll(struct selector_s *sel, int fd, int op, int dummy)
 {
     return 1;
 }
+
+static int
+sel_update_enables(struct selector_s *sel, int fd, int dummy)
+{
+    return 1;
+}
 #endif
 
 static void
@@ -395,6 +874,16 @@ sel_set_fd_handlers(struct selector_s *sel,
     void         *olddata = NULL;
     int          added = 1;
 
+#ifdef HAVE_EPOLL_PWAIT
+    if (sel->epollfd < 0 && !sel_uses_uring(sel) && fd >= FD_SETSIZE)
+#else
+    if (fd >= FD_SETSIZE)
+#endif
+	/* select() can't handle it. */
+	return EMFILE;
+    if (fd < 0)
+	return EBADF;
+
     state = malloc(sizeof(*state));
     if (!state)
 	return ENOMEM;
@@ -404,7 +893,12 @@ sel_set_fd_handlers(struct selector_s *sel,
     state->done_runner.sel = sel;
 
     sel_fd_lock(sel);
-    fdc = (fd_control_t *) &(sel->fds[fd]);
+    fdc = sel_alloc_fdc(sel, fd);
+    if (!fdc) {
+	sel_fd_unlock(sel);
+	free(state);
+	return ENOMEM;
+    }
     if (fdc->state) {
 	oldstate = fdc->state;
 	olddata = fdc->data;
@@ -449,7 +943,9 @@ i_sel_clear_fd_handler(struct selector_s *sel, int fd, int rpt)
     void         *olddata = NULL;
 
     sel_fd_lock(sel);
-    fdc = (fd_control_t *) &(sel->fds[fd]);
+    fdc = sel_fdc(sel, fd);
+    if (!fdc)
+	goto out_unlock;
 
     if (fdc->state) {
 	oldstate = fdc->state;
@@ -457,17 +953,19 @@ i_sel_clear_fd_handler(struct selector_s *sel, int fd, int rpt)
 	fdc->state = NULL;
 
 	sel_update_epoll(sel, fd, EPOLL_CTL_DEL, 0);
-	fdc->saved_events = 0;
+#ifdef HAVE_EPOLL_PWAIT
+	fdc->seq++;
+#endif
     }
 
     init_fd(fdc);
-    FD_CLR(fd, &sel->read_set);
-    FD_CLR(fd, &sel->write_set);
-    FD_CLR(fd, &sel->except_set);
 
     /* Move maxfd down if necessary. */
     if (fd == sel->maxfd) {
-	while ((sel->maxfd >= 0) && (! sel->fds[sel->maxfd].state)) {
+	while (sel->maxfd >= 0) {
+	    fdc = sel_fdc(sel, sel->maxfd);
+	    if (fdc && fdc->state)
+		break;
 	    sel->maxfd--;
 	}
     }
@@ -483,6 +981,7 @@ i_sel_clear_fd_handler(struct selector_s *sel, int fd, int rpt)
 	}
     }
 
+ out_unlock:
     sel_fd_unlock(sel);
 }
 
@@ -502,28 +1001,30 @@ sel_clear_fd_handlers_norpt(struct selector_s *sel, int fd)
     i_sel_clear_fd_handler(sel, fd, 0);
 }
 
-/* Set whether the file descriptor will be monitored for data ready to
-   read on the file descriptor. */
-void
-sel_set_fd_read_handler(struct selector_s *sel, int fd, int state)
+/* Turn the given SEL_FD_xxx_ENABLED bit on or off for the fd. */
+static void
+sel_set_fd_enabled(struct selector_s *sel, int fd, unsigned int bit,
+		   int state)
 {
-    fd_control_t *fdc = (fd_control_t *) &(sel->fds[fd]);
+    fd_control_t *fdc;
 
     sel_fd_lock(sel);
-    if (!fdc->state)
+    fdc = sel_fdc(sel, fd);
+    if (!fdc || !fdc->state)
 	goto out;
 
     if (state == SEL_FD_HANDLER_ENABLED) {
-	if (FD_ISSET(fd, &sel->read_set))
+	if (fdc->enabled & bit)
 	    goto out;
-	FD_SET(fd, &sel->read_set);
+	fdc->enabled |= bit;
     } else if (state == SEL_FD_HANDLER_DISABLED) {
-	if (!FD_ISSET(fd, &sel->read_set))
+	if (!(fdc->enabled & bit))
 	    goto out;
-	FD_CLR(fd, &sel->read_set);
+	fdc->enabled &= ~bit;
     }
-    if (sel_update_epoll(sel, fd, EPOLL_CTL_MOD,
-			 state == SEL_FD_HANDLER_ENABLED)) {
+    if (sel_update_enables(sel, fd,
+			   (bit == SEL_FD_READ_ENABLED &&
+			    state == SEL_FD_HANDLER_ENABLED))) {
 	wake_fd_sel_thread(sel);
 	return;
     }
@@ -532,33 +1033,20 @@ sel_set_fd_read_handler(struct selector_s *sel, int fd, int state)
     sel_fd_unlock(sel);
 }
 
+/* Set whether the file descriptor will be monitored for data ready to
+   read on the file descriptor. */
+void
+sel_set_fd_read_handler(struct selector_s *sel, int fd, int state)
+{
+    sel_set_fd_enabled(sel, fd, SEL_FD_READ_ENABLED, state);
+}
+
 /* Set whether the file descriptor will be monitored for when the file
    descriptor can be written to. */
 void
 sel_set_fd_write_handler(struct selector_s *sel, int fd, int state)
 {
-    fd_control_t *fdc = (fd_control_t *) &(sel->fds[fd]);
-
-    sel_fd_lock(sel);
-    if (!fdc->state)
-	goto out;
-
-    if (state == SEL_FD_HANDLER_ENABLED) {
-	if (FD_ISSET(fd, &sel->write_set))
-	    goto out;
-	FD_SET(fd, &sel->write_set);
-    } else if (state == SEL_FD_HANDLER_DISABLED) {
-	if (!FD_ISSET(fd, &sel->write_set))
-	    goto out;
-	FD_CLR(fd, &sel->write_set);
-    }
-    if (sel_update_epoll(sel, fd, EPOLL_CTL_MOD, 0)) {
-	wake_fd_sel_thread(sel);
-	return;
-    }
-
- out:
-    sel_fd_unlock(sel);
+    sel_set_fd_enabled(sel, fd, SEL_FD_WRITE_ENABLED, state);
 }
 
 /* Set whether the file descriptor will be monitored for exceptions
@@ -566,28 +1054,7 @@ sel_set_fd_write_handler(struct selector_s *sel, int fd, int state)
 void
 sel_set_fd_except_handler(struct selector_s *sel, int fd, int state)
 {
-    fd_control_t *fdc = (fd_control_t *) &(sel->fds[fd]);
-
-    sel_fd_lock(sel);
-    if (!fdc->state)
-	goto out;
-
-    if (state == SEL_FD_HANDLER_ENABLED) {
-	if (FD_ISSET(fd, &sel->except_set))
-	    goto out;
-	FD_SET(fd, &sel->except_set);
-    } else if (state == SEL_FD_HANDLER_DISABLED) {
-	if (!FD_ISSET(fd, &sel->except_set))
-	    goto out;
-	FD_CLR(fd, &sel->except_set);
-    }
-    if (sel_update_epoll(sel, fd, EPOLL_CTL_MOD, 0)) {
-	wake_fd_sel_thread(sel);
-	return;
-    }
-
- out:
-    sel_fd_unlock(sel);
+    sel_set_fd_enabled(sel, fd, SEL_FD_EXCEPT_ENABLED, state);
 }
 
 static void
@@ -775,36 +1242,390 @@ sel_get_monotonic_time(struct timeval *tv)
     tv->tv_usec = (ts.tv_nsec + 500) / 1000;
 }
 
-/*
- * Process timers on selector.  The timeout is always set, to a very
- * long value if no timers are waiting.  Note that this *must* be
- * called with sel->timer_lock held.  Note that if this processes
- * any timers, the timeout will be set to { 0,0 }.
- */
-static void
-process_timers(struct selector_s       *sel,
-	       unsigned int            *count,
-	       volatile struct timeval *timeout)
+static sel_tick_t
+sel_get_tick(void)
 {
     struct timeval now;
-    sel_timer_t    *timer;
 
-    timer = theap_get_top(&sel->timer_heap);
     sel_get_monotonic_time(&now);
-    while (timer && cmp_timeval(&now, &timer->val.timeout) >= 0) {
-	theap_remove(&(sel->timer_heap), timer);
-	timer->val.in_heap = 0;
-	timer->val.stopped = 1;
+    return ((sel_tick_t) now.tv_sec * 1000 + now.tv_usec / 1000)
+	/ SEL_WHEEL_TICK_MSEC;
+}
 
-	/*
-	 * A timer may be in a handler here if it has been stopped with
-	 * a done_handler.  In that case the timer was stopped, so we
-	 * don't call the main handler.
-	 */
-	if (!timer->val.in_handler) {
-	    timer->val.in_handler = 1;
-	    sel_timer_unlock(sel);
-	    timer->val.handler(sel, timer, timer->val.user_data);
+static void
+sel_tick_to_time(sel_tick_t tick, struct timeval *tv)
+{
+    tick *= SEL_WHEEL_TICK_MSEC;
+    tv->tv_sec = tick / 1000;
+    tv->tv_usec = (tick % 1000) * 1000;
+}
+
+static void
+wheel_list_init(sel_wheel_link_t *head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static void
+wheel_list_add(sel_wheel_link_t *head, sel_wheel_link_t *link)
+{
+    link->next = head;
+    link->prev = head->prev;
+    head->prev->next = link;
+    head->prev = link;
+}
+
+static void
+wheel_list_del(sel_wheel_link_t *link)
+{
+    link->next->prev = link->prev;
+    link->prev->next = link->next;
+    link->next = link->prev = link;
+}
+
+/* Move everything in from to the empty list to. */
+static void
+wheel_list_splice(sel_wheel_link_t *from, sel_wheel_link_t *to)
+{
+    if (from->next == from)
+	return;
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    wheel_list_init(from);
+}
+
+/* Put the timer in the right slot for its expiry time. */
+static void
+wheel_place(struct selector_s *sel, sel_wheel_timer_t *timer)
+{
+    sel_tick_t expires = timer->expires;
+    sel_tick_t idx = expires - sel->wheel_tick;
+    sel_wheel_link_t *head;
+    unsigned int level, shift;
+
+    if (expires < sel->wheel_tick) {
+	/* Already late, do it on the next tick. */
+	head = &sel->wheel_tv1[sel->wheel_tick & SEL_WHEEL_TV1_MASK];
+    } else if (idx < SEL_WHEEL_TV1_SIZE) {
+	head = &sel->wheel_tv1[expires & SEL_WHEEL_TV1_MASK];
+    } else {
+	for (level = 0; ; level++) {
+	    shift = SEL_WHEEL_TV1_BITS + level * SEL_WHEEL_TVN_BITS;
+	    if (idx < (1ULL << (shift + SEL_WHEEL_TVN_BITS)) ||
+			level == SEL_WHEEL_TVN_LEVELS - 1)
+		break;
+	}
+	head = &sel->wheel_tvn[level][(expires >> shift) & SEL_WHEEL_TVN_MASK];
+    }
+    wheel_list_add(head, &timer->link);
+}
+
+/*
+ * Add a timer to the wheel and make sure the selector wakes up in
+ * time for it.  Must be called with the timer lock held.
+ */
+static void
+wheel_add(struct selector_s *sel, sel_wheel_timer_t *timer, sel_tick_t now)
+{
+    if (sel->wheel_count == 0) {
+	/* Nothing is pending, the wheel can jump to the current time. */
+	sel->wheel_tick = now;
+	sel->wheel_next_tick = (sel_tick_t) -1;
+    }
+    wheel_place(sel, timer);
+    timer->in_wheel = 1;
+    sel->wheel_count++;
+
+    if (timer->expires < sel->wheel_next_tick) {
+	if (timer->expires < sel->wheel_tick)
+	    sel->wheel_next_tick = sel->wheel_tick;
+	else
+	    sel->wheel_next_tick = timer->expires;
+	i_wake_sel_thread(sel);
+    }
+}
+
+static void
+wheel_remove(struct selector_s *sel, sel_wheel_timer_t *timer)
+{
+    wheel_list_del(&timer->link);
+    timer->in_wheel = 0;
+    sel->wheel_count--;
+}
+
+/* Re-place all the timers in a slot of an upper level. */
+static unsigned int
+wheel_cascade(struct selector_s *sel, unsigned int level)
+{
+    unsigned int shift = SEL_WHEEL_TV1_BITS + level * SEL_WHEEL_TVN_BITS;
+    unsigned int idx = (sel->wheel_tick >> shift) & SEL_WHEEL_TVN_MASK;
+    sel_wheel_link_t list;
+
+    wheel_list_init(&list);
+    wheel_list_splice(&sel->wheel_tvn[level][idx], &list);
+    while (list.next != &list) {
+	sel_wheel_timer_t *timer = (sel_wheel_timer_t *) list.next;
+
+	wheel_list_del(&timer->link);
+	wheel_place(sel, timer);
+    }
+
+    return idx;
+}
+
+/*
+ * Find the next tick that has something to do, either a timer or a
+ * cascade.  This is never more than a turn of the first level away.
+ */
+static void
+wheel_find_next(struct selector_s *sel)
+{
+    sel_tick_t tick = sel->wheel_tick;
+    sel_wheel_link_t *head;
+
+    for (;;) {
+	head = &sel->wheel_tv1[tick & SEL_WHEEL_TV1_MASK];
+	if (head->next != head || !(tick & SEL_WHEEL_TV1_MASK))
+	    break;
+	tick++;
+    }
+    sel->wheel_next_tick = tick;
+}
+
+int
+sel_alloc_wheel_timer(struct selector_s   *sel,
+		      sel_wheel_handler_t handler,
+		      void                *user_data,
+		      sel_wheel_timer_t   **new_timer)
+{
+    sel_wheel_timer_t *timer;
+
+    timer = malloc(sizeof(*timer));
+    if (!timer)
+	return ENOMEM;
+    memset(timer, 0, sizeof(*timer));
+
+    wheel_list_init(&timer->link);
+    timer->handler = handler;
+    timer->user_data = user_data;
+    timer->sel = sel;
+    timer->stopped = 1;
+    *new_timer = timer;
+
+    return 0;
+}
+
+int
+sel_free_wheel_timer(sel_wheel_timer_t *timer)
+{
+    struct selector_s *sel = timer->sel;
+    int in_handler;
+
+    sel_timer_lock(sel);
+    if (timer->in_wheel)
+	wheel_remove(sel, timer);
+    timer->stopped = 1;
+    timer->freed = 1;
+    in_handler = timer->in_handler;
+    sel_timer_unlock(sel);
+
+    if (!in_handler)
+	free(timer);
+
+    return 0;
+}
+
+int
+sel_start_wheel_timer(sel_wheel_timer_t *timer, unsigned int msecs)
+{
+    struct selector_s *sel = timer->sel;
+    sel_tick_t now = sel_get_tick();
+    sel_tick_t ticks;
+
+    ticks = (msecs + SEL_WHEEL_TICK_MSEC - 1) / SEL_WHEEL_TICK_MSEC;
+    if (ticks > SEL_WHEEL_MAX_TICKS)
+	ticks = SEL_WHEEL_MAX_TICKS;
+
+    sel_timer_lock(sel);
+    if (timer->in_wheel) {
+	sel_timer_unlock(sel);
+	return EBUSY;
+    }
+
+    timer->expires = now + ticks;
+
+    if (!timer->in_handler)
+	/* Wait until the handler returns to start the timer. */
+	wheel_add(sel, timer, now);
+    timer->stopped = 0;
+
+    sel_timer_unlock(sel);
+
+    return 0;
+}
+
+int
+sel_stop_wheel_timer(sel_wheel_timer_t *timer)
+{
+    struct selector_s *sel = timer->sel;
+
+    sel_timer_lock(sel);
+    if (timer->stopped) {
+	sel_timer_unlock(sel);
+	return ETIMEDOUT;
+    }
+
+    /* No need to wake anything, an early wakeup does no harm. */
+    if (timer->in_wheel)
+	wheel_remove(sel, timer);
+    timer->stopped = 1;
+
+    sel_timer_unlock(sel);
+
+    return 0;
+}
+
+int
+sel_stop_wheel_timer_with_done(sel_wheel_timer_t *timer,
+			       sel_wheel_handler_t done_handler,
+			       void *cb_data)
+{
+    struct selector_s *sel = timer->sel;
+
+    sel_timer_lock(sel);
+    if (timer->stopped || timer->done_handler) {
+	sel_timer_unlock(sel);
+	return ETIMEDOUT;
+    }
+
+    timer->stopped = 1;
+
+    timer->done_handler = done_handler;
+    timer->done_cb_data = cb_data;
+
+    if (timer->in_handler)
+	goto out_unlock;
+
+    /*
+     * Like the heap timers, run the done handler from the selector by
+     * putting it on the next tick.
+     */
+    timer->in_handler = 1;
+    if (timer->in_wheel)
+	wheel_remove(sel, timer);
+    timer->expires = 0;
+    wheel_add(sel, timer, sel_get_tick());
+
+ out_unlock:
+    sel_timer_unlock(sel);
+    return 0;
+}
+
+/*
+ * Run all the wheel timers that are due.  Must be called with the
+ * timer lock held.
+ */
+static void
+process_wheel(struct selector_s *sel, unsigned int *count)
+{
+    sel_tick_t now;
+    sel_wheel_link_t expired;
+    unsigned int level;
+
+    if (sel->wheel_count == 0)
+	return;
+
+    now = sel_get_tick();
+    if (now < sel->wheel_next_tick)
+	return;
+
+    wheel_list_init(&expired);
+    while (sel->wheel_count && sel->wheel_tick <= now) {
+	unsigned int idx = sel->wheel_tick & SEL_WHEEL_TV1_MASK;
+
+	if (!idx) {
+	    for (level = 0; level < SEL_WHEEL_TVN_LEVELS; level++) {
+		if (wheel_cascade(sel, level))
+		    break;
+	    }
+	}
+	wheel_list_splice(&sel->wheel_tv1[idx], &expired);
+	sel->wheel_tick++;
+
+	/*
+	 * Other threads may stop timers on the expired list while the
+	 * lock is released, that's fine, they just get unlinked.
+	 */
+	while (expired.next != &expired) {
+	    sel_wheel_timer_t *timer = (sel_wheel_timer_t *) expired.next;
+
+	    wheel_remove(sel, timer);
+	    timer->stopped = 1;
+
+	    /* See process_timers() for how this works. */
+	    if (!timer->in_handler) {
+		timer->in_handler = 1;
+		sel_timer_unlock(sel);
+		timer->handler(sel, timer, timer->user_data);
+		sel_timer_lock(sel);
+	    }
+	    (*count)++;
+	    if (timer->done_handler) {
+		sel_wheel_handler_t done_handler = timer->done_handler;
+		void *done_cb_data = timer->done_cb_data;
+
+		timer->done_handler = NULL;
+		timer->in_handler = 1;
+		sel_timer_unlock(sel);
+		done_handler(sel, timer, done_cb_data);
+		sel_timer_lock(sel);
+	    }
+	    timer->in_handler = 0;
+	    if (timer->freed)
+		free(timer);
+	    else if (!timer->stopped)
+		/* We were restarted while in the handler. */
+		wheel_add(sel, timer, sel_get_tick());
+	}
+    }
+
+    if (sel->wheel_count)
+	wheel_find_next(sel);
+}
+
+/*
+ * Process timers on selector.  The timeout is always set, to a very
+ * long value if no timers are waiting.  Note that this *must* be
+ * called with sel->timer_lock held.  Note that if this processes
+ * any timers, the timeout will be set to { 0,0 }.
+ */
+static void
+process_timers(struct selector_s       *sel,
+	       unsigned int            *count,
+	       volatile struct timeval *timeout)
+{
+    struct timeval now;
+    sel_timer_t    *timer;
+
+    timer = theap_get_top(&sel->timer_heap);
+    sel_get_monotonic_time(&now);
+    while (timer && cmp_timeval(&now, &timer->val.timeout) >= 0) {
+	theap_remove(&(sel->timer_heap), timer);
+	timer->val.in_heap = 0;
+	timer->val.stopped = 1;
+
+	/*
+	 * A timer may be in a handler here if it has been stopped with
+	 * a done_handler.  In that case the timer was stopped, so we
+	 * don't call the main handler.
+	 */
+	if (!timer->val.in_handler) {
+	    timer->val.in_handler = 1;
+	    sel_timer_unlock(sel);
+	    timer->val.handler(sel, timer, timer->val.user_data);
 	    sel_timer_lock(sel);
 	}
 	(*count)++;
@@ -830,15 +1651,24 @@ process_timers(struct selector_s       *sel,
 	timer = theap_get_top(&sel->timer_heap);
     }
 
+    process_wheel(sel, count);
+
     if (*count) {
 	/* If called, set the timeout to zero. */
 	timeout->tv_sec = 0;
 	timeout->tv_usec = 0;
-    } else if (timer) {
+    } else if (timer || sel->wheel_count) {
+	struct timeval next;
+
+	if (sel->wheel_count) {
+	    sel_tick_to_time(sel->wheel_next_tick, &next);
+	    if (timer && cmp_timeval(&timer->val.timeout, &next) < 0)
+		next = timer->val.timeout;
+	} else {
+	    next = timer->val.timeout;
+	}
 	sel_get_monotonic_time(&now);
-	diff_timeval((struct timeval *) timeout,
-		     (struct timeval *) &timer->val.timeout,
-		     &now);
+	diff_timeval((struct timeval *) timeout, &next, &now);
     } else {
 	/* No timers, just set a long time. */
 	timeout->tv_sec = 100000;
@@ -898,6 +1728,8 @@ sel_run(sel_runner_t *runner, sel_runner_func_t func, void *cb_data)
 	sel->runner_head = runner;
 	sel->runner_tail = runner;
     }
+    /* The runner may be queued from a thread not running this selector. */
+    i_wake_sel_thread(sel);
     sel_timer_unlock(sel);
     return 0;
 }
@@ -928,25 +1760,26 @@ process_runners(struct selector_s *sel)
 }
 
 static void
-handle_selector_call(struct selector_s *sel, int i, volatile fd_set *fdset,
+handle_selector_call(struct selector_s *sel, int i, unsigned int bit,
 		     sel_fd_handler_t handler)
 {
+    fd_control_t     *fdc = sel_fdc(sel, i);
     void             *data;
     fd_state_t       *state;
 
     if (handler == NULL) {
 	/* Somehow we don't have a handler for this.
 	   Just shut it down. */
-	FD_CLR(i, fdset);
+	fdc->enabled &= ~bit;
 	return;
     }
 
-    if (!FD_ISSET(i, fdset))
+    if (!(fdc->enabled & bit))
 	/* The value was cleared, ignore it. */
 	return;
 
-    data = sel->fds[i].data;
-    state = sel->fds[i].state;
+    data = fdc->data;
+    state = fdc->state;
     state->use_count++;
     sel_fd_unlock(sel);
     handler(i, data);
@@ -963,6 +1796,9 @@ handle_selector_call(struct selector_s *sel, int i, volatile fd_set *fdset,
 }
 
 /*
+ * This is the fallback when epoll is not available, the fds are
+ * limited to FD_SETSIZE in that case.
+ *
  * return == 0  when timeout
  * 	  >  0  when successful
  * 	  <  0  when error
@@ -974,14 +1810,26 @@ process_fds(struct selector_s	    *sel,
     fd_set      tmp_read_set;
     fd_set      tmp_write_set;
     fd_set      tmp_except_set;
+    fd_control_t *fdc;
     int i;
     int err;
     int num_fds;
 
+    FD_ZERO(&tmp_read_set);
+    FD_ZERO(&tmp_write_set);
+    FD_ZERO(&tmp_except_set);
     sel_fd_lock(sel);
-    memcpy(&tmp_read_set, (void *) &sel->read_set, sizeof(tmp_read_set));
-    memcpy(&tmp_write_set, (void *) &sel->write_set, sizeof(tmp_write_set));
-    memcpy(&tmp_except_set, (void *) &sel->except_set, sizeof(tmp_except_set));
+    for (i = 0; i <= sel->maxfd; i++) {
+	fdc = sel_fdc(sel, i);
+	if (!fdc || !fdc->state)
+	    continue;
+	if (fdc->enabled & SEL_FD_READ_ENABLED)
+	    FD_SET(i, &tmp_read_set);
+	if (fdc->enabled & SEL_FD_WRITE_ENABLED)
+	    FD_SET(i, &tmp_write_set);
+	if (fdc->enabled & SEL_FD_EXCEPT_ENABLED)
+	    FD_SET(i, &tmp_except_set);
+    }
     num_fds = sel->maxfd + 1;
     sel_fd_unlock(sel);
 
@@ -996,15 +1844,18 @@ process_fds(struct selector_s	    *sel,
     /* We got some I/O. */
     sel_fd_lock(sel);
     for (i = 0; i <= sel->maxfd; i++) {
+	fdc = sel_fdc(sel, i);
+	if (!fdc)
+	    continue;
 	if (FD_ISSET(i, &tmp_read_set))
-	    handle_selector_call(sel, i, &sel->read_set,
-				 sel->fds[i].handle_read);
+	    handle_selector_call(sel, i, SEL_FD_READ_ENABLED,
+				 fdc->handle_read);
 	if (FD_ISSET(i, &tmp_write_set))
-	    handle_selector_call(sel, i, &sel->write_set,
-				 sel->fds[i].handle_write);
+	    handle_selector_call(sel, i, SEL_FD_WRITE_ENABLED,
+				 fdc->handle_write);
 	if (FD_ISSET(i, &tmp_except_set))
-	    handle_selector_call(sel, i, &sel->except_set,
-				 sel->fds[i].handle_except);
+	    handle_selector_call(sel, i, SEL_FD_EXCEPT_ENABLED,
+				 fdc->handle_except);
     }
     sel_fd_unlock(sel);
 out:
@@ -1012,14 +1863,79 @@ out:
 }
 
 #ifdef HAVE_EPOLL_PWAIT
+/*
+ * Handle a single event harvested from epoll.  Must be called with
+ * the fd lock held.  The fd is not rearmed here, that is done for the
+ * whole batch once all the handlers have been called.  seq is the
+ * fd's seq when the batch was harvested.
+ */
+static void
+handle_epoll_event(struct selector_s *sel, struct epoll_event *event,
+		   uint32_t seq)
+{
+    int fd = event->data.fd;
+    fd_control_t *fdc = sel_fdc(sel, fd);
+
+    if (!fdc || !fdc->state || fdc->seq != seq)
+	/* Cleared by an earlier handler in the batch. */
+	return;
+
+    if (event->events & (EPOLLHUP | EPOLLERR)) {
+	/*
+	 * The crazy people that designed epoll made it so that EPOLLHUP
+	 * and EPOLLERR always wake it up, even if they are not set.  That
+	 * makes this fairly inconvenient, because we don't want to wake
+	 * up in that case unless we explicitly ask for it.  Fortunately,
+	 * in those cases we can pretty easily simulate it by just deleting
+	 * it, since in those cases you will not get anything but an
+	 * EPOLLHUP or EPOLLERR, anyway, and then doing the callback
+	 * by hand.
+	 */
+	sel_update_epoll(sel, fd, EPOLL_CTL_DEL, 0);
+	fdc->saved_events = event->events & (EPOLLHUP | EPOLLERR);
+    }
+    if (event->events & (EPOLLIN | EPOLLHUP))
+	handle_selector_call(sel, fd, SEL_FD_READ_ENABLED, fdc->handle_read);
+    if (event->events & EPOLLOUT)
+	handle_selector_call(sel, fd, SEL_FD_WRITE_ENABLED, fdc->handle_write);
+    if (event->events & (EPOLLPRI | EPOLLERR))
+	handle_selector_call(sel, fd, SEL_FD_EXCEPT_ENABLED,
+			     fdc->handle_except);
+}
+
+/*
+ * The wake eventfd went off.  Only clear it once every thread it was
+ * written for has woken up, otherwise the ones still waiting would
+ * never see it.
+ */
+static void
+sel_handle_wake_fd(struct selector_s *sel, sel_wait_list_t *self)
+{
+    sel_wait_list_t *item;
+    uint64_t val;
+
+    sel_timer_lock(sel);
+    self->wake_needed = 0;
+    for (item = sel->wait_list.next; item != &sel->wait_list;
+	 item = item->next) {
+	if (item->wake_needed)
+	    break;
+    }
+    if (item == &sel->wait_list) {
+	if (read(sel->wake_fd, &val, sizeof(val)) == -1 && errno != EAGAIN)
+	    syslog(LOG_ERR, "Unable to read selector wake fd: %m");
+    }
+    sel_timer_unlock(sel);
+}
+
 static int
-process_fds_epoll(struct selector_s *sel, struct timeval *tvtimeout)
+process_fds_epoll(struct selector_s *sel, struct timeval *tvtimeout,
+		  sel_wait_list_t *self)
 {
-    int rv, fd;
-    struct epoll_event event;
+    int rv, i, j;
+    struct epoll_event events[SEL_MAX_EPOLL_BATCH];
+    uint32_t seqs[SEL_MAX_EPOLL_BATCH];
     int timeout;
-    sigset_t sigmask;
-    fd_control_t *fdc;
 
     if (tvtimeout->tv_sec > 600)
 	 /* Don't wait over 10 minutes, to work around an old epoll bug
@@ -1030,50 +1946,208 @@ process_fds_epoll(struct selector_s *sel, struct timeval *tvtimeout)
 	timeout = ((tvtimeout->tv_sec * 1000) +
 		   (tvtimeout->tv_usec + 999) / 1000);
 
-#ifdef USE_PTHREADS
-    pthread_sigmask(SIG_SETMASK, NULL, &sigmask);
-#else
-    sigprocmask(SIG_SETMASK, NULL, &sigmask);
-#endif
-    sigdelset(&sigmask, sel->wake_sig);
-    rv = epoll_pwait(sel->epollfd, &event, 1, timeout, &sigmask);
+    sel_fd_lock(sel);
+    sel_flush_dirty(sel);
+    sel->nr_epoll_waiting++;
+    sel_fd_unlock(sel);
+
+    /*
+     * The wake signal is only used if there is no wake fd, or to
+     * stop threads at shutdown, so it's left open here.
+     */
+    rv = epoll_pwait(sel->epollfd, events, sel->epoll_batch, timeout,
+		     &sel->wait_sigmask);
 
+    sel_fd_lock(sel);
+    sel->nr_epoll_waiting--;
     if (rv <= 0)
-	return rv;
+	goto out_unlock;
+
+    if (sel->wake_fd >= 0) {
+	/* Pull the wakeup out of the batch, it's not a registered fd. */
+	for (i = 0, j = 0; i < rv; i++) {
+	    if (events[i].data.fd == sel->wake_fd)
+		sel_handle_wake_fd(sel, self);
+	    else
+		events[j++] = events[i];
+	}
+	if (j == 0) {
+	    /* Only a wakeup, that still counts as doing something. */
+	    rv = 1;
+	    goto out_unlock;
+	}
+	rv = j;
+    }
+
+    /*
+     * All the fds are registered EPOLLONESHOT, so nothing harvested
+     * here can be delivered to another thread until we rearm it
+     * below.  That means we can run the whole batch with a single
+     * pass and rearm everything at the end.
+     */
+    for (i = 0; i < rv; i++) {
+	fd_control_t *fdc = sel_fdc(sel, events[i].data.fd);
+
+	/* The EPOLLONESHOT disarmed it. */
+	if (fdc)
+	    fdc->epoll_events = 0;
+	seqs[i] = fdc ? fdc->seq : 0;
+    }
+    for (i = 0; i < rv; i++)
+	handle_epoll_event(sel, &events[i], seqs[i]);
+
+    /*
+     * Rearm the events.  Remember they could have been deleted in a
+     * handler, and a new fd with the same number is already armed.
+     */
+    for (i = 0; i < rv; i++) {
+	int fd = events[i].data.fd;
+	fd_control_t *fdc = sel_fdc(sel, fd);
+
+	if (fdc && fdc->state && fdc->seq == seqs[i])
+	    sel_update_epoll(sel, fd, EPOLL_CTL_MOD, 0);
+    }
+ out_unlock:
+    sel_fd_unlock(sel);
+
+    return rv;
+}
+
+#ifdef SEL_URING
+/*
+ * Like process_fds_epoll(), but for io_uring.  Whatever is queued is
+ * submitted with the wait, so rearming after a batch and any fd
+ * changes made by the handlers go in with a single system call.
+ */
+static int
+process_fds_uring(struct selector_s *sel, struct timeval *tvtimeout,
+		  sel_wait_list_t *self)
+{
+    struct sel_uring *u = &sel->uring;
+    struct epoll_event events[SEL_MAX_EPOLL_BATCH];
+    uint32_t seqs[SEL_MAX_EPOLL_BATCH];
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned int head, tail, to_submit;
+    int rv, i, n = 0, wake_armed = 0;
+
+    if (tvtimeout->tv_sec > 600) {
+	/* Same limit as epoll, see process_fds_epoll(). */
+	ts.tv_sec = 600;
+	ts.tv_nsec = 0;
+    } else {
+	ts.tv_sec = tvtimeout->tv_sec;
+	ts.tv_nsec = tvtimeout->tv_usec * 1000;
+    }
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask = (uint64_t) (uintptr_t) &sel->wait_sigmask;
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = (uint64_t) (uintptr_t) &ts;
 
     sel_fd_lock(sel);
-    fd = event.data.fd;
-    fdc = (fd_control_t *) &sel->fds[fd];
-    if (event.events & (EPOLLHUP | EPOLLERR)) {
-	/*
-	 * The crazy people that designed epoll made it so that EPOLLHUP
-	 * and EPOLLERR always wake it up, even if they are not set.  That
-	 * makes this fairly inconvenient, because we don't want to wake
-	 * up in that case unless we explicitly ask for it.  Fortunately,
-	 * in those cases we can pretty easily simulate it by just deleting
-	 * it, since in those cases you will not get anything but an
-	 * EPOLLHUP or EPOLLERR, anyway, and then doing the callback
-	 * by hand.
-	 */
-	sel_update_epoll(sel, fd, EPOLL_CTL_DEL, 0);
-	fdc->saved_events = event.events & (EPOLLHUP | EPOLLERR);
-    }
-    if (event.events & (EPOLLIN | EPOLLHUP))
-	handle_selector_call(sel, fd, &sel->read_set, fdc->handle_read);
-    if (event.events & EPOLLOUT)
-	handle_selector_call(sel, fd, &sel->write_set, fdc->handle_write);
-    if (event.events & (EPOLLPRI | EPOLLERR))
-	handle_selector_call(sel, fd, &sel->except_set, fdc->handle_except);
-
-    /* Rearm the event.  Remember it could have been deleted in the handler. */
-    if (fdc->state)
-	sel_update_epoll(sel, fd, EPOLL_CTL_MOD, 0);
+    to_submit = sel_uring_unsubmitted(u);
+    u->nr_waiting++;
     sel_fd_unlock(sel);
 
+    rv = sys_io_uring_enter(u->fd, to_submit, 1,
+			    IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+			    &arg, sizeof(arg));
+
+    sel_fd_lock(sel);
+    u->nr_waiting--;
+    if (rv == -1) {
+	if (errno == ETIME) {
+	    rv = 0;
+	    goto out_unlock;
+	}
+	if (errno == EINTR)
+	    goto out_unlock;
+	/* Anything else is a submission problem, still harvest. */
+    }
+
+    head = *u->cq_head;
+    tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail && n < sel->epoll_batch) {
+	struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+	int fd = (int) (uint32_t) cqe->user_data;
+	fd_control_t *fdc;
+
+	head++;
+	if (cqe->user_data == SEL_URING_IGNORE)
+	    continue;
+	if (cqe->user_data == SEL_URING_WAKE) {
+	    /* Not a registered fd, see process_fds_epoll(). */
+	    sel_handle_wake_fd(sel, self);
+	    sel_uring_wake_arm(sel);
+	    wake_armed = 1;
+	    continue;
+	}
+	fdc = sel_fdc(sel, fd);
+	if (!fdc || !fdc->state || !fdc->uring_armed ||
+		fdc->uring_gen != (uint32_t) (cqe->user_data >> 32))
+	    /* Stale, the poll was replaced or the fd cleared. */
+	    continue;
+	fdc->uring_armed = 0;
+	if (cqe->res < 0) {
+	    /*
+	     * Polls are cancelled if the task that submitted them goes
+	     * away, a thread exiting or the parent after a fork.  That
+	     * just needs a rearm, which is done below.
+	     */
+	    if (cqe->res != -ECANCELED) {
+		syslog(LOG_ERR, "io_uring poll on fd %d failed: %s", fd,
+		       strerror(-cqe->res));
+		continue;
+	    }
+	    events[n].events = 0;
+	} else {
+	    events[n].events = cqe->res;
+	}
+	events[n].data.fd = fd;
+	seqs[n] = fdc->seq;
+	n++;
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    if (wake_armed)
+	/* Other threads may still need to see the wakeup. */
+	sel_uring_queued(sel);
+
+    /* The polls are single-shot, so the same as with EPOLLONESHOT. */
+    for (i = 0; i < n; i++)
+	handle_epoll_event(sel, &events[i], seqs[i]);
+
+    for (i = 0; i < n; i++) {
+	int fd = events[i].data.fd;
+	fd_control_t *fdc = sel_fdc(sel, fd);
+
+	if (fdc && fdc->state && fdc->seq == seqs[i])
+	    sel_update_epoll(sel, fd, EPOLL_CTL_MOD, 0);
+    }
+
+    /* Nothing usable still counts as doing something, like a wakeup. */
+    rv = n ? n : 1;
+ out_unlock:
+    sel_fd_unlock(sel);
     return rv;
 }
 #endif
 
+void
+sel_set_epoll_batch(struct selector_s *sel, unsigned int batch)
+{
+    if (batch < 1)
+	batch = 1;
+    else if (batch > SEL_MAX_EPOLL_BATCH)
+	batch = SEL_MAX_EPOLL_BATCH;
+    sel->epoll_batch = batch;
+}
+#else
+void
+sel_set_epoll_batch(struct selector_s *sel, unsigned int batch)
+{
+}
+#endif
+
 int
 sel_select_intr(struct selector_s *sel,
 		sel_send_sig_cb send_sig,
@@ -1107,9 +2181,14 @@ sel_select_intr(struct selector_s *sel,
 		      &loc_timeout);
     sel_timer_unlock(sel);
 
+#ifdef SEL_URING
+    if (sel_uses_uring(sel))
+	err = process_fds_uring(sel, &loc_timeout, &wait_entry);
+    else
+#endif
 #ifdef HAVE_EPOLL_PWAIT
     if (sel->epollfd >= 0)
-	err = process_fds_epoll(sel, &loc_timeout);
+	err = process_fds_epoll(sel, &loc_timeout, &wait_entry);
     else
 #endif
 	err = process_fds(sel, &loc_timeout);
@@ -1182,6 +2261,139 @@ sel_select_loop(struct selector_s *sel,
     }
 }
 
+#if defined(HAVE_EPOLL_PWAIT) && defined(HAVE_EVENTFD)
+static void
+sel_alloc_wake_fd(struct selector_s *sel)
+{
+    struct epoll_event event;
+
+    sel->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (sel->wake_fd == -1) {
+	syslog(LOG_ERR, "Unable to allocate selector wake fd, using"
+	       " signals: %m");
+	return;
+    }
+
+#ifdef SEL_URING
+    if (sel_uses_uring(sel)) {
+	/* Submitted with the first wait. */
+	sel_uring_wake_arm(sel);
+	return;
+    }
+#endif
+
+    /* Level triggered and never rearmed, unlike the other fds. */
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = sel->wake_fd;
+    if (epoll_ctl(sel->epollfd, EPOLL_CTL_ADD, sel->wake_fd, &event) == -1) {
+	syslog(LOG_ERR, "Unable to add selector wake fd, using signals: %m");
+	close(sel->wake_fd);
+	sel->wake_fd = -1;
+    }
+}
+#endif
+
+#ifdef SEL_URING
+#define SEL_URING_ENTRIES	256
+
+static void
+sel_uring_free(struct sel_uring *u)
+{
+    if (u->sqes)
+	munmap(u->sqes, u->sqes_size);
+    if (u->cq_ring && u->cq_ring != u->sq_ring)
+	munmap(u->cq_ring, u->cq_ring_size);
+    if (u->sq_ring)
+	munmap(u->sq_ring, u->sq_ring_size);
+    if (u->fd >= 0)
+	close(u->fd);
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+}
+
+static void *
+sel_uring_map(int fd, size_t size, off_t offset)
+{
+    void *rv = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, fd, offset);
+
+    if (rv == MAP_FAILED)
+	return NULL;
+    return rv;
+}
+
+/* Try to set up io_uring, on failure uring.fd is left at -1. */
+static void
+sel_uring_setup(struct selector_s *sel)
+{
+    struct sel_uring *u = &sel->uring;
+    struct io_uring_params p;
+    unsigned int i;
+    char *sq, *cq;
+    int fd;
+
+    memset(&p, 0, sizeof(p));
+    fd = sys_io_uring_setup(SEL_URING_ENTRIES, &p);
+    if (fd == -1) {
+	syslog(LOG_NOTICE, "Unable to set up io_uring, falling back to"
+	       " epoll: %m");
+	return;
+    }
+    u->fd = fd;
+    if (!(p.features & IORING_FEAT_EXT_ARG) ||
+	    !(p.features & IORING_FEAT_NODROP) ||
+	    !(p.features & IORING_FEAT_POLL_32BITS)) {
+	syslog(LOG_NOTICE, "io_uring is too old, falling back to epoll");
+	goto out_err;
+    }
+
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    u->cq_ring_size = p.cq_off.cqes +
+	p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	if (u->cq_ring_size > u->sq_ring_size)
+	    u->sq_ring_size = u->cq_ring_size;
+	u->cq_ring_size = u->sq_ring_size;
+    }
+    u->sq_ring = sel_uring_map(fd, u->sq_ring_size, IORING_OFF_SQ_RING);
+    if (!u->sq_ring)
+	goto out_map_err;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+	u->cq_ring = u->sq_ring;
+    else
+	u->cq_ring = sel_uring_map(fd, u->cq_ring_size, IORING_OFF_CQ_RING);
+    if (!u->cq_ring)
+	goto out_map_err;
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = sel_uring_map(fd, u->sqes_size, IORING_OFF_SQES);
+    if (!u->sqes)
+	goto out_map_err;
+
+    sq = u->sq_ring;
+    u->sq_head = (unsigned int *) (sq + p.sq_off.head);
+    u->sq_tail = (unsigned int *) (sq + p.sq_off.tail);
+    u->sq_mask = (unsigned int *) (sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned int *) (sq + p.sq_off.array);
+    u->sq_entries = p.sq_entries;
+    cq = u->cq_ring;
+    u->cq_head = (unsigned int *) (cq + p.cq_off.head);
+    u->cq_tail = (unsigned int *) (cq + p.cq_off.tail);
+    u->cq_mask = (unsigned int *) (cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    /* Entries are always used in order, so the indirection is fixed. */
+    for (i = 0; i < p.sq_entries; i++)
+	u->sq_array[i] = i;
+    return;
+
+ out_map_err:
+    syslog(LOG_ERR, "Unable to map io_uring, falling back to epoll: %m");
+ out_err:
+    sel_uring_free(u);
+}
+#endif
+
 /* Initialize the select code. */
 int
 sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
@@ -1192,7 +2404,7 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
 			  void *cb_data)
 {
     struct selector_s *sel;
-    unsigned int i;
+    unsigned int i, j;
 
     sel = malloc(sizeof(*sel));
     if (!sel)
@@ -1210,16 +2422,17 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
 
     sel->wake_sig = wake_sig;
 
-    FD_ZERO((fd_set *) &sel->read_set);
-    FD_ZERO((fd_set *) &sel->write_set);
-    FD_ZERO((fd_set *) &sel->except_set);
-
-    for (i = 0; i < FD_SETSIZE; i++) {
-	init_fd((fd_control_t *) &(sel->fds[i]));
-    }
+    sel->maxfd = -1;
 
     theap_init(&sel->timer_heap);
 
+    for (i = 0; i < SEL_WHEEL_TV1_SIZE; i++)
+	wheel_list_init(&sel->wheel_tv1[i]);
+    for (i = 0; i < SEL_WHEEL_TVN_LEVELS; i++) {
+	for (j = 0; j < SEL_WHEEL_TVN_SIZE; j++)
+	    wheel_list_init(&sel->wheel_tvn[i][j]);
+    }
+
     if (sel->sel_lock_alloc) {
 	sel->timer_lock = sel->sel_lock_alloc(cb_data);
 	if (!sel->timer_lock) {
@@ -1235,8 +2448,18 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
     }
 
 #ifdef HAVE_EPOLL_PWAIT
-    sel->epollfd = epoll_create(32768);
-    if (sel->epollfd == -1) {
+    sel->epoll_batch = SEL_DEFAULT_EPOLL_BATCH;
+    sel->wake_fd = -1;
+    sel->dirty_head = -1;
+    sel->epollfd = -1;
+#ifdef SEL_URING
+    sel->uring.fd = -1;
+    if (sel_default_backend == SEL_BACKEND_URING)
+	sel_uring_setup(sel);
+    if (!sel_uses_uring(sel))
+#endif
+	sel->epollfd = epoll_create(32768);
+    if (sel->epollfd == -1 && !sel_uses_uring(sel)) {
 	syslog(LOG_ERR, "Unable to set up epoll, falling back to select: %m");
     } else {
 	int rv;
@@ -1244,10 +2467,15 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
 
 	sigemptyset(&sigset);
 	sigaddset(&sigset, wake_sig);
-	rv = sigprocmask(SIG_BLOCK, &sigset, NULL);
+	rv = sigprocmask(SIG_BLOCK, &sigset, &sel->wait_sigmask);
+	sigdelset(&sel->wait_sigmask, wake_sig);
 	if (rv == -1) {
 	    rv = errno;
-	    close(sel->epollfd);
+	    if (sel->epollfd >= 0)
+		close(sel->epollfd);
+#ifdef SEL_URING
+	    sel_uring_free(&sel->uring);
+#endif
 	    if (sel->sel_lock_alloc) {
 		sel->sel_lock_free(sel->fd_lock);
 		sel->sel_lock_free(sel->timer_lock);
@@ -1255,6 +2483,12 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
 	    free(sel);
 	    return rv;
 	}
+
+#ifdef HAVE_EVENTFD
+	/* Only needed if more than one thread can be waiting. */
+	if (sel->sel_lock_alloc)
+	    sel_alloc_wake_fd(sel);
+#endif
     }
 #endif
 
@@ -1263,6 +2497,24 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
     return 0;
 }
 
+void
+sel_set_default_backend(int backend)
+{
+    sel_default_backend = backend;
+}
+
+const char *
+sel_backend_name(struct selector_s *sel)
+{
+    if (sel_uses_uring(sel))
+	return "io_uring";
+#ifdef HAVE_EPOLL_PWAIT
+    if (sel->epollfd >= 0)
+	return "epoll";
+#endif
+    return "select";
+}
+
 int
 sel_alloc_selector_nothread(struct selector_s **new_selector)
 {
@@ -1270,10 +2522,22 @@ sel_alloc_selector_nothread(struct selector_s **new_selector)
 				     NULL);
 }
 
+static void
+sel_free_wheel_list(sel_wheel_link_t *head)
+{
+    while (head->next != head) {
+	sel_wheel_link_t *link = head->next;
+
+	wheel_list_del(link);
+	free(link);
+    }
+}
+
 int
 sel_free_selector(struct selector_s *sel)
 {
     sel_timer_t *elem;
+    unsigned int i, j;
 
     elem = theap_get_top(&(sel->timer_heap));
     while (elem) {
@@ -1281,14 +2545,32 @@ sel_free_selector(struct selector_s *sel)
 	free(elem);
 	elem = theap_get_top(&(sel->timer_heap));
     }
+    for (i = 0; i < SEL_WHEEL_TV1_SIZE; i++)
+	sel_free_wheel_list(&sel->wheel_tv1[i]);
+    for (i = 0; i < SEL_WHEEL_TVN_LEVELS; i++) {
+	for (j = 0; j < SEL_WHEEL_TVN_SIZE; j++)
+	    sel_free_wheel_list(&sel->wheel_tvn[i][j]);
+    }
 #ifdef HAVE_EPOLL_PWAIT
+    if (sel->wake_fd >= 0)
+	close(sel->wake_fd);
     if (sel->epollfd >= 0)
 	close(sel->epollfd);
+#endif
+#ifdef SEL_URING
+    if (sel_uses_uring(sel))
+	sel_uring_free(&sel->uring);
 #endif
     if (sel->fd_lock)
 	sel->sel_lock_free(sel->fd_lock);
     if (sel->timer_lock)
 	sel->sel_lock_free(sel->timer_lock);
+    for (i = 0; i < sel->nr_fd_pages; i++) {
+	if (sel->fd_pages[i])
+	    free(sel->fd_pages[i]);
+    }
+    if (sel->fd_pages)
+	free(sel->fd_pages);
     free(sel);
 
     return 0;
@@ -59,6 +59,37 @@ int sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
      NULL for all the values. */
 int sel_alloc_selector_nothread(struct selector_s **new_selector);
 
+/*
+ * The epoll backend harvests up to this many ready file descriptors
+ * per wait and dispatches them all in one pass.  The default may be
+ * changed with sel_set_epoll_batch(), the value is clamped between 1
+ * and SEL_MAX_EPOLL_BATCH.  In threaded use, a smaller batch spreads
+ * the events more evenly over the threads.  This does nothing if
+ * epoll is not in use.
+ */
+#define SEL_DEFAULT_EPOLL_BATCH	16
+#define SEL_MAX_EPOLL_BATCH	128
+void sel_set_epoll_batch(struct selector_s *sel, unsigned int batch);
+
+/*
+ * The kernel interface selectors wait on.  SEL_BACKEND_EPOLL is the
+ * default and falls back to select() if epoll is not available.
+ * SEL_BACKEND_URING arms the fds and waits through io_uring, so the
+ * fd changes made while handling a batch of events go to the kernel
+ * with the next wait in one system call.  It falls back to epoll if
+ * the kernel can't do what it needs.  With io_uring the batch size
+ * above applies the same way, and threads waiting in the selector
+ * are woken with the wake signal.
+ *
+ * sel_set_default_backend() only affects selectors allocated after
+ * it is called.  sel_backend_name() returns the interface a selector
+ * ended up using, "select", "epoll", or "io_uring".
+ */
+#define SEL_BACKEND_EPOLL	0
+#define SEL_BACKEND_URING	1
+void sel_set_default_backend(int backend);
+const char *sel_backend_name(struct selector_s *sel);
+
 /* Used to destroy a selector. */
 int sel_free_selector(struct selector_s *new_selector);
 
@@ -128,6 +159,39 @@ int sel_stop_timer_with_done(sel_timer_t *timer,
 /* Use this for times provided to sel_start_time() */
 void sel_get_monotonic_time(struct timeval *tv);
 
+/*
+ * Coarse timers.  These are kept in a hierarchical timing wheel
+ * instead of the timer heap, so starting and stopping them is cheap
+ * no matter how many there are, but they only go off on a tick
+ * boundary, SEL_WHEEL_TICK_MSEC apart.  Use them for timeouts
+ * measured in seconds, like idle timeouts and periodic housekeeping.
+ * The calls work just like the sel_xxx_timer() calls, except the
+ * time given to sel_start_wheel_timer() is relative, in milliseconds.
+ */
+#define SEL_WHEEL_TICK_MSEC	100
+
+struct sel_wheel_timer_s;
+typedef struct sel_wheel_timer_s sel_wheel_timer_t;
+
+typedef void (*sel_wheel_handler_t)(struct selector_s *sel,
+				    sel_wheel_timer_t *timer,
+				    void              *data);
+
+int sel_alloc_wheel_timer(struct selector_s   *sel,
+			  sel_wheel_handler_t handler,
+			  void                *user_data,
+			  sel_wheel_timer_t   **new_timer);
+
+int sel_free_wheel_timer(sel_wheel_timer_t *timer);
+
+int sel_start_wheel_timer(sel_wheel_timer_t *timer, unsigned int msecs);
+
+int sel_stop_wheel_timer(sel_wheel_timer_t *timer);
+
+int sel_stop_wheel_timer_with_done(sel_wheel_timer_t *timer,
+				   sel_wheel_handler_t done_handler,
+				   void *cb_data);
+
 typedef struct sel_runner_s sel_runner_t;
 typedef void (*sel_runner_func_t)(sel_runner_t *runner, void *cb_data);
 int sel_alloc_runner(struct selector_s *sel, sel_runner_t **new_runner);
@@ -139,7 +203,9 @@ int sel_run(sel_runner_t *runner, sel_runner_func_t func, void *cb_data);
    mask.  This code should send a signal to the thread that calls
    sel-select_loop.  The user will have to allocate the signal, set
    the handlers, etc.  The thread_id and cb_data are just the values
-   passed into sel_select_loop(). */
+   passed into sel_select_loop().  On systems with epoll and eventfd a
+   selector allocated with locks wakes its threads with an eventfd
+   instead, and this is not called. */
 typedef void (*sel_send_sig_cb)(long thread_id, void *cb_data);
 
 /*
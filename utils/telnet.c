@@ -2,9 +2,76 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "telnet.h"
 
+/*
+ * Return the number of bytes at the start of buf before the first
+ * IAC, or len if there isn't one.  IACs are rare in most data, so
+ * check 32 or 16 bytes at a time if the compiler allows it.
+ */
+static inline unsigned int
+find_iac(const unsigned char *buf, unsigned int len)
+{
+    const unsigned char *p;
+    unsigned int i;
+
+    /*
+     * Runs between IACs are short in IAC-heavy data, don't pay for
+     * setting up the vector compare for those.
+     */
+    for (i = 0; i < len && i < 8; i++) {
+	if (buf[i] == TN_IAC)
+	    return i;
+    }
+#if defined(__AVX2__)
+    const __m256i iac32 = _mm256_set1_epi8((char) TN_IAC);
+
+    for (; i + 32 <= len; i += 32) {
+	__m256i v = _mm256_loadu_si256((const __m256i *) (buf + i));
+	unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, iac32));
+
+	if (mask)
+	    return i + __builtin_ctz(mask);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i iac16 = _mm_set1_epi8((char) TN_IAC);
+
+    for (; i + 16 <= len; i += 16) {
+	__m128i v = _mm_loadu_si128((const __m128i *) (buf + i));
+	unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, iac16));
+
+	if (mask)
+	    return i + __builtin_ctz(mask);
+    }
+#endif
+
+    p = memchr(buf + i, TN_IAC, len - i);
+    if (p)
+	return p - buf;
+    return len;
+}
+
+/* Short runs are common with lots of IACs, avoid the memcpy call. */
+static void
+copy_run(unsigned char *out, const unsigned char *in, unsigned int len)
+{
+    unsigned int i;
+
+    if (len > 16) {
+	memcpy(out, in, len);
+	return;
+    }
+    for (i = 0; i < len; i++)
+	out[i] = in[i];
+}
+
 static struct telnet_cmd *
 find_cmd(struct telnet_cmd *array, unsigned char option)
 {
@@ -241,7 +308,14 @@ process_telnet_data(unsigned char *outdata, unsigned int outlen,
 	    td->telnet_cmd[td->telnet_cmd_pos++] = TN_IAC;
 	    td->suboption_iac = 0;
 	} else {
-	    outdata[j++] = indata[i];
+	    /* Copy everything up to the next IAC in one go. */
+	    unsigned int run = find_iac(indata + i, *inlen - i);
+
+	    if (run > outlen - j)
+		run = outlen - j;
+	    copy_run(outdata + j, indata + i, run);
+	    j += run;
+	    i += run - 1;
 	}
     }
 
@@ -255,24 +329,30 @@ unsigned int
 process_telnet_xmit(unsigned char *outdata, unsigned int outlen,
 		    const unsigned char **indata, unsigned int *r_inlen)
 {
-    unsigned int i, j = 0;
+    unsigned int i = 0, j = 0, run;
     unsigned int inlen = *r_inlen;
     const unsigned char *ibuf = *indata;
 
     /* Double the IACs on a telnet transmit stream. */
-    for (i = 0; i < inlen; i++) {
-	if (ibuf[i] == TN_IAC) {
-	    if (outlen < 2)
-		    break;
-	    outdata[j++] = TN_IAC;
-	    outdata[j++] = TN_IAC;
-	    outlen -= 2;
-	} else {
-	    if (outlen < 1)
-		break;
-	    outdata[j++] = ibuf[i];
-	    outlen--;
-	}
+    while (i < inlen) {
+	/* Copy everything up to the next IAC in one go. */
+	run = find_iac(ibuf + i, inlen - i);
+	if (run > outlen)
+	    run = outlen;
+	copy_run(outdata + j, ibuf + i, run);
+	i += run;
+	j += run;
+	outlen -= run;
+
+	if (i == inlen || ibuf[i] != TN_IAC)
+	    /* All done or out of room. */
+	    break;
+	if (outlen < 2)
+	    break;
+	outdata[j++] = TN_IAC;
+	outdata[j++] = TN_IAC;
+	outlen -= 2;
+	i++;
     }
 
     *indata = ibuf + i;
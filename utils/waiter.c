@@ -36,6 +36,7 @@ alloc_waiter(struct selector_s *sel, int wake_sig)
     if (waiter) {
 	memset(waiter, 0, sizeof(*waiter));
 	waiter->sel = sel;
+	waiter->wake_sig = wake_sig;
 	pthread_mutex_init(&waiter->lock, NULL);
 	waiter->wts.next = &waiter->wts;
 	waiter->wts.prev = &waiter->wts;
@@ -72,11 +73,17 @@ i_wait_for_waiter_timeout(waiter_t *waiter, unsigned int count,
 {
     struct waiter_timeout wt;
     struct wait_data w;
+    struct timeval end, now;
     int err = 0;
 
     w.id = pthread_self();
     w.wake_sig = waiter->wake_sig;
 
+    if (timeout) {
+	sel_get_monotonic_time(&end);
+	add_to_timeval(&end, timeout);
+    }
+
     wt.tv.tv_sec = LONG_MAX;
     wt.next = NULL;
     wt.prev = NULL;
@@ -88,25 +95,51 @@ i_wait_for_waiter_timeout(waiter_t *waiter, unsigned int count,
     wt.prev = &waiter->wts;
 
     while (waiter->count < count) {
+	/*
+	 * The selector reads wt.tv with its timer lock held as it adds
+	 * us to its wait list, and wake_waiter() zeroes it before
+	 * waking the selector, so a wake from another thread that
+	 * comes in before we wait is not lost.
+	 */
+	if (timeout) {
+	    sel_get_monotonic_time(&now);
+	    if (cmp_timeval(&now, &end) >= 0) {
+		err = ETIMEDOUT;
+		break;
+	    }
+	    wt.tv = end;
+	    sub_from_timeval(&wt.tv, &now);
+	} else {
+	    /* The selector limits waits to this anyway. */
+	    wt.tv.tv_sec = 600;
+	    wt.tv.tv_usec = 0;
+	}
 	pthread_mutex_unlock(&waiter->lock);
 	if (intr)
 	    err = sel_select_intr(waiter->sel, wake_thread_send_sig,
-				  w.id, &w, timeout);
+				  w.id, &w, &wt.tv);
 	else
 	    err = sel_select(waiter->sel, wake_thread_send_sig, w.id, &w,
-			     timeout);
+			     &wt.tv);
 	pthread_mutex_lock(&waiter->lock);
 	if (err < 0) {
 	    err = errno;
 	    break;
-	} else if (err == 0) {
-	    err = ETIMEDOUT;
-	    break;
 	}
 	err = 0;
     }
     if (!err)
 	waiter->count -= count;
+    if (timeout) {
+	sel_get_monotonic_time(&now);
+	if (cmp_timeval(&now, &end) >= 0) {
+	    timeout->tv_sec = 0;
+	    timeout->tv_usec = 0;
+	} else {
+	    *timeout = end;
+	    sub_from_timeval(timeout, &now);
+	}
+    }
     wt.next->prev = wt.prev;
     wt.prev->next = wt.next;
     pthread_mutex_unlock(&waiter->lock);
@@ -124,6 +157,7 @@ wake_waiter(waiter_t *waiter)
     wt = waiter->wts.next;
     while (wt != &waiter->wts) {
 	wt->tv.tv_sec = 0;
+	wt->tv.tv_usec = 0;
 	wt = wt->next;
     }
     sel_wake_all(waiter->sel);